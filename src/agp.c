@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include "agp.h"
+#include "calculations.h"
+#include "config.h"
+#include "instrument.h"
+#include "local_time.h"
+#include "logging.h"
+#include "log_index.h"
+#include "log_scan.h"
+#include "records.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The plot spans this range of glucose in mmol/L, one row per step; readings outside
+// it are drawn in the top or bottom row
+#define AGP_PLOT_LOW 2.0
+#define AGP_PLOT_HIGH 20.0
+#define AGP_PLOT_STEP 1.0
+
+// Percentiles shown, as fractions
+static const double agp_percentiles[] = {0.05, 0.25, 0.50, 0.75, 0.95};
+#define AGP_PERCENTILES (sizeof(agp_percentiles) / sizeof(agp_percentiles[0]))
+
+// One piece of the log, read into its own partial profile
+typedef struct {
+    const char *data;             // Text log contents, or NULL for a binary log
+    const log_record *records;    // Binary log records, or NULL for a text log
+    size_t begin;                 // First byte (text) or record (binary) of the piece
+    size_t end;                   // End of the piece
+    agp_profile *profile;         // Receives the piece's readings
+} agp_chunk;
+
+/**
+ * add_reading - Adds a reading to the bin of its local time of day, if it is inside the window.
+ */
+static void add_reading(agp_profile *profile, time_t timestamp, float blood_glucose_level){
+    if (timestamp < profile->start_time || timestamp > profile->end_time){
+        return;
+    }
+    long long local = (long long)timestamp + local_utc_offset(timestamp);
+    long long second_of_day = (local % 86400 + 86400) % 86400;
+    sketch_add(&profile->bins[second_of_day / (AGP_BIN_MINUTES * 60)], blood_glucose_level);
+    profile->readings++;
+}
+
+/**
+ * add_scanned_entry - log_scan callback that adds the reading of an entry to the profile.
+ */
+static int add_scanned_entry(const scanned_entry *scanned, void *context){
+    if (scanned->kind == SCAN_ENTRY && scanned->has_timestamp && (scanned->lines & SCAN_LINE_BLOOD_GLUCOSE)){
+        add_reading(context, scanned->timestamp, scanned->entry.blood_glucose_level);
+    }
+    return 0;
+}
+
+/**
+ * read_chunk - Adds the readings of one piece of the log to its partial profile.
+ */
+static void read_chunk(agp_chunk *chunk){
+    if (chunk->data != NULL){
+        log_scan(chunk->data + chunk->begin, chunk->end - chunk->begin, add_scanned_entry, chunk->profile);
+        return;
+    }
+    for (size_t i = chunk->begin; i < chunk->end; i++){
+        if ((chunk->records[i].flags & (RECORD_FLAG_BLOOD_GLUCOSE | RECORD_FLAG_REVISION)) == RECORD_FLAG_BLOOD_GLUCOSE &&
+            record_intact(&chunk->records[i])){
+            add_reading(chunk->profile, chunk->records[i].timestamp, chunk->records[i].blood_glucose_level);
+        }
+    }
+}
+
+/**
+ * agp_worker - Thread body: reads one piece of the log.
+ */
+static void *agp_worker(void *argument){
+    read_chunk(argument);
+    instrument_thread_exit();
+    return NULL;
+}
+
+/**
+ * start_profile - Empties a profile and sets its window.
+ */
+static void start_profile(agp_profile *profile, time_t start_time, time_t end_time, int days){
+    for (int bin = 0; bin < AGP_BINS; bin++){
+        sketch_init(&profile->bins[bin]);
+    }
+    profile->readings = 0;
+    profile->start_time = start_time;
+    profile->end_time = end_time;
+    profile->days = days;
+}
+
+/**
+ * read_pieces - Splits [begin, end) into pieces, reads them on up to `pieces` threads
+ * and merges their partial profiles into the profile, in log order.
+ */
+static int read_pieces(agp_chunk *whole, int pieces){
+    agp_chunk chunks[QUERY_MAX_THREADS];
+    pthread_t workers[QUERY_MAX_THREADS];
+    int started[QUERY_MAX_THREADS];
+    size_t length = whole->end - whole->begin;
+
+    for (int i = 0; i < pieces; i++){
+        chunks[i] = *whole;
+        started[i] = 0;
+        if (i > 0){
+            size_t split = whole->begin + length / (size_t)pieces * (size_t)i;
+            // Text pieces start at an entry time line so they scan like one piece
+            if (whole->data != NULL){
+                split = log_scan_boundary(whole->data, whole->end, split);
+            }
+            if (split < chunks[i - 1].begin){
+                split = chunks[i - 1].begin;
+            }
+            chunks[i - 1].end = split;
+            chunks[i].begin = split;
+
+            chunks[i].profile = malloc(sizeof(agp_profile));
+            if (chunks[i].profile == NULL){
+                perror("Error allocating glucose profile");
+                for (int j = 1; j < i; j++){
+                    free(chunks[j].profile);
+                }
+                return -1;
+            }
+            start_profile(chunks[i].profile, whole->profile->start_time, whole->profile->end_time,
+                          whole->profile->days);
+        }
+    }
+
+    for (int i = 1; i < pieces; i++){
+        started[i] = pthread_create(&workers[i], NULL, agp_worker, &chunks[i]) == 0;
+    }
+    read_chunk(&chunks[0]);
+
+    for (int i = 1; i < pieces; i++){
+        if (started[i]){
+            pthread_join(workers[i], NULL);
+        } else {
+            read_chunk(&chunks[i]);
+        }
+        for (int bin = 0; bin < AGP_BINS; bin++){
+            sketch_merge(&whole->profile->bins[bin], &chunks[i].profile->bins[bin]);
+        }
+        whole->profile->readings += chunks[i].profile->readings;
+        free(chunks[i].profile);
+    }
+    return 0;
+}
+
+int agp_compute(const char *log_filename, int days, agp_profile *profile){
+    if (days < AGP_MIN_DAYS || days > AGP_MAX_DAYS){
+        printf("Glucose profiles cover %d to %d days.\n", AGP_MIN_DAYS, AGP_MAX_DAYS);
+        return -1;
+    }
+
+    // Today and the days before it, from local midnight
+    time_t now = time(NULL);
+    struct tm today;
+    epoch_to_local_time(now, &today);
+    time_t start_time = local_time_to_epoch(today.tm_year + 1900, today.tm_mon + 1, today.tm_mday - (days - 1), 0, 0, 0);
+    start_profile(profile, start_time, now, days);
+
+    uint64_t started = probe_begin();
+    int binary = is_binary_log(log_filename);
+    if (binary){
+        // Checks the header before the records are mapped
+        FILE *file = open_record_file(log_filename, "rb");
+        if (file == NULL){
+            return -1;
+        }
+        fclose(file);
+    }
+
+    log_map map;
+    if (log_map_open(&map, log_filename) != 0){
+        return -1;
+    }
+
+    // Skip straight to the first block that can hold readings in the window
+    size_t offset = (size_t)log_index_seek(log_filename, start_time);
+    if (offset > map.size){
+        offset = 0;
+    }
+
+    agp_chunk whole;
+    memset(&whole, 0, sizeof(whole));
+    whole.profile = profile;
+    if (binary){
+        if (offset < sizeof(record_header)){
+            offset = sizeof(record_header);
+        }
+        whole.records = (const log_record *)(map.data + sizeof(record_header));
+        whole.begin = (offset - sizeof(record_header)) / sizeof(log_record);
+        whole.end = map.size > sizeof(record_header) ? (map.size - sizeof(record_header)) / sizeof(log_record) : 0;
+        if (whole.begin > whole.end){
+            whole.begin = whole.end;
+        }
+    } else {
+        whole.data = map.data;
+        whole.begin = offset;
+        whole.end = map.size;
+    }
+
+    // Large ranges are read in pieces on several threads
+    size_t scanned = map.size > offset ? map.size - offset : 0;
+    int pieces = 1;
+    int threads = get_query_threads();
+    if (threads > 1 && scanned >= 2 * QUERY_CHUNK_BYTES){
+        size_t most = scanned / QUERY_CHUNK_BYTES;
+        pieces = (size_t)threads < most ? threads : (int)most;
+        if (pieces > QUERY_MAX_THREADS){
+            pieces = QUERY_MAX_THREADS;
+        }
+    }
+
+    int status = read_pieces(&whole, pieces);
+    log_map_close(&map);
+    probe_end(PROBE_AGP, started, scanned);
+    return status;
+}
+
+/**
+ * print_level - Prints a glucose level in the preferred unit, or dashes for an empty bin.
+ */
+static void print_level(FILE *out, int empty, double level, const char *unit){
+    if (empty){
+        fprintf(out, " %7s", "-");
+    } else if (strcmp(unit, "mg/dL") == 0){
+        fprintf(out, " %7.0f", convert_to_preferred_unit((float)level, unit));
+    } else {
+        fprintf(out, " %7.1f", convert_to_preferred_unit((float)level, unit));
+    }
+}
+
+/**
+ * display_table - Prints the percentiles of each hour, merged from its bins.
+ */
+static void display_table(FILE *out, agp_profile *profile, const char *unit){
+    fprintf(out, "\nTime    Readings      5%%     25%%     50%%     75%%     95%%\n");
+    int bins_per_hour = 60 / AGP_BIN_MINUTES;
+    quantile_sketch hour;
+    for (int h = 0; h < 24; h++){
+        sketch_init(&hour);
+        for (int bin = h * bins_per_hour; bin < (h + 1) * bins_per_hour; bin++){
+            sketch_merge(&hour, &profile->bins[bin]);
+        }
+        fprintf(out, "%02d:00 %10.0f", h, hour.total_weight);
+        for (size_t p = 0; p < AGP_PERCENTILES; p++){
+            print_level(out, hour.total_weight == 0, sketch_quantile(&hour, agp_percentiles[p]), unit);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/**
+ * display_plot - Prints the percentile bands of every bin, one column per bin,
+ * with the target range marked.
+ */
+static void display_plot(FILE *out, agp_profile *profile, const char *unit){
+    double levels[AGP_BINS][AGP_PERCENTILES];
+    for (int bin = 0; bin < AGP_BINS; bin++){
+        for (size_t p = 0; p < AGP_PERCENTILES; p++){
+            levels[bin][p] = sketch_quantile(&profile->bins[bin], agp_percentiles[p]);
+        }
+    }
+
+    fprintf(out, "\n");
+    int rows = (int)((AGP_PLOT_HIGH - AGP_PLOT_LOW) / AGP_PLOT_STEP);
+    for (int row = 0; row < rows; row++){
+        // The row covers [low, high); the top and bottom rows also take what is beyond them
+        double high = AGP_PLOT_HIGH - row * AGP_PLOT_STEP;
+        double low = high - AGP_PLOT_STEP;
+        double top = row == 0 ? 1e9 : high;
+        double bottom = row == rows - 1 ? -1e9 : low;
+
+        if (strcmp(unit, "mg/dL") == 0){
+            fprintf(out, "%5.0f |", convert_to_preferred_unit((float)low, unit));
+        } else {
+            fprintf(out, "%5.1f |", convert_to_preferred_unit((float)low, unit));
+        }
+        for (int bin = 0; bin < AGP_BINS; bin++){
+            const double *level = levels[bin];
+            char mark = ' ';
+            if (profile->bins[bin].total_weight > 0 && level[2] >= bottom && level[2] < top){
+                mark = '*';
+            } else if (profile->bins[bin].total_weight > 0 && level[1] < top && level[3] >= bottom){
+                mark = '#';
+            } else if (profile->bins[bin].total_weight > 0 && level[0] < top && level[4] >= bottom){
+                mark = ':';
+            } else if ((lower_target >= low && lower_target < high) || (upper_target >= low && upper_target < high)){
+                mark = '-';
+            }
+            fputc(mark, out);
+        }
+        fprintf(out, "\n");
+    }
+
+    // Time axis, marked every three hours
+    int bins_per_hour = 60 / AGP_BIN_MINUTES;
+    fprintf(out, "      +");
+    for (int bin = 0; bin < AGP_BINS; bin++){
+        fputc(bin % (3 * bins_per_hour) == 0 ? '+' : '-', out);
+    }
+    fprintf(out, "\n       ");
+    for (int h = 0; h < 24; h += 3){
+        fprintf(out, "%02d:00%*s", h, 3 * bins_per_hour - 5, "");
+    }
+    fprintf(out, "\n\n* median   # 25th-75th percentile   : 5th-95th percentile   - target range (%.1f-%.1f %s)\n",
+            convert_to_preferred_unit(lower_target, unit), convert_to_preferred_unit(upper_target, unit), unit);
+}
+
+void display_agp(FILE *out, agp_profile *profile, const char *unit){
+    struct tm first;
+    epoch_to_local_time(profile->start_time, &first);
+    fprintf(out, "\nAmbulatory Glucose Profile: %d days from %d-%02d-%02d (%s)\n",
+            profile->days, first.tm_year + 1900, first.tm_mon + 1, first.tm_mday, unit);
+
+    if (profile->readings == 0){
+        fprintf(out, "No blood glucose readings in this period.\n");
+        return;
+    }
+    fprintf(out, "Blood glucose readings: %ld\n", profile->readings);
+    display_table(out, profile, unit);
+    display_plot(out, profile, unit);
+}
+
+int view_agp(const char *filename, int days){
+    agp_profile *profile = malloc(sizeof(agp_profile));
+    if (profile == NULL){
+        perror("Error allocating glucose profile");
+        return -1;
+    }
+
+    int status = agp_compute(filename, days, profile);
+    if (status == 0){
+        const char *unit = read_config("blood glucose unit");
+        display_agp(stdout, profile, unit != NULL ? unit : "mmol/L");
+    }
+    free(profile);
+    return status;
+}
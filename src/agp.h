@@ -0,0 +1,61 @@
+#ifndef AGP_H
+#define AGP_H
+
+#include <stdio.h>
+#include <time.h>
+#include "sketch.h"
+
+// The day is split into bins of this many minutes
+#define AGP_BIN_MINUTES 15
+#define AGP_BINS (24 * 60 / AGP_BIN_MINUTES)
+
+// Range of days a profile can cover
+#define AGP_MIN_DAYS 14
+#define AGP_MAX_DAYS 90
+
+// Glucose percentiles by local time of day over a number of days. One quantile
+// sketch is kept per bin, so the memory used does not grow with the log.
+typedef struct {
+    quantile_sketch bins[AGP_BINS];   // Readings in mmol/L, by time of day
+    long readings;                    // Readings in the window
+    time_t start_time;                // Local midnight at the start of the window
+    time_t end_time;                  // When the profile was computed
+    int days;                         // Days covered, including today
+} agp_profile;
+
+/**
+ * agp_compute - Builds an ambulatory glucose profile from the readings of the past days,
+ * in one pass over the log from the first indexed block of the window. Large logs are
+ * split into chunks whose sketches are built on several threads and then merged.
+ *
+ * Entries are read as logged: edits and deletions reach the profile once compaction
+ * has folded them into the log. The profile is large (about half a MB), so callers
+ * should allocate it on the heap.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param days: Days to cover, from AGP_MIN_DAYS to AGP_MAX_DAYS, including today.
+ * @param profile: Receives the profile.
+ * @return: 0 for success, -1 for errors.
+ */
+int agp_compute(const char *log_filename, int days, agp_profile *profile);
+
+/**
+ * display_agp - Prints the 5th, 25th, 50th, 75th and 95th percentiles of a profile as an
+ * hourly table, followed by an ASCII plot of the 15-minute bins.
+ *
+ * @param out: Stream to print to.
+ * @param profile: The profile to print; its sketches are compressed while reading them.
+ * @param unit: The user's preferred unit ("mmol/L" or "mg/dL").
+ */
+void display_agp(FILE *out, agp_profile *profile, const char *unit);
+
+/**
+ * view_agp - Computes and prints the ambulatory glucose profile of the past days.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @param days: Days to cover, from AGP_MIN_DAYS to AGP_MAX_DAYS.
+ * @return: 0 for success, -1 for errors.
+ */
+int view_agp(const char *filename, int days);
+
+#endif
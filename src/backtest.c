@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include "backtest.h"
+#include "calculations.h"
+#include "config.h"
+#include "logging.h"
+#include "records.h"
+#include "log_index.h"
+#include "log_scan.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of records read per fread call when loading a binary log
+#define BACKTEST_RECORD_BATCH 256
+
+// Entries to replay, one array per field
+typedef struct {
+    size_t count;
+    size_t capacity;
+    float *blood_glucose;         // mmol/L; 0 when no reading was logged
+    float *carbs;                 // grams; 0 for corrections
+    float *logged_dose;           // Total insulin dosage that was logged
+    unsigned char *has_logged_dose;
+    float *insulin_on_board;      // Units on board when the entry was logged; 0 when none was
+    unsigned char *has_insulin_on_board;
+    time_t start_time;            // Entries before this are not loaded
+} backtest_history;
+
+// State shared by the worker threads
+typedef struct {
+    const backtest_history *history;
+    float **targets;              // One array per target value, filled with that value in mmol/L
+    const float *carb_ratios;
+    const int *sensitivities;
+    const float *target_values;   // Target values in the configured unit
+    int carb_ratio_count;
+    int sensitivity_count;
+    int target_count;
+    long cells;
+    atomic_long next_cell;        // Next grid cell to be calculated
+    backtest_result *results;
+    atomic_int failed;            // Set if a worker could not allocate its buffers
+} backtest_job;
+
+
+int parse_grid_axis(const char *text, grid_axis *axis){
+    char *end;
+    float start = strtof(text, &end);
+    if (end == text){
+        return -1;
+    }
+    if (*end == '\0'){
+        axis->start = start;
+        axis->step = 0;
+        axis->count = 1;
+        return 0;
+    }
+
+    float last, step;
+    if (*end != ':'){
+        return -1;
+    }
+    const char *next = end + 1;
+    last = strtof(next, &end);
+    if (end == next || *end != ':'){
+        return -1;
+    }
+    next = end + 1;
+    step = strtof(next, &end);
+    if (end == next || *end != '\0' || !(step > 0) || last < start){
+        return -1;
+    }
+
+    // Allow for the step not dividing the range exactly in binary
+    double count = floor((double)(last - start) / step + 1e-6) + 1;
+    if (count > 1000000){
+        return -1;
+    }
+    axis->start = start;
+    axis->step = step;
+    axis->count = (int)count;
+    return 0;
+}
+
+/**
+ * axis_value - Returns the i-th value of a grid axis.
+ */
+static float axis_value(const grid_axis *axis, int i){
+    return (float)(axis->start + (double)axis->step * i);
+}
+
+/**
+ * free_history - Releases the arrays of a loaded history.
+ */
+static void free_history(backtest_history *history){
+    free(history->blood_glucose);
+    free(history->carbs);
+    free(history->logged_dose);
+    free(history->has_logged_dose);
+    free(history->insulin_on_board);
+    free(history->has_insulin_on_board);
+    memset(history, 0, sizeof(*history));
+}
+
+/**
+ * add_history_entry - Appends one replayable entry to the history.
+ */
+static int add_history_entry(backtest_history *history, const log_entry *entry, int has_blood_glucose,
+                             int has_carbs, int has_dose, int has_insulin_on_board){
+    // Only entries that calculate_dosages would have calculated a dose for
+    int carb_entry = strcmp(entry->entry_type, "meal") == 0 || strcmp(entry->entry_type, "snack") == 0;
+    int correction_entry = strcmp(entry->entry_type, "correction") == 0;
+    if (!(carb_entry && has_carbs) && !((carb_entry || correction_entry) && has_blood_glucose)){
+        return 0;
+    }
+
+    if (history->count == history->capacity){
+        size_t capacity = history->capacity > 0 ? history->capacity * 2 : 1024;
+        float *blood_glucose = realloc(history->blood_glucose, capacity * sizeof(float));
+        if (blood_glucose != NULL) history->blood_glucose = blood_glucose;
+        float *carbs = realloc(history->carbs, capacity * sizeof(float));
+        if (carbs != NULL) history->carbs = carbs;
+        float *logged_dose = realloc(history->logged_dose, capacity * sizeof(float));
+        if (logged_dose != NULL) history->logged_dose = logged_dose;
+        unsigned char *has_logged_dose = realloc(history->has_logged_dose, capacity);
+        if (has_logged_dose != NULL) history->has_logged_dose = has_logged_dose;
+        float *insulin_on_board = realloc(history->insulin_on_board, capacity * sizeof(float));
+        if (insulin_on_board != NULL) history->insulin_on_board = insulin_on_board;
+        unsigned char *has_insulin_on_board = realloc(history->has_insulin_on_board, capacity);
+        if (has_insulin_on_board != NULL) history->has_insulin_on_board = has_insulin_on_board;
+        if (blood_glucose == NULL || carbs == NULL || logged_dose == NULL || has_logged_dose == NULL ||
+            insulin_on_board == NULL || has_insulin_on_board == NULL){
+            perror("Error allocating backtest history");
+            return -1;
+        }
+        history->capacity = capacity;
+    }
+
+    size_t i = history->count++;
+    history->blood_glucose[i] = has_blood_glucose ? entry->blood_glucose_level : 0.0f;
+    history->carbs[i] = carb_entry && has_carbs ? entry->meal_time_carbs : 0.0f;
+    history->logged_dose[i] = has_dose ? entry->insulin_dosage : 0.0f;
+    history->has_logged_dose[i] = (unsigned char)(has_dose != 0);
+    history->insulin_on_board[i] = has_insulin_on_board ? entry->insulin_on_board : 0.0f;
+    history->has_insulin_on_board[i] = (unsigned char)(has_insulin_on_board != 0);
+    return 0;
+}
+
+/**
+ * load_scanned_entry - log_scan callback that adds entries inside the window to the history.
+ */
+static int load_scanned_entry(const scanned_entry *scanned, void *context){
+    backtest_history *history = context;
+    if (scanned->kind != SCAN_ENTRY || !scanned->has_timestamp || scanned->timestamp < history->start_time){
+        return 0;
+    }
+    return add_history_entry(history, &scanned->entry,
+                             (scanned->lines & SCAN_LINE_BLOOD_GLUCOSE) != 0,
+                             (scanned->lines & SCAN_LINE_CARBS) != 0,
+                             (scanned->lines & SCAN_LINE_TOTAL_DOSAGE) != 0,
+                             (scanned->lines & SCAN_LINE_INSULIN_ON_BOARD) != 0);
+}
+
+/**
+ * load_history - Loads the replayable entries of a log from start_time onwards.
+ */
+static int load_history(const char *filename, backtest_history *history){
+    long offset = log_index_seek(filename, history->start_time);
+
+    if (is_binary_log(filename)){
+        FILE *file = open_record_file(filename, "rb");
+        if (file == NULL){
+            return -1;
+        }
+        if (offset > 0){
+            fseek(file, offset, SEEK_SET);
+        }
+
+        log_record records[BACKTEST_RECORD_BATCH];
+        size_t count;
+        while ((count = fread(records, sizeof(log_record), BACKTEST_RECORD_BATCH, file)) > 0){
+            for (size_t i = 0; i < count; i++){
+                // Edits and deletions are replayed once compaction folds them in
+                if (records[i].timestamp < (int64_t)history->start_time ||
+                    (records[i].flags & RECORD_FLAG_REVISION) || !record_intact(&records[i])){
+                    continue;
+                }
+                log_entry entry;
+                record_to_entry(&records[i], &entry);
+                if (add_history_entry(history, &entry, entry.blood_glucose_level_flag,
+                                      entry.meal_time_carbs_flag, entry.insulin_dosage_flag,
+                                      entry.insulin_on_board_flag) != 0){
+                    fclose(file);
+                    return -1;
+                }
+            }
+        }
+        fclose(file);
+        return 0;
+    }
+
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+    if ((size_t)offset > map.size){
+        offset = 0;
+    }
+    int status = log_scan(map.data + offset, map.size - (size_t)offset, load_scanned_entry, history) == 0 ? 0 : -1;
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * percentile_dose - Reads a nearest-rank percentile from a dose histogram.
+ */
+static float percentile_dose(const long *histogram, size_t count, double fraction){
+    long rank = (long)ceil(fraction * (double)count);
+    if (rank < 1){
+        rank = 1;
+    }
+    long seen = 0;
+    for (int bin = 0; bin < BACKTEST_HISTOGRAM_BINS; bin++){
+        seen += histogram[bin];
+        if (seen >= rank){
+            return bin * 0.5f;
+        }
+    }
+    return (BACKTEST_HISTOGRAM_BINS - 1) * 0.5f;
+}
+
+/**
+ * backtest_worker - Thread body: takes grid cells one at a time until none are left.
+ */
+static void *backtest_worker(void *argument){
+    backtest_job *job = argument;
+    const backtest_history *history = job->history;
+    size_t n = history->count;
+
+    float *doses = malloc((n > 0 ? n : 1) * sizeof(float));
+    if (doses == NULL){
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+    long histogram[BACKTEST_HISTOGRAM_BINS];
+
+    long cell;
+    while ((cell = atomic_fetch_add(&job->next_cell, 1)) < job->cells){
+        int t = (int)(cell % job->target_count);
+        int s = (int)(cell / job->target_count % job->sensitivity_count);
+        int c = (int)(cell / job->target_count / job->sensitivity_count);
+
+        backtest_result *result = &job->results[cell];
+        memset(result, 0, sizeof(*result));
+        result->carb_ratio = job->carb_ratios[c];
+        result->insulin_sensitivity_factor = job->sensitivities[s];
+        result->target_blood_glucose = job->target_values[t];
+
+        // Insulin on board is taken off as it was when each dose was suggested
+        total_dosage_on_board_batch(history->carbs, history->blood_glucose, job->targets[t],
+                                    history->insulin_on_board, history->has_insulin_on_board,
+                                    result->carb_ratio, result->insulin_sensitivity_factor, doses, n,
+                                    UNIT_MMOL_L);
+
+        memset(histogram, 0, sizeof(histogram));
+        double total = 0, difference = 0, absolute_difference = 0, squared_difference = 0;
+        float max_dose = 0;
+        long compared = 0;
+        for (size_t i = 0; i < n; i++){
+            float dose = doses[i];
+            total += dose;
+            if (dose > max_dose){
+                max_dose = dose;
+            }
+            int bin = dose > 0 ? (int)(dose * 2) : 0;
+            histogram[bin < BACKTEST_HISTOGRAM_BINS ? bin : BACKTEST_HISTOGRAM_BINS - 1]++;
+
+            if (history->has_logged_dose[i]){
+                double delta = (double)dose - history->logged_dose[i];
+                difference += delta;
+                absolute_difference += fabs(delta);
+                squared_difference += delta * delta;
+                compared++;
+            }
+        }
+
+        if (n > 0){
+            result->mean_dose = (float)(total / (double)n);
+            result->median_dose = percentile_dose(histogram, n, 0.5);
+            result->p90_dose = percentile_dose(histogram, n, 0.9);
+            result->max_dose = max_dose;
+        }
+        result->compared = compared;
+        if (compared > 0){
+            result->mean_difference = difference / compared;
+            result->mean_absolute_difference = absolute_difference / compared;
+            result->rms_difference = sqrt(squared_difference / compared);
+        }
+    }
+
+    free(doses);
+    return NULL;
+}
+
+/**
+ * compare_results - qsort comparison putting the results closest to the logged doses first.
+ */
+static int compare_results(const void *a, const void *b){
+    const backtest_result *first = *(const backtest_result *const *)a;
+    const backtest_result *second = *(const backtest_result *const *)b;
+    if (first->mean_absolute_difference < second->mean_absolute_difference) return -1;
+    if (first->mean_absolute_difference > second->mean_absolute_difference) return 1;
+    if (first->rms_difference < second->rms_difference) return -1;
+    if (first->rms_difference > second->rms_difference) return 1;
+    return 0;
+}
+
+/**
+ * write_results_csv - Writes the result for every grid cell to a CSV file.
+ */
+static int write_results_csv(const char *csv_filename, const backtest_result *results, long cells){
+    FILE *csv = fopen(csv_filename, "w");
+    if (csv == NULL){
+        perror("Error opening backtest results file");
+        return -1;
+    }
+    fprintf(csv, "carb_ratio,isf,target,mean_dose,median_dose,p90_dose,max_dose,compared,"
+                 "mean_difference,mean_absolute_difference,rms_difference\n");
+    for (long i = 0; i < cells; i++){
+        const backtest_result *r = &results[i];
+        fprintf(csv, "%.2f,%d,%.2f,%.3f,%.1f,%.1f,%.1f,%ld,%.3f,%.3f,%.3f\n",
+                r->carb_ratio, r->insulin_sensitivity_factor, r->target_blood_glucose,
+                r->mean_dose, r->median_dose, r->p90_dose, r->max_dose, r->compared,
+                r->mean_difference, r->mean_absolute_difference, r->rms_difference);
+    }
+    if (fclose(csv) != 0){
+        perror("Error writing backtest results file");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * display_results - Prints the settings whose doses were closest to the logged doses.
+ */
+static int display_results(const backtest_result *results, long cells, const char *unit){
+    const backtest_result **order = malloc((size_t)cells * sizeof(*order));
+    if (order == NULL){
+        perror("Error allocating backtest results");
+        return -1;
+    }
+    for (long i = 0; i < cells; i++){
+        order[i] = &results[i];
+    }
+
+    if (results[0].compared > 0){
+        qsort(order, (size_t)cells, sizeof(*order), compare_results);
+        printf("\nSettings closest to the logged doses:\n");
+    } else {
+        printf("\nNo logged doses to compare with. Suggested doses:\n");
+    }
+
+    printf("%10s %5s %8s %9s %7s %6s %6s %10s %13s %9s\n", "Carb ratio", "ISF", "Target",
+           "Mean dose", "Median", "P90", "Max", "Mean diff", "Mean abs diff", "RMS diff");
+    long shown = cells < BACKTEST_TOP ? cells : BACKTEST_TOP;
+    for (long i = 0; i < shown; i++){
+        const backtest_result *r = order[i];
+        printf("%10.2f %5d %8.2f %9.2f %7.1f %6.1f %6.1f %10.2f %13.2f %9.2f\n",
+               r->carb_ratio, r->insulin_sensitivity_factor, r->target_blood_glucose,
+               r->mean_dose, r->median_dose, r->p90_dose, r->max_dose,
+               r->mean_difference, r->mean_absolute_difference, r->rms_difference);
+    }
+    printf("Targets are in %s; doses and differences in units.\n", unit);
+
+    free(order);
+    return 0;
+}
+
+/**
+ * fill_axes - Expands the grid axes into the setting values for each cell and checks them.
+ */
+static int fill_axes(backtest_job *job, const grid_axis *carb_ratio_axis, const grid_axis *sensitivity_axis,
+                     const grid_axis *target_axis, float *carb_ratios, int *sensitivities, float *target_values){
+    for (int i = 0; i < carb_ratio_axis->count; i++){
+        carb_ratios[i] = axis_value(carb_ratio_axis, i);
+        if (!(carb_ratios[i] > 0)){
+            printf("Error: carb ratios must be greater than 0.\n");
+            return -1;
+        }
+    }
+    for (int i = 0; i < sensitivity_axis->count; i++){
+        float value = axis_value(sensitivity_axis, i);
+        sensitivities[i] = (int)lroundf(value);
+        if (sensitivities[i] <= 0 || fabsf(value - (float)sensitivities[i]) > 1e-3f){
+            printf("Error: insulin sensitivity factors must be whole numbers greater than 0.\n");
+            return -1;
+        }
+    }
+    for (int i = 0; i < target_axis->count; i++){
+        target_values[i] = axis_value(target_axis, i);
+        if (!(target_values[i] > 0)){
+            printf("Error: targets must be greater than 0.\n");
+            return -1;
+        }
+    }
+
+    job->carb_ratios = carb_ratios;
+    job->sensitivities = sensitivities;
+    job->target_values = target_values;
+    job->carb_ratio_count = carb_ratio_axis->count;
+    job->sensitivity_count = sensitivity_axis->count;
+    job->target_count = target_axis->count;
+    return 0;
+}
+
+/**
+ * fill_targets - Builds one array per target value, converted to mmol/L, for the kernels.
+ */
+static int fill_targets(backtest_job *job, const char *unit){
+    size_t count = job->history->count;
+    for (int t = 0; t < job->target_count; t++){
+        job->targets[t] = malloc((count > 0 ? count : 1) * sizeof(float));
+        if (job->targets[t] == NULL){
+            perror("Error allocating backtest grid");
+            return -1;
+        }
+        float target = convert_to_mmol_L(job->target_values[t], unit);
+        for (size_t i = 0; i < count; i++){
+            job->targets[t][i] = target;
+        }
+    }
+    return 0;
+}
+
+/**
+ * replay_grid - Calculates every grid cell on the worker threads.
+ *
+ * @return: Number of threads that worked on the grid, or -1 for errors.
+ */
+static int replay_grid(backtest_job *job, int threads){
+    if (threads <= 0){
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    if (threads > BACKTEST_MAX_THREADS){
+        threads = BACKTEST_MAX_THREADS;
+    }
+    if (threads > job->cells){
+        threads = (int)job->cells;
+    }
+
+    // The calling thread is one of the workers
+    pthread_t workers[BACKTEST_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, backtest_worker, job) == 0){
+        started++;
+    }
+    backtest_worker(job);
+    for (int i = 0; i < started; i++){
+        pthread_join(workers[i], NULL);
+    }
+
+    if (atomic_load(&job->failed)){
+        printf("Error: not enough memory for the backtest.\n");
+        return -1;
+    }
+    return started + 1;
+}
+
+int run_backtest(const char *filename, int days, const backtest_grid *grid, int threads, const char *csv_filename){
+    log_entry settings = {0};
+    if (log_config(&settings) != 0){
+        printf("Failed to load configuration values. Please check config.txt.\n");
+        return -1;
+    }
+
+    // Axes that were not given use the configured setting
+    grid_axis carb_ratio_axis = grid->carb_ratio;
+    grid_axis sensitivity_axis = grid->sensitivity;
+    grid_axis target_axis = grid->target;
+    if (carb_ratio_axis.count == 0){
+        carb_ratio_axis = (grid_axis){settings.carb_ratio, 0, 1};
+    }
+    if (sensitivity_axis.count == 0){
+        sensitivity_axis = (grid_axis){(float)settings.correction_factor, 0, 1};
+    }
+    if (target_axis.count == 0){
+        target_axis = (grid_axis){settings.target_blood_glucose, 0, 1};
+    }
+    long cells = (long)carb_ratio_axis.count * sensitivity_axis.count * target_axis.count;
+    if (cells > 10000000L){
+        printf("Error: the settings grid has too many combinations (%ld).\n", cells);
+        return -1;
+    }
+
+    backtest_history history;
+    memset(&history, 0, sizeof(history));
+    backtest_job job;
+    memset(&job, 0, sizeof(job));
+    job.history = &history;
+    job.cells = cells;
+    atomic_init(&job.next_cell, 0);
+    atomic_init(&job.failed, 0);
+
+    float *carb_ratios = calloc((size_t)carb_ratio_axis.count, sizeof(float));
+    int *sensitivities = calloc((size_t)sensitivity_axis.count, sizeof(int));
+    float *target_values = calloc((size_t)target_axis.count, sizeof(float));
+    job.targets = calloc((size_t)target_axis.count, sizeof(float *));
+    job.results = calloc((size_t)cells, sizeof(backtest_result));
+
+    int status = -1;
+    struct timespec started, loaded, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    history.start_time = time(NULL) - (time_t)days * 24 * 60 * 60;
+
+    if (carb_ratios == NULL || sensitivities == NULL || target_values == NULL ||
+        job.targets == NULL || job.results == NULL){
+        perror("Error allocating backtest grid");
+    } else if (fill_axes(&job, &carb_ratio_axis, &sensitivity_axis, &target_axis,
+                         carb_ratios, sensitivities, target_values) == 0 &&
+               load_history(filename, &history) == 0 &&
+               fill_targets(&job, settings.unit) == 0){
+        clock_gettime(CLOCK_MONOTONIC, &loaded);
+        int used_threads = replay_grid(&job, threads);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+
+        if (used_threads > 0){
+            long compared = 0;
+            for (size_t i = 0; i < history.count; i++){
+                compared += history.has_logged_dose[i];
+            }
+            double load_seconds = (loaded.tv_sec - started.tv_sec) + (loaded.tv_nsec - started.tv_nsec) / 1e9;
+            double grid_seconds = (finished.tv_sec - loaded.tv_sec) + (finished.tv_nsec - loaded.tv_nsec) / 1e9;
+            printf("Backtest of the past %d days: %zu entries (%ld with logged doses)\n", days, history.count, compared);
+            printf("%ld settings combinations on %d threads: loaded in %.3f s, replayed in %.3f s (%.1f M doses/s)\n",
+                   cells, used_threads, load_seconds, grid_seconds,
+                   grid_seconds > 0 ? (double)cells * history.count / grid_seconds / 1e6 : 0.0);
+
+            status = display_results(job.results, cells, settings.unit);
+            if (status == 0 && csv_filename != NULL){
+                status = write_results_csv(csv_filename, job.results, cells);
+                if (status == 0){
+                    printf("Results for every combination written to %s\n", csv_filename);
+                }
+            }
+        }
+    }
+
+    if (job.targets != NULL){
+        for (int t = 0; t < target_axis.count; t++){
+            free(job.targets[t]);
+        }
+    }
+    free(job.targets);
+    free(job.results);
+    free(carb_ratios);
+    free(sensitivities);
+    free(target_values);
+    free_history(&history);
+    return status;
+}
@@ -0,0 +1,70 @@
+#ifndef BACKTEST_H
+#define BACKTEST_H
+
+#include <stddef.h>
+
+// Upper bound on worker threads for a backtest
+#define BACKTEST_MAX_THREADS 64
+
+// Doses are histogrammed in 0.5 unit steps up to 200 units for the percentiles
+#define BACKTEST_HISTOGRAM_BINS 401
+
+// Number of closest settings printed after a backtest
+#define BACKTEST_TOP 10
+
+// One axis of the settings grid: count values from start in steps of step.
+// A count of 0 means the configured setting is used.
+typedef struct {
+    float start;
+    float step;
+    int count;
+} grid_axis;
+
+// The settings combinations to replay the history with.
+typedef struct {
+    grid_axis carb_ratio;         // Carb ratios in g/unit
+    grid_axis sensitivity;        // Insulin sensitivity factors in mmol/L/unit (whole numbers)
+    grid_axis target;             // Target blood glucose in the configured unit
+} backtest_grid;
+
+// Doses suggested by one settings combination over the whole history.
+typedef struct {
+    float carb_ratio;
+    int insulin_sensitivity_factor;
+    float target_blood_glucose;   // In the configured unit
+    float mean_dose;              // Mean suggested dose in units
+    float median_dose;
+    float p90_dose;               // 90th percentile suggested dose
+    float max_dose;
+    long compared;                // Entries that had a logged dose to compare with
+    double mean_difference;       // Mean of suggested minus logged dose
+    double mean_absolute_difference;
+    double rms_difference;        // Root mean square of suggested minus logged dose
+} backtest_result;
+
+/**
+ * parse_grid_axis - Parses a grid axis given as "VALUE" or "START:END:STEP".
+ *
+ * @param text: The axis text.
+ * @param axis: Receives the axis.
+ * @return: 0 for success, -1 if the text is not a valid axis.
+ */
+int parse_grid_axis(const char *text, grid_axis *axis);
+
+/**
+ * run_backtest - Replays the meal, snack and correction entries of a history window
+ * with every combination of settings in a grid and reports the suggested doses.
+ * The history is loaded once; grid cells are shared out between worker threads,
+ * each calculating a whole cell with the batch dosage kernels. Entries logged with
+ * insulin on board have it taken off their corrections, as when they were logged.
+ *
+ * @param filename: Log file to replay (text or binary).
+ * @param days: Length of the history window in days, ending now.
+ * @param grid: Settings to try; axes with a count of 0 use config.txt.
+ * @param threads: Number of worker threads, or 0 for one per online CPU.
+ * @param csv_filename: File to write the results for every cell to, or NULL.
+ * @return: 0 for success, -1 for errors.
+ */
+int run_backtest(const char *filename, int days, const backtest_grid *grid, int threads, const char *csv_filename);
+
+#endif
@@ -0,0 +1,2000 @@
+#include <stdio.h>
+#include "calculations.h"
+#include "config.h"
+#include "logging.h"
+#include "log_writer.h"
+#include "storage.h"
+#include "log_index.h"
+#include "import.h"
+#include "pipeline.h"
+#include "glucose_stats.h"
+#include "rollup.h"
+#include "records.h"
+#include "log_scan.h"
+#include "segments.h"
+#include "fooddb.h"
+#include "log_verify.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Readings used by the kernel benchmark unless a count is given
+#define BENCH_KERNEL_COUNT 10000000
+
+// Settings used for the dosage kernels
+#define BENCH_CARB_RATIO 8.0f
+#define BENCH_SENSITIVITY 2
+
+// Defaults for the benchmark suite
+#define BENCH_SUITE_ENTRIES 100000
+#define BENCH_SUITE_RUNS 20
+#define BENCH_SUITE_DIR "bench_data"
+#define BENCH_APPENDS 1000            // Entries appended per append benchmark
+#define BENCH_CONFIG_READS 100000     // read_config calls timed
+
+// Defaults for the pipeline benchmark
+#define BENCH_PIPELINE_SOURCES 4
+#define BENCH_PIPELINE_ROWS 250000    // Rows per source
+
+// Defaults for the parallel scan benchmark
+#define BENCH_SCAN_ENTRIES 500000
+#define BENCH_SCAN_RUNS 3             // Timed runs per thread count; the fastest is reported
+
+// Defaults for the concurrent append stress test
+#define BENCH_STRESS_WRITERS 8
+#define BENCH_STRESS_ENTRIES 2000     // Entries appended by each writer
+#define BENCH_STRESS_FLUSH 16         // Entries per flush for writers holding a log_writer
+
+// Defaults for the storage backend comparison
+#define BENCH_STORAGE_ENTRIES 100000
+#define BENCH_STORAGE_RUNS 10
+
+// Defaults for the food table benchmark
+#define BENCH_FOODS 300000
+#define BENCH_FOOD_RUNS 1000          // Timed runs of each kind of search
+
+// Seed for generated logs, so every run uses the same history
+#define BENCH_SEED 0x9E3779B97F4A7C15ULL
+
+// Seconds between generated entries, before jitter (a CGM reading every 5 minutes)
+#define BENCH_ENTRY_SPACING 300
+
+// Settings written to the suite's config.txt and used to calculate generated doses
+#define BENCH_CONFIG "blood glucose unit = mmol/L\ncarb ratio = 10.00\n" \
+                     "insulin sensitivity factor = 2\ntarget blood glucose = 6.00\n"
+
+// Function declarations
+
+/**
+ * print_usage - Displays the benchmarks that can be run.
+ *
+ * @param program: Name the program was invoked with.
+ */
+void print_usage(const char *program);
+
+/**
+ * bench_kernels - Times the scalar calculations against the batch kernels and checks they agree,
+ * then checks imported mg/dL rows get the same doses as the matching mmol/L rows.
+ *
+ * @param count: Number of readings to calculate.
+ * @return: 0 if every batch result matches the scalar result and the doses agree, -1 otherwise.
+ */
+int bench_kernels(size_t count);
+
+/**
+ * generate_log - Writes a deterministic text log in the format written by log_data.
+ * Entries are a mix of meal, snack, correction and other entries about five minutes
+ * apart, with doses calculated from the suite's settings, ending at end_time.
+ *
+ * @param filename: Log file to create (replaced if it exists).
+ * @param count: Number of entries.
+ * @param end_time: Time of the last entry.
+ * @return: Bytes written, or -1 for errors.
+ */
+long generate_log(const char *filename, long count, time_t end_time);
+
+/**
+ * bench_suite - Runs the logging and config benchmarks on a generated log and prints JSON results.
+ * Works inside its own directory, with its own config.txt and data/logs.txt.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param entries: Number of entries in the generated log.
+ * @param runs: Number of timed runs of each query and config update.
+ * @param json: Stream to write the JSON results to.
+ * @return: 0 for success, -1 for errors.
+ */
+int bench_suite(const char *directory, long entries, int runs, FILE *json);
+
+/**
+ * bench_pipeline - Imports generated CSV exports from several devices one after another
+ * with import_csv, then together through the ingest pipeline, and prints the throughput
+ * and queue depths of each. Works inside its own directory like bench_suite.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param sources: Number of devices.
+ * @param rows: Rows exported by each device.
+ * @return: 0 for success, -1 for errors.
+ */
+int bench_pipeline(const char *directory, int sources, long rows);
+
+/**
+ * bench_scan - Times an all-history query of a generated log, text and binary, on one
+ * thread and then on 2, 4, ... up to max_threads, and checks every parallel output is
+ * byte for byte the serial output. Works inside its own directory like bench_suite.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param entries: Number of entries in the generated log.
+ * @param max_threads: Most threads to scan on.
+ * @return: 0 if every output matches, -1 otherwise.
+ */
+int bench_scan(const char *directory, long entries, int max_threads);
+
+/**
+ * bench_stress - Appends to one log from several processes at once, text and binary,
+ * then checks every entry landed whole and in order for its writer, that the
+ * statistics and rollups count every reading, and that a partly written entry left
+ * at the end of the log is removed when a writer opens it. Half the writers append
+ * through log_date_time and log_data, the others through a log_writer. Works inside
+ * its own directory like bench_suite.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param writers: Number of writer processes.
+ * @param entries: Entries appended by each writer.
+ * @return: 0 if every check passes, -1 otherwise.
+ */
+int bench_stress(const char *directory, int writers, long entries);
+
+/**
+ * bench_storage - Loads the same generated entries into a text, a binary, a SQLite and
+ * a segmented log through the storage interface, then times durable single appends,
+ * range scans and aggregates on each and checks the scans agree. Prints JSON results.
+ * Works inside its own directory like bench_suite.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param entries: Number of entries loaded into each log.
+ * @param runs: Number of timed runs of each scan and aggregate.
+ * @param json: Stream to write the JSON results to.
+ * @return: 0 for success, -1 for errors or if the backends disagree.
+ */
+int bench_storage(const char *directory, long entries, int runs, FILE *json);
+
+/**
+ * bench_foods - Generates a CSV file of foods, compiles it into a food table, then times
+ * opening the table and prefix, several word and misspelled searches of it. Prints JSON
+ * results. Works inside its own directory like bench_suite.
+ *
+ * @param directory: Directory to run in; created if needed.
+ * @param foods: Number of foods generated.
+ * @param runs: Number of timed runs of each kind of search.
+ * @param json: Stream to write the JSON results to.
+ * @return: 0 for success, -1 for errors.
+ */
+int bench_foods(const char *directory, long foods, int runs, FILE *json);
+
+
+/**
+ * next_random - xorshift64 generator, so every run uses the same data.
+ */
+static uint64_t next_random(uint64_t *state){
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * random_between - Uniform value in [low, high) from the generator.
+ */
+static float random_between(uint64_t *state, float low, float high){
+    return low + (high - low) * (float)(next_random(state) >> 40) / (float)(1 << 24);
+}
+
+/**
+ * seconds_since - Seconds elapsed since a monotonic clock reading.
+ */
+static double seconds_since(const struct timespec *start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * report_kernel - Prints the timings of one kernel and whether its results match.
+ */
+static int report_kernel(const char *name, size_t count, double scalar_seconds, double batch_seconds,
+                         const float *scalar, const float *batch){
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++){
+        if (memcmp(&scalar[i], &batch[i], sizeof(float)) != 0){
+            mismatches++;
+        }
+    }
+    printf("%-24s scalar %8.2f M/s   batch %8.2f M/s   speedup %5.2fx   %s\n", name,
+           count / scalar_seconds / 1e6, count / batch_seconds / 1e6, scalar_seconds / batch_seconds,
+           mismatches == 0 ? "identical" : "MISMATCH");
+    if (mismatches > 0){
+        printf("  %zu of %zu results differ\n", mismatches, count);
+    }
+    return mismatches == 0 ? 0 : -1;
+}
+
+/**
+ * import_dose - Parses an import row with dose "calc" and gives its correction and total dosage.
+ */
+static int import_dose(const log_entry *settings, const char *unit, float blood_glucose, const char *carbs,
+                       float *correction, float *dosage){
+    char row[IMPORT_LINE_MAX];
+    snprintf(row, sizeof(row), "2026-10-17 10:00:00,%s,%.3f,%s,%s,calc",
+             *carbs != '\0' ? "meal" : "correction", blood_glucose, unit, carbs);
+    log_entry entry;
+    time_t timestamp;
+    const char *error;
+    if (parse_import_row(row, settings, NULL, &entry, &timestamp, &error) != 0){
+        printf("  import row rejected: %s\n", error);
+        return -1;
+    }
+    *correction = entry.correction_dosage;
+    *dosage = entry.insulin_dosage;
+    return 0;
+}
+
+/**
+ * check_import_units - Checks rows given in mg/dL, or in no unit with mg/dL configured, are
+ * converted to mmol/L once and get the doses of the same rows given in mmol/L.
+ */
+static int check_import_units(void){
+    log_entry mmol_settings = {0};
+    mmol_settings.carb_ratio = BENCH_CARB_RATIO;
+    mmol_settings.correction_factor = BENCH_SENSITIVITY;
+    mmol_settings.target_blood_glucose = 6.0f;
+    strcpy(mmol_settings.unit, "mmol/L");
+    log_entry mg_settings = mmol_settings;
+    mg_settings.target_blood_glucose = (float)(6.0 * 18.018);
+    strcpy(mg_settings.unit, "mg/dL");
+
+    const float readings[] = {3.5f, 6.0f, 9.0f, 12.0f, 20.0f};
+    const char *const carbs[] = {"", "45"};
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(readings) / sizeof(readings[0]); i++){
+        for (size_t j = 0; j < sizeof(carbs) / sizeof(carbs[0]); j++){
+            float mg_dl = (float)(readings[i] * 18.018);
+            float correction[3], dosage[3];
+            if (import_dose(&mmol_settings, "mmol/L", readings[i], carbs[j], &correction[0], &dosage[0]) != 0 ||
+                import_dose(&mmol_settings, "mg/dL", mg_dl, carbs[j], &correction[1], &dosage[1]) != 0 ||
+                import_dose(&mg_settings, "", mg_dl, carbs[j], &correction[2], &dosage[2]) != 0){
+                return -1;
+            }
+            for (int k = 1; k < 3; k++){
+                if (fabsf(correction[k] - correction[0]) > 0.001f || dosage[k] != dosage[0]){
+                    printf("  %.1f mmol/L: correction %.2f and dosage %.2f units, not %.2f and %.2f\n",
+                           readings[i], correction[k], dosage[k], correction[0], dosage[0]);
+                    mismatches++;
+                }
+            }
+        }
+    }
+    printf("%-24s %s\n", "import units", mismatches == 0 ? "identical" : "MISMATCH");
+    return mismatches == 0 ? 0 : -1;
+}
+
+int bench_kernels(size_t count){
+    float *blood_glucose = malloc(count * sizeof(float));
+    float *carbs = malloc(count * sizeof(float));
+    float *targets = malloc(count * sizeof(float));
+    float *scalar = malloc(count * sizeof(float));
+    float *batch = malloc(count * sizeof(float));
+    float *insulin_on_board = malloc(count * sizeof(float));
+    unsigned char *has_insulin_on_board = malloc(count);
+    if (blood_glucose == NULL || carbs == NULL || targets == NULL || scalar == NULL || batch == NULL ||
+        insulin_on_board == NULL || has_insulin_on_board == NULL){
+        printf("Error: not enough memory for %zu readings.\n", count);
+        free(blood_glucose);
+        free(carbs);
+        free(targets);
+        free(scalar);
+        free(batch);
+        free(insulin_on_board);
+        free(has_insulin_on_board);
+        return -1;
+    }
+
+    // Readings in mg/dL; whole grams of carbs make many doses land exactly halfway between 0.5 units
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < count; i++){
+        blood_glucose[i] = random_between(&state, 40.0f, 400.0f);
+        carbs[i] = (float)(next_random(&state) % 121);
+        targets[i] = random_between(&state, 5.0f, 7.0f);
+    }
+    // Include the edges of the target range exactly
+    for (size_t i = 0; i + 1 < count; i += 97){
+        blood_glucose[i] = (float)(lower_target * 18.018);
+        blood_glucose[i + 1] = (float)(upper_target * 18.018);
+    }
+
+    // Touch the outputs first so page faults are not timed
+    memset(scalar, 0, count * sizeof(float));
+    memset(batch, 0, count * sizeof(float));
+
+    log_entry entry = {0};
+    strcpy(entry.unit, "mg/dL");
+    int status = 0;
+    struct timespec start;
+    double scalar_seconds, batch_seconds;
+
+    printf("Kernel benchmark: %zu readings\n", count);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        scalar[i] = convert_to_mmol_L(blood_glucose[i], entry.unit);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    convert_to_mmol_L_batch(blood_glucose, batch, count, UNIT_MG_DL);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("convert_to_mmol_L", count, scalar_seconds, batch_seconds, scalar, batch);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        scalar[i] = convert_to_preferred_unit(targets[i], entry.unit);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    convert_to_preferred_unit_batch(targets, batch, count, UNIT_MG_DL);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("convert_to_preferred_unit", count, scalar_seconds, batch_seconds, scalar, batch);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        scalar[i] = meal_dosage_calculation(carbs[i], BENCH_CARB_RATIO);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    meal_dosage_batch(carbs, BENCH_CARB_RATIO, batch, count);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("meal_dosage", count, scalar_seconds, batch_seconds, scalar, batch);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        scalar[i] = correction_dosage_calculation(&entry, BENCH_SENSITIVITY, blood_glucose[i], targets[i]);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    correction_dosage_batch(blood_glucose, targets, BENCH_SENSITIVITY, batch, count, UNIT_MG_DL);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("correction_dosage", count, scalar_seconds, batch_seconds, scalar, batch);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        scalar[i] = total_dosage(&entry, carbs[i], BENCH_CARB_RATIO, BENCH_SENSITIVITY, blood_glucose[i], targets[i]);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    total_dosage_batch(carbs, blood_glucose, targets, BENCH_CARB_RATIO, BENCH_SENSITIVITY, batch, count, UNIT_MG_DL);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("total_dosage", count, scalar_seconds, batch_seconds, scalar, batch);
+
+    // Every other reading has insulin on board, often more than its correction
+    for (size_t i = 0; i < count; i++){
+        insulin_on_board[i] = random_between(&state, 0.0f, 4.0f);
+        has_insulin_on_board[i] = (unsigned char)(i % 2);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++){
+        entry.insulin_on_board = insulin_on_board[i];
+        entry.insulin_on_board_flag = has_insulin_on_board[i];
+        scalar[i] = total_dosage(&entry, carbs[i], BENCH_CARB_RATIO, BENCH_SENSITIVITY, blood_glucose[i], targets[i]);
+    }
+    scalar_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    total_dosage_on_board_batch(carbs, blood_glucose, targets, insulin_on_board, has_insulin_on_board,
+                                BENCH_CARB_RATIO, BENCH_SENSITIVITY, batch, count, UNIT_MG_DL);
+    batch_seconds = seconds_since(&start);
+    status |= report_kernel("total_dosage_on_board", count, scalar_seconds, batch_seconds, scalar, batch);
+    status |= check_import_units();
+
+    free(blood_glucose);
+    free(carbs);
+    free(targets);
+    free(scalar);
+    free(batch);
+    free(insulin_on_board);
+    free(has_insulin_on_board);
+    return status == 0 ? 0 : -1;
+}
+
+/**
+ * generated_entry - Fills in the next generated entry, the way the menu would log it.
+ */
+static void generated_entry(uint64_t *state, const log_entry *settings, log_entry *entry){
+    *entry = *settings;
+    entry->blood_glucose_level_flag = 1;
+    entry->target_blood_glucose_flag = 0;
+    entry->meal_time_carbs_flag = 0;
+    entry->correction_dosage_flag = 0;
+    entry->insulin_dosage_flag = 0;
+    entry->blood_glucose_level = random_between(state, 3.0f, 16.0f);
+
+    // 70% other, 12% meal, 8% snack, 10% correction
+    unsigned int kind = (unsigned int)(next_random(state) % 100);
+    const char *type = kind < 70 ? "other" : kind < 82 ? "meal" : kind < 90 ? "snack" : "correction";
+    strcpy(entry->entry_type, type);
+    if (strcmp(type, "other") == 0){
+        return;
+    }
+
+    entry->target_blood_glucose_flag = 1;
+    if (strcmp(type, "correction") != 0){
+        entry->meal_time_carbs = (float)(strcmp(type, "meal") == 0 ? 20 + next_random(state) % 80
+                                                                    : 5 + next_random(state) % 25);
+        entry->meal_time_carbs_flag = 1;
+    }
+    calculate_dosages(entry);
+}
+
+long generate_log(const char *filename, long count, time_t end_time){
+    log_entry settings = {0};
+    settings.carb_ratio = 10.0f;
+    settings.correction_factor = 2;
+    settings.target_blood_glucose = 6.0f;
+    strcpy(settings.unit, "mmol/L");
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL){
+        perror("Error creating generated log");
+        return -1;
+    }
+    static char buffer[1 << 20];
+    setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+
+    uint64_t state = BENCH_SEED;
+    time_t timestamp = end_time - (time_t)count * BENCH_ENTRY_SPACING;
+    long bytes = 0;
+    for (long i = 0; i < count; i++){
+        // Up to a minute either side of the nominal time; entries stay in order
+        time_t jitter = (time_t)(next_random(&state) % 120) - 60;
+        timestamp += BENCH_ENTRY_SPACING;
+
+        log_entry entry;
+        generated_entry(&state, &settings, &entry);
+
+        char text[LOG_ENTRY_MAX];
+        int length = format_log_entry(text, sizeof(text), &entry, i + 1 < count ? timestamp + jitter : end_time);
+        if (length < 0 || fwrite(text, 1, (size_t)length, file) != (size_t)length){
+            perror("Error writing generated log");
+            fclose(file);
+            return -1;
+        }
+        bytes += length;
+    }
+
+    if (fclose(file) != 0){
+        perror("Error writing generated log");
+        return -1;
+    }
+    return bytes;
+}
+
+/**
+ * compare_doubles - qsort comparison for latency samples.
+ */
+static int compare_doubles(const void *a, const void *b){
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * percentile - Nearest-rank percentile of sorted samples.
+ */
+static double percentile(const double *sorted, int count, double fraction){
+    int rank = (int)((fraction * count) + 0.999999);
+    if (rank < 1){
+        rank = 1;
+    }
+    if (rank > count){
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
+
+/**
+ * report_result - Writes one benchmark's latency percentiles and throughput as a JSON object.
+ * samples are in seconds and are sorted in place.
+ */
+static void report_result(FILE *json, int *first, const char *name, double *samples, int count,
+                          double bytes_per_sample){
+    double total = 0;
+    for (int i = 0; i < count; i++){
+        total += samples[i];
+    }
+    qsort(samples, (size_t)count, sizeof(double), compare_doubles);
+
+    double mean = count > 0 ? total / count : 0;
+    double p50 = count > 0 ? percentile(samples, count, 0.50) : 0;
+    double p90 = count > 0 ? percentile(samples, count, 0.90) : 0;
+    double p99 = count > 0 ? percentile(samples, count, 0.99) : 0;
+    double max = count > 0 ? samples[count - 1] : 0;
+    double bytes_per_second = total > 0 ? bytes_per_sample * count / total : 0;
+
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"samples\": %d, \"mean_us\": %.3f, \"p50_us\": %.3f, "
+                  "\"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"ops_per_second\": %.1f, "
+                  "\"bytes_per_second\": %.1f}",
+            *first ? "" : ",", name, count, mean * 1e6, p50 * 1e6, p90 * 1e6, p99 * 1e6, max * 1e6,
+            total > 0 ? count / total : 0.0, bytes_per_second);
+    *first = 0;
+
+    fprintf(stderr, "%-22s p50 %10.2f us   p90 %10.2f us   p99 %10.2f us   %12.1f ops/s\n",
+            name, p50 * 1e6, p90 * 1e6, p99 * 1e6, total > 0 ? count / total : 0.0);
+}
+
+/**
+ * silence_stdout - Sends stdout to /dev/null so rendering and dosage messages are not printed.
+ *
+ * @return: Descriptor to restore stdout from, or -1 if stdout was left alone.
+ */
+static int silence_stdout(void){
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (saved < 0 || null < 0){
+        if (saved >= 0) close(saved);
+        if (null >= 0) close(null);
+        return -1;
+    }
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+/**
+ * restore_stdout - Undoes silence_stdout.
+ */
+static void restore_stdout(int saved){
+    if (saved < 0){
+        return;
+    }
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+/**
+ * file_size - Size of a file in bytes, or 0 if it cannot be read.
+ */
+static double file_size(const char *filename){
+    struct stat file_stat;
+    return stat(filename, &file_stat) == 0 ? (double)file_stat.st_size : 0;
+}
+
+/**
+ * bench_log_data - Times the menu's original append path: log_date_time then log_data, per entry.
+ */
+static int bench_log_data(FILE *json, int *first, const char *filename, double *samples){
+    log_entry settings = {0};
+    if (log_config(&settings) != 0){
+        return -1;
+    }
+    uint64_t state = BENCH_SEED ^ 1;
+    double before = file_size(filename);
+
+    int saved = silence_stdout();
+    int status = 0;
+    for (int i = 0; i < BENCH_APPENDS && status == 0; i++){
+        log_entry entry;
+        generated_entry(&state, &settings, &entry);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (log_date_time(filename) != 0 || log_data(entry, filename) != 0){
+            status = -1;
+        }
+        samples[i] = seconds_since(&start);
+    }
+    restore_stdout(saved);
+
+    if (status == 0){
+        report_result(json, first, "append_log_data", samples, BENCH_APPENDS,
+                      (file_size(filename) - before) / BENCH_APPENDS);
+    }
+    return status;
+}
+
+/**
+ * bench_writer - Times appends through a session log_writer with a sync policy.
+ */
+static int bench_writer(FILE *json, int *first, const char *name, const char *filename,
+                        sync_policy policy, int sync_every, double *samples){
+    log_entry settings = {0};
+    if (log_config(&settings) != 0){
+        return -1;
+    }
+    log_writer *writer = malloc(sizeof(log_writer));
+    if (writer == NULL || log_writer_open(writer, filename, policy, sync_every, 1000) != 0){
+        free(writer);
+        return -1;
+    }
+    uint64_t state = BENCH_SEED ^ 2;
+    double before = file_size(filename);
+
+    int status = 0;
+    time_t now = time(NULL);
+    for (int i = 0; i < BENCH_APPENDS && status == 0; i++){
+        log_entry entry;
+        generated_entry(&state, &settings, &entry);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = log_writer_append(writer, &entry, now);
+        samples[i] = seconds_since(&start);
+    }
+    if (log_writer_close(writer) != 0){
+        status = -1;
+    }
+    free(writer);
+
+    if (status == 0){
+        report_result(json, first, name, samples, BENCH_APPENDS, (file_size(filename) - before) / BENCH_APPENDS);
+    }
+    return status;
+}
+
+/**
+ * bench_queries - Times read_logs for each time filter. Output is rendered to /dev/null.
+ */
+static int bench_queries(FILE *json, int *first, const char *filename, int runs, double *samples){
+    const char *filters[] = {"day", "week", "2 weeks", "month", "90 days"};
+    const char *names[] = {"query_day", "query_week", "query_2_weeks", "query_month", "query_90_days"};
+
+    for (int f = 0; f < 5; f++){
+        time_t start_time;
+        if (time_filter_start(filters[f], &start_time) != 0){
+            return -1;
+        }
+        // Bytes read per query: from where the index starts the scan to the end of the log
+        double bytes = file_size(filename) - (double)log_index_seek(filename, start_time);
+
+        int saved = silence_stdout();
+        int status = read_logs(filename, filters[f]); // Warm up: page cache and index
+        for (int i = 0; i < runs && status == 0; i++){
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = read_logs(filename, filters[f]);
+            samples[i] = seconds_since(&start);
+        }
+        restore_stdout(saved);
+        if (status != 0){
+            return -1;
+        }
+        report_result(json, first, names[f], samples, runs, bytes);
+    }
+    return 0;
+}
+
+/**
+ * bench_summaries - Times View Glucose Statistics, whose rollup part reads the daily
+ * table for whole days instead of the entries.
+ */
+static int bench_summaries(FILE *json, int *first, const char *filename, int runs, double *samples){
+    const char *filters[] = {"month", "90 days"};
+    const char *names[] = {"summary_month", "summary_90_days"};
+
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL){
+        perror("Error opening /dev/null");
+        return -1;
+    }
+    for (int f = 0; f < 2; f++){
+        int status = print_glucose_stats(out, filename, filters[f]); // Warm up: builds the sidecars
+        for (int i = 0; i < runs && status == 0; i++){
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = print_glucose_stats(out, filename, filters[f]);
+            samples[i] = seconds_since(&start);
+        }
+        if (status != 0){
+            fclose(out);
+            return -1;
+        }
+        report_result(json, first, names[f], samples, runs, 0);
+    }
+    fclose(out);
+    return 0;
+}
+
+/**
+ * bench_config - Times read_config lookups and update_config rewrites.
+ */
+static int bench_config(FILE *json, int *first, int runs, double *samples){
+    double config_bytes = file_size(CONFIG_FILE);
+    const char *keys[] = {"carb ratio", "insulin sensitivity factor", "blood glucose unit", "target blood glucose"};
+
+    for (int i = 0; i < BENCH_CONFIG_READS; i++){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        const char *value = read_config(keys[i % 4]);
+        samples[i] = seconds_since(&start);
+        if (value == NULL){
+            return -1;
+        }
+    }
+    report_result(json, first, "config_read", samples, BENCH_CONFIG_READS, config_bytes);
+
+    int saved = silence_stdout();
+    int status = 0;
+    for (int i = 0; i < runs && status == 0; i++){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = update_config(CONFIG_FILE, "carb ratio", i % 2 ? "10.00" : "10.50");
+        samples[i] = seconds_since(&start);
+    }
+    restore_stdout(saved);
+    if (status != 0 || update_config(CONFIG_FILE, "carb ratio", "10.00") != 0){
+        return -1;
+    }
+    report_result(json, first, "config_update", samples, runs, config_bytes);
+    return 0;
+}
+
+/**
+ * enter_bench_directory - Changes into a benchmark directory with a data directory
+ * and the benchmark config.txt, creating them as needed.
+ *
+ * @return: 0 for success, -1 for errors.
+ */
+static int enter_bench_directory(const char *directory){
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST){
+        perror("Error creating benchmark directory");
+        return -1;
+    }
+    if (chdir(directory) != 0 || (mkdir("data", 0755) != 0 && errno != EEXIST)){
+        perror("Error entering benchmark directory");
+        return -1;
+    }
+
+    FILE *config = fopen(CONFIG_FILE, "w");
+    if (config == NULL || fputs(BENCH_CONFIG, config) == EOF || fclose(config) != 0){
+        perror("Error writing benchmark config.txt");
+        return -1;
+    }
+    return 0;
+}
+
+int bench_suite(const char *directory, long entries, int runs, FILE *json){
+    if (enter_bench_directory(directory) != 0){
+        return -1;
+    }
+
+    const char *filename = "data/logs.txt";
+    // Start from a fresh log, index and statistics each run
+    remove("data/logs.txt.idx");
+    remove("data/logs.txt.stats");
+    remove("data/logs.txt.rollup");
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long bytes = generate_log(filename, entries, time(NULL) - 60);
+    if (bytes < 0){
+        return -1;
+    }
+    double generate_seconds = seconds_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (log_index_update(filename) != 0){
+        printf("Error: could not index the generated log.\n");
+        return -1;
+    }
+    double index_seconds = seconds_since(&start);
+
+    int sample_count = BENCH_CONFIG_READS;
+    if (runs > sample_count) sample_count = runs;
+    if (BENCH_APPENDS > sample_count) sample_count = BENCH_APPENDS;
+    double *samples = malloc((size_t)sample_count * sizeof(double));
+    if (samples == NULL){
+        printf("Error: not enough memory for benchmark samples.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Generated %ld entries (%ld bytes) in %.3f s, indexed in %.3f s\n",
+            entries, bytes, generate_seconds, index_seconds);
+    fprintf(json, "{\n  \"suite\": \"logging\",\n  \"entries\": %ld,\n  \"log_bytes\": %ld,\n  \"runs\": %d,\n"
+                  "  \"generate_seconds\": %.6f,\n  \"index_seconds\": %.6f,\n  \"results\": [",
+            entries, bytes, runs, generate_seconds, index_seconds);
+
+    int first = 1;
+    int status = bench_queries(json, &first, filename, runs, samples);
+    if (status == 0) status = bench_summaries(json, &first, filename, runs, samples);
+    if (status == 0) status = bench_config(json, &first, runs, samples);
+    if (status == 0) status = bench_log_data(json, &first, filename, samples);
+    if (status == 0) status = bench_writer(json, &first, "append_writer_entry", filename, SYNC_EVERY_ENTRY, 1, samples);
+    if (status == 0) status = bench_writer(json, &first, "append_writer_every_4096", filename, SYNC_EVERY_N, 4096, samples);
+
+    fprintf(json, "\n  ]\n}\n");
+    free(samples);
+    return status;
+}
+
+/**
+ * generate_export - Writes a deterministic CSV export of one device, in import row format
+ * and in time order. Devices read every five minutes, offset from each other.
+ *
+ * @return: Bytes written, or -1 for errors.
+ */
+static long generate_export(const char *filename, int device, long rows, time_t end_time){
+    FILE *file = fopen(filename, "w");
+    if (file == NULL){
+        perror("Error creating generated export");
+        return -1;
+    }
+    static char buffer[1 << 20];
+    setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+
+    uint64_t state = BENCH_SEED ^ (uint64_t)(device + 1);
+    time_t timestamp = end_time - (time_t)rows * BENCH_ENTRY_SPACING + device * 7;
+    long bytes = fprintf(file, "time,type,glucose,unit,carbs,dose\n");
+    for (long i = 0; i < rows && bytes > 0; i++){
+        timestamp += BENCH_ENTRY_SPACING;
+        float glucose = random_between(&state, 3.0f, 16.0f);
+        unsigned int kind = (unsigned int)(next_random(&state) % 100);
+        int written;
+        if (kind < 80){
+            written = fprintf(file, "%lld,other,%.1f,mmol/L,,\n", (long long)timestamp, glucose);
+        } else if (kind < 92){
+            written = fprintf(file, "%lld,meal,%.1f,mmol/L,%d,calc\n", (long long)timestamp, glucose,
+                              (int)(20 + next_random(&state) % 80));
+        } else {
+            written = fprintf(file, "%lld,correction,%.1f,mmol/L,,calc\n", (long long)timestamp, glucose);
+        }
+        bytes = written < 0 ? -1 : bytes + written;
+    }
+
+    if (fclose(file) != 0 || bytes < 0){
+        perror("Error writing generated export");
+        return -1;
+    }
+    return bytes;
+}
+
+int bench_pipeline(const char *directory, int sources, long rows){
+    if (enter_bench_directory(directory) != 0){
+        return -1;
+    }
+    log_entry settings = {0};
+    if (log_config(&settings) != 0){
+        return -1;
+    }
+
+    char names[PIPELINE_MAX_SOURCES][64];
+    const char *source_names[PIPELINE_MAX_SOURCES];
+    long input_bytes = 0;
+    time_t end_time = time(NULL) - 60;
+    for (int i = 0; i < sources; i++){
+        snprintf(names[i], sizeof(names[i]), "data/device_%d.csv", i + 1);
+        source_names[i] = names[i];
+        long bytes = generate_export(names[i], i, rows, end_time);
+        if (bytes < 0){
+            return -1;
+        }
+        input_bytes += bytes;
+    }
+    printf("Generated %d exports of %ld rows (%.1f MB)\n", sources, rows, input_bytes / 1e6);
+
+    const char *logs[] = {"data/serial.txt", "data/pipeline.txt"};
+    for (int i = 0; i < 2; i++){
+        char sidecar[64];
+        remove(logs[i]);
+        snprintf(sidecar, sizeof(sidecar), "%s.idx", logs[i]);
+        remove(sidecar);
+        snprintf(sidecar, sizeof(sidecar), "%s.stats", logs[i]);
+        remove(sidecar);
+    }
+
+    // Serial: one import_csv per export, as separate --import runs would do
+    storage store;
+    if (storage_open(&store, logs[0], SYNC_EVERY_N, IMPORT_SYNC_EVERY, 1000) != 0){
+        return -1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int saved = silence_stdout();
+    int status = 0;
+    for (int i = 0; i < sources && status == 0; i++){
+        FILE *input = fopen(names[i], "r");
+        status = input != NULL ? import_csv(input, names[i], &store, &settings) : -1;
+        if (input != NULL){
+            fclose(input);
+        }
+    }
+    restore_stdout(saved);
+    if (storage_close(&store) != 0){
+        status = -1;
+    }
+    double serial_seconds = seconds_since(&start);
+    if (status != 0){
+        return -1;
+    }
+    double output_bytes = file_size(logs[0]);
+    printf("serial:   %.3f s, %.0f rows/s, %.1f MB/s written\n", serial_seconds,
+           sources * rows / serial_seconds, output_bytes / serial_seconds / 1e6);
+
+    // Pipelined: all exports at once, merged by time
+    log_writer *writer = malloc(sizeof(log_writer));
+    if (writer == NULL || log_writer_open(writer, logs[1], SYNC_EVERY_N, IMPORT_SYNC_EVERY, 1000) != 0){
+        free(writer);
+        return -1;
+    }
+    pipeline_stats stats;
+    status = pipeline_import(source_names, sources, writer, &settings, &stats);
+    if (log_writer_close(writer) != 0){
+        status = -1;
+    }
+    free(writer);
+    if (status != 0){
+        return -1;
+    }
+    printf("pipeline: %.3f s, %.0f rows/s, %.1f MB/s written (%.2fx)\n", stats.seconds,
+           stats.imported / stats.seconds, stats.bytes_written / stats.seconds / 1e6,
+           serial_seconds / stats.seconds);
+    display_pipeline_stats(&stats);
+    return 0;
+}
+
+/**
+ * timed_query - Prints an all-history query of a log to a file on a number of threads.
+ *
+ * @return: Seconds taken by the fastest of BENCH_SCAN_RUNS runs, or -1 for errors.
+ */
+static double timed_query(const char *log_filename, const char *output_filename, int threads){
+    set_query_threads(threads);
+    double best = -1;
+    for (int run = 0; run < BENCH_SCAN_RUNS; run++){
+        FILE *out = fopen(output_filename, "w");
+        if (out == NULL){
+            perror("Error opening query output");
+            return -1;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int status = print_logs(out, log_filename, "all", NULL);
+        if (fclose(out) != 0 || status != 0){
+            return -1;
+        }
+        double seconds = seconds_since(&start);
+        if (best < 0 || seconds < best){
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+/**
+ * same_contents - Checks two files hold the same bytes.
+ *
+ * @return: 1 if they do, 0 if they differ or cannot be read.
+ */
+static int same_contents(const char *first_filename, const char *second_filename){
+    FILE *first = fopen(first_filename, "rb");
+    FILE *second = fopen(second_filename, "rb");
+    int same = first != NULL && second != NULL;
+    char first_buffer[65536], second_buffer[65536];
+    while (same){
+        size_t first_read = fread(first_buffer, 1, sizeof(first_buffer), first);
+        size_t second_read = fread(second_buffer, 1, sizeof(second_buffer), second);
+        if (first_read != second_read || memcmp(first_buffer, second_buffer, first_read) != 0){
+            same = 0;
+        } else if (first_read == 0){
+            break;
+        }
+    }
+    if (first != NULL) fclose(first);
+    if (second != NULL) fclose(second);
+    return same;
+}
+
+int bench_scan(const char *directory, long entries, int max_threads){
+    if (enter_bench_directory(directory) != 0){
+        return -1;
+    }
+    const char *logs[] = {"data/scan.txt", "data/scan.dat"};
+    for (int i = 0; i < 2; i++){
+        char sidecar[64];
+        remove(logs[i]);
+        snprintf(sidecar, sizeof(sidecar), "%s.idx", logs[i]);
+        remove(sidecar);
+    }
+    if (generate_log(logs[0], entries, time(NULL) - 60) < 0){
+        return -1;
+    }
+    int saved = silence_stdout();
+    int status = convert_text_log(logs[0], logs[1]);
+    restore_stdout(saved);
+    if (status != 0){
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++){
+        double bytes = file_size(logs[i]);
+        double serial_seconds = timed_query(logs[i], "data/scan_serial.out", 1);
+        if (serial_seconds < 0){
+            return -1;
+        }
+        printf("%s (%.1f MB): 1 thread %.3f s, %.1f MB/s\n", logs[i], bytes / 1e6,
+               serial_seconds, bytes / serial_seconds / 1e6);
+
+        for (int threads = 2; threads <= max_threads; threads *= 2){
+            double seconds = timed_query(logs[i], "data/scan_parallel.out", threads);
+            if (seconds < 0){
+                return -1;
+            }
+            int same = same_contents("data/scan_serial.out", "data/scan_parallel.out");
+            printf("%s (%.1f MB): %d threads %.3f s, %.1f MB/s (%.2fx), output %s\n", logs[i],
+                   bytes / 1e6, threads, seconds, bytes / seconds / 1e6, serial_seconds / seconds,
+                   same ? "identical" : "DIFFERS");
+            if (!same){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * stress_entry - The entry a stress writer appends: the writer's number is logged as the
+ * carbohydrates and the entry's sequence number as the carb ratio.
+ */
+static void stress_entry(int writer, long sequence, log_entry *entry){
+    memset(entry, 0, sizeof(*entry));
+    entry->blood_glucose_level = 5.5f;
+    entry->blood_glucose_level_flag = 1;
+    entry->meal_time_carbs = (float)writer;
+    entry->meal_time_carbs_flag = 1;
+    entry->carb_ratio = (float)sequence;
+    strcpy(entry->entry_type, "meal");
+}
+
+/**
+ * stress_writer - Body of one writer process: waits for the start signal, then appends
+ * its entries.
+ *
+ * @return: 0 for success, -1 for errors.
+ */
+static int stress_writer(const char *filename, int writer, long entries, int start_fd){
+    char start;
+    if (read(start_fd, &start, 1) < 0){
+        return -1;
+    }
+    close(start_fd);
+
+    log_entry entry;
+    if (writer % 2 == 0){
+        // The menu's original path: the log is opened for every entry
+        for (long i = 0; i < entries; i++){
+            stress_entry(writer, i, &entry);
+            if (log_date_time(filename) != 0 || log_data(entry, filename) != 0){
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    log_writer *log = malloc(sizeof(log_writer));
+    if (log == NULL || log_writer_open(log, filename, SYNC_EVERY_N, BENCH_STRESS_FLUSH, 1000) != 0){
+        free(log);
+        return -1;
+    }
+    int status = 0;
+    for (long i = 0; i < entries && status == 0; i++){
+        stress_entry(writer, i, &entry);
+        status = log_writer_append(log, &entry, time(NULL));
+    }
+    if (log_writer_close(log) != 0){
+        status = -1;
+    }
+    free(log);
+    return status;
+}
+
+// Results of checking a stress test log
+typedef struct {
+    int writers;
+    long entries;
+    long *next;                   // Next sequence number expected from each writer
+    long intact;                  // Entries found whole and in order
+    long damaged;                 // Entries with missing, extra or wrong lines or values
+    long out_of_order;            // Whole entries found before an earlier one from their writer
+} stress_check;
+
+/**
+ * check_stress_entry - Checks one entry read back from a stress test log.
+ */
+static void check_stress_entry(stress_check *check, int whole, const log_entry *entry){
+    int writer = (int)entry->meal_time_carbs;
+    long sequence = (long)entry->carb_ratio;
+    if (!whole || entry->blood_glucose_level != 5.5f || (float)writer != entry->meal_time_carbs ||
+        writer < 0 || writer >= check->writers || sequence < 0 || sequence >= check->entries){
+        check->damaged++;
+        return;
+    }
+    if (sequence == check->next[writer]){
+        check->intact++;
+    } else {
+        check->out_of_order++;
+    }
+    check->next[writer] = sequence + 1;
+}
+
+/**
+ * check_scanned_stress_entry - log_scan callback for check_stress_entry.
+ */
+static int check_scanned_stress_entry(const scanned_entry *scanned, void *context){
+    // A repaired log ends with a tombstone keeping the ID of the entry left out
+    if (scanned->kind == SCAN_DELETE){
+        return 0;
+    }
+    int whole = scanned->kind == SCAN_ENTRY && scanned->time_line != NULL &&
+                scanned->lines == (SCAN_LINE_BLOOD_GLUCOSE | SCAN_LINE_CARBS);
+    check_stress_entry(context, whole, &scanned->entry);
+    return 0;
+}
+
+/**
+ * check_stress_log - Reads back every entry of a stress test log.
+ */
+static int check_stress_log(const char *filename, stress_check *check){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+    if (!is_binary_log(filename)){
+        log_scan(map.data, map.size, check_scanned_stress_entry, check);
+    } else if (map.size < sizeof(record_header) || (map.size - sizeof(record_header)) % sizeof(log_record) != 0){
+        check->damaged++;
+    } else {
+        const log_record *records = (const log_record *)(map.data + sizeof(record_header));
+        size_t count = (map.size - sizeof(record_header)) / sizeof(log_record);
+        for (size_t i = 0; i < count; i++){
+            if (records[i].flags & RECORD_FLAG_DELETED){
+                continue;
+            }
+            log_entry entry;
+            record_to_entry(&records[i], &entry);
+            // Whole records carry a checksum as well as the values a stress entry sets
+            uint16_t values = records[i].flags & ~(RECORD_FLAG_CHECKSUM | RECORD_FLAG_INSULIN_ON_BOARD);
+            check_stress_entry(check, record_intact(&records[i]) &&
+                               values == (RECORD_FLAG_BLOOD_GLUCOSE | RECORD_FLAG_CARBS), &entry);
+        }
+    }
+    log_map_close(&map);
+    return 0;
+}
+
+/**
+ * check_torn_tails - Appends part of an entry, as a writer stopping mid-write would,
+ * and checks opening a log_writer cuts the log back to its last whole entry.
+ *
+ * @return: 0 if every partial entry was removed, -1 otherwise.
+ */
+static int check_torn_tails(const char *filename){
+    char data[LOG_ENTRY_MAX];
+    log_entry entry;
+    stress_entry(0, 0, &entry);
+    size_t length;
+    size_t time_line;
+    if (is_binary_log(filename)){
+        log_record record;
+        entry_to_record(&entry, time(NULL), &record);
+        seal_record(&record);
+        memcpy(data, &record, sizeof(record));
+        length = sizeof(record);
+        time_line = 1;
+    } else {
+        length = (size_t)format_log_entry(data, sizeof(data), &entry, time(NULL));
+        time_line = (size_t)(strchr(data, '\n') - data) + 1;
+    }
+
+    // Cut part way through a line, and for text logs just after the time line
+    size_t cuts[] = {length / 2, time_line};
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++){
+        double before = file_size(filename);
+        int fd = open(filename, O_WRONLY | O_APPEND);
+        if (fd < 0 || write(fd, data, cuts[i]) != (ssize_t)cuts[i]){
+            perror("Error writing partial entry");
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        close(fd);
+
+        log_writer *writer = malloc(sizeof(log_writer));
+        if (writer == NULL || log_writer_open(writer, filename, SYNC_EVERY_ENTRY, 1, 1000) != 0){
+            free(writer);
+            return -1;
+        }
+        log_writer_close(writer);
+        free(writer);
+        if (file_size(filename) != before){
+            printf("%s: a partial entry of %zu bytes was not removed\n", filename, cuts[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * check_repair - Appends an entry whose record is damaged and carries the largest ID
+ * there is, as one flipped bit in a high byte of the ID would leave it, and checks
+ * repairing the log leaves out just that entry.
+ *
+ * @return: 0 if every stress entry was salvaged, -1 otherwise.
+ */
+static int check_repair(const char *filename, int writers, long entries){
+    char data[LOG_ENTRY_MAX];
+    log_entry entry;
+    stress_entry(0, 0, &entry);
+    size_t length;
+    if (is_binary_log(filename)){
+        log_record record;
+        entry_to_record(&entry, time(NULL), &record);
+        record.id = INT64_MAX;
+        seal_record(&record);
+        record.blood_glucose_level += 1.0f;
+        memcpy(data, &record, sizeof(record));
+        length = sizeof(record);
+    } else {
+        length = (size_t)format_numbered_entry(data, sizeof(data), &entry, time(NULL), INT64_MAX);
+        char *reading = strstr(data, "Blood Glucose: ");
+        if (reading == NULL){
+            return -1;
+        }
+        reading[15] = reading[15] == '9' ? '8' : '9';
+    }
+    int fd = open(filename, O_WRONLY | O_APPEND);
+    if (fd < 0 || write(fd, data, length) != (ssize_t)length){
+        perror("Error writing damaged entry");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+
+    const char *repaired = is_binary_log(filename) ? "data/stress_repaired.dat" : "data/stress_repaired.txt";
+    remove(repaired);
+    if (log_repair(filename, repaired) != 0){
+        printf("%s: repair failed\n", filename);
+        return -1;
+    }
+    stress_check check = {writers, entries, calloc((size_t)writers, sizeof(long)), 0, 0, 0};
+    int status = check.next == NULL || check_stress_log(repaired, &check) != 0 ? -1 : 0;
+    free(check.next);
+    remove(repaired);
+    if (status == 0 && (check.intact != (long)writers * entries || check.damaged != 0 || check.out_of_order != 0)){
+        printf("%s: repair kept %ld intact, %ld damaged, %ld out of order entries\n", filename,
+               check.intact, check.damaged, check.out_of_order);
+        status = -1;
+    }
+    return status;
+}
+
+/**
+ * run_stress - Runs the stress test on one log.
+ */
+static int run_stress(const char *filename, int writers, long entries){
+    const char *suffixes[] = {"", ".idx", ".stats", ".rollup"};
+    for (int i = 0; i < 4; i++){
+        char name[64];
+        snprintf(name, sizeof(name), "%s%s", filename, suffixes[i]);
+        remove(name);
+    }
+
+    // Writers wait on a pipe so they all start appending together
+    int start_pipe[2];
+    if (pipe(start_pipe) != 0){
+        perror("Error creating start pipe");
+        return -1;
+    }
+    fflush(stdout);
+    int started = 0;
+    for (; started < writers; started++){
+        pid_t pid = fork();
+        if (pid < 0){
+            perror("Error starting writer");
+            break;
+        }
+        if (pid == 0){
+            close(start_pipe[1]);
+            _exit(stress_writer(filename, started, entries, start_pipe[0]) == 0 ? 0 : 1);
+        }
+    }
+    close(start_pipe[0]);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    close(start_pipe[1]);
+
+    int failed = started < writers;
+    for (int i = 0; i < started; i++){
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            failed = 1;
+        }
+    }
+    double seconds = seconds_since(&start);
+    if (failed){
+        printf("%s: a writer failed\n", filename);
+        return -1;
+    }
+
+    stress_check check = {writers, entries, calloc((size_t)writers, sizeof(long)), 0, 0, 0};
+    if (check.next == NULL || check_stress_log(filename, &check) != 0){
+        free(check.next);
+        return -1;
+    }
+    free(check.next);
+
+    glucose_summary summary;
+    rollup_summary totals;
+    time_t now = time(NULL) + 1;
+    if (glucose_stats_window(filename, 0, now, &summary) != 0 || rollup_window(filename, 0, now, &totals) != 0){
+        return -1;
+    }
+
+    long expected = (long)writers * entries;
+    printf("%s: %d writers x %ld entries in %.3f s (%.0f entries/s)\n", filename, writers, entries,
+           seconds, (double)expected / seconds);
+    printf("  %ld intact, %ld damaged, %ld out of order, %ld missing; statistics %ld readings, rollups %lld\n",
+           check.intact, check.damaged, check.out_of_order, expected - check.intact - check.out_of_order,
+           summary.readings, (long long)totals.totals.readings);
+    if (check.intact != expected || check.damaged != 0 || check.out_of_order != 0 ||
+        summary.readings != expected || totals.totals.readings != expected){
+        printf("  FAILED\n");
+        return -1;
+    }
+
+    if (check_torn_tails(filename) != 0){
+        return -1;
+    }
+    printf("  partly written entries removed on open\n");
+
+    if (check_repair(filename, writers, entries) != 0){
+        printf("  FAILED\n");
+        return -1;
+    }
+    printf("  repair left out an entry damaged with an out of range ID\n");
+    return 0;
+}
+
+int bench_stress(const char *directory, int writers, long entries){
+    if (enter_bench_directory(directory) != 0){
+        return -1;
+    }
+    if (run_stress("data/stress.txt", writers, entries) != 0 || run_stress("data/stress.dat", writers, entries) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+// The synthetic dataset every backend is loaded with
+typedef struct {
+    log_entry *entries;
+    time_t *timestamps;
+    long count;
+} storage_dataset;
+
+/**
+ * generate_dataset - Generates the entries generate_log would write, in memory.
+ */
+static int generate_dataset(storage_dataset *dataset, long count, time_t end_time){
+    log_entry settings = {0};
+    settings.carb_ratio = 10.0f;
+    settings.correction_factor = 2;
+    settings.target_blood_glucose = 6.0f;
+    strcpy(settings.unit, "mmol/L");
+
+    dataset->entries = malloc((size_t)count * sizeof(log_entry));
+    dataset->timestamps = malloc((size_t)count * sizeof(time_t));
+    dataset->count = count;
+    if (dataset->entries == NULL || dataset->timestamps == NULL){
+        printf("Error: not enough memory for %ld entries.\n", count);
+        return -1;
+    }
+
+    uint64_t state = BENCH_SEED;
+    time_t timestamp = end_time - (time_t)count * BENCH_ENTRY_SPACING;
+    for (long i = 0; i < count; i++){
+        time_t jitter = (time_t)(next_random(&state) % 120) - 60;
+        timestamp += BENCH_ENTRY_SPACING;
+        generated_entry(&state, &settings, &dataset->entries[i]);
+        dataset->timestamps[i] = i + 1 < count ? timestamp + jitter : end_time;
+    }
+    return 0;
+}
+
+/**
+ * segment_files - Adds up the sizes of a segmented log's manifest, segments and the open
+ * month's sidecars, which all start with the manifest's name, removing them if asked.
+ */
+static double segment_files(const char *filename, int remove_them){
+    const char *base = strrchr(filename, '/');
+    char directory[128] = ".";
+    if (base != NULL){
+        snprintf(directory, sizeof(directory), "%.*s", (int)(base - filename), filename);
+        base++;
+    } else {
+        base = filename;
+    }
+
+    DIR *dir = opendir(directory);
+    if (dir == NULL){
+        return 0;
+    }
+    double bytes = 0;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL){
+        if (strncmp(item->d_name, base, strlen(base)) == 0){
+            char name[512];
+            snprintf(name, sizeof(name), "%s/%s", directory, item->d_name);
+            bytes += file_size(name);
+            if (remove_them){
+                remove(name);
+            }
+        }
+    }
+    closedir(dir);
+    return bytes;
+}
+
+/**
+ * storage_file_size - Bytes a log takes on disk, with its sidecars, segments or SQLite journal.
+ */
+static double storage_file_size(const char *filename){
+    if (is_segmented_log(filename)){
+        return segment_files(filename, 0);
+    }
+    const char *suffixes[] = {"", INDEX_SUFFIX, STATS_SUFFIX, ROLLUP_SUFFIX, "-wal"};
+    double bytes = 0;
+    for (int i = 0; i < 5; i++){
+        char name[128];
+        snprintf(name, sizeof(name), "%s%s", filename, suffixes[i]);
+        bytes += file_size(name);
+    }
+    return bytes;
+}
+
+/**
+ * count_entry - storage_scan callback that counts entries and their readings.
+ */
+static int count_entry(int64_t id, time_t timestamp, const log_entry *entry, void *context){
+    long *counts = context;
+    (void)id;
+    (void)timestamp;
+    counts[0]++;
+    counts[1] += entry->blood_glucose_level_flag;
+    return 0;
+}
+
+/**
+ * bench_backend - Loads the dataset into one log and times appends, scans and aggregates.
+ *
+ * @param counts: Receives the entries and readings each scan window found.
+ */
+static int bench_backend(FILE *json, int *first, const char *filename, const storage_dataset *dataset,
+                         int runs, double *samples, long counts[][2]){
+    segment_files(filename, 1);
+    const char *suffixes[] = {"", INDEX_SUFFIX, STATS_SUFFIX, ROLLUP_SUFFIX, "-wal", "-shm"};
+    for (int i = 0; i < 6; i++){
+        char name[128];
+        snprintf(name, sizeof(name), "%s%s", filename, suffixes[i]);
+        remove(name);
+    }
+
+    storage store;
+    if (storage_open(&store, filename, SYNC_EVERY_N, IMPORT_SYNC_EVERY, 1000) != 0){
+        return -1;
+    }
+    const char *backend = store.backend->name;
+    char name[64];
+
+    // Bulk load, synced every IMPORT_SYNC_EVERY entries as imports are
+    int status = 0;
+    for (long i = 0; i < dataset->count && status == 0; i++){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = storage_append(&store, &dataset->entries[i], dataset->timestamps[i]);
+        samples[i] = seconds_since(&start);
+    }
+    if (status != 0 || storage_sync(&store) != 0 || storage_close(&store) != 0){
+        return -1;
+    }
+    double bytes = storage_file_size(filename);
+    snprintf(name, sizeof(name), "%s_append_bulk", backend);
+    report_result(json, first, name, samples, (int)dataset->count, bytes / (double)dataset->count);
+
+    // Durable single appends, as the menu logs them
+    if (storage_open(&store, filename, SYNC_EVERY_ENTRY, 1, 1000) != 0){
+        return -1;
+    }
+    time_t now = time(NULL);
+    for (int i = 0; i < BENCH_APPENDS && status == 0; i++){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = storage_append(&store, &dataset->entries[i], now);
+        samples[i] = seconds_since(&start);
+    }
+    if (status != 0){
+        storage_close(&store);
+        return -1;
+    }
+    snprintf(name, sizeof(name), "%s_append_entry", backend);
+    report_result(json, first, name, samples, BENCH_APPENDS,
+                  (storage_file_size(filename) - bytes) / BENCH_APPENDS);
+
+    const char *filters[] = {"day", "week", "month", "90 days"};
+    const char *labels[] = {"day", "week", "month", "90_days"};
+    time_t end_time = time(NULL);
+    for (int f = 0; f < 4 && status == 0; f++){
+        time_t start_time;
+        if (time_filter_start(filters[f], &start_time) != 0){
+            status = -1;
+            break;
+        }
+        // Warm up: page cache, index and sidecars
+        counts[f][0] = counts[f][1] = 0;
+        status = storage_scan(&store, start_time, end_time, count_entry, counts[f]);
+        for (int i = 0; i < runs && status == 0; i++){
+            long scanned[2] = {0, 0};
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = storage_scan(&store, start_time, end_time, count_entry, scanned);
+            samples[i] = seconds_since(&start);
+        }
+        if (status != 0){
+            break;
+        }
+        snprintf(name, sizeof(name), "%s_scan_%s", backend, labels[f]);
+        report_result(json, first, name, samples, runs, 0);
+
+        storage_summary summary;
+        status = storage_aggregate(&store, start_time, end_time, &summary);
+        for (int i = 0; i < runs && status == 0; i++){
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = storage_aggregate(&store, start_time, end_time, &summary);
+            samples[i] = seconds_since(&start);
+        }
+        if (status != 0){
+            break;
+        }
+        snprintf(name, sizeof(name), "%s_aggregate_%s", backend, labels[f]);
+        report_result(json, first, name, samples, runs, 0);
+    }
+
+    if (storage_close(&store) != 0){
+        status = -1;
+    }
+    return status;
+}
+
+int bench_storage(const char *directory, long entries, int runs, FILE *json){
+    if (enter_bench_directory(directory) != 0){
+        return -1;
+    }
+
+    storage_dataset dataset;
+    if (generate_dataset(&dataset, entries, time(NULL) - 3600) != 0){
+        free(dataset.entries);
+        free(dataset.timestamps);
+        return -1;
+    }
+    long sample_count = entries > runs ? entries : runs;
+    if (sample_count < BENCH_APPENDS) sample_count = BENCH_APPENDS;
+    double *samples = malloc((size_t)sample_count * sizeof(double));
+    if (samples == NULL){
+        printf("Error: not enough memory for benchmark samples.\n");
+        free(dataset.entries);
+        free(dataset.timestamps);
+        return -1;
+    }
+
+    fprintf(json, "{\n  \"suite\": \"storage\",\n  \"entries\": %ld,\n  \"runs\": %d,\n  \"results\": [",
+            entries, runs);
+
+    const char *logs[] = {"data/storage.txt", "data/storage.dat", "data/storage.db", "data/storage.seg"};
+    long counts[4][4][2];
+    int first = 1;
+    int status = 0;
+    for (int i = 0; i < 4 && status == 0; i++){
+        status = bench_backend(json, &first, logs[i], &dataset, runs, samples, counts[i]);
+    }
+    fprintf(json, "\n  ]\n}\n");
+
+    // Every backend must find the same entries in every window
+    for (int i = 1; i < 4 && status == 0; i++){
+        for (int f = 0; f < 4; f++){
+            if (counts[i][f][0] != counts[0][f][0] || counts[i][f][1] != counts[0][f][1]){
+                fprintf(stderr, "%s found %ld entries (%ld readings) where %s found %ld (%ld) in window %d\n",
+                        logs[i], counts[i][f][0], counts[i][f][1], logs[0], counts[0][f][0], counts[0][f][1], f);
+                status = -1;
+            }
+        }
+    }
+    if (status == 0){
+        fprintf(stderr, "All backends found the same entries in every window.\n");
+    }
+
+    free(samples);
+    free(dataset.entries);
+    free(dataset.timestamps);
+    return status;
+}
+
+// Words generated food names are made of, and text searched for in them
+static const char *const bench_food_words[] = {
+    "apple", "banana", "bread", "rice", "pasta", "chicken", "beef", "milk", "cheese", "yogurt",
+    "orange", "grape", "potato", "tomato", "carrot", "corn", "oats", "wheat", "lentils", "beans",
+    "almonds", "honey", "chocolate", "cookie", "muffin", "bagel", "tortilla", "noodles", "soup", "pizza",
+    "cereal", "granola", "crackers", "juice", "salmon", "turkey", "mango", "pineapple", "peach", "strawberry",
+};
+static const char *const bench_food_styles[] = {
+    "raw", "cooked", "boiled", "fried", "baked", "roasted", "dried", "canned", "frozen", "whole",
+    "sliced", "mashed", "low fat", "sweetened", "unsweetened", "with skin", "plain", "enriched",
+};
+static const char *const bench_food_queries[][2] = {
+    {"prefix", "straw"},
+    {"prefix", "choc"},
+    {"words", "bread whole"},
+    {"words", "chicken roast"},
+    {"misspelled", "chiken"},
+    {"misspelled", "strawbery"},
+};
+
+/**
+ * generate_foods - Writes a deterministic CSV file of foods in --build-foods format.
+ *
+ * @return: 0 for success, -1 for errors.
+ */
+static int generate_foods(const char *filename, long count){
+    FILE *file = fopen(filename, "w");
+    if (file == NULL){
+        perror("Error creating food file");
+        return -1;
+    }
+    size_t word_count = sizeof(bench_food_words) / sizeof(bench_food_words[0]);
+    size_t style_count = sizeof(bench_food_styles) / sizeof(bench_food_styles[0]);
+    uint64_t state = BENCH_SEED;
+    fprintf(file, "name,carbs,portion_grams,portion\n");
+    for (long i = 0; i < count; i++){
+        const char *food = bench_food_words[next_random(&state) % word_count];
+        const char *style = bench_food_styles[next_random(&state) % style_count];
+        const char *with = bench_food_words[next_random(&state) % word_count];
+        fprintf(file, "\"%c%s, %s, with %s, recipe %ld\",%.1f,%d,1 serving\n", food[0] - 'a' + 'A', food + 1,
+                style, with, i, random_between(&state, 0, 90), 50 + (int)(next_random(&state) % 200));
+    }
+    if (fclose(file) != 0){
+        perror("Error writing food file");
+        return -1;
+    }
+    return 0;
+}
+
+int bench_foods(const char *directory, long foods, int runs, FILE *json){
+    if (enter_bench_directory(directory) != 0 || generate_foods("data/foods.csv", foods) != 0){
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int saved = silence_stdout();
+    int status = food_table_build("data/foods.csv", "data/foods.tbl");
+    restore_stdout(saved);
+    double build_seconds = seconds_since(&start);
+    if (status != 0){
+        return -1;
+    }
+
+    double *samples = malloc((size_t)runs * sizeof(double));
+    if (samples == NULL){
+        printf("Error: not enough memory for benchmark samples.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Built a table of %ld foods in %.3f s\n", foods, build_seconds);
+    fprintf(json, "{\n  \"suite\": \"foods\",\n  \"foods\": %ld,\n  \"runs\": %d,\n"
+                  "  \"build_seconds\": %.6f,\n  \"table_bytes\": %.0f,\n  \"results\": [",
+            foods, runs, build_seconds, file_size("data/foods.tbl"));
+
+    // Opening maps the table and checks its header; nothing is parsed
+    int first = 1;
+    food_table table;
+    for (int run = 0; run < runs && status == 0; run++){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = food_table_open(&table, "data/foods.tbl");
+        samples[run] = seconds_since(&start);
+        if (status == 0){
+            food_table_close(&table);
+        }
+    }
+    if (status == 0){
+        report_result(json, &first, "open", samples, runs, 0);
+        status = food_table_open(&table, "data/foods.tbl");
+    }
+
+    // Each kind of search is timed over its queries in turn
+    size_t query_count = sizeof(bench_food_queries) / sizeof(bench_food_queries[0]);
+    for (size_t q = 0; q < query_count && status == 0; q += 2){
+        food_match matches[FOOD_MATCHES_MAX];
+        int found = 0;
+        for (int run = 0; run < runs; run++){
+            const char *query = bench_food_queries[q + run % 2][1];
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            found += food_search(&table, query, matches, FOOD_MATCHES_MAX);
+            samples[run] = seconds_since(&start);
+        }
+        if (found == 0){
+            fprintf(stderr, "No foods found for the %s searches\n", bench_food_queries[q][0]);
+            status = -1;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "search_%s", bench_food_queries[q][0]);
+        report_result(json, &first, name, samples, runs, 0);
+    }
+    if (status == 0){
+        food_table_close(&table);
+    }
+    fprintf(json, "\n  ]\n}\n");
+    free(samples);
+    return status;
+}
+
+void print_usage(const char *program){
+    printf("Usage: %s kernels [COUNT]\n", program);
+    printf("       %s generate COUNT FILE [END_TIME]\n", program);
+    printf("       %s suite [--entries N] [--runs N] [--dir DIRECTORY] [--json FILE]\n", program);
+    printf("       %s pipeline [--sources N] [--rows N] [--dir DIRECTORY]\n", program);
+    printf("       %s scan [--entries N] [--threads N] [--dir DIRECTORY]\n", program);
+    printf("       %s stress [--writers N] [--entries N] [--dir DIRECTORY]\n", program);
+    printf("       %s storage [--entries N] [--runs N] [--dir DIRECTORY] [--json FILE]\n", program);
+    printf("       %s foods [--foods N] [--runs N] [--dir DIRECTORY] [--json FILE]\n", program);
+    printf("\nkernels:  times the scalar dosage calculations against the batch kernels\n");
+    printf("          on COUNT readings (default %d) and checks the results are identical, and\n", BENCH_KERNEL_COUNT);
+    printf("          that imported mg/dL rows get the same doses as mmol/L rows.\n");
+    printf("generate: writes a deterministic text log of COUNT entries ending at END_TIME\n");
+    printf("          (seconds since the epoch, default now).\n");
+    printf("suite:    times read_logs for each time filter, the month and 90 day statistics,\n");
+    printf("          read_config, update_config and\n");
+    printf("          appends on a generated log of N entries (default %d), %d runs each,\n",
+           BENCH_SUITE_ENTRIES, BENCH_SUITE_RUNS);
+    printf("          inside DIRECTORY (default %s). Results are written as JSON to FILE or stdout.\n",
+           BENCH_SUITE_DIR);
+    printf("pipeline: imports N device exports (default %d) of N rows each (default %d) with\n",
+           BENCH_PIPELINE_SOURCES, BENCH_PIPELINE_ROWS);
+    printf("          import_csv one after another, then through the ingest pipeline, and\n");
+    printf("          prints throughput and queue depths. Runs inside DIRECTORY like suite.\n");
+    printf("scan:     times an all-history query of a generated log of N entries (default %d),\n",
+           BENCH_SCAN_ENTRIES);
+    printf("          text and binary, on 1, 2, 4, ... up to N threads (default %d) and checks\n",
+           QUERY_MAX_THREADS);
+    printf("          the outputs are identical. Runs inside DIRECTORY like suite.\n");
+    printf("stress:   appends N entries (default %d) from each of N processes (default %d) to\n",
+           BENCH_STRESS_ENTRIES, BENCH_STRESS_WRITERS);
+    printf("          one text and one binary log at once, checks every entry landed whole and\n");
+    printf("          in order, that partly written entries are removed when a log is opened and\n");
+    printf("          that repair salvages the log around an entry damaged in its ID.\n");
+    printf("          Runs inside DIRECTORY like suite.\n");
+    printf("storage:  loads the same N generated entries (default %d) into a text, a binary,\n",
+           BENCH_STORAGE_ENTRIES);
+    printf("          a SQLite and a segmented log, then times bulk and durable appends and N runs\n");
+    printf("          (default %d) of range scans and aggregates on each. Runs inside DIRECTORY\n",
+           BENCH_STORAGE_RUNS);
+    printf("          like suite and writes JSON to FILE or stdout.\n");
+    printf("foods:    compiles a generated CSV file of N foods (default %d) into a food table,\n",
+           BENCH_FOODS);
+    printf("          then times N runs (default %d) of opening it and of prefix, several word and\n",
+           BENCH_FOOD_RUNS);
+    printf("          misspelled searches. Runs inside DIRECTORY like suite and writes JSON to FILE\n");
+    printf("          or stdout.\n");
+}
+
+/**
+ * parse_count - Parses a positive count argument.
+ *
+ * @return: The count, or -1 if the text is not a positive number.
+ */
+static long long parse_count(const char *text){
+    char *end;
+    long long parsed = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || parsed <= 0){
+        return -1;
+    }
+    return parsed;
+}
+
+int main(int argc, char *argv[]){
+    if (argc >= 2 && argc <= 3 && strcmp(argv[1], "kernels") == 0){
+        long long count = argc == 3 ? parse_count(argv[2]) : BENCH_KERNEL_COUNT;
+        if (count < 0){
+            print_usage(argv[0]);
+            return 1;
+        }
+        return bench_kernels((size_t)count) == 0 ? 0 : 1;
+    }
+
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "generate") == 0){
+        long long count = parse_count(argv[2]);
+        long long end_time = argc == 5 ? parse_count(argv[4]) : (long long)time(NULL) - 60;
+        if (count < 0 || end_time < 0){
+            print_usage(argv[0]);
+            return 1;
+        }
+        long bytes = generate_log(argv[3], (long)count, (time_t)end_time);
+        if (bytes < 0){
+            return 1;
+        }
+        printf("Generated %lld entries (%ld bytes) in %s\n", count, bytes, argv[3]);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "suite") == 0){
+        long long entries = BENCH_SUITE_ENTRIES;
+        long long runs = BENCH_SUITE_RUNS;
+        const char *directory = BENCH_SUITE_DIR;
+        const char *json_filename = NULL;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc && (entries = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc && (runs = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+                json_filename = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        // Opened before entering the benchmark directory so relative names work as expected
+        FILE *json = stdout;
+        if (json_filename != NULL && (json = fopen(json_filename, "w")) == NULL){
+            perror("Error opening JSON output");
+            return 1;
+        }
+        int status = bench_suite(directory, (long)entries, (int)runs, json);
+        if (json != stdout && fclose(json) != 0){
+            status = -1;
+        }
+        return status == 0 ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "pipeline") == 0){
+        long long sources = BENCH_PIPELINE_SOURCES;
+        long long rows = BENCH_PIPELINE_ROWS;
+        const char *directory = BENCH_SUITE_DIR;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--sources") == 0 && i + 1 < argc && (sources = parse_count(argv[i + 1])) > 0 &&
+                sources <= PIPELINE_MAX_SOURCES){
+                i++;
+            } else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc && (rows = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        return bench_pipeline(directory, (int)sources, (long)rows) == 0 ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "scan") == 0){
+        long long entries = BENCH_SCAN_ENTRIES;
+        long long threads = QUERY_MAX_THREADS;
+        const char *directory = BENCH_SUITE_DIR;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc && (entries = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && (threads = parse_count(argv[i + 1])) > 0 &&
+                       threads <= QUERY_MAX_THREADS){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        return bench_scan(directory, (long)entries, (int)threads) == 0 ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "stress") == 0){
+        long long writers = BENCH_STRESS_WRITERS;
+        long long entries = BENCH_STRESS_ENTRIES;
+        const char *directory = BENCH_SUITE_DIR;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--writers") == 0 && i + 1 < argc && (writers = parse_count(argv[i + 1])) > 0 &&
+                writers <= 1000){
+                i++;
+            } else if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc && (entries = parse_count(argv[i + 1])) > 0 &&
+                       entries <= 1000000){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        return bench_stress(directory, (int)writers, (long)entries) == 0 ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "storage") == 0){
+        long long entries = BENCH_STORAGE_ENTRIES;
+        long long runs = BENCH_STORAGE_RUNS;
+        const char *directory = BENCH_SUITE_DIR;
+        const char *json_filename = NULL;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc && (entries = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc && (runs = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+                json_filename = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        FILE *json = stdout;
+        if (json_filename != NULL && (json = fopen(json_filename, "w")) == NULL){
+            perror("Error opening JSON output");
+            return 1;
+        }
+        int status = bench_storage(directory, (long)entries, (int)runs, json);
+        if (json != stdout && fclose(json) != 0){
+            status = -1;
+        }
+        return status == 0 ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "foods") == 0){
+        long long foods = BENCH_FOODS;
+        long long runs = BENCH_FOOD_RUNS;
+        const char *directory = BENCH_SUITE_DIR;
+        const char *json_filename = NULL;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--foods") == 0 && i + 1 < argc && (foods = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc && (runs = parse_count(argv[i + 1])) > 0){
+                i++;
+            } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+                directory = argv[++i];
+            } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+                json_filename = argv[++i];
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        FILE *json = stdout;
+        if (json_filename != NULL && (json = fopen(json_filename, "w")) == NULL){
+            perror("Error opening JSON output");
+            return 1;
+        }
+        int status = bench_foods(directory, (long)foods, (int)runs, json);
+        if (json != stdout && fclose(json) != 0){
+            status = -1;
+        }
+        return status == 0 ? 0 : 1;
+    }
+
+    print_usage(argv[0]);
+    return 1;
+}
@@ -1,13 +1,10 @@
 #include <stdio.h>
 #include "calculations.h"
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include "logging.h"
 
-// Target Blood Glucose Range in mmol/L
-#define lower_target 4.0
-#define upper_target 8.0
-
 
 float convert_to_mmol_L(float blood_glucose, const char *unit){
 
@@ -43,7 +40,16 @@ float correction_dosage_calculation(log_entry *entry, int insulin_sensitivity_fa
     }
     
     // Correction dosage formula for high blood glucose
-    return ((blood_glucose_level - target_blood_glucose) / insulin_sensitivity_factor);
+    float correction = (blood_glucose_level - target_blood_glucose) / insulin_sensitivity_factor;
+
+    // Insulin still acting from earlier doses will bring the level down too
+    if (entry->insulin_on_board_flag){
+        correction -= entry->insulin_on_board;
+        if (correction < 0){
+            correction = 0.0;
+        }
+    }
+    return correction;
 }
 
 
@@ -56,3 +62,187 @@ float total_dosage(log_entry *entry,float carb_amount, float carb_ratio,
     //Rounds total dosage to nearest 0.5 units
     return round((meal_dosage + correction_dosage) * 2) / 2;
 }
+
+
+void calculate_dosages(log_entry *entry) {
+    
+    // Calculates only correction dose if applicable
+    if (entry->blood_glucose_level_flag && entry->target_blood_glucose_flag) {
+        entry->correction_dosage = correction_dosage_calculation(
+            entry,
+            entry->correction_factor,
+            entry->blood_glucose_level,
+            entry->target_blood_glucose
+        );
+        entry->correction_dosage_flag = 1; // Set flag
+        entry->insulin_dosage = round(entry->correction_dosage * 2)/2;
+        entry->insulin_dosage_flag = 1;
+    } else {
+        entry->correction_dosage_flag = 0; // Unset flag
+        entry->insulin_dosage_flag = 0;
+    }
+    // Calculates total insulin dose for meals and snacks
+    if (entry->meal_time_carbs_flag) {
+        entry->insulin_dosage = total_dosage(
+            entry,
+            entry->meal_time_carbs,
+            entry->carb_ratio,
+            entry->correction_factor,
+            entry->blood_glucose_level,
+            entry->target_blood_glucose
+        );
+        entry->insulin_dosage_flag = 1; // Set flag
+    } else {
+        if (strcmp(entry->entry_type,"correction") != 0)
+            entry->insulin_dosage_flag = 0; // Unset flag
+    }
+}
+
+
+/**
+ * select_float - Returns if_true when condition is set, otherwise if_false, using bit masks.
+ * Both values are always computed, so loops using it have no branches even when
+ * the compiler must assume floating point operations can trap.
+ */
+static inline float select_float(int condition, float if_true, float if_false){
+    uint32_t true_bits, false_bits;
+    memcpy(&true_bits, &if_true, sizeof(true_bits));
+    memcpy(&false_bits, &if_false, sizeof(false_bits));
+    uint32_t mask = 0u - (uint32_t)(condition != 0);
+    uint32_t bits = (true_bits & mask) | (false_bits & ~mask);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/**
+ * mmol_L_from - Converts one blood glucose value to mmol/L the same way convert_to_mmol_L does.
+ */
+static inline float mmol_L_from(float blood_glucose, int mg_dl){
+    return mg_dl ? (float)(blood_glucose / 18.018) : blood_glucose;
+}
+
+/**
+ * correction_kernel - correction_dosage_calculation for a value already in mmol/L, without branches.
+ */
+static inline float correction_kernel(float blood_glucose_level, float target_blood_glucose, float insulin_sensitivity_factor){
+    float correction = (blood_glucose_level - target_blood_glucose) / insulin_sensitivity_factor;
+    // Same tests as the scalar version, so NaN readings give the same result.
+    int in_range = isgreaterequal(blood_glucose_level, (float)lower_target) &
+                   islessequal(blood_glucose_level, (float)upper_target);
+    int below = isless(blood_glucose_level, (float)lower_target);
+    return select_float(in_range | below, 0.0f, correction);
+}
+
+/**
+ * take_off_board - Takes insulin on board off a correction, never going below zero, as
+ * correction_dosage_calculation does for entries that have it, without branches.
+ */
+static inline float take_off_board(float correction, float insulin_on_board, int has_insulin_on_board){
+    float reduced = correction - insulin_on_board;
+    reduced = select_float(isless(reduced, 0.0f), 0.0f, reduced);
+    return select_float(has_insulin_on_board, reduced, correction);
+}
+
+/**
+ * round_half_units - round(dosage * 2) / 2 without calling round.
+ * round rounds halfway cases away from zero, which the SIMD rounding modes do
+ * not, so the whole part is found by adding and removing 2^23 (which rounds to
+ * a whole number), stepping back if that rounded up, and the remaining fraction
+ * is compared to 0.5. Floats of 2^23 and above are already whole numbers.
+ */
+static inline float round_half_units(float dosage){
+    float doubled = dosage * 2;
+    float magnitude = fabsf(doubled);
+    float nearest = (magnitude + 8388608.0f) - 8388608.0f;
+    float whole = select_float(isgreater(nearest, magnitude), nearest - 1.0f, nearest);
+    float rounded = select_float(isgreaterequal(magnitude - whole, 0.5f), whole + 1.0f, whole);
+    rounded = select_float(isless(magnitude, 8388608.0f), rounded, magnitude);
+    return copysignf(rounded, doubled) * 0.5f;
+}
+
+void convert_to_mmol_L_batch(const float *restrict blood_glucose, float *restrict out, size_t count, glucose_unit unit){
+    if (unit == UNIT_MG_DL){
+        for (size_t i = 0; i < count; i++){
+            out[i] = mmol_L_from(blood_glucose[i], 1);
+        }
+    } else {
+        memcpy(out, blood_glucose, count * sizeof(float));
+    }
+}
+
+void convert_to_preferred_unit_batch(const float *restrict blood_glucose, float *restrict out, size_t count, glucose_unit unit){
+    if (unit == UNIT_MG_DL){
+        for (size_t i = 0; i < count; i++){
+            out[i] = (float)(blood_glucose[i] * 18.018);
+        }
+    } else {
+        memcpy(out, blood_glucose, count * sizeof(float));
+    }
+}
+
+void meal_dosage_batch(const float *restrict carb_amount, float carb_ratio, float *restrict out, size_t count){
+    for (size_t i = 0; i < count; i++){
+        out[i] = carb_amount[i] / carb_ratio;
+    }
+}
+
+void correction_dosage_batch(const float *restrict blood_glucose, const float *restrict target_blood_glucose,
+                             int insulin_sensitivity_factor, float *restrict out, size_t count, glucose_unit unit){
+    float factor = (float)insulin_sensitivity_factor;
+    // The unit test is hoisted so each loop body is straight-line code
+    if (unit == UNIT_MG_DL){
+        for (size_t i = 0; i < count; i++){
+            out[i] = correction_kernel(mmol_L_from(blood_glucose[i], 1), target_blood_glucose[i], factor);
+        }
+    } else {
+        for (size_t i = 0; i < count; i++){
+            out[i] = correction_kernel(blood_glucose[i], target_blood_glucose[i], factor);
+        }
+    }
+}
+
+void total_dosage_batch(const float *restrict carb_amount, const float *restrict blood_glucose,
+                        const float *restrict target_blood_glucose, float carb_ratio,
+                        int insulin_sensitivity_factor, float *restrict out, size_t count, glucose_unit unit){
+    float factor = (float)insulin_sensitivity_factor;
+    if (unit == UNIT_MG_DL){
+        for (size_t i = 0; i < count; i++){
+            float correction = correction_kernel(mmol_L_from(blood_glucose[i], 1), target_blood_glucose[i], factor);
+            out[i] = round_half_units(carb_amount[i] / carb_ratio + correction);
+        }
+    } else {
+        for (size_t i = 0; i < count; i++){
+            float correction = correction_kernel(blood_glucose[i], target_blood_glucose[i], factor);
+            out[i] = round_half_units(carb_amount[i] / carb_ratio + correction);
+        }
+    }
+}
+
+void total_dosage_on_board_batch(const float *restrict carb_amount, const float *restrict blood_glucose,
+                                 const float *restrict target_blood_glucose,
+                                 const float *restrict insulin_on_board,
+                                 const unsigned char *restrict has_insulin_on_board, float carb_ratio,
+                                 int insulin_sensitivity_factor, float *restrict out, size_t count,
+                                 glucose_unit unit){
+    float factor = (float)insulin_sensitivity_factor;
+    if (unit == UNIT_MG_DL){
+        for (size_t i = 0; i < count; i++){
+            float correction = correction_kernel(mmol_L_from(blood_glucose[i], 1), target_blood_glucose[i], factor);
+            correction = take_off_board(correction, insulin_on_board[i], has_insulin_on_board[i] != 0);
+            out[i] = round_half_units(carb_amount[i] / carb_ratio + correction);
+        }
+    } else {
+        for (size_t i = 0; i < count; i++){
+            float correction = correction_kernel(blood_glucose[i], target_blood_glucose[i], factor);
+            correction = take_off_board(correction, insulin_on_board[i], has_insulin_on_board[i] != 0);
+            out[i] = round_half_units(carb_amount[i] / carb_ratio + correction);
+        }
+    }
+}
+
+void round_half_units_batch(const float *dosage, float *out, size_t count){
+    for (size_t i = 0; i < count; i++){
+        out[i] = round_half_units(dosage[i]);
+    }
+}
@@ -1,6 +1,12 @@
 #ifndef CALCULATIONS_H
 #define CALCULATIONS_H
+#include <stddef.h>
 #include "logging.h"
+#include "config.h"
+
+// Target Blood Glucose Range in mmol/L
+#define lower_target 4.0
+#define upper_target 8.0
 
 /** 
  * convert_to_mmol_L - converts given blood glucose value from the user's unit to mmol/L.
@@ -37,7 +43,7 @@ float meal_dosage_calculation(float carb_amount, float carb_ratio);
 /**
  * correction_dosage_calculation - Calculates the correction dosage using user's
  * insulin sensitivity factor (ISF), current blood glucose level, and target blood glucose 
- * level.
+ * level. Insulin on board, when the entry has it, is taken off; the result is never negative.
  * 
  * @param entry: The log entry storing user data and untis. 
  * @param insulin_sensitivity_factor: The ISF in mmol/L per unit of insulin.
@@ -64,4 +70,113 @@ float total_dosage(log_entry *entry,float carb_amount, float carb_ratio,
                    int insulin_sensitivity_factor, float blood_glucose_level, 
                    float target_blood_glucose);
 
+
+/**
+ * calculate_dosages - Calculates insulin dosage based on the log entry type.
+ * 
+ * @param entry: Pointer to log_entry struct containing data for calculations.
+ */
+void calculate_dosages(log_entry *entry);
+
+
+/*
+ * Batch kernels
+ *
+ * The *_batch functions apply the scalar calculations above to arrays of values
+ * (one array per field) with the unit resolved once, and give bit for bit the
+ * same results. Their loops have no branches or calls so the compiler can
+ * vectorise them (e.g. with -O3). Output arrays may not overlap the inputs.
+ * Only total_dosage_on_board_batch takes insulin on board; the others give
+ * the results for entries without it.
+ */
+
+/**
+ * convert_to_mmol_L_batch - Converts blood glucose values from a unit to mmol/L, as convert_to_mmol_L.
+ *
+ * @param blood_glucose: Blood glucose values in unit.
+ * @param out: Receives the values in mmol/L.
+ * @param count: Number of values.
+ * @param unit: The unit of the input values.
+ */
+void convert_to_mmol_L_batch(const float *blood_glucose, float *out, size_t count, glucose_unit unit);
+
+/**
+ * convert_to_preferred_unit_batch - Converts blood glucose values from mmol/L to a unit, as convert_to_preferred_unit.
+ *
+ * @param blood_glucose: Blood glucose values in mmol/L.
+ * @param out: Receives the values in unit.
+ * @param count: Number of values.
+ * @param unit: The unit to convert to.
+ */
+void convert_to_preferred_unit_batch(const float *blood_glucose, float *out, size_t count, glucose_unit unit);
+
+/**
+ * meal_dosage_batch - Calculates meal dosages, as meal_dosage_calculation.
+ *
+ * @param carb_amount: Carbs in grams for each meal.
+ * @param carb_ratio: The carb to insulin ratio in grams/unit.
+ * @param out: Receives the meal dosages.
+ * @param count: Number of meals.
+ */
+void meal_dosage_batch(const float *carb_amount, float carb_ratio, float *out, size_t count);
+
+/**
+ * correction_dosage_batch - Calculates correction dosages, as correction_dosage_calculation.
+ *
+ * @param blood_glucose: Blood glucose levels in unit.
+ * @param target_blood_glucose: Target blood glucose levels in mmol/L.
+ * @param insulin_sensitivity_factor: The ISF in mmol/L per unit of insulin.
+ * @param out: Receives the correction dosages.
+ * @param count: Number of entries.
+ * @param unit: The unit of the blood glucose levels.
+ */
+void correction_dosage_batch(const float *blood_glucose, const float *target_blood_glucose,
+                             int insulin_sensitivity_factor, float *out, size_t count, glucose_unit unit);
+
+/**
+ * total_dosage_batch - Calculates total dosages rounded to the nearest 0.5 units, as total_dosage.
+ *
+ * @param carb_amount: Carbs in grams for each entry.
+ * @param blood_glucose: Blood glucose levels in unit.
+ * @param target_blood_glucose: Target blood glucose levels in mmol/L.
+ * @param carb_ratio: The carb to insulin ratio in grams/unit.
+ * @param insulin_sensitivity_factor: The ISF in mmol/L per unit of insulin.
+ * @param out: Receives the total dosages.
+ * @param count: Number of entries.
+ * @param unit: The unit of the blood glucose levels.
+ */
+void total_dosage_batch(const float *carb_amount, const float *blood_glucose, const float *target_blood_glucose,
+                        float carb_ratio, int insulin_sensitivity_factor, float *out, size_t count,
+                        glucose_unit unit);
+
+/**
+ * total_dosage_on_board_batch - Calculates total dosages like total_dosage_batch, taking
+ * insulin on board off the corrections of the entries that have it, as total_dosage does.
+ *
+ * @param carb_amount: Carbs in grams for each entry.
+ * @param blood_glucose: Blood glucose levels in unit.
+ * @param target_blood_glucose: Target blood glucose levels in mmol/L.
+ * @param insulin_on_board: Insulin on board in units for each entry.
+ * @param has_insulin_on_board: Non-zero for the entries that have insulin on board.
+ * @param carb_ratio: The carb to insulin ratio in grams/unit.
+ * @param insulin_sensitivity_factor: The ISF in mmol/L per unit of insulin.
+ * @param out: Receives the total dosages.
+ * @param count: Number of entries.
+ * @param unit: The unit of the blood glucose levels.
+ */
+void total_dosage_on_board_batch(const float *carb_amount, const float *blood_glucose,
+                                 const float *target_blood_glucose, const float *insulin_on_board,
+                                 const unsigned char *has_insulin_on_board, float carb_ratio,
+                                 int insulin_sensitivity_factor, float *out, size_t count,
+                                 glucose_unit unit);
+
+/**
+ * round_half_units_batch - Rounds dosages to the nearest 0.5 units, as round(dosage * 2) / 2.
+ *
+ * @param dosage: Dosages to round.
+ * @param out: Receives the rounded dosages; may be the same array as dosage.
+ * @param count: Number of dosages.
+ */
+void round_half_units_batch(const float *dosage, float *out, size_t count);
+
 #endif
@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include "config.h"
+#include "instrument.h"
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
 //list config just shows the units, ratio, isf
 //read config for getting the units, ratio, isf 
@@ -31,18 +34,31 @@ char *trimwhitespace(char *str)
 }
 
 
-const char* read_config(const char *key) {
+// Cached copy of config.txt, reloaded when the file's modification time changes
+static config_item config_items[CONFIG_MAX_ITEMS];
+static int config_count = 0;
+static int config_loaded = 0;
+static struct timespec config_mtime;
+static off_t config_size;
 
-    static char value[50];
-    
-    FILE *file = fopen("config.txt", "r");
+/**
+ * load_config - Parses config.txt into the cached table.
+ * 
+ * @param file_stat: Result of stat() on the file, recorded to detect changes.
+ * @return: 0 on success, -1 if the file cannot be opened.
+ */
+static int load_config(const struct stat *file_stat) {
+    uint64_t start = probe_begin();
+    FILE *file = fopen(CONFIG_FILE, "r");
 
     if (file == NULL) {
         perror("Error opening file");
-        return NULL;
+        probe_end(PROBE_CONFIG_LOAD, start, 0);
+        return -1;
     }
 
-    char buffer[50]; 
+    config_count = 0;
+    char buffer[CONFIG_LINE_SIZE]; 
     while (fgets(buffer, sizeof(buffer), file) != NULL) {
         buffer[strcspn(buffer, "\n")] = '\0';  // remove newline character
 
@@ -51,24 +67,123 @@ const char* read_config(const char *key) {
         char *parsed_value = strtok(NULL, "=");
 
         if (parsed_key != NULL && parsed_value != NULL) {
-            parsed_key = trimwhitespace(parsed_key);
-            parsed_value = trimwhitespace(parsed_value);
-            
-            // Compare the keys
-            if (strcmp(key, parsed_key) == 0) {
-                fclose(file);
-                strncpy(value, parsed_value, sizeof(value) - 1); 
-                value[sizeof(value) - 1] = '\0';
-                return value;  // Return the parsed value
+            if (config_count == CONFIG_MAX_ITEMS) {
+                printf("Warning: too many keys in %s, ignoring the rest.\n", CONFIG_FILE);
+                break;
             }
+            config_item *item = &config_items[config_count++];
+            snprintf(item->key, sizeof(item->key), "%s", trimwhitespace(parsed_key));
+            snprintf(item->value, sizeof(item->value), "%s", trimwhitespace(parsed_value));
         }
     }
 
     fclose(file);
-    return NULL; // If key not found, return NULL
+    config_mtime = file_stat->st_mtim;
+    config_size = file_stat->st_size;
+    config_loaded = 1;
+    probe_end(PROBE_CONFIG_LOAD, start, (uint64_t)file_stat->st_size);
+    return 0;
+}
+
+/**
+ * refresh_config - Makes sure the cached table matches config.txt on disk.
+ * 
+ * @return: 0 on success, -1 if the file cannot be read.
+ */
+static int refresh_config(void) {
+    struct stat file_stat;
+    if (stat(CONFIG_FILE, &file_stat) != 0) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    if (config_loaded &&
+        file_stat.st_mtim.tv_sec == config_mtime.tv_sec &&
+        file_stat.st_mtim.tv_nsec == config_mtime.tv_nsec &&
+        file_stat.st_size == config_size) {
+        return 0; // Unchanged since the last load
+    }
+
+    return load_config(&file_stat);
+}
+
+/**
+ * find_config_item - Looks up a key in the cached table.
+ * 
+ * @return: The cached item, or NULL if the key is not present.
+ */
+static config_item *find_config_item(const char *key) {
+    for (int i = 0; i < config_count; i++) {
+        if (strcmp(key, config_items[i].key) == 0) {
+            return &config_items[i];
+        }
+    }
+    return NULL;
+}
+
+const char* read_config(const char *key) {
+    uint64_t start = probe_begin();
+    if (refresh_config() != 0) {
+        probe_end(PROBE_CONFIG_READ, start, 0);
+        return NULL;
+    }
+
+    config_item *item = find_config_item(key);
+    probe_end(PROBE_CONFIG_READ, start, 0);
+    return item != NULL ? item->value : NULL; // If key not found, return NULL
+}
+
+int config_get_float(const char *key, float *value) {
+    const char *text = read_config(key);
+    if (text == NULL) {
+        return -1;
+    }
+
+    char *end;
+    float parsed = strtof(text, &end);
+    if (end == text) {
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+int config_get_int(const char *key, int *value) {
+    const char *text = read_config(key);
+    if (text == NULL) {
+        return -1;
+    }
+
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (end == text) {
+        return -1;
+    }
+    *value = (int)parsed;
+    return 0;
+}
+
+int config_get_unit(glucose_unit *unit) {
+    const char *text = read_config("blood glucose unit");
+    if (text == NULL) {
+        return -1;
+    }
+
+    if (strcmp(text, "mmol/L") == 0) {
+        *unit = UNIT_MMOL_L;
+    } else if (strcmp(text, "mg/dL") == 0) {
+        *unit = UNIT_MG_DL;
+    } else {
+        return -1;
+    }
+    return 0;
 }
 
 int list_config(const char *filename){
+    return print_config(stdout, filename);
+}
+
+int print_config(FILE *out, const char *filename){
 
     FILE *file = fopen(filename,"r");
     char buffer[100];
@@ -79,7 +194,7 @@ int list_config(const char *filename){
     }
 
     while (fgets(buffer, sizeof(buffer), file) != NULL){
-        printf("%s",buffer);
+        fprintf(out, "%s",buffer);
     }
 
     fclose(file);
@@ -87,8 +202,11 @@ int list_config(const char *filename){
 
 }
 
-int update_config(const char *filename, const char *key, const char *new_value){
-    
+/**
+ * rewrite_config - Writes a copy of the file with the key's new value and puts it in
+ * place; see update_config.
+ */
+static int rewrite_config(const char *filename, const char *key, const char *new_value){
     FILE *file = fopen(filename,"r");
     if (file == NULL){
         perror("Error opening original file");
@@ -97,7 +215,7 @@ int update_config(const char *filename, const char *key, const char *new_value){
 
     //Open a temporary file
     FILE *temp_file = fopen("temp_config.txt","w");
-    if (file == NULL){
+    if (temp_file == NULL){
         perror("Error opening temporary file");
         fclose(file);
         return -1;
@@ -153,7 +271,25 @@ int update_config(const char *filename, const char *key, const char *new_value){
         return -1;
     }
 
-
+    // Keep the cached table in step without parsing the file again
+    if (strcmp(filename, CONFIG_FILE) == 0 && config_loaded) {
+        struct stat file_stat;
+        config_item *item = find_config_item(key);
+        if (item != NULL && stat(filename, &file_stat) == 0) {
+            snprintf(item->value, sizeof(item->value), "%s", new_value);
+            config_mtime = file_stat.st_mtim;
+            config_size = file_stat.st_size;
+        } else {
+            config_loaded = 0; // Reload on next access
+        }
+    }
     return 0;
 }
 
+int update_config(const char *filename, const char *key, const char *new_value){
+    uint64_t start = probe_begin();
+    int status = rewrite_config(filename, key, new_value);
+    probe_end(PROBE_CONFIG_UPDATE, start, 0);
+    return status;
+}
+
@@ -1,6 +1,26 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdio.h>
+
+// Configuration file read by read_config and the typed accessors
+#define CONFIG_FILE "config.txt"
+
+#define CONFIG_MAX_ITEMS 32
+#define CONFIG_LINE_SIZE 100
+
+// A key/value pair from the configuration file.
+typedef struct {
+    char key[CONFIG_LINE_SIZE];
+    char value[CONFIG_LINE_SIZE];
+} config_item;
+
+// Blood glucose units the user can choose for display and input.
+typedef enum {
+    UNIT_MMOL_L,
+    UNIT_MG_DL
+} glucose_unit;
+
 /**
  * trimewhitespace - Removes leading and trailing whitespace from a string
  * 
@@ -10,13 +30,42 @@
 char *trimwhitespace(char *str);
 
 /**
- * read_config - Reads a configuration value from a file based on a key.
+ * read_config - Reads a configuration value from config.txt based on a key.
+ * The file is parsed once and cached; it is only read again when its
+ * modification time changes. The returned string belongs to the cache and
+ * stays valid across calls until the value is changed.
  * 
  * @param key: The configuration key to search for.
  * @return: The value corresponding to the key, or NULL if key is not found. 
  */
 const char* read_config(const char *key);
 
+/**
+ * config_get_float - Reads a configuration value as a float.
+ * 
+ * @param key: The configuration key to search for.
+ * @param value: Receives the parsed value.
+ * @return: 0 on success, -1 if the key is missing or not a number.
+ */
+int config_get_float(const char *key, float *value);
+
+/**
+ * config_get_int - Reads a configuration value as an int.
+ * 
+ * @param key: The configuration key to search for.
+ * @param value: Receives the parsed value.
+ * @return: 0 on success, -1 if the key is missing or not a number.
+ */
+int config_get_int(const char *key, int *value);
+
+/**
+ * config_get_unit - Reads the "blood glucose unit" setting.
+ * 
+ * @param unit: Receives the unit.
+ * @return: 0 on success, -1 if the key is missing or not a known unit.
+ */
+int config_get_unit(glucose_unit *unit);
+
 
 /**
  * list_config - Lists the configurations in a specified file.
@@ -26,9 +75,19 @@ const char* read_config(const char *key);
  */
 int list_config(const char *filename);
 
+/**
+ * print_config - Lists the configurations in a specified file to a stream.
+ * 
+ * @param out: Stream to print to.
+ * @param filename: The name of the configuration file.
+ * @return: 0 on success, -1 if error occurs.
+ */
+int print_config(FILE *out, const char *filename);
+
 
 /**
- * update_config - Updates a configuration value based on a key
+ * update_config - Updates a configuration value based on a key.
+ * The cached copy used by read_config is updated as well.
  * 
  * @param filename: Name of configuration file
  * @param key: Configuration key to update.
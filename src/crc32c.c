@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+// The CRC-32C polynomial with its bits reversed
+#define CRC32C_POLYNOMIAL 0x82f63b78u
+
+// tables[0] is the usual byte table; tables[k] advances a byte through k more zero bytes,
+// so eight bytes are folded in with eight lookups (slicing by 8)
+static uint32_t tables[8][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+typedef uint32_t (*crc_function)(uint32_t crc, const unsigned char *data, size_t length);
+static crc_function chosen;
+static const char *chosen_name;
+static pthread_once_t chosen_once = PTHREAD_ONCE_INIT;
+
+/**
+ * build_tables - Fills in the lookup tables.
+ */
+static void build_tables(void){
+    for (uint32_t byte = 0; byte < 256; byte++){
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++){
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        tables[0][byte] = crc;
+    }
+    for (int k = 1; k < 8; k++){
+        for (int byte = 0; byte < 256; byte++){
+            uint32_t crc = tables[k - 1][byte];
+            tables[k][byte] = (crc >> 8) ^ tables[0][crc & 0xff];
+        }
+    }
+}
+
+/**
+ * crc_table - Computes the CRC of a buffer eight bytes at a time with the lookup tables.
+ * crc and the result are the raw register, without the final inversion.
+ */
+static uint32_t crc_table(uint32_t crc, const unsigned char *data, size_t length){
+    pthread_once(&tables_once, build_tables);
+    while (length >= 8){
+        uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                              (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+              tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^
+              tables[3][data[4]] ^ tables[2][data[5]] ^ tables[1][data[6]] ^ tables[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0){
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+/**
+ * crc_sse42 - Computes the CRC of a buffer with the SSE 4.2 crc32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *data, size_t length){
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    while (length >= 8){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)wide;
+#endif
+    while (length >= 4){
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        data += 4;
+        length -= 4;
+    }
+    while (length-- > 0){
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+/**
+ * crc_armv8 - Computes the CRC of a buffer with the ARMv8 crc32c instructions.
+ */
+static uint32_t crc_armv8(uint32_t crc, const unsigned char *data, size_t length){
+    while (length >= 8){
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0){
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * choose_function - Picks the fastest way this CPU has to compute CRCs.
+ */
+static void choose_function(void){
+    chosen = crc_table;
+    chosen_name = "table";
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")){
+        chosen = crc_sse42;
+        chosen_name = "sse4.2";
+    }
+#endif
+#ifdef CRC32C_ARM
+    chosen = crc_armv8;
+    chosen_name = "armv8";
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length){
+    pthread_once(&chosen_once, choose_function);
+    return ~chosen(~crc, data, length);
+}
+
+uint32_t crc32c_software(uint32_t crc, const void *data, size_t length){
+    return ~crc_table(~crc, data, length);
+}
+
+const char *crc32c_method(void){
+    pthread_once(&chosen_once, choose_function);
+    return chosen_name;
+}
@@ -0,0 +1,39 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), the checksum carried by every log record. It is the CRC that
+// SSE 4.2 and ARMv8 compute in a single instruction; other CPUs use lookup tables.
+
+/**
+ * crc32c - Computes or continues a CRC-32C. The result of one call can be passed back
+ * in with the data that follows, and gives the same CRC as a single call over both.
+ *
+ * @param crc: 0 to start, or the CRC of the data before.
+ * @param data: The data.
+ * @param length: Number of bytes of data.
+ * @return: The CRC of all the data so far.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+/**
+ * crc32c_software - Computes or continues a CRC-32C with lookup tables alone, as
+ * crc32c does on CPUs without a CRC instruction.
+ *
+ * @param crc: 0 to start, or the CRC of the data before.
+ * @param data: The data.
+ * @param length: Number of bytes of data.
+ * @return: The CRC of all the data so far.
+ */
+uint32_t crc32c_software(uint32_t crc, const void *data, size_t length);
+
+/**
+ * crc32c_method - Names the way crc32c computes CRCs on this CPU.
+ *
+ * @return: "sse4.2", "armv8" or "table".
+ */
+const char *crc32c_method(void);
+
+#endif
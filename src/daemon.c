@@ -0,0 +1,741 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "daemon.h"
+#include "logging.h"
+#include "storage.h"
+#include "import.h"
+#include "config.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Length of the big-endian size that starts every frame
+#define FRAME_HEADER 4
+
+// One connected client
+typedef struct daemon_client {
+    int fd;
+    char input[FRAME_HEADER + DAEMON_MAX_REQUEST]; // Received bytes not yet handled
+    size_t input_used;
+    char *output;                 // Framed responses not yet sent
+    size_t output_used;
+    size_t output_sent;
+    size_t output_capacity;
+    uint32_t events;              // Events the client is registered for
+    int logged;                   // Entries logged this round, acknowledged once synced
+    int closing;                  // Close once the output has been sent
+    int touched;                  // Already listed for the end of the round
+    struct daemon_client *previous;
+    struct daemon_client *next;
+} daemon_client;
+
+// Everything the event loop works on
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    storage store;                // The log, held open for the life of the daemon
+    int unsynced;                 // Entries appended since the last sync
+    daemon_client *clients;       // All connected clients
+    daemon_client *touched[DAEMON_EVENTS]; // Clients with events this round
+    int touched_count;
+} daemon_state;
+
+// Set by SIGINT and SIGTERM
+static volatile sig_atomic_t stop_requested = 0;
+
+
+static void request_stop(int signal_number){
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+/**
+ * queue_response - Frames a response and adds it to a client's output.
+ *
+ * @param error: NULL for an "OK" response, otherwise the error message.
+ * @param body: Output of the command, may be NULL.
+ * @return: 0 for success, -1 if out of memory.
+ */
+static int queue_response(daemon_client *client, const char *error, const char *body, size_t body_length){
+    char status[128];
+    int status_length = error == NULL ? snprintf(status, sizeof(status), "OK\n")
+                                      : snprintf(status, sizeof(status), "ERR %s\n", error);
+    if (status_length >= (int)sizeof(status)){
+        status_length = sizeof(status) - 1;
+        status[status_length - 1] = '\n';
+    }
+
+    size_t payload = (size_t)status_length + body_length;
+    size_t needed = client->output_used + FRAME_HEADER + payload;
+    if (needed > client->output_capacity){
+        size_t capacity = client->output_capacity > 0 ? client->output_capacity : 4096;
+        while (capacity < needed){
+            capacity *= 2;
+        }
+        char *grown = realloc(client->output, capacity);
+        if (grown == NULL){
+            perror("Error queueing response");
+            return -1;
+        }
+        client->output = grown;
+        client->output_capacity = capacity;
+    }
+
+    uint32_t header = htonl((uint32_t)payload);
+    char *frame = client->output + client->output_used;
+    memcpy(frame, &header, FRAME_HEADER);
+    memcpy(frame + FRAME_HEADER, status, (size_t)status_length);
+    if (body_length > 0){
+        memcpy(frame + FRAME_HEADER + status_length, body, body_length);
+    }
+    client->output_used = needed;
+    return 0;
+}
+
+/**
+ * log_row - Handles LOG: parses an import row, calculates doses and appends the entry.
+ * The entry is written and synced at the end of the round with the other clients' entries.
+ */
+static int log_row(daemon_state *state, daemon_client *client, char *row, FILE *out, const char **error){
+    log_entry settings = {0};
+    if (log_config(&settings) != 0){
+        *error = "configuration could not be loaded";
+        return -1;
+    }
+
+    log_entry entry;
+    time_t timestamp;
+    if (parse_import_row(row, &settings, &state->store, &entry, &timestamp, error) != 0){
+        return -1;
+    }
+    if (storage_append(&state->store, &entry, timestamp) != 0){
+        *error = "entry could not be written";
+        return -1;
+    }
+    client->logged++;
+    state->unsynced++;
+
+    suggest_dosage(out, &entry);
+    return 0;
+}
+
+/**
+ * set_setting - Handles SET: updates one existing setting from "KEY=VALUE".
+ */
+static int set_setting(char *argument, const char **error){
+    char *equals = strchr(argument, '=');
+    if (equals == NULL){
+        *error = "expected KEY=VALUE";
+        return -1;
+    }
+    *equals = '\0';
+    char *key = trimwhitespace(argument);
+    char *value = trimwhitespace(equals + 1);
+
+    if (read_config(key) == NULL){
+        *error = "unknown setting";
+        return -1;
+    }
+    if (*value == '\0' || update_config(CONFIG_FILE, key, value) != 0){
+        *error = "setting could not be updated";
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * take_number - Takes a trailing number off a request argument, returning 0 and cutting
+ * the argument before it, or -1 if the argument does not end in a number.
+ */
+static int take_number(char *argument, long *value){
+    char *space = strrchr(argument, ' ');
+    if (space == NULL || space[1] == '\0'){
+        return -1;
+    }
+    for (const char *p = space + 1; *p != '\0'; p++){
+        if (!isdigit((unsigned char)*p)){
+            return -1;
+        }
+    }
+    *value = atol(space + 1);
+    *space = '\0';
+    return 0;
+}
+
+/**
+ * split_page - Takes the page off a QUERY argument, "FILTER LIMIT OFFSET". Filters end
+ * in a word, so an argument ending in two numbers holds a page.
+ *
+ * @return: 1 if the argument held a page, 0 if not.
+ */
+static int split_page(char *argument, log_page *page){
+    if (take_number(argument, &page->offset) != 0){
+        return 0;
+    }
+    if (take_number(argument, &page->limit) != 0){
+        argument[strlen(argument)] = ' '; // Put the offset back
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * run_command - Runs one request, printing its output to out.
+ *
+ * @return: 0 for success, -1 with error set when the request fails.
+ */
+static int run_command(daemon_state *state, daemon_client *client, char *request, FILE *out, const char **error){
+    char *argument = strchr(request, ' ');
+    if (argument != NULL){
+        *argument++ = '\0';
+    } else {
+        argument = request + strlen(request);
+    }
+
+    time_t start_time;
+    if (strcmp(request, "PING") == 0){
+        return 0;
+    } else if (strcmp(request, "LOG") == 0){
+        return log_row(state, client, argument, out, error);
+    } else if (strcmp(request, "QUERY") == 0 || strcmp(request, "STATS") == 0){
+        log_page page;
+        int paged = strcmp(request, "QUERY") == 0 && split_page(argument, &page);
+        if (time_filter_start(argument, &start_time) != 0){
+            *error = "invalid time filter";
+            return -1;
+        }
+        // Entries logged earlier in this round must be visible to the query
+        if (storage_flush(&state->store) != 0){
+            *error = "log could not be written";
+            return -1;
+        }
+        int status = strcmp(request, "QUERY") == 0
+                         ? storage_print_logs(&state->store, out, argument, paged ? &page : NULL)
+                         : storage_print_stats(&state->store, out, argument);
+        if (status != 0){
+            *error = "log could not be read";
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(request, "CONFIG") == 0){
+        if (print_config(out, CONFIG_FILE) != 0){
+            *error = "configuration could not be read";
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(request, "GET") == 0){
+        const char *value = read_config(argument);
+        if (value == NULL){
+            *error = "unknown setting";
+            return -1;
+        }
+        fprintf(out, "%s", value);
+        return 0;
+    } else if (strcmp(request, "SET") == 0){
+        return set_setting(argument, error);
+    }
+
+    *error = "unknown command";
+    return -1;
+}
+
+/**
+ * handle_request - Runs one request and queues its response.
+ */
+static void handle_request(daemon_state *state, daemon_client *client, char *request){
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *out = open_memstream(&body, &body_length);
+    if (out == NULL){
+        perror("Error creating response");
+        client->closing = 1;
+        return;
+    }
+
+    const char *error = NULL;
+    int status = run_command(state, client, request, out, &error);
+    if (fclose(out) != 0){
+        status = -1;
+        error = "response could not be created";
+    }
+
+    if (queue_response(client, status == 0 ? NULL : error, body, status == 0 ? body_length : 0) != 0){
+        client->closing = 1;
+    }
+    free(body);
+}
+
+/**
+ * read_client - Reads what a client has sent and handles every complete request.
+ * One read per event keeps a busy client from starving the others.
+ *
+ * @return: 0 if anything was read, -1 if the client had nothing to read or has gone.
+ */
+static int read_client(daemon_state *state, daemon_client *client){
+    ssize_t received = recv(client->fd, client->input + client->input_used,
+                            sizeof(client->input) - client->input_used, 0);
+    if (received == 0){
+        client->closing = 1;
+        return -1;
+    }
+    if (received < 0){
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+            client->closing = 1;
+        }
+        return -1;
+    }
+    client->input_used += (size_t)received;
+
+    size_t offset = 0;
+    while (!client->closing && client->input_used - offset >= FRAME_HEADER){
+        uint32_t length;
+        memcpy(&length, client->input + offset, FRAME_HEADER);
+        length = ntohl(length);
+        if (length > DAEMON_MAX_REQUEST){
+            queue_response(client, "request too large", NULL, 0);
+            client->closing = 1;
+            break;
+        }
+        if (client->input_used - offset - FRAME_HEADER < length){
+            break;
+        }
+
+        char request[DAEMON_MAX_REQUEST + 1];
+        memcpy(request, client->input + offset + FRAME_HEADER, length);
+        request[length] = '\0';
+        offset += FRAME_HEADER + length;
+        handle_request(state, client, request);
+    }
+
+    memmove(client->input, client->input + offset, client->input_used - offset);
+    client->input_used -= offset;
+    return 0;
+}
+
+/**
+ * drain_client - Handles every request a client sent before hanging up. Nobody is left
+ * to read the responses, so they are dropped, but logged entries are still synced.
+ */
+static void drain_client(daemon_state *state, daemon_client *client){
+    while (!client->closing && read_client(state, client) == 0){
+        client->output_used = 0;
+        client->output_sent = 0;
+    }
+    client->closing = 1;
+    client->output_used = 0;
+    client->output_sent = 0;
+}
+
+/**
+ * send_output - Sends as much of a client's output as the socket accepts.
+ *
+ * @return: 0 for success, -1 if the client has gone.
+ */
+static int send_output(daemon_client *client){
+    while (client->output_sent < client->output_used){
+        ssize_t sent = send(client->fd, client->output + client->output_sent,
+                            client->output_used - client->output_sent, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        client->output_sent += (size_t)sent;
+    }
+    client->output_used = 0;
+    client->output_sent = 0;
+    return 0;
+}
+
+static void close_client(daemon_state *state, daemon_client *client){
+    epoll_ctl(state->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+
+    if (client->previous != NULL){
+        client->previous->next = client->next;
+    } else {
+        state->clients = client->next;
+    }
+    if (client->next != NULL){
+        client->next->previous = client->previous;
+    }
+    free(client->output);
+    free(client);
+}
+
+/**
+ * watch_client - Registers for the events a client needs: input unless it is closing
+ * or has too much unsent output, and output while there is any left to send.
+ *
+ * @return: 0 for success, -1 for errors.
+ */
+static int watch_client(daemon_state *state, daemon_client *client){
+    size_t pending = client->output_used - client->output_sent;
+    uint32_t events = 0;
+    if (!client->closing && pending <= DAEMON_MAX_PENDING){
+        events |= EPOLLIN;
+    }
+    if (pending > 0){
+        events |= EPOLLOUT;
+    }
+    if (events == client->events){
+        return 0;
+    }
+
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = client;
+    if (epoll_ctl(state->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) != 0){
+        perror("Error watching client");
+        return -1;
+    }
+    client->events = events;
+    return 0;
+}
+
+static void accept_clients(daemon_state *state){
+    while (1){
+        int fd = accept4(state->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED){
+                perror("Error accepting client");
+            }
+            return;
+        }
+
+        daemon_client *client = calloc(1, sizeof(*client));
+        if (client == NULL){
+            perror("Error accepting client");
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0){
+            perror("Error watching client");
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        client->next = state->clients;
+        if (state->clients != NULL){
+            state->clients->previous = client;
+        }
+        state->clients = client;
+    }
+}
+
+/**
+ * finish_round - Syncs the entries logged this round with one fsync, then sends the
+ * responses. Clients whose entries could not be synced are disconnected without
+ * their acknowledgements, so they know to retry.
+ */
+static void finish_round(daemon_state *state){
+    int synced = 1;
+    if (state->unsynced > 0){
+        synced = storage_sync(&state->store) == 0;
+        if (synced){
+            state->unsynced = 0;
+        }
+    }
+
+    for (int i = 0; i < state->touched_count; i++){
+        daemon_client *client = state->touched[i];
+        client->touched = 0;
+        if ((!synced && client->logged > 0) || send_output(client) != 0 ||
+            (client->closing && client->output_used == 0)){
+            close_client(state, client);
+            continue;
+        }
+        client->logged = 0;
+        if (watch_client(state, client) != 0){
+            close_client(state, client);
+        }
+    }
+    state->touched_count = 0;
+}
+
+/**
+ * open_listener - Creates the listening socket, replacing a stale socket file
+ * but refusing to take over from a daemon that is still running.
+ *
+ * @return: The listening socket, or -1 for errors.
+ */
+static int open_listener(const char *socket_path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        printf("Error: socket path too long.\n");
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("Error creating socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0){
+        printf("Error: a daemon is already listening on %s.\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("Error creating socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0){
+        perror("Error binding socket");
+        close(fd);
+        return -1;
+    }
+    // Health data: only the owner may connect
+    if (chmod(socket_path, 0600) != 0 || listen(fd, SOMAXCONN) != 0){
+        perror("Error listening on socket");
+        close(fd);
+        unlink(socket_path);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * serve - Runs the event loop until a stop is requested.
+ * SIGINT and SIGTERM are only delivered inside epoll_pwait, so a stop is never missed.
+ */
+static int serve(daemon_state *state, const sigset_t *wait_mask){
+    struct epoll_event events[DAEMON_EVENTS];
+    while (!stop_requested){
+        int count = epoll_pwait(state->epoll_fd, events, DAEMON_EVENTS, -1, wait_mask);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            perror("Error waiting for clients");
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++){
+            daemon_client *client = events[i].data.ptr;
+            if (client == NULL){
+                accept_clients(state);
+                continue;
+            }
+
+            if (events[i].events & EPOLLERR){
+                client->closing = 1;
+                client->output_used = 0;
+                client->output_sent = 0;
+            } else if (events[i].events & EPOLLHUP){
+                // The peer closing reports EPOLLIN and EPOLLHUP together, with its last
+                // requests still waiting in the socket
+                drain_client(state, client);
+            } else if (events[i].events & EPOLLIN){
+                read_client(state, client);
+            }
+            if (!client->touched){
+                client->touched = 1;
+                state->touched[state->touched_count++] = client;
+            }
+        }
+        finish_round(state);
+    }
+    return 0;
+}
+
+int run_daemon(const char *socket_path, const char *log_filename){
+    daemon_state state;
+    memset(&state, 0, sizeof(state));
+
+    state.listen_fd = open_listener(socket_path);
+    if (state.listen_fd < 0){
+        return -1;
+    }
+
+    // The daemon syncs once per round of the event loop, never in storage_append
+    if (storage_open(&state.store, log_filename, SYNC_EVERY_N, INT_MAX, 1000) != 0){
+        close(state.listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int status = -1;
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state.epoll_fd < 0 || epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, state.listen_fd, &event) != 0){
+        perror("Error creating event loop");
+    } else {
+        printf("Listening on %s for %s. Press Ctrl+C to stop.\n", socket_path, log_filename);
+        fflush(stdout);
+        status = serve(&state, &wait_mask);
+        printf("Daemon stopped.\n");
+    }
+
+    while (state.clients != NULL){
+        close_client(&state, state.clients);
+    }
+    if (state.epoll_fd >= 0){
+        close(state.epoll_fd);
+    }
+    close(state.listen_fd);
+    unlink(socket_path);
+    if (storage_close(&state.store) != 0){
+        status = -1;
+    }
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    return status;
+}
+
+/**
+ * send_all - Sends a whole buffer, retrying short sends.
+ */
+static int send_all(int fd, const char *data, size_t length){
+    while (length > 0){
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/**
+ * receive_all - Receives exactly length bytes.
+ *
+ * @return: 0 for success, -1 if the connection closed or failed first.
+ */
+static int receive_all(int fd, char *data, size_t length){
+    while (length > 0){
+        ssize_t received = recv(fd, data, length, 0);
+        if (received < 0 && errno == EINTR){
+            continue;
+        }
+        if (received <= 0){
+            return -1;
+        }
+        data += received;
+        length -= (size_t)received;
+    }
+    return 0;
+}
+
+int daemon_connect(const char *socket_path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        printf("Error: socket path too long.\n");
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        perror("Error creating socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0){
+        perror("Error connecting to daemon");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_request(int fd, const char *request, char **body){
+    *body = NULL;
+
+    size_t length = strlen(request);
+    if (length > DAEMON_MAX_REQUEST){
+        printf("Error: request too large.\n");
+        return -1;
+    }
+    char frame[FRAME_HEADER + DAEMON_MAX_REQUEST];
+    uint32_t header = htonl((uint32_t)length);
+    memcpy(frame, &header, FRAME_HEADER);
+    memcpy(frame + FRAME_HEADER, request, length);
+    if (send_all(fd, frame, FRAME_HEADER + length) != 0){
+        perror("Error sending request to daemon");
+        return -1;
+    }
+
+    if (receive_all(fd, (char *)&header, FRAME_HEADER) != 0){
+        printf("Error: no response from daemon.\n");
+        return -1;
+    }
+    length = ntohl(header);
+    if (length > DAEMON_MAX_RESPONSE){
+        printf("Error: response from daemon too large.\n");
+        return -1;
+    }
+    char *payload = malloc(length + 1);
+    if (payload == NULL){
+        perror("Error receiving response");
+        return -1;
+    }
+    if (receive_all(fd, payload, length) != 0){
+        printf("Error: no response from daemon.\n");
+        free(payload);
+        return -1;
+    }
+    payload[length] = '\0';
+
+    // Split the status line from the output
+    char *newline = memchr(payload, '\n', length);
+    size_t status_length = newline != NULL ? (size_t)(newline - payload) : length;
+    size_t output = newline != NULL ? status_length + 1 : length;
+    int ok = status_length == 2 && memcmp(payload, "OK", 2) == 0;
+    if (ok){
+        memmove(payload, payload + output, length - output + 1);
+    } else if (status_length >= 4 && memcmp(payload, "ERR ", 4) == 0){
+        memmove(payload, payload + 4, status_length - 4);
+        payload[status_length - 4] = '\0';
+    } else {
+        free(payload);
+        payload = strdup("malformed response");
+    }
+    *body = payload;
+    return ok ? 0 : -1;
+}
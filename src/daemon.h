@@ -0,0 +1,70 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Default socket the daemon listens on and clients connect to
+#define DAEMON_SOCKET "data/dms.sock"
+
+// Largest request payload accepted by the daemon
+#define DAEMON_MAX_REQUEST 4096
+
+// Largest response payload accepted by clients
+#define DAEMON_MAX_RESPONSE (64 << 20)
+
+// Events handled per epoll_wait; entries logged in one round share an fsync
+#define DAEMON_EVENTS 64
+
+// Clients with more unsent output than this are not read from until it drains
+#define DAEMON_MAX_PENDING (1 << 20)
+
+/*
+ * Protocol: every request and response is a 4 byte big-endian payload length
+ * followed by the payload. Requests are one command line:
+ *
+ *   PING                        Checks the daemon is alive.
+ *   LOG time,type,glucose,unit,carbs,dose
+ *                               Logs an entry given as an import row (see parse_import_row).
+ *   QUERY FILTER [LIMIT OFFSET] Returns the log entries within a time filter, as View Logs;
+ *                               with a page, LIMIT entries newest first after skipping OFFSET.
+ *   STATS FILTER                Returns glucose statistics for a time filter.
+ *   CONFIG                      Returns the insulin settings.
+ *   GET KEY                     Returns one setting.
+ *   SET KEY=VALUE               Updates one setting.
+ *
+ * Responses start with a status line, "OK" or "ERR message", followed by the
+ * output of the command. Responses are sent in the order requests arrive.
+ */
+
+/**
+ * run_daemon - Serves the log and configuration over a Unix domain socket until
+ * interrupted with SIGINT or SIGTERM. Clients are served by a single epoll loop;
+ * entries logged by any client during one pass of the loop are written with one
+ * write call and forced to disk with one fsync before any of them is acknowledged.
+ *
+ * @param socket_path: Path of the socket to listen on.
+ * @param log_filename: Log file owned by the daemon (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int run_daemon(const char *socket_path, const char *log_filename);
+
+/**
+ * daemon_connect - Connects to a running daemon.
+ *
+ * @param socket_path: Path of the daemon's socket.
+ * @return: The connected socket, or -1 for errors.
+ */
+int daemon_connect(const char *socket_path);
+
+/**
+ * daemon_request - Sends one request to the daemon and waits for its response.
+ *
+ * @param fd: Socket returned by daemon_connect.
+ * @param request: The command line.
+ * @param body: Receives the output of the command (after the status line) for "OK"
+ * responses, or the error message for "ERR" responses. Allocated with malloc and
+ * NUL terminated; the caller frees it. Set to NULL when the request could not be
+ * sent or no response arrived.
+ * @return: 0 for "OK" responses, -1 for "ERR" responses and errors.
+ */
+int daemon_request(int fd, const char *request, char **body);
+
+#endif
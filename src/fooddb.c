@@ -0,0 +1,730 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "fooddb.h"
+#include "config.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest CSV row accepted when building a table
+#define FOOD_LINE_MAX 1024
+
+// Number of columns in a food row: name,carbs,portion_grams,portion
+#define FOOD_COLUMNS 4
+
+// Longest search text kept after folding, and most words in it
+#define FOOD_QUERY_MAX 128
+#define FOOD_QUERY_WORDS 8
+
+// Foods collected by one search before they are ranked
+#define FOOD_CANDIDATES_MAX 128
+
+// Words looked at for the text typed, and for each one letter variant of it
+#define FOOD_RANGE_MAX 4096
+#define FOOD_VARIANT_RANGE_MAX 256
+
+// Shortest word tried with a letter changed; shorter ones would match too much
+#define FOOD_FUZZY_MIN 3
+
+// Letters tried when a letter is added or changed
+static const char food_alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+// A food table being built in memory
+typedef struct {
+    food_record *foods;
+    size_t food_count;
+    size_t food_capacity;
+    food_word *words;
+    size_t word_count;
+    size_t word_capacity;
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+} food_builder;
+
+/**
+ * fold_name - Folds text for searching: letters and digits are kept, in lower case,
+ * and every other run of characters becomes one space. Bytes of UTF-8 characters are
+ * kept as they are.
+ *
+ * @return: Length of the folded text, which is null terminated.
+ */
+static size_t fold_name(const char *text, char *out, size_t size){
+    size_t length = 0;
+    int separated = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0' && length + 2 < size; p++){
+        if (isalnum(*p) || *p >= 0x80){
+            if (separated && length > 0){
+                out[length++] = ' ';
+            }
+            out[length++] = (char)tolower(*p);
+            separated = 0;
+        } else {
+            separated = 1;
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+/**
+ * split_csv - Splits a CSV row into fields in place. A quoted field may hold commas,
+ * and "" inside it stands for one quote; other fields are trimmed.
+ *
+ * @return: Number of fields found.
+ */
+static int split_csv(char *line, char *fields[], int max_fields){
+    line[strcspn(line, "\r\n")] = '\0';
+
+    int count = 0;
+    char *p = line;
+    while (count < max_fields){
+        while (*p == ' ' || *p == '\t'){
+            p++;
+        }
+        if (*p == '"'){
+            char *out = ++p;
+            fields[count++] = out;
+            while (*p != '\0'){
+                if (*p == '"' && p[1] == '"'){
+                    *out++ = '"';
+                    p += 2;
+                } else if (*p == '"'){
+                    p++;
+                    break;
+                } else {
+                    *out++ = *p++;
+                }
+            }
+            char *comma = strchr(p, ',');
+            *out = '\0';
+            if (comma == NULL){
+                break;
+            }
+            p = comma + 1;
+        } else {
+            char *comma = strchr(p, ',');
+            if (comma != NULL){
+                *comma = '\0';
+            }
+            fields[count++] = trimwhitespace(p);
+            if (comma == NULL){
+                break;
+            }
+            p = comma + 1;
+        }
+    }
+    return count;
+}
+
+/**
+ * parse_amount - Parses a whole field as a number of grams.
+ *
+ * @return: 0 for success, -1 if the field is not a number.
+ */
+static int parse_amount(const char *field, float *value){
+    char *end;
+    float parsed = strtof(field, &end);
+    if (end == field || *end != '\0' || !(parsed >= 0)){
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+/**
+ * grow - Makes room for one more item in a builder array.
+ *
+ * @return: 0 for success, -1 if memory ran out.
+ */
+static int grow(void **items, size_t count, size_t *capacity, size_t item_size){
+    if (count < *capacity){
+        return 0;
+    }
+    size_t new_capacity = *capacity > 0 ? *capacity * 2 : 4096;
+    void *resized = realloc(*items, new_capacity * item_size);
+    if (resized == NULL){
+        perror("Error building food table");
+        return -1;
+    }
+    *items = resized;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * add_string - Adds a string, cut to FOOD_NAME_MAX bytes, to the string table.
+ *
+ * @return: Offset of the string, or -1 if memory ran out or the table is full.
+ */
+static int64_t add_string(food_builder *builder, const char *text, size_t *length){
+    *length = strlen(text);
+    if (*length > FOOD_NAME_MAX){
+        *length = FOOD_NAME_MAX;
+    }
+    if (builder->strings_size + *length + 1 > UINT32_MAX){
+        printf("Error building food table: too many foods.\n");
+        return -1;
+    }
+    while (builder->strings_size + *length + 1 > builder->strings_capacity){
+        size_t capacity = builder->strings_capacity > 0 ? builder->strings_capacity * 2 : 1 << 20;
+        char *strings = realloc(builder->strings, capacity);
+        if (strings == NULL){
+            perror("Error building food table");
+            return -1;
+        }
+        builder->strings = strings;
+        builder->strings_capacity = capacity;
+    }
+    int64_t offset = (int64_t)builder->strings_size;
+    memcpy(builder->strings + offset, text, *length);
+    builder->strings[offset + (int64_t)*length] = '\0';
+    builder->strings_size += *length + 1;
+    return offset;
+}
+
+/**
+ * add_food - Adds one food, and an entry for each word of its folded name.
+ *
+ * @return: 0 for success, -1 if memory ran out.
+ */
+static int add_food(food_builder *builder, const char *name, const char *key, float carbs,
+                    float portion_grams, const char *portion){
+    if (grow((void **)&builder->foods, builder->food_count, &builder->food_capacity, sizeof(food_record)) != 0){
+        return -1;
+    }
+
+    food_record food;
+    size_t name_length, key_length, portion_length;
+    int64_t name_offset = add_string(builder, name, &name_length);
+    int64_t key_offset = name_offset < 0 ? -1 : add_string(builder, key, &key_length);
+    int64_t portion_offset = key_offset < 0 ? -1 : add_string(builder, portion, &portion_length);
+    if (portion_offset < 0){
+        return -1;
+    }
+    food.name = (uint32_t)name_offset;
+    food.key = (uint32_t)key_offset;
+    food.portion = (uint32_t)portion_offset;
+    food.name_length = (uint16_t)name_length;
+    food.key_length = (uint16_t)key_length;
+    food.carbs = carbs;
+    food.portion_grams = portion_grams;
+
+    // A word starts at the start of the key and after every space
+    const char *text = builder->strings + key_offset;
+    for (size_t i = 0; i < key_length; i++){
+        if (i > 0 && text[i - 1] != ' '){
+            continue;
+        }
+        if (grow((void **)&builder->words, builder->word_count, &builder->word_capacity, sizeof(food_word)) != 0){
+            return -1;
+        }
+        builder->words[builder->word_count].text = (uint32_t)(key_offset + (int64_t)i);
+        builder->words[builder->word_count].food = (uint32_t)builder->food_count;
+        builder->word_count++;
+    }
+    builder->foods[builder->food_count++] = food;
+    return 0;
+}
+
+/**
+ * compare_words - qsort_r comparator ordering words by their text to the end of the
+ * name, then by food.
+ */
+static int compare_words(const void *a, const void *b, void *context){
+    const char *strings = context;
+    const food_word *left = a;
+    const food_word *right = b;
+    int order = strcmp(strings + left->text, strings + right->text);
+    if (order != 0){
+        return order;
+    }
+    return left->food < right->food ? -1 : left->food > right->food;
+}
+
+/**
+ * read_foods - Reads the rows of a food CSV file into a builder.
+ *
+ * @return: 0 for success, -1 for errors.
+ */
+static int read_foods(FILE *input, const char *csv_filename, food_builder *builder, long *skipped){
+    char line[FOOD_LINE_MAX];
+    long line_number = 0;
+    while (fgets(line, sizeof(line), input) != NULL){
+        line_number++;
+        if (strchr(line, '\n') == NULL && !feof(input)){
+            printf("%s:%ld: line too long, skipped\n", csv_filename, line_number);
+            (*skipped)++;
+            int c;
+            while ((c = fgetc(input)) != '\n' && c != EOF);
+            continue;
+        }
+
+        char *fields[FOOD_COLUMNS] = {NULL};
+        int count = split_csv(line, fields, FOOD_COLUMNS);
+        if (count == 1 && fields[0][0] == '\0'){
+            continue; // A blank line
+        }
+
+        float carbs;
+        float portion_grams = 0;
+        const char *error = NULL;
+        char key[FOOD_NAME_MAX + 2];
+        if (count < 2 || parse_amount(fields[1], &carbs) != 0){
+            if (line_number == 1){
+                continue; // A header row
+            }
+            error = "carbohydrates per 100 g missing or not a number";
+        } else if (carbs > 100){
+            error = "more than 100 g of carbohydrates per 100 g";
+        } else if (fold_name(fields[0], key, sizeof(key)) == 0){
+            error = "name has no letters or digits";
+        } else if (count > 2 && fields[2][0] != '\0' &&
+                   (parse_amount(fields[2], &portion_grams) != 0 || portion_grams <= 0)){
+            error = "portion weight is not a positive number";
+        }
+        if (error != NULL){
+            printf("%s:%ld: %s, skipped\n", csv_filename, line_number, error);
+            (*skipped)++;
+            continue;
+        }
+
+        const char *portion = count > 3 && portion_grams > 0 ? fields[3] : "";
+        if (add_food(builder, fields[0], key, carbs, portion_grams, portion) != 0){
+            return -1;
+        }
+        if (builder->food_count == UINT32_MAX){
+            printf("Error building food table: too many foods.\n");
+            return -1;
+        }
+    }
+    if (ferror(input)){
+        perror("Error reading food file");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * write_table - Writes a built table to a temporary file and renames it over the table,
+ * so a running program keeps the table it mapped.
+ */
+static int write_table(const char *table_filename, const food_builder *builder){
+    char name[512];
+    snprintf(name, sizeof(name), "%s.tmp", table_filename);
+    FILE *out = fopen(name, "wb");
+    if (out == NULL){
+        perror("Error writing food table");
+        return -1;
+    }
+
+    food_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FOOD_TABLE_MAGIC, sizeof(FOOD_TABLE_MAGIC));
+    header.version = FOOD_TABLE_VERSION;
+    header.food_count = (uint32_t)builder->food_count;
+    header.word_count = builder->word_count;
+    header.strings_size = builder->strings_size;
+
+    int status = 0;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(builder->foods, sizeof(food_record), builder->food_count, out) != builder->food_count ||
+        fwrite(builder->words, sizeof(food_word), builder->word_count, out) != builder->word_count ||
+        fwrite(builder->strings, 1, builder->strings_size, out) != builder->strings_size ||
+        fflush(out) != 0 || fsync(fileno(out)) != 0){
+        perror("Error writing food table");
+        status = -1;
+    }
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    if (status == 0 && rename(name, table_filename) != 0){
+        perror("Error writing food table");
+        status = -1;
+    }
+    if (status != 0){
+        unlink(name);
+    }
+    return status;
+}
+
+int food_table_build(const char *csv_filename, const char *table_filename){
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    FILE *input = fopen(csv_filename, "r");
+    if (input == NULL){
+        perror("Error opening food file");
+        return -1;
+    }
+
+    // Portions that are not given all point at the empty string at offset 0
+    food_builder builder;
+    memset(&builder, 0, sizeof(builder));
+    size_t length;
+    long skipped = 0;
+    int status = add_string(&builder, "", &length) < 0 ? -1 : read_foods(input, csv_filename, &builder, &skipped);
+    fclose(input);
+
+    if (status == 0){
+        qsort_r(builder.words, builder.word_count, sizeof(food_word), compare_words, builder.strings);
+        status = write_table(table_filename, &builder);
+    }
+    if (status == 0){
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        printf("Built %s: %zu foods (%ld skipped), %zu words, in %.3f s.\n", table_filename,
+               builder.food_count, skipped, builder.word_count,
+               (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9);
+    }
+    free(builder.foods);
+    free(builder.words);
+    free(builder.strings);
+    return status;
+}
+
+int food_table_open(food_table *table, const char *filename){
+    memset(table, 0, sizeof(*table));
+    if (log_map_open(&table->map, filename) != 0){
+        return -1;
+    }
+
+    const food_header *header = (const food_header *)table->map.data;
+    size_t size = table->map.size;
+    if (size < sizeof(food_header) || memcmp(header->magic, FOOD_TABLE_MAGIC, sizeof(FOOD_TABLE_MAGIC)) != 0 ||
+        header->version != FOOD_TABLE_VERSION){
+        printf("Error: %s is not a food table; build it with --build-foods.\n", filename);
+        log_map_close(&table->map);
+        return -1;
+    }
+
+    // The sections must fill the file exactly, and the strings must end in a null so
+    // no search can read past them
+    size_t foods_size = (size_t)header->food_count * sizeof(food_record);
+    size_t words_size = header->word_count * sizeof(food_word);
+    if (header->word_count > size || header->strings_size > size || header->strings_size == 0 ||
+        sizeof(food_header) + foods_size + words_size + header->strings_size != size ||
+        table->map.data[size - 1] != '\0'){
+        printf("Error: food table %s is damaged; build it again with --build-foods.\n", filename);
+        log_map_close(&table->map);
+        return -1;
+    }
+
+    // Searches jump around the table rather than reading it in order
+    madvise((void *)table->map.data, size, MADV_RANDOM);
+
+    table->header = header;
+    table->foods = (const food_record *)(table->map.data + sizeof(food_header));
+    table->words = (const food_word *)(table->map.data + sizeof(food_header) + foods_size);
+    table->strings = table->map.data + sizeof(food_header) + foods_size + words_size;
+    return 0;
+}
+
+void food_table_close(food_table *table){
+    log_map_close(&table->map);
+    table->header = NULL;
+}
+
+/**
+ * table_string - Returns a string of the table, or an empty string for an offset out of range.
+ */
+static const char *table_string(const food_table *table, uint32_t offset){
+    return offset < table->header->strings_size ? table->strings + offset : "";
+}
+
+// A food found while searching, before the foods are ranked
+typedef struct {
+    uint32_t food;
+    int rank;                     // 0: the name starts with the text typed, 1: a word does, 2: with a letter changed
+    uint16_t name_length;
+} food_candidate;
+
+// The words typed and the foods found for them so far
+typedef struct {
+    const food_table *table;
+    char text[FOOD_QUERY_MAX + 2];    // The folded text typed
+    size_t length;
+    const char *words[FOOD_QUERY_WORDS];
+    size_t word_lengths[FOOD_QUERY_WORDS];
+    int word_count;
+    int anchor;                   // The word whose word entries are searched; the others are checked
+    food_candidate candidates[FOOD_CANDIDATES_MAX];
+    int candidate_count;
+} food_query;
+
+/**
+ * first_word_from - Binary search for the first word entry whose text is not before text.
+ */
+static uint64_t first_word_from(const food_table *table, const char *text, size_t length){
+    uint64_t low = 0;
+    uint64_t high = table->header->word_count;
+    while (low < high){
+        uint64_t middle = low + (high - low) / 2;
+        if (strncmp(table_string(table, table->words[middle].text), text, length) < 0){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * count_words_from - Counts the word entries from first whose text starts with text.
+ */
+static uint64_t count_words_from(const food_table *table, uint64_t first, const char *text, size_t length){
+    uint64_t low = first;
+    uint64_t high = table->header->word_count;
+    while (low < high){
+        uint64_t middle = low + (high - low) / 2;
+        if (strncmp(table_string(table, table->words[middle].text), text, length) <= 0){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low - first;
+}
+
+/**
+ * has_word_starting - Checks whether a folded name has a word starting with some text.
+ */
+static int has_word_starting(const char *key, const char *word, size_t length){
+    for (const char *p = key; *p != '\0'; p++){
+        if ((p == key || p[-1] == ' ') && strncmp(p, word, length) == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * add_candidate - Adds a food to the search's candidates, keeping its best rank.
+ *
+ * @return: 0, or -1 once there is no room for more.
+ */
+static int add_candidate(food_query *query, uint32_t food, int rank){
+    for (int i = 0; i < query->candidate_count; i++){
+        if (query->candidates[i].food == food){
+            if (rank < query->candidates[i].rank){
+                query->candidates[i].rank = rank;
+            }
+            return 0;
+        }
+    }
+    if (query->candidate_count == FOOD_CANDIDATES_MAX){
+        return -1;
+    }
+    food_candidate *candidate = &query->candidates[query->candidate_count++];
+    candidate->food = food;
+    candidate->rank = rank;
+    candidate->name_length = query->table->foods[food].name_length;
+    return 0;
+}
+
+/**
+ * collect_words - Adds the foods with a word starting with text, and with a word starting
+ * with each of the other words typed, looking at no more than limit word entries.
+ *
+ * @param fuzzy: Non-zero if text is the anchor word with a letter changed.
+ * @return: 0, or -1 once there is no room for more candidates.
+ */
+static int collect_words(food_query *query, const char *text, size_t length, int fuzzy, int limit){
+    const food_table *table = query->table;
+    for (uint64_t i = first_word_from(table, text, length); i < table->header->word_count && limit > 0; i++, limit--){
+        if (strncmp(table_string(table, table->words[i].text), text, length) != 0){
+            break;
+        }
+        uint32_t food = table->words[i].food;
+        if (food >= table->header->food_count){
+            continue;
+        }
+        const char *key = table_string(table, table->foods[food].key);
+        int matched = 1;
+        for (int w = 0; w < query->word_count && matched; w++){
+            if (w != query->anchor){
+                matched = has_word_starting(key, query->words[w], query->word_lengths[w]);
+            }
+        }
+        if (!matched){
+            continue;
+        }
+        int rank = fuzzy ? 2 : strncmp(key, query->text, query->length) == 0 ? 0 : 1;
+        if (add_candidate(query, food, rank) != 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * collect_variant - Adds the foods matching the anchor word changed to edit. With phrase
+ * set, the word is changed in place in the whole text typed, which is searched for as
+ * one range like the words in order; otherwise the changed word is searched for alone.
+ *
+ * @return: 0, or -1 once there is no room for more candidates.
+ */
+static int collect_variant(food_query *query, const char *edit, size_t edit_length, int phrase){
+    if (!phrase){
+        return collect_words(query, edit, edit_length, 1, FOOD_VARIANT_RANGE_MAX);
+    }
+    const char *word = query->words[query->anchor];
+    size_t before = (size_t)(word - query->text);
+    size_t after = query->length - before - query->word_lengths[query->anchor];
+    char text[FOOD_QUERY_MAX + 3];
+    memcpy(text, query->text, before);
+    memcpy(text + before, edit, edit_length);
+    memcpy(text + before + edit_length, word + query->word_lengths[query->anchor], after);
+    return collect_words(query, text, before + edit_length + after, 1, FOOD_VARIANT_RANGE_MAX);
+}
+
+/**
+ * collect_variants - Tries the anchor word with one letter left out, swapped with the
+ * next, changed or added, until the candidates are full.
+ *
+ * @param phrase: Non-zero to search for the changed word in place in the text typed.
+ * @return: 0, or -1 once there is no room for more candidates.
+ */
+static int collect_variants(food_query *query, int phrase){
+    const char *word = query->words[query->anchor];
+    size_t length = query->word_lengths[query->anchor];
+    char variant[FOOD_QUERY_MAX + 2];
+
+    for (size_t i = 0; i < length; i++){
+        memcpy(variant, word, i);
+        memcpy(variant + i, word + i + 1, length - i - 1);
+        if (collect_variant(query, variant, length - 1, phrase) != 0){
+            return -1;
+        }
+    }
+    memcpy(variant, word, length);
+    for (size_t i = 0; i + 1 < length; i++){
+        if (word[i] == word[i + 1]){
+            continue;
+        }
+        variant[i] = word[i + 1];
+        variant[i + 1] = word[i];
+        int status = collect_variant(query, variant, length, phrase);
+        variant[i] = word[i];
+        variant[i + 1] = word[i + 1];
+        if (status != 0){
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < length; i++){
+        for (const char *c = food_alphabet; *c != '\0'; c++){
+            if (*c == word[i]){
+                continue;
+            }
+            variant[i] = *c;
+            if (collect_variant(query, variant, length, phrase) != 0){
+                return -1;
+            }
+        }
+        variant[i] = word[i];
+    }
+    for (size_t i = 0; i <= length; i++){
+        memcpy(variant, word, i);
+        memcpy(variant + i + 1, word + i, length - i);
+        for (const char *c = food_alphabet; *c != '\0'; c++){
+            variant[i] = *c;
+            if (collect_variant(query, variant, length + 1, phrase) != 0){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * compare_candidates - qsort comparator ranking candidates: best rank first, then the
+ * shortest name, then the order of the CSV file.
+ */
+static int compare_candidates(const void *a, const void *b){
+    const food_candidate *left = a;
+    const food_candidate *right = b;
+    if (left->rank != right->rank){
+        return left->rank - right->rank;
+    }
+    if (left->name_length != right->name_length){
+        return left->name_length - right->name_length;
+    }
+    return left->food < right->food ? -1 : left->food > right->food;
+}
+
+int food_search(const food_table *table, const char *query_text, food_match *matches, int max_matches){
+    food_query query;
+    query.table = table;
+    query.length = fold_name(query_text, query.text, sizeof(query.text));
+    query.word_count = 0;
+    query.anchor = 0;
+    query.candidate_count = 0;
+    if (query.length == 0 || max_matches <= 0){
+        return 0;
+    }
+
+    // Split the text into words, and find the word starting the fewest word entries
+    uint64_t fewest = UINT64_MAX;
+    for (char *p = query.text; *p != '\0' && query.word_count < FOOD_QUERY_WORDS; ){
+        size_t length = strcspn(p, " ");
+        uint64_t count = count_words_from(table, first_word_from(table, p, length), p, length);
+        query.words[query.word_count] = p;
+        query.word_lengths[query.word_count] = length;
+        if (count < fewest){
+            fewest = count;
+            query.anchor = query.word_count;
+        }
+        query.word_count++;
+        p += length;
+        while (*p == ' '){
+            p++;
+        }
+    }
+
+    // Names with the words in the order typed are one range of the word entries, so
+    // "bread whole" finds "Bread, whole wheat" without looking at every bread
+    int status = 0;
+    if (query.word_count > 1){
+        status = collect_words(&query, query.text, query.length, 0, FOOD_RANGE_MAX);
+    }
+    if (status == 0 && query.candidate_count < max_matches){
+        status = collect_words(&query, query.words[query.anchor], query.word_lengths[query.anchor], 0, FOOD_RANGE_MAX);
+    }
+
+    // Then each word in turn is taken to be misspelled, the longest first, as one letter
+    // is least likely to turn a long word into another word. The words in the order typed
+    // are tried before the changed word alone, as with the exact words.
+    int order[FOOD_QUERY_WORDS];
+    for (int w = 0; w < query.word_count; w++){
+        int position = w;
+        while (position > 0 && query.word_lengths[order[position - 1]] < query.word_lengths[w]){
+            order[position] = order[position - 1];
+            position--;
+        }
+        order[position] = w;
+    }
+    for (int phrase = query.word_count > 1; phrase >= 0; phrase--){
+        for (int w = 0; w < query.word_count && status == 0 && query.candidate_count < max_matches; w++){
+            query.anchor = order[w];
+            if (query.word_lengths[query.anchor] >= FOOD_FUZZY_MIN){
+                status = collect_variants(&query, phrase);
+            }
+        }
+    }
+
+    qsort(query.candidates, (size_t)query.candidate_count, sizeof(food_candidate), compare_candidates);
+    int count = query.candidate_count < max_matches ? query.candidate_count : max_matches;
+    for (int i = 0; i < count; i++){
+        const food_record *food = &table->foods[query.candidates[i].food];
+        matches[i].name = table_string(table, food->name);
+        matches[i].name_length = strnlen(matches[i].name, food->name_length);
+        matches[i].portion = table_string(table, food->portion);
+        matches[i].portion_length = strlen(matches[i].portion);
+        matches[i].carbs = food->carbs;
+        matches[i].portion_grams = food->portion_grams;
+        matches[i].fuzzy = query.candidates[i].rank == 2;
+    }
+    return count;
+}
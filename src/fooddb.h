@@ -0,0 +1,122 @@
+#ifndef FOODDB_H
+#define FOODDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "log_scan.h"
+
+// The food table the menu looks foods up in, built from a CSV file with --build-foods
+#define FOOD_TABLE_FILE "data/foods.tbl"
+
+// Food tables start with this magic followed by the format version
+#define FOOD_TABLE_MAGIC "DMSFOOD"
+#define FOOD_TABLE_VERSION 1
+
+// Longest food name and portion description kept; longer ones are cut short
+#define FOOD_NAME_MAX 255
+
+// Most foods one search returns
+#define FOOD_MATCHES_MAX 10
+
+// Header at the start of a food table. The file is laid out as the header, then
+// food_count food_record entries, then word_count food_word entries, then the string
+// table of strings_size bytes. Nothing is parsed when a table is opened: the file is
+// mapped and searched in place.
+typedef struct {
+    char magic[8];                // FOOD_TABLE_MAGIC, null terminated
+    uint32_t version;             // FOOD_TABLE_VERSION
+    uint32_t food_count;
+    uint64_t word_count;
+    uint64_t strings_size;        // Bytes of the string table, which ends in a null
+} food_header;
+
+// One food. Strings are offsets into the string table and are null terminated.
+typedef struct {
+    uint32_t name;                // The name as it was given, e.g. "Apples, raw, with skin"
+    uint32_t key;                 // The name folded for searching: "apples raw with skin"
+    uint32_t portion;             // Description of a typical portion, e.g. "1 medium", or empty
+    uint16_t name_length;
+    uint16_t key_length;
+    float carbs;                  // Carbohydrates in grams per 100 g
+    float portion_grams;          // Weight of the typical portion, or 0 if there is none
+} food_record;
+
+// One word of a folded name. The table holds an entry for the start of every word of
+// every name, sorted by the text from that word to the end of the name, so the foods
+// with a word starting with some text are one binary search away.
+typedef struct {
+    uint32_t text;                // Offset of the word in the string table
+    uint32_t food;                // Index of the food
+} food_word;
+
+// A food table mapped for searching
+typedef struct {
+    log_map map;
+    const food_header *header;
+    const food_record *foods;
+    const food_word *words;
+    const char *strings;
+} food_table;
+
+// A food found by food_search. Strings point into the mapped table.
+typedef struct {
+    const char *name;
+    size_t name_length;
+    const char *portion;          // Typical portion, or an empty string
+    size_t portion_length;
+    float carbs;                  // Carbohydrates in grams per 100 g
+    float portion_grams;          // Weight of the typical portion, or 0
+    int fuzzy;                    // 1 if the food matched only with one letter changed
+} food_match;
+
+/**
+ * food_table_build - Compiles a CSV file of foods into a food table.
+ *
+ * Columns: name,carbs[,portion_grams,portion]
+ *   name:          the food's name; quote it if it holds commas.
+ *   carbs:         carbohydrates in grams per 100 g.
+ *   portion_grams: weight of a typical portion in grams; may be empty.
+ *   portion:       description of that portion, e.g. "1 cup"; may be empty.
+ * Rows that cannot be read are reported with their line number and skipped; a header
+ * row is skipped too.
+ *
+ * @param csv_filename: The CSV file.
+ * @param table_filename: Name of the table to write; an existing table is replaced.
+ * @return: 0 for success, -1 for errors.
+ */
+int food_table_build(const char *csv_filename, const char *table_filename);
+
+/**
+ * food_table_open - Maps a food table for searching. Only the header and the section sizes are
+ * checked; nothing is read into memory.
+ *
+ * @param table: Receives the mapped table.
+ * @param filename: Name of the table.
+ * @return: 0 for success, -1 for errors.
+ */
+int food_table_open(food_table *table, const char *filename);
+
+/**
+ * food_table_close - Unmaps a food table.
+ *
+ * @param table: A table opened by food_table_open.
+ */
+void food_table_close(food_table *table);
+
+/**
+ * food_search - Finds the foods matching what the user typed. Case and punctuation are
+ * ignored, and each word typed matches the start of a word of the name, so "app raw"
+ * finds "Apples, raw, with skin". Names starting with the text typed come first, then
+ * other names, shorter ones first. When fewer than max_matches foods are found, each
+ * word typed, longest first, is also tried with one letter left out, added, changed or
+ * swapped.
+ *
+ * @param table: An open table.
+ * @param query: The text typed.
+ * @param matches: Receives the foods found.
+ * @param max_matches: Size of matches, at most FOOD_MATCHES_MAX.
+ * @return: Number of foods found.
+ */
+int food_search(const food_table *table, const char *query, food_match *matches, int max_matches);
+
+#endif
@@ -0,0 +1,580 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "glucose_stats.h"
+#include "calculations.h"
+#include "config.h"
+#include "logging.h"
+#include "records.h"
+#include "log_scan.h"
+#include "log_lock.h"
+#include "instrument.h"
+#include "rollup.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of records read per fread call when totalling a binary log
+#define STATS_RECORD_BATCH 256
+
+// Running totals loaded into memory while readings are added. Totals are read from
+// the file from the oldest bucket a reading touches, so appending to the latest
+// bucket reads only that bucket's totals however long the history is.
+typedef struct {
+    stats_header header;
+    FILE *file;                   // The statistics file
+    stats_totals *totals;         // Running totals, header.bucket_count of them
+    stats_totals *deltas;         // Readings added during this update, per bucket
+    int64_t capacity;             // Allocated length of totals and deltas
+    int64_t loaded_from;          // First bucket whose totals are in memory; later ones are too
+    int64_t dirty_from;           // First bucket whose totals need writing back
+    long skipped;                 // Readings too far from the others to be totalled
+} stats_table;
+
+
+/**
+ * stats_filename - Builds the name of the sidecar statistics file for a log file.
+ */
+static void stats_filename(const char *log_filename, char *buffer, size_t size){
+    snprintf(buffer, size, "%s%s", log_filename, STATS_SUFFIX);
+}
+
+/**
+ * bucket_of - Returns the bucket number of a timestamp, rounding down for times before the epoch.
+ */
+static int64_t bucket_of(int64_t timestamp){
+    int64_t bucket = timestamp / STATS_BUCKET_SECONDS;
+    if (timestamp % STATS_BUCKET_SECONDS < 0){
+        bucket--;
+    }
+    return bucket;
+}
+
+/**
+ * add_totals - Adds the totals in from to to.
+ */
+static void add_totals(stats_totals *to, const stats_totals *from){
+    to->count += from->count;
+    to->below += from->below;
+    to->in_range += from->in_range;
+    to->above += from->above;
+    to->sum += from->sum;
+    to->sum_squares += from->sum_squares;
+}
+
+/**
+ * reserve_buckets - Makes room for at least count buckets in the table.
+ */
+static int reserve_buckets(stats_table *table, int64_t count){
+    if (count <= table->capacity){
+        return 0;
+    }
+    int64_t capacity = table->capacity > 0 ? table->capacity : 1024;
+    while (capacity < count){
+        capacity *= 2;
+    }
+
+    stats_totals *totals = realloc(table->totals, (size_t)capacity * sizeof(stats_totals));
+    if (totals == NULL){
+        perror("Error allocating glucose statistics");
+        return -1;
+    }
+    table->totals = totals;
+
+    stats_totals *deltas = realloc(table->deltas, (size_t)capacity * sizeof(stats_totals));
+    if (deltas == NULL){
+        perror("Error allocating glucose statistics");
+        return -1;
+    }
+    table->deltas = deltas;
+    table->capacity = capacity;
+    return 0;
+}
+
+/**
+ * load_buckets - Reads the running totals of the buckets from index first up to the
+ * ones already in memory from the statistics file.
+ */
+static int load_buckets(stats_table *table, int64_t first){
+    if (first >= table->loaded_from){
+        return 0;
+    }
+    size_t count = (size_t)(table->loaded_from - first);
+    if (fseek(table->file, (long)(sizeof(stats_header) + (size_t)first * sizeof(stats_totals)), SEEK_SET) != 0 ||
+        fread(table->totals + first, sizeof(stats_totals), count, table->file) != count){
+        perror("Error reading glucose statistics");
+        return -1;
+    }
+    memset(table->deltas + first, 0, count * sizeof(stats_totals));
+    table->loaded_from = first;
+    return 0;
+}
+
+/**
+ * add_reading - Records one blood glucose reading in the bucket for its time, or with
+ * sign -1 takes out a reading an edit or deletion replaced.
+ * The running totals are brought up to date by finish_readings.
+ */
+static int add_reading(stats_table *table, int64_t timestamp, float blood_glucose_level, int sign){
+    stats_header *header = &table->header;
+    int64_t bucket = bucket_of(timestamp);
+
+    if (header->bucket_count == 0){
+        if (reserve_buckets(table, 1) != 0){
+            return -1;
+        }
+        memset(&table->totals[0], 0, sizeof(stats_totals));
+        memset(&table->deltas[0], 0, sizeof(stats_totals));
+        header->first_bucket = bucket;
+        header->bucket_count = 1;
+        table->loaded_from = 0;
+    } else if (bucket < header->first_bucket){
+        // An older reading: shift the table so it starts at the new bucket
+        int64_t shift = header->first_bucket - bucket;
+        if (header->bucket_count + shift > STATS_MAX_BUCKETS){
+            table->skipped++;
+            return 0;
+        }
+        if (reserve_buckets(table, header->bucket_count + shift) != 0 || load_buckets(table, 0) != 0){
+            return -1;
+        }
+        memmove(table->totals + shift, table->totals, (size_t)header->bucket_count * sizeof(stats_totals));
+        memmove(table->deltas + shift, table->deltas, (size_t)header->bucket_count * sizeof(stats_totals));
+        memset(table->totals, 0, (size_t)shift * sizeof(stats_totals));
+        memset(table->deltas, 0, (size_t)shift * sizeof(stats_totals));
+        header->first_bucket = bucket;
+        header->bucket_count += shift;
+        table->dirty_from = 0;
+    } else if (bucket >= header->first_bucket + header->bucket_count){
+        // A later reading: carry the running totals forward to its bucket
+        int64_t count = bucket - header->first_bucket + 1;
+        if (count > STATS_MAX_BUCKETS){
+            table->skipped++;
+            return 0;
+        }
+        if (reserve_buckets(table, count) != 0 || load_buckets(table, header->bucket_count - 1) != 0){
+            return -1;
+        }
+        for (int64_t i = header->bucket_count; i < count; i++){
+            table->totals[i] = table->totals[header->bucket_count - 1];
+            memset(&table->deltas[i], 0, sizeof(stats_totals));
+        }
+        header->bucket_count = count;
+    }
+
+    int64_t i = bucket - header->first_bucket;
+    if (load_buckets(table, i) != 0){
+        return -1;
+    }
+    stats_totals *delta = &table->deltas[i];
+    delta->count += sign;
+    if (blood_glucose_level < lower_target){
+        delta->below += sign;
+    } else if (blood_glucose_level <= upper_target){
+        delta->in_range += sign;
+    } else {
+        delta->above += sign;
+    }
+    delta->sum += sign * blood_glucose_level;
+    delta->sum_squares += sign * (double)blood_glucose_level * blood_glucose_level;
+
+    if (i < table->dirty_from){
+        table->dirty_from = i;
+    }
+    return 0;
+}
+
+/**
+ * finish_readings - Folds the readings added since loading into the running totals.
+ * Each bucket is visited once however many readings arrived out of order.
+ */
+static void finish_readings(stats_table *table){
+    stats_totals carry = {0};
+    for (int64_t i = table->dirty_from; i < table->header.bucket_count; i++){
+        add_totals(&carry, &table->deltas[i]);
+        add_totals(&table->totals[i], &carry);
+    }
+}
+
+// State passed through log_scan while totalling a text log
+typedef struct {
+    stats_table *table;
+    const char *data;             // Start of the mapped log, for reading replaced versions
+    size_t size;
+    int status;
+} stats_scan_context;
+
+/**
+ * total_scanned_entry - log_scan callback that adds the blood glucose reading of each entry.
+ * An edit or tombstone takes out the reading of the version it replaces, and an edit
+ * adds its own.
+ */
+static int total_scanned_entry(const scanned_entry *scanned, void *context){
+    stats_scan_context *scan = context;
+    if (scanned->kind == SCAN_BAD_TIME || scanned->kind == SCAN_CORRUPT || !scanned->has_timestamp){
+        return 0;
+    }
+
+    scanned_entry replaced;
+    if ((scanned->kind == SCAN_EDIT || scanned->kind == SCAN_DELETE) && scanned->replaces >= 0 &&
+        log_scan_record(scan->data, scan->size, (size_t)scanned->replaces, &replaced) == 0 &&
+        replaced.kind != SCAN_DELETE && (replaced.lines & SCAN_LINE_BLOOD_GLUCOSE)){
+        scan->status = add_reading(scan->table, (int64_t)replaced.timestamp, replaced.entry.blood_glucose_level, -1);
+    }
+    if (scan->status == 0 && scanned->kind != SCAN_DELETE && (scanned->lines & SCAN_LINE_BLOOD_GLUCOSE)){
+        scan->status = add_reading(scan->table, (int64_t)scanned->timestamp, scanned->entry.blood_glucose_level, 1);
+    }
+    return scan->status;
+}
+
+/**
+ * stats_text_tail - Adds the readings of a text log from header.indexed_size onwards.
+ */
+static int stats_text_tail(const char *log_filename, stats_table *table){
+    log_map map;
+    if (log_map_open(&map, log_filename) != 0){
+        return -1;
+    }
+
+    // Leave a record another process is still appending for the next update
+    size_t start = (size_t)table->header.indexed_size;
+    size_t end = map.size > start ? log_map_whole_end(&map) : start;
+
+    int status = 0;
+    if (end > start){
+        stats_scan_context scan = {table, map.data, map.size, 0};
+        log_scan(map.data + start, end - start, total_scanned_entry, &scan);
+        status = scan.status;
+        if (status == 0){
+            table->header.indexed_size = (int64_t)end;
+        }
+    }
+
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * stats_binary_tail - Adds the readings of a binary log from header.indexed_size onwards.
+ */
+static int stats_binary_tail(const char *log_filename, stats_table *table){
+    FILE *log = fopen(log_filename, "rb");
+    if (log == NULL){
+        return -1;
+    }
+
+    stats_header *header = &table->header;
+    if (header->indexed_size < (int64_t)sizeof(record_header)){
+        header->indexed_size = sizeof(record_header);
+    }
+    if (fseek(log, (long)header->indexed_size, SEEK_SET) != 0){
+        fclose(log);
+        return -1;
+    }
+
+    log_record records[STATS_RECORD_BATCH];
+    size_t count;
+    while ((count = fread(records, sizeof(log_record), STATS_RECORD_BATCH, log)) > 0){
+        for (size_t i = 0; i < count; i++){
+            // Damaged records are left out; edits and tombstones take out the reading of
+            // the version they replace
+            log_record replaced;
+            int status = 0;
+            if (!record_intact(&records[i])){
+                header->indexed_size += sizeof(log_record);
+                continue;
+            }
+            if ((records[i].flags & RECORD_FLAG_REVISION) && records[i].replaces >= 0 &&
+                pread(fileno(log), &replaced, sizeof(replaced), (off_t)records[i].replaces) == (ssize_t)sizeof(replaced) &&
+                record_intact(&replaced) &&
+                !(replaced.flags & RECORD_FLAG_DELETED) && (replaced.flags & RECORD_FLAG_BLOOD_GLUCOSE)){
+                status = add_reading(table, replaced.timestamp, replaced.blood_glucose_level, -1);
+            }
+            if (status == 0 && !(records[i].flags & RECORD_FLAG_DELETED) &&
+                (records[i].flags & RECORD_FLAG_BLOOD_GLUCOSE)){
+                status = add_reading(table, records[i].timestamp, records[i].blood_glucose_level, 1);
+            }
+            if (status != 0){
+                fclose(log);
+                return -1;
+            }
+            header->indexed_size += sizeof(log_record);
+        }
+    }
+
+    fclose(log);
+    return 0;
+}
+
+/**
+ * load_totals - Reads the header of a statistics file and makes room for its running
+ * totals, which are read by load_buckets as readings need them.
+ *
+ * @return: 0 for success, -1 if the file is damaged or does not match the log.
+ */
+static int load_totals(FILE *file, stats_table *table, int64_t log_size){
+    stats_header *header = &table->header;
+    struct stat file_stat;
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        strncmp(header->magic, STATS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->indexed_size > log_size ||
+        header->bucket_count < 0 || header->bucket_count > STATS_MAX_BUCKETS ||
+        fstat(fileno(file), &file_stat) != 0){
+        return -1;
+    }
+
+    // The totals are only read later, so a file cut short is caught here
+    if (file_stat.st_size < (off_t)(sizeof(stats_header) + (size_t)header->bucket_count * sizeof(stats_totals)) ||
+        reserve_buckets(table, header->bucket_count) != 0){
+        return -1;
+    }
+    table->file = file;
+    table->loaded_from = header->bucket_count;
+    return 0;
+}
+
+/**
+ * update_stats - Brings the statistics up to date with the log; see glucose_stats_update.
+ */
+static int update_stats(const char *log_filename){
+    struct stat log_stat;
+    if (stat(log_filename, &log_stat) != 0){
+        return -1;
+    }
+
+    char name[512];
+    stats_filename(log_filename, name, sizeof(name));
+
+    stats_table table;
+    memset(&table, 0, sizeof(table));
+
+    FILE *file = fopen(name, "r+b");
+    if (file == NULL || load_totals(file, &table, (int64_t)log_stat.st_size) != 0){
+        // Missing, damaged or stale: start again from the beginning of the log
+        if (file != NULL){
+            fclose(file);
+        }
+        file = fopen(name, "w+b");
+        if (file == NULL){
+            free(table.totals);
+            free(table.deltas);
+            return -1;
+        }
+        memset(&table.header, 0, sizeof(table.header));
+        table.file = file;
+        table.loaded_from = 0;
+        memcpy(table.header.magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+        if (fwrite(&table.header, sizeof(table.header), 1, file) != 1){
+            fclose(file);
+            free(table.totals);
+            free(table.deltas);
+            return -1;
+        }
+    }
+
+    if (table.header.indexed_size == (int64_t)log_stat.st_size){
+        fclose(file);
+        free(table.totals);
+        free(table.deltas);
+        return 0;
+    }
+
+    table.dirty_from = table.header.bucket_count;
+    int status = is_binary_log(log_filename) ? stats_binary_tail(log_filename, &table)
+                                             : stats_text_tail(log_filename, &table);
+
+    if (table.skipped > 0){
+        printf("Warning: %ld blood glucose readings are too far from the rest of the log to be included in statistics.\n",
+               table.skipped);
+    }
+
+    // Only buckets from the oldest new reading onwards change; the header is written last
+    if (status == 0){
+        finish_readings(&table);
+        int64_t changed = table.header.bucket_count - table.dirty_from;
+        if (changed > 0 &&
+            (fseek(file, (long)(sizeof(stats_header) + (size_t)table.dirty_from * sizeof(stats_totals)), SEEK_SET) != 0 ||
+             fwrite(table.totals + table.dirty_from, sizeof(stats_totals), (size_t)changed, file) != (size_t)changed)){
+            perror("Error writing glucose statistics");
+            status = -1;
+        }
+    }
+    if (status == 0){
+        rewind(file);
+        if (fwrite(&table.header, sizeof(table.header), 1, file) != 1){
+            perror("Error writing glucose statistics");
+            status = -1;
+        }
+    }
+    if (fclose(file) != 0){
+        status = -1;
+    }
+
+    free(table.totals);
+    free(table.deltas);
+    return status;
+}
+
+/**
+ * timed_update_stats - Runs update_stats, timing it.
+ */
+static int timed_update_stats(const char *log_filename){
+    uint64_t start = probe_begin();
+    int status = update_stats(log_filename);
+    probe_end(PROBE_STATS_UPDATE, start, 0);
+    return status;
+}
+
+int glucose_stats_update(const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = timed_update_stats(log_filename);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+/**
+ * read_totals - Reads the running totals of one bucket from an open statistics file.
+ */
+static int read_totals(FILE *file, int64_t i, stats_totals *totals){
+    if (fseek(file, (long)(sizeof(stats_header) + (size_t)i * sizeof(stats_totals)), SEEK_SET) != 0 ||
+        fread(totals, sizeof(*totals), 1, file) != 1){
+        return -1;
+    }
+    return 0;
+}
+
+void summarize_totals(const stats_totals *totals, glucose_summary *summary){
+    memset(summary, 0, sizeof(*summary));
+    summary->readings = (long)totals->count;
+    if (totals->count == 0){
+        return;
+    }
+
+    double count = (double)totals->count;
+    summary->below_percent = 100.0 * (double)totals->below / count;
+    summary->in_range_percent = 100.0 * (double)totals->in_range / count;
+    summary->above_percent = 100.0 * (double)totals->above / count;
+    summary->mean = totals->sum / count;
+    if (totals->count > 1){
+        double variance = (totals->sum_squares - totals->sum * totals->sum / count) / (count - 1);
+        summary->standard_deviation = variance > 0 ? sqrt(variance) : 0.0;
+    }
+    summary->coefficient_of_variation = summary->mean > 0 ? 100.0 * summary->standard_deviation / summary->mean : 0.0;
+    // GMI (%) = 3.31 + 0.02392 x mean glucose in mg/dL
+    summary->gmi = 3.31 + 0.02392 * convert_to_preferred_unit((float)summary->mean, "mg/dL");
+}
+
+/**
+ * stats_window - Totals a window for glucose_stats_totals while the sidecars are locked.
+ */
+static int stats_window(const char *log_filename, time_t start_time, time_t end_time, stats_totals *window){
+    memset(window, 0, sizeof(*window));
+
+    if (timed_update_stats(log_filename) != 0){
+        printf("Error updating glucose statistics.\n");
+        return -1;
+    }
+
+    char name[512];
+    stats_filename(log_filename, name, sizeof(name));
+    FILE *file = fopen(name, "rb");
+    if (file == NULL){
+        perror("Error opening glucose statistics");
+        return -1;
+    }
+
+    stats_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1){
+        fclose(file);
+        return -1;
+    }
+
+    int64_t first = bucket_of((int64_t)start_time) - header.first_bucket;
+    int64_t last = bucket_of((int64_t)end_time) - header.first_bucket;
+    if (first < 0){
+        first = 0;
+    }
+    if (last > header.bucket_count - 1){
+        last = header.bucket_count - 1;
+    }
+
+    // Totals for the window are the running totals at its end less those before its start
+    if (first <= last){
+        stats_totals before = {0};
+        if (read_totals(file, last, window) != 0 ||
+            (first > 0 && read_totals(file, first - 1, &before) != 0)){
+            printf("Error reading glucose statistics.\n");
+            fclose(file);
+            return -1;
+        }
+        window->count -= before.count;
+        window->below -= before.below;
+        window->in_range -= before.in_range;
+        window->above -= before.above;
+        window->sum -= before.sum;
+        window->sum_squares -= before.sum_squares;
+    }
+    fclose(file);
+    return 0;
+}
+
+int glucose_stats_totals(const char *log_filename, time_t start_time, time_t end_time, stats_totals *totals){
+    int lock = log_lock_sidecars(log_filename);
+    int status = stats_window(log_filename, start_time, end_time, totals);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+int glucose_stats_window(const char *log_filename, time_t start_time, time_t end_time, glucose_summary *summary){
+    stats_totals totals;
+    if (glucose_stats_totals(log_filename, start_time, end_time, &totals) != 0){
+        memset(summary, 0, sizeof(*summary));
+        return -1;
+    }
+    summarize_totals(&totals, summary);
+    return 0;
+}
+
+void display_glucose_summary(FILE *out, const glucose_summary *summary, const char *unit){
+    if (summary->readings == 0){
+        fprintf(out, "No blood glucose readings in this period.\n");
+        return;
+    }
+
+    fprintf(out, "Blood glucose readings: %ld\n", summary->readings);
+    fprintf(out, "Time in range (%.1f-%.1f %s): %.1f%%\n",
+           convert_to_preferred_unit(lower_target, unit), convert_to_preferred_unit(upper_target, unit), unit,
+           summary->in_range_percent);
+    fprintf(out, "Time below range: %.1f%%\n", summary->below_percent);
+    fprintf(out, "Time above range: %.1f%%\n", summary->above_percent);
+    fprintf(out, "Mean glucose: %.2f %s\n", convert_to_preferred_unit((float)summary->mean, unit), unit);
+    fprintf(out, "Standard deviation: %.2f %s\n", convert_to_preferred_unit((float)summary->standard_deviation, unit), unit);
+    fprintf(out, "Coefficient of variation: %.1f%%\n", summary->coefficient_of_variation);
+    fprintf(out, "GMI: %.1f%%\n", summary->gmi);
+}
+
+int view_glucose_stats(const char *filename, const char *time_filter){
+    return print_glucose_stats(stdout, filename, time_filter);
+}
+
+int print_glucose_stats(FILE *out, const char *filename, const char *time_filter){
+    time_t start_time;
+    if (time_filter_start(time_filter, &start_time) != 0){
+        return -1;
+    }
+
+    time_t end_time = time(NULL);
+    glucose_summary summary;
+    rollup_summary totals;
+    if (glucose_stats_window(filename, start_time, end_time, &summary) != 0 ||
+        rollup_window(filename, start_time, end_time, &totals) != 0){
+        return -1;
+    }
+
+    const char *unit = read_config("blood glucose unit");
+    fprintf(out, "\nGlucose Statistics\n");
+    display_glucose_summary(out, &summary, unit != NULL ? unit : "mmol/L");
+    display_rollup_summary(out, &totals, unit != NULL ? unit : "mmol/L");
+    return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef GLUCOSE_STATS_H
+#define GLUCOSE_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Running totals are kept in a sidecar file next to the log, e.g. data/logs.txt.stats
+#define STATS_SUFFIX ".stats"
+#define STATS_MAGIC "DMSSTA2"
+
+// Readings are totalled in buckets of this many seconds
+#define STATS_BUCKET_SECONDS 3600
+
+// Most buckets kept in one file (about 20 years of hourly buckets)
+#define STATS_MAX_BUCKETS (24L * 366 * 20)
+
+// Header at the start of the statistics file.
+typedef struct {
+    char magic[8];                // STATS_MAGIC, null terminated
+    int64_t indexed_size;         // Bytes of the log covered by the totals
+    int64_t first_bucket;         // Bucket number of the first totals record
+    int64_t bucket_count;         // Number of totals records that follow the header
+} stats_header;
+
+// Running totals of all readings up to and including one bucket.
+typedef struct {
+    int64_t count;                // Number of blood glucose readings
+    int64_t below;                // Readings below lower_target
+    int64_t in_range;             // Readings from lower_target to upper_target
+    int64_t above;                // Readings above upper_target
+    double sum;                   // Sum of readings in mmol/L
+    double sum_squares;           // Sum of squared readings
+} stats_totals;
+
+// Glycemic statistics for a time window.
+typedef struct {
+    long readings;                // Number of blood glucose readings in the window
+    double below_percent;         // Time below range, as a percentage of readings
+    double in_range_percent;      // Time in range
+    double above_percent;         // Time above range
+    double mean;                  // Mean glucose in mmol/L
+    double standard_deviation;    // Sample standard deviation in mmol/L
+    double coefficient_of_variation; // Standard deviation as a percentage of the mean
+    double gmi;                   // Glucose management indicator, as an estimated HbA1c percentage
+} glucose_summary;
+
+/**
+ * glucose_stats_update - Adds readings appended to the log since the last update to the running totals.
+ * Only the unread tail of the log is read, and only the totals from the oldest bucket
+ * it touches onwards are read and written back. The totals are rebuilt from scratch
+ * if they are missing, damaged or the log has been truncated.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int glucose_stats_update(const char *log_filename);
+
+/**
+ * glucose_stats_window - Computes glycemic statistics for a time window from the running totals.
+ * Only the totals at the two ends of the window are read, so the cost does not
+ * depend on the length of the window. Windows are resolved to whole buckets:
+ * the buckets holding start_time and end_time are both included.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param summary: Receives the statistics.
+ * @return: 0 for success, -1 for errors.
+ */
+int glucose_stats_window(const char *log_filename, time_t start_time, time_t end_time, glucose_summary *summary);
+
+/**
+ * glucose_stats_totals - Totals the readings of a time window from the running totals,
+ * for callers that combine windows of several logs before summarizing them.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param totals: Receives the totals.
+ * @return: 0 for success, -1 for errors.
+ */
+int glucose_stats_totals(const char *log_filename, time_t start_time, time_t end_time, stats_totals *totals);
+
+/**
+ * summarize_totals - Computes glycemic statistics from the totals of a window's readings.
+ *
+ * @param totals: Totals of the readings in the window.
+ * @param summary: Receives the statistics.
+ */
+void summarize_totals(const stats_totals *totals, glucose_summary *summary);
+
+/**
+ * display_glucose_summary - Prints glycemic statistics.
+ *
+ * @param out: Stream to print to.
+ * @param summary: The statistics to print.
+ * @param unit: The user's preferred unit ("mmol/L" or "mg/dL").
+ */
+void display_glucose_summary(FILE *out, const glucose_summary *summary, const char *unit);
+
+/**
+ * view_glucose_stats - Prints glycemic statistics from the start of a time filter until now,
+ * followed by the extremes, events, carbohydrates and insulin from the rollup tables.
+ *
+ * @param filename: File that contains log entries.
+ * @param time_filter: The time filter; "day", "week", "2 weeks", "month" or "90 days".
+ * @return: 0 for success, -1 for errors.
+ */
+int view_glucose_stats(const char *filename, const char *time_filter);
+
+/**
+ * print_glucose_stats - Prints the statistics view_glucose_stats shows to a stream.
+ *
+ * @param out: Stream to print to.
+ * @param filename: File that contains log entries.
+ * @param time_filter: The time filter; "day", "week", "2 weeks", "month" or "90 days".
+ * @return: 0 for success, -1 for errors.
+ */
+int print_glucose_stats(FILE *out, const char *filename, const char *time_filter);
+
+#endif
@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include "gorilla.h"
+#include "log_scan.h"
+#include "crc32c.h"
+#include <stddef.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The values of an entry, in the order they are stored
+#define GORILLA_FIELDS 8
+
+// Record flag a value is stored under
+static const uint16_t field_flags[GORILLA_FIELDS] = {
+    RECORD_FLAG_BLOOD_GLUCOSE, RECORD_FLAG_TARGET, RECORD_FLAG_CARBS, RECORD_FLAG_CARBS,
+    RECORD_FLAG_CORRECTION, RECORD_FLAG_CORRECTION, RECORD_FLAG_INSULIN, RECORD_FLAG_INSULIN_ON_BOARD
+};
+
+// Version 1 files have block table entries without a checksum
+#define GORILLA_V1_BLOCK_SIZE offsetof(gorilla_block, checksum)
+
+// Bits of the type and flags; version 3 added a ninth bit for the insulin on board
+#define META_FLAGS 0x1f
+#define META_TYPE_SHIFT 5
+#define META_TYPE_MASK 0x7
+#define META_INSULIN_ON_BOARD 0x100
+#define META_BITS 9
+#define META_V2_BITS 8
+
+// What the entry before left behind, which the next entry is stored against
+typedef struct {
+    int64_t timestamp;
+    int64_t delta;                // Gap between the last two entries
+    int meta;                     // Type and flags byte; -1 before the first entry
+    uint32_t values[GORILLA_FIELDS];
+    int leading[GORILLA_FIELDS];  // Zero bits above the changed bits last stored; -1 for none
+    int trailing[GORILLA_FIELDS]; // Zero bits below them
+} gorilla_state;
+
+// A growing buffer written a few bits at a time, most significant bit first
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint64_t bits;                // Bits not yet written to data, in the low pending bits
+    int pending;
+    int failed;
+} bit_writer;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t position;              // Bits read so far
+} bit_reader;
+
+/**
+ * reset_state - Starts a block: the first entry is stored against nothing.
+ */
+static void reset_state(gorilla_state *state){
+    memset(state, 0, sizeof(*state));
+    state->meta = -1;
+    for (int i = 0; i < GORILLA_FIELDS; i++){
+        state->leading[i] = -1;
+    }
+}
+
+/**
+ * record_values - Gets the bits of a record's values, in storage order.
+ */
+static void record_values(const log_record *record, uint32_t *values){
+    memcpy(&values[0], &record->blood_glucose_level, sizeof(uint32_t));
+    memcpy(&values[1], &record->target_blood_glucose, sizeof(uint32_t));
+    memcpy(&values[2], &record->meal_time_carbs, sizeof(uint32_t));
+    memcpy(&values[3], &record->carb_ratio, sizeof(uint32_t));
+    memcpy(&values[4], &record->correction_factor, sizeof(uint32_t));
+    memcpy(&values[5], &record->correction_dosage, sizeof(uint32_t));
+    memcpy(&values[6], &record->insulin_dosage, sizeof(uint32_t));
+    memcpy(&values[7], &record->insulin_on_board, sizeof(uint32_t));
+}
+
+/**
+ * set_record_values - Sets a record's values from their bits, in storage order.
+ */
+static void set_record_values(log_record *record, const uint32_t *values){
+    memcpy(&record->blood_glucose_level, &values[0], sizeof(uint32_t));
+    memcpy(&record->target_blood_glucose, &values[1], sizeof(uint32_t));
+    memcpy(&record->meal_time_carbs, &values[2], sizeof(uint32_t));
+    memcpy(&record->carb_ratio, &values[3], sizeof(uint32_t));
+    memcpy(&record->correction_factor, &values[4], sizeof(uint32_t));
+    memcpy(&record->correction_dosage, &values[5], sizeof(uint32_t));
+    memcpy(&record->insulin_dosage, &values[6], sizeof(uint32_t));
+    memcpy(&record->insulin_on_board, &values[7], sizeof(uint32_t));
+}
+
+/**
+ * write_bits - Appends the low count bits of a value, at most 32.
+ */
+static void write_bits(bit_writer *writer, uint64_t value, int count){
+    writer->bits = (writer->bits << count) | (value & ((UINT64_C(1) << count) - 1));
+    writer->pending += count;
+    while (writer->pending >= 8){
+        if (writer->size == writer->capacity){
+            size_t capacity = writer->capacity > 0 ? writer->capacity * 2 : 4096;
+            uint8_t *data = realloc(writer->data, capacity);
+            if (data == NULL){
+                writer->failed = 1;
+                writer->pending = 0;
+                return;
+            }
+            writer->data = data;
+            writer->capacity = capacity;
+        }
+        writer->pending -= 8;
+        writer->data[writer->size++] = (uint8_t)(writer->bits >> writer->pending);
+    }
+}
+
+/**
+ * finish_bits - Pads the bits written to a whole byte, so the next block starts on one.
+ */
+static void finish_bits(bit_writer *writer){
+    if (writer->pending > 0){
+        write_bits(writer, 0, 8 - writer->pending);
+    }
+}
+
+/**
+ * read_bits - Reads the next count bits, from 1 to 32. Reading past the end gives zeros;
+ * callers check the position afterwards.
+ */
+static uint32_t read_bits(bit_reader *reader, int count){
+    size_t byte = reader->position >> 3;
+    uint64_t window;
+    if (byte + sizeof(window) <= reader->size){
+        memcpy(&window, reader->data + byte, sizeof(window));
+        window = be64toh(window);
+    } else {
+        window = 0;
+        for (size_t i = 0; i < sizeof(window); i++){
+            window = (window << 8) | (byte + i < reader->size ? reader->data[byte + i] : 0);
+        }
+    }
+    int shift = (int)(reader->position & 7);
+    reader->position += (size_t)count;
+    return (uint32_t)((window << shift) >> (64 - count));
+}
+
+/**
+ * fits - Checks whether a value can be stored as a signed number of bits.
+ */
+static int fits(int64_t value, int bits){
+    return value >= -(INT64_C(1) << (bits - 1)) && value < (INT64_C(1) << (bits - 1));
+}
+
+/**
+ * sign_extend - Reads back a signed number stored in a number of bits.
+ */
+static int64_t sign_extend(uint64_t value, int bits){
+    return (int64_t)(value << (64 - bits)) >> (64 - bits);
+}
+
+/**
+ * write_timestamp - Stores an entry time as its delta of delta: '0' for none, or a
+ * prefix choosing how many bits hold it.
+ */
+static void write_timestamp(bit_writer *writer, gorilla_state *state, int64_t timestamp, int first){
+    if (first){
+        write_bits(writer, (uint64_t)timestamp >> 32, 32);
+        write_bits(writer, (uint64_t)timestamp, 32);
+    } else {
+        int64_t delta = timestamp - state->timestamp;
+        int64_t change = delta - state->delta;
+        if (change == 0){
+            write_bits(writer, 0, 1);
+        } else if (fits(change, 7)){
+            write_bits(writer, 0x2, 2);
+            write_bits(writer, (uint64_t)change, 7);
+        } else if (fits(change, 9)){
+            write_bits(writer, 0x6, 3);
+            write_bits(writer, (uint64_t)change, 9);
+        } else if (fits(change, 12)){
+            write_bits(writer, 0xe, 4);
+            write_bits(writer, (uint64_t)change, 12);
+        } else {
+            write_bits(writer, 0xf, 4);
+            write_bits(writer, (uint64_t)change >> 32, 32);
+            write_bits(writer, (uint64_t)change, 32);
+        }
+        state->delta = delta;
+    }
+    state->timestamp = timestamp;
+}
+
+static int64_t read_timestamp(bit_reader *reader, gorilla_state *state, int first){
+    if (first){
+        uint64_t high = read_bits(reader, 32);
+        state->timestamp = (int64_t)((high << 32) | read_bits(reader, 32));
+        return state->timestamp;
+    }
+
+    int64_t change = 0;
+    if (read_bits(reader, 1) != 0){
+        if (read_bits(reader, 1) == 0){
+            change = sign_extend(read_bits(reader, 7), 7);
+        } else if (read_bits(reader, 1) == 0){
+            change = sign_extend(read_bits(reader, 9), 9);
+        } else if (read_bits(reader, 1) == 0){
+            change = sign_extend(read_bits(reader, 12), 12);
+        } else {
+            uint64_t high = read_bits(reader, 32);
+            change = (int64_t)((high << 32) | read_bits(reader, 32));
+        }
+    }
+    state->delta += change;
+    state->timestamp += state->delta;
+    return state->timestamp;
+}
+
+/**
+ * write_value - Stores a value XORed with the one before: '0' if it did not change,
+ * '10' and the changed bits if they fall within the window stored last, or '11', the
+ * new window and the changed bits.
+ */
+static void write_value(bit_writer *writer, gorilla_state *state, int field, uint32_t value){
+    uint32_t change = value ^ state->values[field];
+    state->values[field] = value;
+    if (change == 0){
+        write_bits(writer, 0, 1);
+        return;
+    }
+
+    int leading = __builtin_clz(change);
+    int trailing = __builtin_ctz(change);
+    if (leading > 31){
+        leading = 31;
+    }
+    if (state->leading[field] >= 0 && leading >= state->leading[field] && trailing >= state->trailing[field]){
+        write_bits(writer, 0x2, 2);
+        write_bits(writer, change >> state->trailing[field], 32 - state->leading[field] - state->trailing[field]);
+        return;
+    }
+
+    int length = 32 - leading - trailing;
+    write_bits(writer, 0x3, 2);
+    write_bits(writer, (uint64_t)leading, 5);
+    write_bits(writer, (uint64_t)(length - 1), 5);
+    write_bits(writer, change >> trailing, length);
+    state->leading[field] = leading;
+    state->trailing[field] = trailing;
+}
+
+static void read_value(bit_reader *reader, gorilla_state *state, int field){
+    if (read_bits(reader, 1) == 0){
+        return;
+    }
+    if (read_bits(reader, 1) == 0){
+        // A value is never stored against the window before one exists
+        if (state->leading[field] < 0){
+            reader->position = reader->size * 8 + 1;
+            return;
+        }
+    } else {
+        state->leading[field] = (int)read_bits(reader, 5);
+        int length = (int)read_bits(reader, 5) + 1;
+        state->trailing[field] = 32 - state->leading[field] - length;
+        if (state->trailing[field] < 0){
+            reader->position = reader->size * 8 + 1;
+            return;
+        }
+    }
+    int length = 32 - state->leading[field] - state->trailing[field];
+    state->values[field] ^= read_bits(reader, length) << state->trailing[field];
+}
+
+/**
+ * write_entry - Stores one entry: its time, its type and flags, then its values.
+ */
+static void write_entry(bit_writer *writer, gorilla_state *state, const log_record *record, int first){
+    write_timestamp(writer, state, record->timestamp, first);
+
+    uint16_t flags = record->flags & (META_FLAGS | RECORD_FLAG_INSULIN_ON_BOARD);
+    int meta = (flags & META_FLAGS) | ((record->entry_type & META_TYPE_MASK) << META_TYPE_SHIFT) |
+               (flags & RECORD_FLAG_INSULIN_ON_BOARD ? META_INSULIN_ON_BOARD : 0);
+    if (meta == state->meta){
+        write_bits(writer, 0, 1);
+    } else {
+        write_bits(writer, 1, 1);
+        write_bits(writer, (uint64_t)meta, META_BITS);
+        state->meta = meta;
+    }
+
+    uint32_t values[GORILLA_FIELDS];
+    record_values(record, values);
+    for (int i = 0; i < GORILLA_FIELDS; i++){
+        if (flags & field_flags[i]){
+            write_value(writer, state, i, values[i]);
+        }
+    }
+}
+
+/**
+ * read_entry - Reads back one entry stored by write_entry.
+ *
+ * @param meta_bits: Bits the type and flags take in the file's version.
+ */
+static void read_entry(bit_reader *reader, gorilla_state *state, log_record *record, int first, int meta_bits){
+    memset(record, 0, sizeof(*record));
+    record->timestamp = read_timestamp(reader, state, first);
+    if (read_bits(reader, 1) != 0){
+        state->meta = (int)read_bits(reader, meta_bits);
+    }
+    record->flags = (uint16_t)((state->meta & META_FLAGS) |
+                               (state->meta & META_INSULIN_ON_BOARD ? RECORD_FLAG_INSULIN_ON_BOARD : 0));
+    record->entry_type = (uint16_t)((state->meta >> META_TYPE_SHIFT) & META_TYPE_MASK);
+
+    uint32_t values[GORILLA_FIELDS] = {0};
+    for (int i = 0; i < GORILLA_FIELDS; i++){
+        if (record->flags & field_flags[i]){
+            read_value(reader, state, i);
+            values[i] = state->values[i];
+        }
+    }
+    set_record_values(record, values);
+}
+
+/**
+ * block_checksum - Computes the checksum of a block: its table entry up to the
+ * checksum, then its bytes.
+ */
+static uint32_t block_checksum(const gorilla_block *block, const uint8_t *data){
+    return crc32c(crc32c(0, block, offsetof(gorilla_block, checksum)), data, block->size);
+}
+
+int gorilla_write(const char *filename, const log_record *records, size_t count, int64_t *size){
+    size_t block_count = (count + GORILLA_BLOCK_ENTRIES - 1) / GORILLA_BLOCK_ENTRIES;
+    gorilla_header header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, GORILLA_MAGIC);
+    header.version = GORILLA_VERSION;
+    header.block_count = (uint32_t)block_count;
+    header.entry_count = (int64_t)count;
+
+    gorilla_block *blocks = calloc(block_count > 0 ? block_count : 1, sizeof(gorilla_block));
+    if (blocks == NULL){
+        perror("Error compressing log segment");
+        return -1;
+    }
+
+    // Blocks are encoded one after another into one buffer, then written behind the table
+    bit_writer writer = {NULL, 0, 0, 0, 0, 0};
+    uint64_t data_offset = sizeof(header) + block_count * sizeof(gorilla_block);
+    for (size_t b = 0; b < block_count; b++){
+        size_t first = b * GORILLA_BLOCK_ENTRIES;
+        size_t last = first + GORILLA_BLOCK_ENTRIES < count ? first + GORILLA_BLOCK_ENTRIES : count;
+        gorilla_state state;
+        reset_state(&state);
+        size_t start = writer.size;
+        blocks[b].min_timestamp = records[first].timestamp;
+        blocks[b].max_timestamp = records[first].timestamp;
+        for (size_t i = first; i < last; i++){
+            write_entry(&writer, &state, &records[i], i == first);
+            if (records[i].timestamp < blocks[b].min_timestamp){
+                blocks[b].min_timestamp = records[i].timestamp;
+            }
+            if (records[i].timestamp > blocks[b].max_timestamp){
+                blocks[b].max_timestamp = records[i].timestamp;
+            }
+        }
+        finish_bits(&writer);
+        blocks[b].offset = data_offset + start;
+        blocks[b].entries = (uint32_t)(last - first);
+        blocks[b].size = (uint32_t)(writer.size - start);
+
+        if (b == 0 || blocks[b].min_timestamp < header.min_timestamp){
+            header.min_timestamp = blocks[b].min_timestamp;
+        }
+        if (b == 0 || blocks[b].max_timestamp > header.max_timestamp){
+            header.max_timestamp = blocks[b].max_timestamp;
+        }
+    }
+    if (writer.failed){
+        perror("Error compressing log segment");
+        free(writer.data);
+        free(blocks);
+        return -1;
+    }
+    for (size_t b = 0; b < block_count; b++){
+        blocks[b].checksum = block_checksum(&blocks[b], writer.data + (blocks[b].offset - data_offset));
+    }
+
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL){
+        perror("Error creating log segment");
+        free(writer.data);
+        free(blocks);
+        return -1;
+    }
+    int status = 0;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        (block_count > 0 && fwrite(blocks, sizeof(gorilla_block), block_count, out) != block_count) ||
+        (writer.size > 0 && fwrite(writer.data, 1, writer.size, out) != writer.size) ||
+        fflush(out) != 0 || fsync(fileno(out)) != 0){
+        perror("Error writing log segment");
+        status = -1;
+    }
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    if (status != 0){
+        unlink(filename);
+    } else if (size != NULL){
+        *size = (int64_t)(data_offset + writer.size);
+    }
+    free(writer.data);
+    free(blocks);
+    return status;
+}
+
+int gorilla_read(const char *filename, time_t start_time, time_t end_time, gorilla_callback callback, void *context){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+
+    gorilla_header header;
+    if (map.size < sizeof(header)){
+        printf("Error: %s is not a compressed log segment.\n", filename);
+        log_map_close(&map);
+        return -1;
+    }
+    memcpy(&header, map.data, sizeof(header));
+    size_t table_entry = header.version == 1 ? GORILLA_V1_BLOCK_SIZE : sizeof(gorilla_block);
+    if (memcmp(header.magic, GORILLA_MAGIC, sizeof(GORILLA_MAGIC)) != 0 ||
+        header.version < 1 || header.version > GORILLA_VERSION ||
+        (map.size - sizeof(header)) / table_entry < header.block_count){
+        printf("Error: %s is not a compressed log segment.\n", filename);
+        log_map_close(&map);
+        return -1;
+    }
+
+    int status = 0;
+    for (uint32_t b = 0; b < header.block_count && status == 0; b++){
+        gorilla_block block = {0};
+        memcpy(&block, map.data + sizeof(header) + b * table_entry, table_entry);
+        if (block.max_timestamp < (int64_t)start_time || block.min_timestamp > (int64_t)end_time){
+            continue;
+        }
+        if (block.offset > map.size || block.size > map.size - block.offset){
+            printf("Error: log segment %s is damaged.\n", filename);
+            status = -1;
+            break;
+        }
+        if (header.version > 1 && block_checksum(&block, (const uint8_t *)map.data + block.offset) != block.checksum){
+            printf("Error: block %u of log segment %s is damaged; its %u entries are skipped.\n",
+                   (unsigned int)b, filename, (unsigned int)block.entries);
+            continue;
+        }
+
+        bit_reader reader = {(const uint8_t *)map.data + block.offset, block.size, 0};
+        gorilla_state state;
+        reset_state(&state);
+        for (uint32_t i = 0; i < block.entries; i++){
+            log_record record;
+            read_entry(&reader, &state, &record, i == 0, header.version >= 3 ? META_BITS : META_V2_BITS);
+            if (reader.position > reader.size * 8){
+                printf("Error: log segment %s is damaged.\n", filename);
+                status = -1;
+                break;
+            }
+            if (record.timestamp >= (int64_t)start_time && record.timestamp <= (int64_t)end_time){
+                status = callback(&record, context);
+                if (status != 0){
+                    break;
+                }
+            }
+        }
+    }
+
+    log_map_close(&map);
+    return status;
+}
+
+int gorilla_verify(FILE *out, const char *filename){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+
+    gorilla_header header;
+    size_t table_entry = sizeof(gorilla_block);
+    if (map.size >= sizeof(header)){
+        memcpy(&header, map.data, sizeof(header));
+        table_entry = header.version == 1 ? GORILLA_V1_BLOCK_SIZE : sizeof(gorilla_block);
+    }
+    if (map.size < sizeof(header) || memcmp(header.magic, GORILLA_MAGIC, sizeof(GORILLA_MAGIC)) != 0 ||
+        header.version < 1 || header.version > GORILLA_VERSION ||
+        (map.size - sizeof(header)) / table_entry < header.block_count){
+        fprintf(out, "Damaged: %s has no valid segment header.\n", filename);
+        log_map_close(&map);
+        return 1;
+    }
+
+    uint32_t damaged = 0;
+    for (uint32_t b = 0; b < header.block_count; b++){
+        gorilla_block block = {0};
+        memcpy(&block, map.data + sizeof(header) + b * table_entry, table_entry);
+        if (block.offset > map.size || block.size > map.size - block.offset){
+            fprintf(out, "Damaged: block %u of %s lies outside the file.\n", (unsigned int)b, filename);
+            damaged++;
+        } else if (header.version > 1 &&
+                   block_checksum(&block, (const uint8_t *)map.data + block.offset) != block.checksum){
+            fprintf(out, "Damaged: bytes %llu-%llu: block %u does not match its checksum (%u entries).\n",
+                    (unsigned long long)block.offset, (unsigned long long)(block.offset + block.size) - 1,
+                    (unsigned int)b, (unsigned int)block.entries);
+            damaged++;
+        }
+    }
+    fprintf(out, "%s: %u blocks of %lld entries intact, %u damaged%s.\n", filename,
+            (unsigned int)(header.block_count - damaged), (long long)header.entry_count, (unsigned int)damaged,
+            header.version == 1 ? " (written without checksums)" : "");
+    log_map_close(&map);
+    return damaged > 0 ? 1 : 0;
+}
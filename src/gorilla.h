@@ -0,0 +1,93 @@
+#ifndef GORILLA_H
+#define GORILLA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "records.h"
+
+// Compressed segment files start with this magic and format version
+#define GORILLA_MAGIC "DMSGOR1"
+#define GORILLA_VERSION 3
+
+// Entries are compressed in blocks of this many; each block can be decoded on its own
+#define GORILLA_BLOCK_ENTRIES 1024
+
+// Header at the start of a compressed segment file, followed by the block table and
+// then the blocks.
+typedef struct {
+    char magic[8];                // GORILLA_MAGIC, null terminated
+    uint32_t version;             // GORILLA_VERSION
+    uint32_t block_count;         // Entries in the block table
+    int64_t entry_count;          // Entries in all blocks
+    int64_t min_timestamp;        // Earliest entry time; 0 without entries
+    int64_t max_timestamp;        // Latest entry time; 0 without entries
+} gorilla_header;
+
+// One block table entry. Version 1 files have entries without the last two members.
+typedef struct {
+    int64_t min_timestamp;        // Earliest entry time in the block
+    int64_t max_timestamp;        // Latest entry time in the block
+    uint64_t offset;              // Byte offset of the block in the file
+    uint32_t entries;             // Entries in the block
+    uint32_t size;                // Bytes in the block
+    uint32_t checksum;            // CRC-32C of the members above, then the block's bytes
+    uint32_t reserved;            // Zeroed
+} gorilla_block;
+
+// Within a block, entries are a stream of bits in the style of Facebook's Gorilla
+// time series store. Each time is stored as the change in the gap since the entry
+// before (delta of delta), which is a single bit for readings at a steady interval.
+// Each value present is XORed with the same value of the entry before: a value that
+// did not change is a single bit, and one that did is stored as its changed bits
+// alone. The entry type and flags take a bit when they did not change.
+
+/**
+ * gorilla_callback - Called for each entry found by gorilla_read.
+ *
+ * @param record: The entry, with its time, type, flags and values; only valid during the call.
+ * @param context: The context passed to gorilla_read.
+ * @return: 0 to continue, anything else to stop.
+ */
+typedef int (*gorilla_callback)(const log_record *record, void *context);
+
+/**
+ * gorilla_write - Compresses entries into a new segment file and forces it to disk.
+ * Only each entry's time, type, flags and values are kept. Entries are stored in the
+ * order given.
+ *
+ * @param filename: Name of the file to create; replaced if it exists.
+ * @param records: The entries.
+ * @param count: Number of entries.
+ * @param size: Receives the size of the file in bytes; may be NULL.
+ * @return: 0 for success, -1 for errors.
+ */
+int gorilla_write(const char *filename, const log_record *records, size_t count, int64_t *size);
+
+/**
+ * gorilla_read - Decodes the entries of a segment file within a time window, in the
+ * order they were stored. Blocks holding no entries in the window are skipped
+ * without being decoded, and so are blocks that do not match their checksum, with
+ * an error message.
+ *
+ * @param filename: Name of the segment file.
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param callback: Function called for each entry in the window.
+ * @param context: Passed through to the callback.
+ * @return: 0 for success, -1 for errors, or the non-zero value returned by the callback.
+ */
+int gorilla_read(const char *filename, time_t start_time, time_t end_time, gorilla_callback callback, void *context);
+
+/**
+ * gorilla_verify - Checks every block of a segment file against its checksum and prints
+ * the byte ranges of the blocks that are damaged, then a count of the blocks checked.
+ *
+ * @param out: Stream to print the report to.
+ * @param filename: Name of the segment file.
+ * @return: 0 if nothing is damaged, 1 if something is, -1 for errors.
+ */
+int gorilla_verify(FILE *out, const char *filename);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include "import.h"
+#include "calculations.h"
+#include "config.h"
+#include "local_time.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Number of columns in an import row
+#define IMPORT_COLUMNS 6
+
+// Input buffer size for the CSV stream
+#define IMPORT_READ_BUFFER (1 << 20)
+
+
+/**
+ * parse_number - Parses a whole field as a float.
+ *
+ * @return: 0 for success, -1 if the field is not a number.
+ */
+static int parse_number(const char *field, float *value){
+    char *end;
+    float parsed = strtof(field, &end);
+    if (end == field || *end != '\0'){
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+/**
+ * parse_time - Parses a local "YYYY-MM-DD HH:MM:SS" time or epoch seconds.
+ *
+ * @return: 0 for success, -1 if the field is not a valid time.
+ */
+static int parse_time(const char *field, time_t *timestamp){
+    if (*field == '\0'){
+        return -1;
+    }
+
+    // All digits: seconds since the epoch
+    if (strspn(field, "0123456789") == strlen(field)){
+        *timestamp = (time_t)strtoll(field, NULL, 10);
+        return 0;
+    }
+
+    int year, month, day, hour, minute, second;
+    int consumed = 0;
+    if (sscanf(field, "%d-%d-%d %d:%d:%d%n", &year, &month, &day,
+               &hour, &minute, &second, &consumed) != 6 ||
+        field[consumed] != '\0' ||
+        month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 ||
+        second < 0 || second > 60){
+        return -1;
+    }
+
+    // The zone table works out daylight saving time
+    *timestamp = local_time_to_epoch(year, month, day, hour, minute, second);
+    return 0;
+}
+
+/**
+ * split_row - Splits a CSV row into trimmed fields in place.
+ *
+ * @return: Number of fields found.
+ */
+static int split_row(char *line, char *fields[], int max_fields){
+    line[strcspn(line, "\r\n")] = '\0';
+
+    int count = 0;
+    char *field = line;
+    while (count < max_fields){
+        char *comma = strchr(field, ',');
+        if (comma != NULL){
+            *comma = '\0';
+        }
+        fields[count++] = trimwhitespace(field);
+        if (comma == NULL){
+            break;
+        }
+        field = comma + 1;
+    }
+    return count;
+}
+
+int parse_import_row(char *line, const log_entry *settings, storage *store, log_entry *entry,
+                     time_t *timestamp, const char **error){
+    char *fields[IMPORT_COLUMNS + 1];
+    int count = split_row(line, fields, IMPORT_COLUMNS + 1);
+    if (count != IMPORT_COLUMNS){
+        *error = "expected 6 columns: time,type,glucose,unit,carbs,dose";
+        return -1;
+    }
+
+    const char *time_field = fields[0];
+    const char *type_field = fields[1];
+    const char *glucose_field = fields[2];
+    const char *unit_field = fields[3];
+    const char *carbs_field = fields[4];
+    const char *dose_field = fields[5];
+
+    if (parse_time(time_field, timestamp) != 0){
+        *error = "invalid time";
+        return -1;
+    }
+
+    // Start from the configured settings, as an interactive entry does
+    *entry = *settings;
+    entry->blood_glucose_level_flag = 0;
+    entry->target_blood_glucose_flag = 0;
+    entry->meal_time_carbs_flag = 0;
+    entry->correction_dosage_flag = 0;
+    entry->insulin_dosage_flag = 0;
+    entry->insulin_on_board_flag = 0;
+
+    const char *types[] = {"meal", "snack", "correction", "other"};
+    int type = -1;
+    for (int i = 0; i < 4; i++){
+        if (strcasecmp(type_field, types[i]) == 0){
+            type = i;
+        }
+    }
+    if (type < 0){
+        *error = "type must be meal, snack, correction or other";
+        return -1;
+    }
+    strcpy(entry->entry_type, types[type]);
+    int carb_entry = strcmp(entry->entry_type, "meal") == 0 || strcmp(entry->entry_type, "snack") == 0;
+
+    if (*unit_field != '\0'){
+        if (strcmp(unit_field, "mmol/L") != 0 && strcmp(unit_field, "mg/dL") != 0){
+            *error = "unit must be mmol/L or mg/dL";
+            return -1;
+        }
+        strcpy(entry->unit, unit_field);
+    }
+
+    if (*glucose_field != '\0'){
+        float blood_glucose;
+        if (parse_number(glucose_field, &blood_glucose) != 0 || blood_glucose < 0){
+            *error = "invalid blood glucose";
+            return -1;
+        }
+        //Convert blood glucose to standard unit for storing
+        entry->blood_glucose_level = convert_to_mmol_L(blood_glucose, entry->unit);
+        entry->blood_glucose_level_flag = 1;
+
+        if (strcmp(entry->entry_type, "other") != 0){
+            entry->target_blood_glucose = convert_to_mmol_L(settings->target_blood_glucose, settings->unit);
+            entry->target_blood_glucose_flag = 1;
+        }
+    }
+    // Glucose and target are in mmol/L from here on, so calculate_dosages must not convert them again
+    strcpy(entry->unit, "mmol/L");
+
+    if (*carbs_field != '\0'){
+        if (!carb_entry){
+            *error = "carbs are only logged for meal or snack entries";
+            return -1;
+        }
+        if (parse_number(carbs_field, &entry->meal_time_carbs) != 0 || entry->meal_time_carbs < 0){
+            *error = "invalid carbs";
+            return -1;
+        }
+        entry->meal_time_carbs_flag = 1;
+    }
+
+    if (strcasecmp(dose_field, "calc") == 0){
+        if (strcmp(entry->entry_type, "other") == 0){
+            *error = "doses are not calculated for other entries";
+            return -1;
+        }
+        if (store != NULL){
+            if (storage_insulin_on_board(store, *timestamp, 0, &entry->insulin_on_board) != 0){
+                *error = "insulin on board could not be worked out";
+                return -1;
+            }
+            entry->insulin_on_board_flag = 1;
+        }
+        calculate_dosages(entry);
+    } else if (*dose_field != '\0'){
+        if (parse_number(dose_field, &entry->insulin_dosage) != 0 || entry->insulin_dosage < 0){
+            *error = "invalid dose";
+            return -1;
+        }
+        entry->insulin_dosage_flag = 1;
+    }
+
+    if (!entry->blood_glucose_level_flag && !entry->meal_time_carbs_flag && !entry->insulin_dosage_flag){
+        *error = "row has no glucose, carbs or dose";
+        return -1;
+    }
+    return 0;
+}
+
+int import_csv(FILE *input, const char *source_name, storage *store, const log_entry *settings){
+    static char read_buffer[IMPORT_READ_BUFFER];
+    setvbuf(input, read_buffer, _IOFBF, sizeof(read_buffer));
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    char line[IMPORT_LINE_MAX];
+    long line_number = 0;
+    long imported = 0;
+    long skipped = 0;
+    int status = 0;
+
+    while (fgets(line, sizeof(line), input) != NULL){
+        line_number++;
+
+        if (strchr(line, '\n') == NULL && !feof(input)){
+            printf("%s:%ld: line too long, skipped\n", source_name, line_number);
+            skipped++;
+            int c;
+            while ((c = fgetc(input)) != '\n' && c != EOF);
+            continue;
+        }
+
+        // Skip blank lines and a header row
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0' || (line_number == 1 && strncasecmp(start, "time", 4) == 0)){
+            continue;
+        }
+
+        log_entry entry;
+        time_t timestamp;
+        const char *error;
+        if (parse_import_row(line, settings, store, &entry, &timestamp, &error) != 0){
+            printf("%s:%ld: %s, skipped\n", source_name, line_number, error);
+            skipped++;
+            continue;
+        }
+
+        if (storage_append(store, &entry, timestamp) != 0){
+            status = -1;
+            break;
+        }
+        imported++;
+    }
+
+    if (ferror(input)){
+        perror("Error reading import file");
+        status = -1;
+    }
+    if (storage_sync(store) != 0){
+        status = -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    printf("Imported %ld entries (%ld skipped) in %.3f s (%.0f entries/s).\n",
+           imported, skipped, seconds, seconds > 0 ? imported / seconds : 0.0);
+    return status;
+}
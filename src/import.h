@@ -0,0 +1,50 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stdio.h>
+#include <time.h>
+#include "logging.h"
+#include "storage.h"
+
+// Longest CSV line accepted by the importer
+#define IMPORT_LINE_MAX 512
+
+// Default durability for imports: one fsync per this many entries
+#define IMPORT_SYNC_EVERY 4096
+
+/**
+ * parse_import_row - Parses one CSV row of a meter/CGM export into a log entry.
+ *
+ * Columns: time,type,glucose,unit,carbs,dose
+ *   time:    "YYYY-MM-DD HH:MM:SS" in local time, or seconds since the epoch.
+ *   type:    meal, snack, correction or other.
+ *   glucose: blood glucose reading; may be empty.
+ *   unit:    mmol/L or mg/dL; empty uses the configured unit.
+ *   carbs:   carbohydrates in grams; may be empty.
+ *   dose:    insulin units given, "calc" to calculate the suggested dose, or empty.
+ *
+ * @param line: The CSV row; modified while parsing.
+ * @param settings: Configured ratios, target and unit (from log_config).
+ * @param store: The log calculated doses take insulin on board from, or NULL to leave it out.
+ * @param entry: Receives the entry, with glucose converted to mmol/L.
+ * @param timestamp: Receives the time of the entry.
+ * @param error: Receives a description of the problem when the row is rejected.
+ * @return: 0 for success, -1 if the row is invalid.
+ */
+int parse_import_row(char *line, const log_entry *settings, storage *store, log_entry *entry,
+                     time_t *timestamp, const char **error);
+
+/**
+ * import_csv - Streams CSV rows into an open log.
+ * Invalid rows are reported with their line number and skipped. A header row
+ * starting with "time" is ignored. Prints the import throughput when done.
+ *
+ * @param input: The CSV stream (a file or stdin).
+ * @param source_name: Name of the input for messages.
+ * @param store: The open log.
+ * @param settings: Configured ratios, target and unit (from log_config).
+ * @return: 0 for success, -1 if reading or writing failed.
+ */
+int import_csv(FILE *input, const char *source_name, storage *store, const log_entry *settings);
+
+#endif
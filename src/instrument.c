@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include "instrument.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+int instrument_enabled = 0;
+_Thread_local probe_totals probes[PROBE_COUNT];
+
+// Totals handed over by worker threads
+static probe_totals exited[PROBE_COUNT];
+static pthread_mutex_t exited_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Names used in reports, indexed by probe_id
+static const char *probe_names[PROBE_COUNT] = {
+    "config_read",
+    "config_load",
+    "config_update",
+    "log_open",
+    "log_append",
+    "log_write",
+    "log_fsync",
+    "log_scan",
+    "parse_line",
+    "time_convert",
+    "time_cached",
+    "index_update",
+    "ids_update",
+    "stats_update",
+    "rollup_update",
+    "render",
+    "query",
+    "agp",
+};
+
+
+uint64_t instrument_now_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void instrument_enable(int enabled){
+    instrument_enabled = enabled != 0;
+}
+
+void instrument_reset(void){
+    memset(probes, 0, sizeof(probes));
+    pthread_mutex_lock(&exited_lock);
+    memset(exited, 0, sizeof(exited));
+    pthread_mutex_unlock(&exited_lock);
+}
+
+/**
+ * add_totals - Adds one set of probe totals to another.
+ */
+static void add_totals(probe_totals *to, const probe_totals *from){
+    for (int i = 0; i < PROBE_COUNT; i++){
+        to[i].count += from[i].count;
+        to[i].total_ns += from[i].total_ns;
+        to[i].bytes += from[i].bytes;
+        if (from[i].max_ns > to[i].max_ns){
+            to[i].max_ns = from[i].max_ns;
+        }
+    }
+}
+
+void instrument_thread_exit(void){
+    if (!instrument_enabled){
+        return;
+    }
+    pthread_mutex_lock(&exited_lock);
+    add_totals(exited, probes);
+    pthread_mutex_unlock(&exited_lock);
+    memset(probes, 0, sizeof(probes));
+}
+
+/**
+ * session_totals - Totals of the calling thread and every thread that has exited.
+ */
+static void session_totals(probe_totals *totals){
+    memcpy(totals, probes, sizeof(probes));
+    pthread_mutex_lock(&exited_lock);
+    add_totals(totals, exited);
+    pthread_mutex_unlock(&exited_lock);
+}
+
+void instrument_report(FILE *out){
+    probe_totals totals[PROBE_COUNT];
+    session_totals(totals);
+
+    fprintf(out, "\nSession Statistics\n");
+    fprintf(out, "%-14s %10s %12s %10s %10s %14s\n", "Probe", "Count", "Total ms", "Mean us", "Max us", "Bytes");
+    for (int i = 0; i < PROBE_COUNT; i++){
+        const probe_totals *probe = &totals[i];
+        if (probe->count == 0){
+            continue;
+        }
+        // Counted-only probes have no time
+        if (probe->total_ns == 0){
+            fprintf(out, "%-14s %10llu %12s %10s %10s %14s\n", probe_names[i],
+                    (unsigned long long)probe->count, "-", "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-14s %10llu %12.3f %10.2f %10.2f %14llu\n", probe_names[i],
+                (unsigned long long)probe->count, probe->total_ns / 1e6,
+                probe->total_ns / 1e3 / (double)probe->count, probe->max_ns / 1e3,
+                (unsigned long long)probe->bytes);
+    }
+}
+
+int instrument_dump_json(const char *filename){
+    FILE *out = fopen(filename, "a");
+    if (out == NULL){
+        perror("Error opening statistics file");
+        return -1;
+    }
+
+    probe_totals totals[PROBE_COUNT];
+    session_totals(totals);
+
+    fprintf(out, "{\"time\": %lld, \"probes\": {", (long long)time(NULL));
+    for (int i = 0; i < PROBE_COUNT; i++){
+        const probe_totals *probe = &totals[i];
+        fprintf(out, "%s\"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"bytes\": %llu}",
+                i == 0 ? "" : ", ", probe_names[i], (unsigned long long)probe->count,
+                (unsigned long long)probe->total_ns, (unsigned long long)probe->max_ns,
+                (unsigned long long)probe->bytes);
+    }
+    fprintf(out, "}}\n");
+
+    if (fclose(out) != 0){
+        perror("Error writing statistics file");
+        return -1;
+    }
+    return 0;
+}
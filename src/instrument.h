@@ -0,0 +1,128 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Hot paths that are counted and timed when instrumentation is enabled
+typedef enum {
+    PROBE_CONFIG_READ,            // Config lookups (read_config and the typed accessors)
+    PROBE_CONFIG_LOAD,            // config.txt opened and parsed into the cache
+    PROBE_CONFIG_UPDATE,          // config.txt rewritten by update_config
+    PROBE_LOG_OPEN,               // Log files opened for writing
+    PROBE_LOG_APPEND,             // Entries appended to a log
+    PROBE_LOG_WRITE,              // write() calls flushing buffered entries
+    PROBE_LOG_FSYNC,              // fsync() calls
+    PROBE_LOG_SCAN,               // Text log scans (bytes scanned)
+    PROBE_PARSE_LINE,             // Lines parsed by the scanner; counted only
+    PROBE_TIME_CONVERT,           // Entry times converted from local wall clock time
+    PROBE_TIME_CACHED,            // Entry times converted from the per-hour cache; counted only
+    PROBE_INDEX_UPDATE,           // Time index catch-ups
+    PROBE_IDS_UPDATE,             // Entry ID sidecar catch-ups
+    PROBE_STATS_UPDATE,           // Glucose statistics catch-ups
+    PROBE_ROLLUP_UPDATE,          // Hourly and daily rollup catch-ups and rebuilds
+    PROBE_RENDER,                 // Entries rendered by View Logs
+    PROBE_QUERY,                  // View Logs queries, including rendering
+    PROBE_AGP,                    // Ambulatory glucose profiles (bytes scanned)
+    PROBE_COUNT
+} probe_id;
+
+// Totals for one probe
+typedef struct {
+    uint64_t count;               // Number of events
+    uint64_t total_ns;            // Time spent in timed events
+    uint64_t max_ns;              // Longest timed event
+    uint64_t bytes;               // Bytes read or written, where it applies
+} probe_totals;
+
+// Non-zero while probes are being recorded; set with instrument_enable.
+extern int instrument_enabled;
+
+// Totals for every probe recorded by the calling thread, indexed by probe_id.
+// Worker threads hand theirs over with instrument_thread_exit.
+extern _Thread_local probe_totals probes[PROBE_COUNT];
+
+/**
+ * instrument_now_ns - Reads the monotonic clock in nanoseconds.
+ *
+ * @return: The current time in nanoseconds.
+ */
+uint64_t instrument_now_ns(void);
+
+/**
+ * probe_begin - Starts timing an event.
+ * Costs one predictable branch when instrumentation is disabled.
+ *
+ * @return: Start time to pass to probe_end, or 0 when disabled.
+ */
+static inline uint64_t probe_begin(void){
+    return instrument_enabled ? instrument_now_ns() : 0;
+}
+
+/**
+ * probe_end - Records a timed event started with probe_begin.
+ *
+ * @param id: The probe.
+ * @param start: Value returned by probe_begin.
+ * @param bytes: Bytes read or written by the event, or 0.
+ */
+static inline void probe_end(probe_id id, uint64_t start, uint64_t bytes){
+    if (instrument_enabled){
+        uint64_t elapsed = instrument_now_ns() - start;
+        probes[id].count++;
+        probes[id].total_ns += elapsed;
+        probes[id].bytes += bytes;
+        if (elapsed > probes[id].max_ns){
+            probes[id].max_ns = elapsed;
+        }
+    }
+}
+
+/**
+ * probe_count - Records untimed events.
+ *
+ * @param id: The probe.
+ * @param count: Number of events.
+ */
+static inline void probe_count(probe_id id, uint64_t count){
+    if (instrument_enabled){
+        probes[id].count += count;
+    }
+}
+
+/**
+ * instrument_enable - Turns recording on or off. Totals are kept.
+ *
+ * @param enabled: Non-zero to record probes.
+ */
+void instrument_enable(int enabled);
+
+/**
+ * instrument_reset - Clears the totals of every probe recorded by the calling thread and
+ * by threads that have exited.
+ */
+void instrument_reset(void);
+
+/**
+ * instrument_thread_exit - Adds the calling thread's totals to the session's.
+ * Called by worker threads that record probes before they exit.
+ */
+void instrument_thread_exit(void);
+
+/**
+ * instrument_report - Prints the totals of every probe that recorded an event as a table.
+ *
+ * @param out: Stream to print to.
+ */
+void instrument_report(FILE *out);
+
+/**
+ * instrument_dump_json - Appends the totals of every probe to a file as one line of JSON,
+ * so a file collects one line per session.
+ *
+ * @param filename: File to append to.
+ * @return: 0 for success, -1 for errors.
+ */
+int instrument_dump_json(const char *filename);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include "iob.h"
+#include "config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Doses a tracker makes room for when it first needs memory
+#define IOB_INITIAL_DOSES 16
+
+int iob_read_settings(iob_settings *settings){
+    float hours = IOB_DEFAULT_DURATION_HOURS;
+    if (read_config("insulin action duration") != NULL &&
+        (config_get_float("insulin action duration", &hours) != 0 ||
+         !(hours >= IOB_MIN_DURATION_HOURS && hours <= IOB_MAX_DURATION_HOURS))){
+        printf("Error: insulin action duration must be between %.0f and %.0f hours.\n",
+               IOB_MIN_DURATION_HOURS, IOB_MAX_DURATION_HOURS);
+        return -1;
+    }
+    settings->duration = lroundf(hours * 3600);
+
+    const char *curve = read_config("insulin action curve");
+    if (curve == NULL || strcmp(curve, "exponential") == 0){
+        settings->curve = IOB_CURVE_EXPONENTIAL;
+    } else if (strcmp(curve, "linear") == 0){
+        settings->curve = IOB_CURVE_LINEAR;
+    } else {
+        printf("Error: insulin action curve must be linear or exponential.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * exponential_fraction - Insulin still acting t minutes into an action of duration minutes,
+ * on an exponential curve peaking at peak minutes. The activity rises and falls as
+ * t * (1 - t / duration) * e^(-t / tau), scaled so the whole dose has acted by the end.
+ */
+static double exponential_fraction(double t, double duration, double peak){
+    double tau = peak * (1 - peak / duration) / (1 - 2 * peak / duration);
+    double a = 2 * tau / duration;
+    double scale = 1 / (1 - a + (1 + a) * exp(-duration / tau));
+    return 1 - scale * (1 - a) *
+           ((t * t / (tau * duration * (1 - a)) - t / tau - 1) * exp(-t / tau) + 1);
+}
+
+float iob_fraction(const iob_settings *settings, long elapsed){
+    if (elapsed < 0 || elapsed >= settings->duration){
+        return 0.0f;
+    }
+    double t = elapsed / 60.0;
+    double duration = settings->duration / 60.0;
+    if (settings->curve == IOB_CURVE_LINEAR){
+        return (float)(1 - t / duration);
+    }
+
+    // The curve needs its peak before the first half of the action
+    double peak = fmin(IOB_PEAK_MINUTES, duration * 0.4);
+    double fraction = exponential_fraction(t, duration, peak);
+    return (float)fmin(fmax(fraction, 0.0), 1.0);
+}
+
+int iob_tracker_add(iob_tracker *tracker, time_t time, float units){
+    if (!(units > 0)){
+        return 0;
+    }
+    if (tracker->count == tracker->capacity){
+        size_t capacity = tracker->capacity > 0 ? tracker->capacity * 2 : IOB_INITIAL_DOSES;
+        iob_dose *doses = realloc(tracker->doses, capacity * sizeof(iob_dose));
+        if (doses == NULL){
+            perror("Error tracking insulin on board");
+            return -1;
+        }
+        tracker->doses = doses;
+        tracker->capacity = capacity;
+    }
+    tracker->doses[tracker->count].time = time;
+    tracker->doses[tracker->count].units = units;
+    tracker->count++;
+    return 0;
+}
+
+float iob_tracker_total(iob_tracker *tracker, const iob_settings *settings, time_t time){
+    // Doses that had stopped acting by now are dropped, keeping log order
+    time_t cutoff = time - settings->duration;
+    if (cutoff > tracker->covered_from){
+        size_t kept = 0;
+        for (size_t i = 0; i < tracker->count; i++){
+            if (tracker->doses[i].time > cutoff){
+                tracker->doses[kept++] = tracker->doses[i];
+            }
+        }
+        tracker->count = kept;
+        tracker->covered_from = cutoff;
+    }
+
+    double total = 0;
+    for (size_t i = 0; i < tracker->count; i++){
+        total += tracker->doses[i].units * iob_fraction(settings, (long)(time - tracker->doses[i].time));
+    }
+    return (float)total;
+}
+
+void iob_tracker_clear(iob_tracker *tracker){
+    tracker->count = 0;
+    tracker->covered_from = 0;
+    tracker->loaded = 0;
+}
+
+void iob_tracker_free(iob_tracker *tracker){
+    free(tracker->doses);
+    memset(tracker, 0, sizeof(*tracker));
+}
@@ -0,0 +1,104 @@
+#ifndef IOB_H
+#define IOB_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Duration of insulin action used when "insulin action duration" is not set, in hours
+#define IOB_DEFAULT_DURATION_HOURS 4.0f
+
+// Shortest and longest durations of insulin action accepted, in hours
+#define IOB_MIN_DURATION_HOURS 1.0f
+#define IOB_MAX_DURATION_HOURS 24.0f
+
+// Minutes after a dose at which the exponential curve acts fastest, for rapid acting
+// insulin. Durations too short for it bring the peak forward.
+#define IOB_PEAK_MINUTES 75.0f
+
+// How the insulin from a dose wears off over the duration of insulin action
+typedef enum {
+    IOB_CURVE_LINEAR,             // At a steady rate
+    IOB_CURVE_EXPONENTIAL         // Slowly at first, fastest at the peak, then tailing off
+} iob_curve;
+
+// The settings insulin on board is worked out with
+typedef struct {
+    long duration;                // Duration of insulin action in seconds
+    iob_curve curve;
+} iob_settings;
+
+// A dose of insulin still acting
+typedef struct {
+    time_t time;                  // When it was logged
+    float units;
+} iob_dose;
+
+// The doses logged within one duration of insulin action of the latest time asked about,
+// kept so insulin on board costs one pass over the doses still acting rather than a scan
+// of the log.
+typedef struct {
+    iob_dose *doses;
+    size_t count;
+    size_t capacity;
+    time_t covered_from;          // Every dose logged from this time on is held
+    int loaded;                   // Set once the doses have been read from the log
+} iob_tracker;
+
+/**
+ * iob_read_settings - Reads the duration of insulin action and the curve from config.txt.
+ * "insulin action duration" is in hours and defaults to IOB_DEFAULT_DURATION_HOURS;
+ * "insulin action curve" is "linear" or "exponential" and defaults to exponential.
+ *
+ * @param settings: Receives the settings.
+ * @return: 0 for success, -1 if either value is not valid.
+ */
+int iob_read_settings(iob_settings *settings);
+
+/**
+ * iob_fraction - Works out how much of a dose is still acting some time after it was taken.
+ *
+ * @param settings: The duration of insulin action and the curve.
+ * @param elapsed: Seconds since the dose was taken.
+ * @return: The fraction still acting, from 1 when the dose was just taken to 0 once the
+ * duration of insulin action has passed. Doses not taken yet give 0.
+ */
+float iob_fraction(const iob_settings *settings, long elapsed);
+
+/**
+ * iob_tracker_add - Records a dose.
+ *
+ * @param tracker: The tracker.
+ * @param time: When the dose was logged.
+ * @param units: Units of insulin; doses of 0 units or less are ignored.
+ * @return: 0 for success, -1 if out of memory.
+ */
+int iob_tracker_add(iob_tracker *tracker, time_t time, float units);
+
+/**
+ * iob_tracker_total - Adds up the insulin still acting at a time from the doses logged up
+ * to it. Doses that had stopped acting by then are dropped and covered_from moves up, so
+ * only times at least settings->duration after covered_from can be answered; the tracker
+ * must be cleared and reloaded before asking about an earlier one.
+ *
+ * @param tracker: The tracker.
+ * @param settings: The duration of insulin action and the curve.
+ * @param time: The time to work out insulin on board for.
+ * @return: Insulin on board in units.
+ */
+float iob_tracker_total(iob_tracker *tracker, const iob_settings *settings, time_t time);
+
+/**
+ * iob_tracker_clear - Forgets every dose, so the tracker is read from the log again.
+ *
+ * @param tracker: The tracker.
+ */
+void iob_tracker_clear(iob_tracker *tracker);
+
+/**
+ * iob_tracker_free - Frees the doses held by a tracker.
+ *
+ * @param tracker: The tracker.
+ */
+void iob_tracker_free(iob_tracker *tracker);
+
+#endif
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "local_time.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SECONDS_PER_DAY 86400
+
+// A stretch of time with one UTC offset
+typedef struct {
+    int64_t start;                // First second the offset applies to
+    long offset;                  // Seconds east of UTC
+    int is_dst;                   // Daylight saving time flag
+} zone_span;
+
+// The local zone's offsets, in time order; built once by build_table
+static zone_span spans[LOCAL_TIME_MAX_SPANS];
+static int span_count = 0;
+static int64_t table_start = 0;   // Times from table_start up to table_end are covered
+static int64_t table_end = 0;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * floor_div - Divides rounding towards negative infinity.
+ */
+static int64_t floor_div(int64_t value, int64_t divisor){
+    int64_t quotient = value / divisor;
+    return quotient - (value % divisor < 0);
+}
+
+/**
+ * days_from_civil - Days from 1970-01-01 to a date in the proleptic Gregorian calendar.
+ * Months out of range are carried into the year and days are counted on from day 1.
+ */
+static int64_t days_from_civil(int64_t year, int64_t month, int64_t day){
+    year += floor_div(month - 1, 12);
+    month -= floor_div(month - 1, 12) * 12;
+
+    // Years start in March so the leap day is the last day of the year
+    year -= month <= 2;
+    int64_t era = floor_div(year, 400);
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468 + day - 1;
+}
+
+/**
+ * civil_from_days - The date a number of days after 1970-01-01.
+ */
+static void civil_from_days(int64_t days, int64_t *year, int *month, int *day){
+    days += 719468;
+    int64_t era = floor_div(days, 146097);
+    int64_t day_of_era = days - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153; // 0 is March
+    *day = (int)(day_of_year - (153 * month_index + 2) / 5 + 1);
+    *month = (int)(month_index < 10 ? month_index + 3 : month_index - 9);
+    *year = era * 400 + year_of_era + (*month <= 2);
+}
+
+/**
+ * zone_at - Asks the C library for the offset and DST flag in force at a time.
+ */
+static void zone_at(int64_t timestamp, long *offset, int *is_dst){
+    time_t t = (time_t)timestamp;
+    struct tm date;
+    localtime_r(&t, &date);
+    *offset = date.tm_gmtoff;
+    *is_dst = date.tm_isdst > 0;
+}
+
+/**
+ * build_table - Records every change of the local zone's offset or DST flag between
+ * LOCAL_TIME_FIRST_YEAR and LOCAL_TIME_YEARS_AHEAD years from now. The zone is
+ * sampled once a day and each change is found to the second by bisection; a
+ * change undone within the same day is not seen.
+ */
+static void build_table(void){
+    tzset();
+    time_t now = time(NULL);
+    struct tm today;
+    localtime_r(&now, &today);
+    table_start = days_from_civil(LOCAL_TIME_FIRST_YEAR, 1, 1) * SECONDS_PER_DAY;
+    table_end = days_from_civil(today.tm_year + 1900 + LOCAL_TIME_YEARS_AHEAD + 1, 1, 1) * SECONDS_PER_DAY;
+
+    zone_span *last = &spans[0];
+    last->start = table_start;
+    zone_at(table_start, &last->offset, &last->is_dst);
+    span_count = 1;
+
+    for (int64_t day = table_start + SECONDS_PER_DAY; day < table_end; day += SECONDS_PER_DAY){
+        long offset;
+        int is_dst;
+        zone_at(day, &offset, &is_dst);
+        if (offset == last->offset && is_dst == last->is_dst){
+            continue;
+        }
+
+        // The zone at low is the last span's, the zone at high is not
+        int64_t low = day - SECONDS_PER_DAY;
+        int64_t high = day;
+        while (high - low > 1){
+            int64_t middle = low + (high - low) / 2;
+            long middle_offset;
+            int middle_dst;
+            zone_at(middle, &middle_offset, &middle_dst);
+            if (middle_offset == last->offset && middle_dst == last->is_dst){
+                low = middle;
+            } else {
+                high = middle;
+            }
+        }
+
+        // A full table ends early; later times go to the C library
+        if (span_count == LOCAL_TIME_MAX_SPANS){
+            table_end = high;
+            break;
+        }
+        last = &spans[span_count++];
+        last->start = high;
+        last->offset = offset;
+        last->is_dst = is_dst;
+    }
+}
+
+/**
+ * find_span - Finds the span holding a time within the table.
+ */
+static const zone_span *find_span(int64_t timestamp){
+    int low = 0;
+    int high = span_count - 1;
+    while (low < high){
+        int middle = (low + high + 1) / 2;
+        if (spans[middle].start <= timestamp){
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return &spans[low];
+}
+
+long local_utc_offset(time_t timestamp){
+    pthread_once(&table_once, build_table);
+    if ((int64_t)timestamp < table_start || (int64_t)timestamp >= table_end){
+        long offset;
+        int is_dst;
+        zone_at((int64_t)timestamp, &offset, &is_dst);
+        return offset;
+    }
+    return find_span((int64_t)timestamp)->offset;
+}
+
+void epoch_to_local_time(time_t timestamp, struct tm *date){
+    pthread_once(&table_once, build_table);
+    if ((int64_t)timestamp < table_start || (int64_t)timestamp >= table_end){
+        localtime_r(&timestamp, date);
+        return;
+    }
+
+    const zone_span *span = find_span((int64_t)timestamp);
+    int64_t local = (int64_t)timestamp + span->offset;
+    int64_t days = floor_div(local, SECONDS_PER_DAY);
+    int seconds = (int)(local - days * SECONDS_PER_DAY);
+    int64_t year;
+    int month, day;
+    civil_from_days(days, &year, &month, &day);
+
+    memset(date, 0, sizeof(*date));
+    date->tm_year = (int)(year - 1900);
+    date->tm_mon = month - 1;
+    date->tm_mday = day;
+    date->tm_hour = seconds / 3600;
+    date->tm_min = seconds / 60 % 60;
+    date->tm_sec = seconds % 60;
+    date->tm_wday = (int)(days + 4 - floor_div(days + 4, 7) * 7); // 1970-01-01 was a Thursday
+    date->tm_yday = (int)(days - days_from_civil(year, 1, 1));
+    date->tm_isdst = span->is_dst;
+    date->tm_gmtoff = span->offset;
+    date->tm_zone = tzname[span->is_dst];
+}
+
+time_t local_time_to_epoch(int year, int month, int day, int hour, int minute, int second){
+    // The wall clock read as if it were UTC
+    int64_t local = days_from_civil(year, month, day) * SECONDS_PER_DAY +
+                    (int64_t)hour * 3600 + (int64_t)minute * 60 + second;
+
+    // The offset near the wall clock gives a first guess; the offset at the guess is the answer.
+    // In a gap left by a change to daylight saving time this is the offset before the change.
+    long guess = local_utc_offset((time_t)local);
+    long offset = local_utc_offset((time_t)(local - guess));
+    return (time_t)(local - offset);
+}
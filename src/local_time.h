@@ -0,0 +1,50 @@
+#ifndef LOCAL_TIME_H
+#define LOCAL_TIME_H
+
+#include <time.h>
+
+// Years covered by the zone table; times outside it are converted by the C library
+#define LOCAL_TIME_FIRST_YEAR 1970
+#define LOCAL_TIME_YEARS_AHEAD 30     // Years after the current one
+
+// Most offset changes kept in the zone table
+#define LOCAL_TIME_MAX_SPANS 1024
+
+/**
+ * local_time_to_epoch - Converts a local wall clock time to seconds since the epoch,
+ * as mktime does with tm_isdst set to -1. Fields out of range are carried over, so
+ * day 0 is the last day of the previous month. A time skipped when the clocks go
+ * forward is read with the offset in force before the change, and a time repeated
+ * when they go back with the offset in force after it.
+ *
+ * The offsets come from a table of the local zone's changes built on first use, so
+ * no C library time function runs per call within the covered years.
+ *
+ * @param year: Year, e.g. 2024.
+ * @param month: Month, 1 to 12.
+ * @param day: Day of the month, from 1.
+ * @param hour: Hour, 0 to 23.
+ * @param minute: Minute, 0 to 59.
+ * @param second: Second, 0 to 60.
+ * @return: Seconds since the epoch.
+ */
+time_t local_time_to_epoch(int year, int month, int day, int hour, int minute, int second);
+
+/**
+ * epoch_to_local_time - Breaks a time down into local wall clock fields, as
+ * localtime_r does, using the zone table.
+ *
+ * @param timestamp: Seconds since the epoch.
+ * @param date: Receives the date, time, weekday, day of the year and DST flag.
+ */
+void epoch_to_local_time(time_t timestamp, struct tm *date);
+
+/**
+ * local_utc_offset - Returns the local zone's offset from UTC at a time.
+ *
+ * @param timestamp: Seconds since the epoch.
+ * @return: Seconds east of UTC, including any daylight saving time.
+ */
+long local_utc_offset(time_t timestamp);
+
+#endif
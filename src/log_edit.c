@@ -0,0 +1,512 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "log_edit.h"
+#include "logging.h"
+#include "records.h"
+#include "log_scan.h"
+#include "log_ids.h"
+#include "log_lock.h"
+#include "log_writer.h"
+#include "log_index.h"
+#include "glucose_stats.h"
+#include "rollup.h"
+#include "local_time.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// State of a compaction while the rewritten log is written
+typedef struct {
+    const char *filename;         // The log being compacted
+    FILE *out;                    // The rewritten log
+    const log_map *map;           // The log being compacted
+    const log_ids *ids;           // Its IDs
+    int64_t hint;                 // Slot of the last entry found
+    int64_t last_kept;            // ID of the last entry written; later IDs follow it
+} compaction;
+
+
+/**
+ * read_version - Reads the entry or edit that starts at an offset of a log.
+ */
+static int read_version(int fd, int binary, int64_t offset, time_t *timestamp, log_entry *entry){
+    if (binary){
+        log_record record;
+        if (pread(fd, &record, sizeof(record), (off_t)offset) != (ssize_t)sizeof(record) ||
+            !record_intact(&record) || (record.flags & RECORD_FLAG_DELETED)){
+            return -1;
+        }
+        *timestamp = (time_t)record.timestamp;
+        record_to_entry(&record, entry);
+        return 0;
+    }
+
+    // A record is never longer than LOG_ENTRY_MAX; the next one may start inside the buffer
+    char text[2 * LOG_ENTRY_MAX];
+    ssize_t length = pread(fd, text, sizeof(text), (off_t)offset);
+    scanned_entry scanned;
+    if (length <= 0 || log_scan_record(text, (size_t)length, 0, &scanned) != 0 || scanned.kind == SCAN_DELETE){
+        return -1;
+    }
+    *timestamp = scanned.timestamp;
+    scanned_to_entry(&scanned, entry);
+    return 0;
+}
+
+int log_get_entry(const char *filename, int64_t id, time_t *timestamp, log_entry *entry){
+    id_slot slot;
+    if (log_ids_lookup(filename, id, &slot) != 0 || slot.current == LOG_ID_DELETED){
+        return -1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        perror("Error opening log file");
+        return -1;
+    }
+    int status = read_version(fd, is_binary_log(filename), slot.current, timestamp, entry);
+    close(fd);
+    return status;
+}
+
+int format_revision(char *buffer, size_t size, int binary, int64_t id, time_t timestamp,
+                           int64_t replaces, const log_entry *entry){
+    if (binary){
+        log_record record;
+        if (entry != NULL){
+            entry_to_record(entry, timestamp, &record);
+            record.flags |= RECORD_FLAG_EDIT;
+        } else {
+            memset(&record, 0, sizeof(record));
+            record.timestamp = (int64_t)timestamp;
+            record.flags = RECORD_FLAG_DELETED;
+        }
+        record.id = id;
+        record.replaces = replaces;
+        seal_record(&record);
+        memcpy(buffer, &record, sizeof(record));
+        return (int)sizeof(record);
+    }
+
+    struct tm date;
+    epoch_to_local_time(timestamp, &date);
+    int length = snprintf(buffer, size, "Log Entry %s: #%lld %d-%02d-%02d %02d:%02d:%02d @%lld replacing %lld\n",
+                          entry != NULL ? "Edit" : "Deleted", (long long)id,
+                          date.tm_year + 1900, date.tm_mon + 1, date.tm_mday,
+                          date.tm_hour, date.tm_min, date.tm_sec, (long long)timestamp, (long long)replaces);
+    if (length > 0 && (size_t)length < size && entry != NULL){
+        length += format_entry_data(buffer + length, size - (size_t)length, entry);
+    }
+    if (length > 0 && (size_t)length < size){
+        length = format_checksum_line(buffer, (size_t)length, size);
+    }
+    if (length < 0 || (size_t)length >= size){
+        printf("Error: log entry too long to write.\n");
+        return -1;
+    }
+    return length;
+}
+
+/**
+ * revise_entry - Appends an edit of an entry, or a tombstone if entry is NULL.
+ */
+static int revise_entry(const char *filename, int64_t id, const log_entry *entry){
+    int binary = is_binary_log(filename);
+    int fd = log_append_open(filename);
+    if (fd < 0){
+        return -1;
+    }
+    if (log_append_begin(&fd, filename) != 0){
+        close(fd);
+        return -1;
+    }
+
+    // With the append lock held no other edit can land between finding the entry's
+    // latest version and appending the record that replaces it
+    id_slot slot;
+    time_t timestamp;
+    log_entry current;
+    int status = 0;
+    if (log_ids_lookup(filename, id, &slot) != 0 || slot.current == LOG_ID_DELETED){
+        printf("Error: there is no entry #%lld.\n", (long long)id);
+        status = -1;
+    } else if (read_version(fd, binary, slot.current, &timestamp, &current) != 0){
+        printf("Error reading entry #%lld.\n", (long long)id);
+        status = -1;
+    }
+
+    if (status == 0){
+        char data[LOG_ENTRY_MAX];
+        int length = format_revision(data, sizeof(data), binary, id, timestamp, slot.current, entry);
+        status = length < 0 ? -1 : log_write_locked(fd, data, (size_t)length);
+    }
+    log_unlock(fd);
+    if (close(fd) != 0){
+        perror("Error closing log file");
+        status = -1;
+    }
+
+    if (status == 0){
+        // The totals take the replaced version out and the new one in
+        log_index_update(filename);
+        glucose_stats_update(filename);
+        rollup_update(filename);
+        log_ids_update(filename);
+    }
+    return status;
+}
+
+int log_edit_entry(const char *filename, int64_t id, const log_entry *entry){
+    return revise_entry(filename, id, entry);
+}
+
+int log_delete_entry(const char *filename, int64_t id){
+    return revise_entry(filename, id, NULL);
+}
+
+int log_compact_due(const char *filename){
+    log_ids ids;
+    if (log_ids_open(&ids, filename) != 0){
+        return 0;
+    }
+    int due = ids.superseded > 0 && ids.superseded * LOG_COMPACT_RATIO >= ids.count;
+    log_ids_close(&ids);
+    return due;
+}
+
+/**
+ * write_bytes - Writes part of the log to the rewritten log.
+ */
+static int write_bytes(compaction *job, const char *data, size_t length){
+    if (length > 0 && fwrite(data, 1, length, job->out) != length){
+        perror("Error writing compacted log");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * line_end - Returns the offset after the line starting at offset.
+ */
+static size_t line_end(const log_map *map, size_t offset, size_t end){
+    const char *newline = memchr(map->data + offset, '\n', end - offset);
+    return newline != NULL ? (size_t)(newline - map->data) + 1 : end;
+}
+
+/**
+ * record_end - Returns the offset of the next line starting "Log Entry " after the
+ * record starting at offset, which is where the record ends.
+ */
+static size_t record_end(const log_map *map, size_t offset, size_t end){
+    size_t p = line_end(map, offset, end);
+    while (p < end && !(end - p >= 10 && memcmp(map->data + p, "Log Entry ", 10) == 0)){
+        p = line_end(map, p, end);
+    }
+    return p;
+}
+
+/**
+ * without_id - Returns the length of a time line with its newline and any " #ID" removed.
+ */
+static size_t without_id(const char *line, size_t length){
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')){
+        length--;
+    }
+    size_t digits = length;
+    while (digits > 0 && line[digits - 1] >= '0' && line[digits - 1] <= '9'){
+        digits--;
+    }
+    if (digits < length && digits >= 2 && line[digits - 1] == '#' && line[digits - 2] == ' '){
+        return digits - 2;
+    }
+    return length;
+}
+
+/**
+ * damaged_log - Reports that a log cannot be compacted because part of it is damaged.
+ * Rewriting it would give damaged records fresh checksums.
+ */
+static int damaged_log(const compaction *job){
+    printf("Error: %s has damaged entries and cannot be compacted; run --verify and --repair.\n", job->filename);
+    return -1;
+}
+
+/**
+ * text_record_intact - Checks a text record against its checksum line, if it has one.
+ * Stray lines after the checksum line count as damage.
+ */
+static int text_record_intact(const log_map *map, size_t offset, size_t end){
+    size_t body_length, sealed_length;
+    int checksum = log_record_check(map->data + offset, end - offset, &body_length, &sealed_length);
+    return checksum != CHECKSUM_BAD && sealed_length == end - offset;
+}
+
+/**
+ * data_lines_end - Returns the offset where a record's data lines end: at its checksum
+ * line, or at the next record.
+ */
+static size_t data_lines_end(const log_map *map, size_t offset, size_t end){
+    size_t record = record_end(map, offset, end);
+    size_t body_length, sealed_length;
+    log_record_check(map->data + offset, record - offset, &body_length, &sealed_length);
+    return offset + body_length;
+}
+
+/**
+ * compact_entry - Writes the latest version of the entry in slot under its time line,
+ * with its ID written out if it does not follow the last entry written, and a new
+ * checksum line.
+ */
+static int compact_entry(compaction *job, int64_t slot, size_t offset, size_t end){
+    const id_slot *entry = &job->ids->slots[slot];
+    int64_t id = slot + 1;
+    if (entry->current == LOG_ID_DELETED){
+        return 0;
+    }
+
+    size_t data_start = line_end(job->map, offset, end);
+    size_t data_end = data_lines_end(job->map, offset, end);
+    if (entry->current != entry->origin && entry->current >= 0 && (size_t)entry->current < end){
+        // The edit's data lines are the entry's new values
+        if (!text_record_intact(job->map, (size_t)entry->current, record_end(job->map, (size_t)entry->current, end))){
+            return damaged_log(job);
+        }
+        data_start = line_end(job->map, (size_t)entry->current, end);
+        data_end = data_lines_end(job->map, (size_t)entry->current, end);
+    }
+
+    const char *time_line = job->map->data + offset;
+    size_t time_length = without_id(time_line, line_end(job->map, offset, end) - offset);
+    char record[2 * LOG_ENTRY_MAX];
+    int length = snprintf(record, sizeof(record), "%.*s", (int)time_length, time_line);
+    if (id != job->last_kept + 1 && length >= 0 && (size_t)length < sizeof(record)){
+        length += snprintf(record + length, sizeof(record) - (size_t)length, " #%lld", (long long)id);
+    }
+    if (length >= 0 && (size_t)length < sizeof(record)){
+        length += snprintf(record + length, sizeof(record) - (size_t)length, "\n%.*s",
+                           (int)(data_end - data_start), job->map->data + data_start);
+    }
+    if (length >= 0 && (size_t)length < sizeof(record)){
+        length = format_checksum_line(record, (size_t)length, sizeof(record));
+    }
+    if (length < 0 || (size_t)length >= sizeof(record)){
+        printf("Error: log entry too long to write.\n");
+        return -1;
+    }
+    if (write_bytes(job, record, (size_t)length) != 0){
+        return -1;
+    }
+    job->last_kept = id;
+    return 0;
+}
+
+/**
+ * compact_text - Writes a text log with its revisions folded in. Lines that are not part
+ * of an entry with an ID, such as bad time lines, are kept as they are.
+ */
+static int compact_text(compaction *job, size_t end){
+    const log_map *map = job->map;
+    size_t p = 0;
+    int status = 0;
+    while (p < end && status == 0){
+        size_t next = line_end(map, p, end);
+        if (end - p < 10 || memcmp(map->data + p, "Log Entry ", 10) != 0){
+            status = write_bytes(job, map->data + p, next - p);
+            p = next;
+            continue;
+        }
+
+        size_t record = record_end(map, p, end);
+        if (!text_record_intact(map, p, record)){
+            return damaged_log(job);
+        }
+        int64_t slot = log_ids_find(job->ids, (int64_t)p, job->hint);
+        if (slot >= 0){
+            job->hint = slot;
+            status = compact_entry(job, slot, p, end);
+        } else if (!(end - p >= 15 && memcmp(map->data + p, "Log Entry Edit:", 15) == 0) &&
+                   !(end - p >= 18 && memcmp(map->data + p, "Log Entry Deleted:", 18) == 0)){
+            status = write_bytes(job, map->data + p, record - p);
+        }
+        p = record;
+    }
+    if (status != 0 || job->ids->count <= job->last_kept){
+        return status;
+    }
+
+    // Keep the IDs of deleted entries at the end given out, with a tombstone for the last
+    scanned_entry last;
+    time_t timestamp = time(NULL);
+    if (log_scan_record(map->data, end, (size_t)job->ids->slots[job->ids->count - 1].origin, &last) == 0){
+        timestamp = last.timestamp;
+    }
+    char tombstone[LOG_ENTRY_MAX];
+    int length = format_revision(tombstone, sizeof(tombstone), 0, job->ids->count, timestamp, -1, NULL);
+    return length < 0 ? -1 : write_bytes(job, tombstone, (size_t)length);
+}
+
+/**
+ * compact_records - Writes a binary log with its revisions folded in.
+ */
+static int compact_records(compaction *job, size_t end){
+    const log_map *map = job->map;
+    if (write_bytes(job, map->data, sizeof(record_header)) != 0){
+        return -1;
+    }
+
+    const log_record *last = NULL;
+    for (size_t offset = sizeof(record_header); offset + sizeof(log_record) <= end; offset += sizeof(log_record)){
+        const log_record *record = (const log_record *)(map->data + offset);
+        last = record;
+        if (!record_intact(record)){
+            return damaged_log(job);
+        }
+        if (record->flags & RECORD_FLAG_REVISION){
+            continue;
+        }
+        int64_t slot = log_ids_find(job->ids, (int64_t)offset, job->hint);
+        if (slot < 0){
+            if (write_bytes(job, (const char *)record, sizeof(*record)) != 0){
+                return -1;
+            }
+            continue;
+        }
+        job->hint = slot;
+
+        const id_slot *entry = &job->ids->slots[slot];
+        if (entry->current == LOG_ID_DELETED){
+            continue;
+        }
+        log_record kept = *record;
+        if (entry->current != entry->origin && entry->current >= (int64_t)sizeof(record_header) &&
+            (size_t)entry->current + sizeof(log_record) <= end){
+            kept = *(const log_record *)(map->data + entry->current);
+            kept.timestamp = record->timestamp;
+        }
+        kept.flags &= (uint16_t)~RECORD_FLAG_REVISION;
+        kept.id = slot + 1 != job->last_kept + 1 ? slot + 1 : 0;
+        kept.replaces = 0;
+        seal_record(&kept);
+        if (write_bytes(job, (const char *)&kept, sizeof(kept)) != 0){
+            return -1;
+        }
+        job->last_kept = slot + 1;
+    }
+    if (job->ids->count <= job->last_kept){
+        return 0;
+    }
+
+    // Keep the IDs of deleted entries at the end given out, with a tombstone for the last
+    log_record tombstone;
+    format_revision((char *)&tombstone, sizeof(tombstone), 1, job->ids->count,
+                    last != NULL ? (time_t)last->timestamp : time(NULL), -1, NULL);
+    return write_bytes(job, (const char *)&tombstone, sizeof(tombstone));
+}
+
+/**
+ * remove_sidecars - Removes the sidecar files of a log so they are rebuilt from it.
+ */
+static void remove_sidecars(const char *filename){
+    const char *suffixes[] = {INDEX_SUFFIX, STATS_SUFFIX, ROLLUP_SUFFIX, IDS_SUFFIX};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++){
+        char name[512];
+        snprintf(name, sizeof(name), "%s%s", filename, suffixes[i]);
+        unlink(name);
+    }
+}
+
+/**
+ * write_compacted - Writes the compacted log to a new file and forces it to disk.
+ */
+static int write_compacted(const char *filename, const char *name, int binary, const log_map *map, const log_ids *ids){
+    FILE *out = fopen(name, "wb");
+    if (out == NULL){
+        perror("Error creating compacted log");
+        return -1;
+    }
+
+    compaction job = {filename, out, map, ids, -1, 0};
+
+    // Only the part of the log the IDs cover is rewritten; a partly written last line
+    // is carried over as it is
+    size_t end = map->size;
+    if (!binary){
+        const char *last_newline = map->size > 0 ? memrchr(map->data, '\n', map->size) : NULL;
+        end = last_newline != NULL ? (size_t)(last_newline - map->data) + 1 : 0;
+    } else if (map->size >= sizeof(record_header)){
+        end = map->size - (map->size - sizeof(record_header)) % sizeof(log_record);
+    }
+
+    int status = binary ? compact_records(&job, end) : compact_text(&job, end);
+    if (status == 0){
+        status = write_bytes(&job, map->data + end, map->size - end);
+    }
+    if (status == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0)){
+        perror("Error writing compacted log");
+        status = -1;
+    }
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    if (status != 0){
+        unlink(name);
+    }
+    return status;
+}
+
+int log_compact(const char *filename, long *folded){
+    *folded = 0;
+    int lock = log_lock_exclusive(filename);
+    if (lock < 0){
+        return -1;
+    }
+
+    // Nothing can append or update the sidecars while the whole log is locked
+    int binary = is_binary_log(filename);
+    log_ids ids;
+    log_map map;
+    if (log_ids_open_held(&ids, filename) != 0){
+        close(lock);
+        return -1;
+    }
+    if (ids.superseded == 0){
+        log_ids_close(&ids);
+        close(lock);
+        return 0;
+    }
+    if (log_map_open(&map, filename) != 0){
+        log_ids_close(&ids);
+        close(lock);
+        return -1;
+    }
+
+    char name[512];
+    snprintf(name, sizeof(name), "%s%s", filename, LOG_COMPACT_SUFFIX);
+    int status = write_compacted(filename, name, binary, &map, &ids);
+
+    // The old sidecars go first, so nobody can bring them up to date against the new log
+    if (status == 0){
+        remove_sidecars(filename);
+        if (rename(name, filename) != 0){
+            perror("Error replacing log with compacted log");
+            unlink(name);
+            status = -1;
+        } else {
+            *folded = (long)ids.superseded;
+        }
+    }
+
+    log_map_close(&map);
+    log_ids_close(&ids);
+    close(lock);
+
+    if (status == 0){
+        // Rebuild the sidecars now rather than on the next query
+        log_index_update(filename);
+        glucose_stats_update(filename);
+        rollup_update(filename);
+        log_ids_update(filename);
+    }
+    return status;
+}
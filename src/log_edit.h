@@ -0,0 +1,91 @@
+#ifndef LOG_EDIT_H
+#define LOG_EDIT_H
+
+#include <stdint.h>
+#include <time.h>
+#include "logging.h"
+
+// Compaction is due once one in this many of a log's entries has been edited or deleted
+#define LOG_COMPACT_RATIO 16
+
+// Suffix of the rewritten log while compaction builds it
+#define LOG_COMPACT_SUFFIX ".compact"
+
+// Entries are never rewritten in place. An edit appends the entry's new values as an
+// edit record, "Log Entry Edit: #ID <time> replacing OFFSET", and a deletion appends a
+// tombstone, "Log Entry Deleted: #ID <time> replacing OFFSET", where OFFSET is where
+// the version being replaced starts. Readers find the latest version of each entry
+// through the ID file, so an edit costs one append and one slot update however long
+// the log is. Compaction later rewrites the log with the edits folded in.
+
+/**
+ * format_revision - Formats an edit record, or a tombstone if entry is NULL, as a line
+ * block for text logs or a record for binary logs.
+ *
+ * @param buffer: Receives the record.
+ * @param size: Size of buffer; at least sizeof(log_record) for binary logs.
+ * @param binary: Non-zero to format a binary record.
+ * @param id: ID of the entry revised.
+ * @param timestamp: Time of the entry revised.
+ * @param replaces: Offset of the version replaced, or -1 for the tombstone compaction
+ *                  ends a log with to keep the IDs of removed entries given out.
+ * @param entry: The entry's new values, or NULL for a tombstone.
+ * @return: Length of the record, or -1 if it does not fit.
+ */
+int format_revision(char *buffer, size_t size, int binary, int64_t id, time_t timestamp,
+                    int64_t replaces, const log_entry *entry);
+
+/**
+ * log_get_entry - Reads the latest version of an entry.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @param id: The entry's ID.
+ * @param timestamp: Receives the time of the entry.
+ * @param entry: Receives the entry's values.
+ * @return: 0 for success, -1 if there is no such entry or it was deleted.
+ */
+int log_get_entry(const char *filename, int64_t id, time_t *timestamp, log_entry *entry);
+
+/**
+ * log_edit_entry - Replaces the values of an entry by appending an edit record. The
+ * entry keeps its ID and time.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @param id: The entry's ID.
+ * @param entry: The new values.
+ * @return: 0 for success, -1 if there is no such entry, it was deleted, or for errors.
+ */
+int log_edit_entry(const char *filename, int64_t id, const log_entry *entry);
+
+/**
+ * log_delete_entry - Deletes an entry by appending a tombstone. Its ID is not given out again.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @param id: The entry's ID.
+ * @return: 0 for success, -1 if there is no such entry, it was already deleted, or for errors.
+ */
+int log_delete_entry(const char *filename, int64_t id);
+
+/**
+ * log_compact_due - Checks whether enough of a log has been edited or deleted for
+ * compaction to be worth its cost, one entry in LOG_COMPACT_RATIO. Compacting at that
+ * rate keeps the cost of each edit, averaged over the edits, constant.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @return: 1 if compaction is due, 0 otherwise.
+ */
+int log_compact_due(const char *filename);
+
+/**
+ * log_compact - Rewrites a log with every edit folded into the entry it edits and every
+ * deleted entry removed, then renames it over the log. Entries keep their IDs and
+ * order. The whole log is locked while it is rewritten; writers holding the old log
+ * open move to the new one on their next append, and the sidecar files are rebuilt.
+ *
+ * @param filename: Name of the log file (text or binary).
+ * @param folded: Receives the number of edits and tombstones folded in.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_compact(const char *filename, long *folded);
+
+#endif
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "log_ids.h"
+#include "records.h"
+#include "log_scan.h"
+#include "log_lock.h"
+#include "instrument.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Number of records read per fread call when giving IDs to a binary log
+#define IDS_RECORD_BATCH 256
+
+// Slots added in memory during an update, written after the ones already in the file
+typedef struct {
+    FILE *file;
+    ids_header header;
+    int64_t stored;               // Slots already in the file
+    id_slot *added;               // Slots for IDs stored + 1 onwards
+    int64_t capacity;             // Allocated length of added
+    const char *data;             // Start of the mapped log, for text logs
+} ids_update;
+
+
+/**
+ * ids_filename - Builds the name of the sidecar ID file for a log file.
+ */
+static void ids_filename(const char *log_filename, char *buffer, size_t size){
+    snprintf(buffer, size, "%s%s", log_filename, IDS_SUFFIX);
+}
+
+/**
+ * slot_position - Returns where the slot of an ID is in the file.
+ */
+static long slot_position(int64_t id){
+    return (long)(sizeof(ids_header) + (size_t)(id - 1) * sizeof(id_slot));
+}
+
+/**
+ * add_slots - Gives out IDs up to id: the last goes to the entry at offset, and any
+ * skipped before it belonged to entries compaction removed.
+ */
+static int add_slots(ids_update *update, int64_t id, int64_t offset, int64_t current){
+    int64_t count = id - update->stored;
+    if (count > update->capacity){
+        int64_t capacity = update->capacity > 0 ? update->capacity : 1024;
+        while (capacity < count){
+            capacity *= 2;
+        }
+        id_slot *added = realloc(update->added, (size_t)capacity * sizeof(id_slot));
+        if (added == NULL){
+            perror("Error allocating entry IDs");
+            return -1;
+        }
+        update->added = added;
+        update->capacity = capacity;
+    }
+
+    while (update->header.count < id){
+        id_slot *slot = &update->added[update->header.count - update->stored];
+        update->header.count++;
+        slot->origin = offset;
+        slot->current = update->header.count == id ? current : LOG_ID_DELETED;
+    }
+    return 0;
+}
+
+/**
+ * add_entry - Gives the next ID, or the one written on its time line, to an entry.
+ */
+static int add_entry(ids_update *update, int64_t written_id, int64_t offset){
+    int64_t id = written_id > update->header.count ? written_id : update->header.count + 1;
+    return add_slots(update, id, offset, offset);
+}
+
+/**
+ * revise_entry - Points the slot of an entry at an edit, or marks it deleted.
+ * Revisions of IDs never given out or of deleted entries are ignored, as are
+ * revisions already applied by an update that stopped before saving its header.
+ */
+static int revise_entry(ids_update *update, int64_t id, int64_t offset, int deleted, int64_t replaces){
+    // Compaction ends the log with a tombstone that keeps the IDs of removed entries given out
+    if (deleted && replaces < 0){
+        return id > update->header.count ? add_slots(update, id, offset, LOG_ID_DELETED) : 0;
+    }
+    if (id < 1 || id > update->header.count){
+        return 0;
+    }
+
+    id_slot stored_slot;
+    id_slot *slot = &stored_slot;
+    if (id > update->stored){
+        slot = &update->added[id - update->stored - 1];
+    } else if (fseek(update->file, slot_position(id), SEEK_SET) != 0 ||
+               fread(slot, sizeof(*slot), 1, update->file) != 1){
+        return -1;
+    }
+
+    int64_t current = deleted ? LOG_ID_DELETED : offset;
+    if (slot->current == LOG_ID_DELETED || slot->current == current){
+        return 0;
+    }
+    slot->current = current;
+    update->header.superseded++;
+
+    if (slot == &stored_slot &&
+        (fseek(update->file, slot_position(id), SEEK_SET) != 0 ||
+         fwrite(slot, sizeof(*slot), 1, update->file) != 1)){
+        perror("Error writing entry IDs");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * id_scanned_entry - log_scan callback that gives IDs to entries and applies revisions.
+ */
+static int id_scanned_entry(const scanned_entry *scanned, void *context){
+    ids_update *update = context;
+    if (scanned->time_line == NULL){
+        return 0;
+    }
+    int64_t offset = (int64_t)(scanned->time_line - update->data);
+    switch (scanned->kind) {
+        case SCAN_ENTRY:
+            return add_entry(update, scanned->id, offset);
+        case SCAN_EDIT:
+            return revise_entry(update, scanned->id, offset, 0, scanned->replaces);
+        case SCAN_DELETE:
+            return revise_entry(update, scanned->id, offset, 1, scanned->replaces);
+        case SCAN_CORRUPT:
+            // A damaged entry keeps its ID, so the entries after it keep theirs
+            if (scanned->time_line_length >= 15 && memcmp(scanned->time_line, "Log Entry Time:", 15) == 0){
+                return add_entry(update, scanned->id, offset);
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * ids_text_tail - Reads the entries of a text log from header.indexed_size onwards.
+ */
+static int ids_text_tail(const char *log_filename, ids_update *update){
+    log_map map;
+    if (log_map_open(&map, log_filename) != 0){
+        return -1;
+    }
+
+    // Leave a record another process is still appending for the next update
+    size_t start = (size_t)update->header.indexed_size;
+    size_t end = map.size > start ? log_map_whole_end(&map) : start;
+
+    int status = 0;
+    if (end > start){
+        update->data = map.data;
+        status = log_scan(map.data + start, end - start, id_scanned_entry, update) == 0 ? 0 : -1;
+        if (status == 0){
+            update->header.indexed_size = (int64_t)end;
+        }
+    }
+
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * ids_binary_tail - Reads the records of a binary log from header.indexed_size onwards.
+ */
+static int ids_binary_tail(const char *log_filename, ids_update *update){
+    FILE *log = fopen(log_filename, "rb");
+    if (log == NULL){
+        return -1;
+    }
+
+    ids_header *header = &update->header;
+    if (header->indexed_size < (int64_t)sizeof(record_header)){
+        header->indexed_size = sizeof(record_header);
+    }
+    if (fseek(log, (long)header->indexed_size, SEEK_SET) != 0){
+        fclose(log);
+        return -1;
+    }
+
+    log_record records[IDS_RECORD_BATCH];
+    size_t count;
+    int status = 0;
+    while (status == 0 && (count = fread(records, sizeof(log_record), IDS_RECORD_BATCH, log)) > 0){
+        for (size_t i = 0; i < count && status == 0; i++){
+            const log_record *record = &records[i];
+            if (record->flags & RECORD_FLAG_REVISION){
+                status = revise_entry(update, record->id, header->indexed_size,
+                                      (record->flags & RECORD_FLAG_DELETED) != 0, record->replaces);
+            } else {
+                status = add_entry(update, record->id, header->indexed_size);
+            }
+            if (status == 0){
+                header->indexed_size += sizeof(log_record);
+            }
+        }
+    }
+
+    fclose(log);
+    return status;
+}
+
+/**
+ * load_header - Reads the header of an ID file and checks it against the log.
+ *
+ * @return: 0 for success, -1 if the file is damaged or does not match the log.
+ */
+static int load_header(FILE *file, ids_header *header, int64_t log_size){
+    struct stat file_stat;
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        strncmp(header->magic, IDS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->indexed_size > log_size || header->count < 0 ||
+        fstat(fileno(file), &file_stat) != 0 ||
+        file_stat.st_size < slot_position(header->count + 1)){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * update_ids - Brings the ID file up to date with the log; see log_ids_update.
+ */
+static int update_ids(const char *log_filename){
+    struct stat log_stat;
+    if (stat(log_filename, &log_stat) != 0){
+        return -1;
+    }
+
+    char name[512];
+    ids_filename(log_filename, name, sizeof(name));
+
+    ids_update update;
+    memset(&update, 0, sizeof(update));
+    update.file = fopen(name, "r+b");
+    if (update.file == NULL || load_header(update.file, &update.header, (int64_t)log_stat.st_size) != 0){
+        // Missing, damaged or stale: start again from the beginning of the log
+        if (update.file != NULL){
+            fclose(update.file);
+        }
+        update.file = fopen(name, "w+b");
+        if (update.file == NULL){
+            return -1;
+        }
+        memset(&update.header, 0, sizeof(update.header));
+        memcpy(update.header.magic, IDS_MAGIC, sizeof(IDS_MAGIC));
+        if (fwrite(&update.header, sizeof(update.header), 1, update.file) != 1){
+            fclose(update.file);
+            return -1;
+        }
+    }
+
+    if (update.header.indexed_size == (int64_t)log_stat.st_size){
+        fclose(update.file);
+        return 0;
+    }
+
+    update.stored = update.header.count;
+    int status = is_binary_log(log_filename) ? ids_binary_tail(log_filename, &update)
+                                             : ids_text_tail(log_filename, &update);
+
+    // New slots go after the stored ones, and the header is written last so an
+    // interrupted update is redone next time
+    int64_t added = update.header.count - update.stored;
+    if (status == 0 && added > 0 &&
+        (fseek(update.file, slot_position(update.stored + 1), SEEK_SET) != 0 ||
+         fwrite(update.added, sizeof(id_slot), (size_t)added, update.file) != (size_t)added)){
+        perror("Error writing entry IDs");
+        status = -1;
+    }
+    if (status == 0){
+        rewind(update.file);
+        if (fwrite(&update.header, sizeof(update.header), 1, update.file) != 1){
+            perror("Error writing entry IDs");
+            status = -1;
+        }
+    }
+    if (fclose(update.file) != 0){
+        status = -1;
+    }
+    free(update.added);
+    return status;
+}
+
+/**
+ * timed_update_ids - Runs update_ids, timing it.
+ */
+static int timed_update_ids(const char *log_filename){
+    uint64_t start = probe_begin();
+    int status = update_ids(log_filename);
+    probe_end(PROBE_IDS_UPDATE, start, 0);
+    return status;
+}
+
+int log_ids_update(const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = timed_update_ids(log_filename);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+int log_ids_open_held(log_ids *ids, const char *log_filename){
+    memset(ids, 0, sizeof(*ids));
+    if (timed_update_ids(log_filename) != 0){
+        return -1;
+    }
+
+    char name[512];
+    ids_filename(log_filename, name, sizeof(name));
+    FILE *file = fopen(name, "rb");
+    if (file == NULL){
+        return -1;
+    }
+
+    ids_header header;
+    size_t size = 0;
+    void *mapping = MAP_FAILED;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.count > 0){
+        size = (size_t)slot_position(header.count + 1);
+        mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    }
+    fclose(file);
+    if (header.count > 0 && mapping == MAP_FAILED){
+        perror("Error mapping entry IDs");
+        return -1;
+    }
+
+    if (mapping != MAP_FAILED){
+        ids->mapping = mapping;
+        ids->mapping_size = size;
+        ids->slots = (const id_slot *)((const char *)mapping + sizeof(ids_header));
+        ids->count = header.count;
+    }
+    ids->superseded = header.superseded;
+    return 0;
+}
+
+int log_ids_open(log_ids *ids, const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = log_ids_open_held(ids, log_filename);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+void log_ids_close(log_ids *ids){
+    if (ids->mapping != NULL){
+        munmap(ids->mapping, ids->mapping_size);
+    }
+    memset(ids, 0, sizeof(*ids));
+}
+
+int64_t log_ids_find(const log_ids *ids, int64_t offset, int64_t hint){
+    int64_t i = hint;
+    if (i < 0 || i >= ids->count || ids->slots[i].origin > offset){
+        // Binary search for the last slot at or before offset
+        int64_t low = 0;
+        int64_t high = ids->count;
+        while (low < high){
+            int64_t middle = low + (high - low) / 2;
+            if (ids->slots[middle].origin <= offset){
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        i = low - 1;
+    } else {
+        while (i + 1 < ids->count && ids->slots[i + 1].origin <= offset){
+            i++;
+        }
+    }
+    return i >= 0 && ids->slots[i].origin == offset ? i : -1;
+}
+
+int64_t log_ids_latest(const log_ids *ids, int64_t offset, int64_t *hint, int64_t *current){
+    *current = offset;
+    int64_t slot = log_ids_find(ids, offset, *hint);
+    if (slot < 0){
+        return 0;
+    }
+    *hint = slot;
+    if (ids->slots[slot].current == LOG_ID_DELETED){
+        return LOG_ID_DELETED;
+    }
+    *current = ids->slots[slot].current;
+    return slot + 1;
+}
+
+/**
+ * lookup_slot - Reads one slot for log_ids_lookup while the sidecars are locked.
+ */
+static int lookup_slot(const char *log_filename, int64_t id, id_slot *slot){
+    if (timed_update_ids(log_filename) != 0){
+        return -1;
+    }
+
+    char name[512];
+    ids_filename(log_filename, name, sizeof(name));
+    FILE *file = fopen(name, "rb");
+    if (file == NULL){
+        return -1;
+    }
+
+    ids_header header;
+    int status = 0;
+    if (fread(&header, sizeof(header), 1, file) != 1 || id < 1 || id > header.count ||
+        fseek(file, slot_position(id), SEEK_SET) != 0 || fread(slot, sizeof(*slot), 1, file) != 1){
+        status = -1;
+    }
+    fclose(file);
+    return status;
+}
+
+int log_ids_lookup(const char *log_filename, int64_t id, id_slot *slot){
+    int lock = log_lock_sidecars(log_filename);
+    int status = lookup_slot(log_filename, id, slot);
+    log_unlock_sidecars(lock);
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef LOG_IDS_H
+#define LOG_IDS_H
+
+#include <stdint.h>
+
+// Entry IDs are kept in a sidecar file next to the log, e.g. data/logs.txt.ids
+#define IDS_SUFFIX ".ids"
+#define IDS_MAGIC "DMSIDS1"
+
+// Offset recorded as the current version of a deleted entry
+#define LOG_ID_DELETED -1
+
+// Entries get IDs 1, 2, 3, ... in the order they are logged. The IDs are not written
+// with the entries: an entry's ID is one more than the entry before's, except after
+// entries that compaction removed, where it is written on the time line. Edits and
+// tombstones name the entry they revise by its ID.
+
+// Header at the start of the ID file.
+typedef struct {
+    char magic[8];                // IDS_MAGIC, null terminated
+    int64_t indexed_size;         // Bytes of the log covered by the slots
+    int64_t count;                // Number of slots: the highest ID given out
+    int64_t superseded;           // Edits and tombstones applied, which compaction folds in
+} ids_header;
+
+// Where one entry is in the log; ID n has slot n - 1. Origins never decrease from one
+// slot to the next, so the slot of an entry can be found from its offset.
+typedef struct {
+    int64_t origin;               // Offset of the entry as first logged; for IDs removed by
+                                  // compaction, the offset of the next entry
+    int64_t current;              // Offset of its latest version, the entry itself or an edit,
+                                  // or LOG_ID_DELETED
+} id_slot;
+
+// The ID file of a log mapped for reading.
+typedef struct {
+    const id_slot *slots;         // slots[id - 1]
+    int64_t count;                // Number of slots
+    int64_t superseded;           // Edits and tombstones applied
+    void *mapping;                // The mapped file, or NULL
+    size_t mapping_size;
+} log_ids;
+
+/**
+ * log_ids_update - Gives IDs to the entries appended to the log since the last update and
+ * applies the edits and tombstones appended since. Only the unread tail of the log is
+ * read; edits rewrite the one slot of the entry they revise. The file is rebuilt from
+ * scratch if it is missing, damaged or the log has been truncated.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int log_ids_update(const char *log_filename);
+
+/**
+ * log_ids_open - Brings the ID file up to date and maps it for reading.
+ *
+ * @param ids: Receives the mapping; left empty on errors.
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int log_ids_open(log_ids *ids, const char *log_filename);
+
+/**
+ * log_ids_open_held - Does what log_ids_open does for a caller that already holds a lock
+ * keeping other sidecar updates out, such as log_lock_exclusive.
+ *
+ * @param ids: Receives the mapping; left empty on errors.
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int log_ids_open_held(log_ids *ids, const char *log_filename);
+
+/**
+ * log_ids_close - Unmaps an ID file mapped by log_ids_open.
+ *
+ * @param ids: The mapping to release.
+ */
+void log_ids_close(log_ids *ids);
+
+/**
+ * log_ids_find - Finds the slot of the entry first logged at an offset. Entries read in
+ * log order are found in constant time by passing the slot found for the one before.
+ *
+ * @param ids: A mapped ID file.
+ * @param offset: Offset of the entry's time line or record.
+ * @param hint: Slot of an earlier entry to search forward from, or -1.
+ * @return: The slot, whose entry has ID slot + 1, or -1 if no entry starts at offset.
+ */
+int64_t log_ids_find(const log_ids *ids, int64_t offset, int64_t hint);
+
+/**
+ * log_ids_latest - Finds the ID and latest version of the entry first logged at an offset,
+ * for readers showing entries as they are now.
+ *
+ * @param ids: A mapped ID file.
+ * @param offset: Offset of the entry's time line or record.
+ * @param hint: Slot of an earlier entry to search forward from, or -1; updated to the slot found.
+ * @param current: Receives the offset of the latest version, which is offset unless the
+ *                 entry was edited.
+ * @return: The entry's ID, 0 if no entry with an ID starts at offset, or LOG_ID_DELETED.
+ */
+int64_t log_ids_latest(const log_ids *ids, int64_t offset, int64_t *hint, int64_t *current);
+
+/**
+ * log_ids_lookup - Brings the ID file up to date and reads the slot of one entry.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param id: The entry's ID.
+ * @param slot: Receives the slot.
+ * @return: 0 for success, -1 if the ID was never given out or the file cannot be read.
+ */
+int log_ids_lookup(const char *log_filename, int64_t id, id_slot *slot);
+
+#endif
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "log_index.h"
+#include "logging.h"
+#include "records.h"
+#include "log_scan.h"
+#include "log_lock.h"
+#include "instrument.h"
+#include <string.h>
+#include <sys/stat.h>
+
+// Number of records read per fread call when indexing a binary log
+#define INDEX_RECORD_BATCH 256
+
+
+/**
+ * index_filename - Builds the name of the sidecar index for a log file.
+ */
+static void index_filename(const char *log_filename, char *buffer, size_t size){
+    snprintf(buffer, size, "%s%s", log_filename, INDEX_SUFFIX);
+}
+
+/**
+ * reset_header - Initialises the header of an empty index.
+ */
+static void reset_header(index_header *header){
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->indexed_size = 0;
+    header->max_timestamp = INT64_MIN;
+    header->last_block = INT64_MIN;
+}
+
+/**
+ * block_of - Returns the block number of a timestamp, rounding down for times before the epoch.
+ */
+static int64_t block_of(int64_t timestamp){
+    int64_t block = timestamp / INDEX_BLOCK_SECONDS;
+    if (timestamp % INDEX_BLOCK_SECONDS < 0){
+        block--;
+    }
+    return block;
+}
+
+/**
+ * index_entry - Adds an entry to the index, writing a new point when it starts a later block.
+ */
+static int index_entry(FILE *index, index_header *header, int64_t timestamp, int64_t offset){
+    int64_t block = block_of(timestamp);
+    if (block > header->last_block){
+        index_point point = {header->max_timestamp, offset};
+        if (fwrite(&point, sizeof(point), 1, index) != 1){
+            perror("Error writing log index");
+            return -1;
+        }
+        header->last_block = block;
+    }
+    if (timestamp > header->max_timestamp){
+        header->max_timestamp = timestamp;
+    }
+    return 0;
+}
+
+// State passed through log_scan while indexing a text log
+typedef struct {
+    FILE *index;
+    index_header *header;
+    const char *data;             // Start of the mapped log
+} index_scan_context;
+
+/**
+ * index_scanned_entry - log_scan callback that indexes each entry with a valid time line.
+ */
+static int index_scanned_entry(const scanned_entry *scanned, void *context){
+    index_scan_context *scan = context;
+    if (scanned->kind != SCAN_ENTRY || scanned->time_line == NULL){
+        return 0;
+    }
+    int64_t offset = (int64_t)(scanned->time_line - scan->data);
+    return index_entry(scan->index, scan->header, (int64_t)scanned->timestamp, offset);
+}
+
+/**
+ * index_text_tail - Indexes the entries of a text log from header->indexed_size onwards.
+ * Uses the same scanner as read_logs so both see the same entries.
+ */
+static int index_text_tail(const char *log_filename, FILE *index, index_header *header){
+    log_map map;
+    if (log_map_open(&map, log_filename) != 0){
+        return -1;
+    }
+
+    // Leave a record another process is still appending for the next update
+    size_t start = (size_t)header->indexed_size;
+    size_t end = map.size > start ? log_map_whole_end(&map) : start;
+
+    int status = 0;
+    if (end > start){
+        index_scan_context scan = {index, header, map.data};
+        status = log_scan(map.data + start, end - start, index_scanned_entry, &scan) == 0 ? 0 : -1;
+        if (status == 0){
+            header->indexed_size = (int64_t)end;
+        }
+    }
+
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * index_binary_tail - Indexes the records of a binary log from header->indexed_size onwards.
+ */
+static int index_binary_tail(FILE *log, FILE *index, index_header *header){
+    if (header->indexed_size < (int64_t)sizeof(record_header)){
+        header->indexed_size = sizeof(record_header);
+    }
+    if (fseek(log, (long)header->indexed_size, SEEK_SET) != 0){
+        return -1;
+    }
+
+    log_record records[INDEX_RECORD_BATCH];
+    size_t count;
+    while ((count = fread(records, sizeof(log_record), INDEX_RECORD_BATCH, log)) > 0){
+        for (size_t i = 0; i < count; i++){
+            if (index_entry(index, header, records[i].timestamp, header->indexed_size) != 0){
+                return -1;
+            }
+            header->indexed_size += sizeof(log_record);
+        }
+    }
+    return 0;
+}
+
+/**
+ * update_index - Brings the index up to date with the log; see log_index_update.
+ */
+static int update_index(const char *log_filename){
+    struct stat log_stat;
+    if (stat(log_filename, &log_stat) != 0){
+        return -1;
+    }
+
+    char name[512];
+    index_filename(log_filename, name, sizeof(name));
+
+    index_header header;
+    FILE *index = fopen(name, "r+b");
+    if (index == NULL ||
+        fread(&header, sizeof(header), 1, index) != 1 ||
+        strncmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.indexed_size > (int64_t)log_stat.st_size){
+        // Missing, damaged or stale: start again from the beginning of the log
+        if (index != NULL){
+            fclose(index);
+        }
+        index = fopen(name, "w+b");
+        if (index == NULL){
+            return -1;
+        }
+        reset_header(&header);
+        if (fwrite(&header, sizeof(header), 1, index) != 1){
+            fclose(index);
+            return -1;
+        }
+    }
+
+    if (header.indexed_size == (int64_t)log_stat.st_size){
+        fclose(index);
+        return 0;
+    }
+
+    int status;
+    fseek(index, 0, SEEK_END);
+    if (is_binary_log(log_filename)){
+        FILE *log = fopen(log_filename, "rb");
+        if (log == NULL){
+            fclose(index);
+            return -1;
+        }
+        status = index_binary_tail(log, index, &header);
+        fclose(log);
+    } else {
+        status = index_text_tail(log_filename, index, &header);
+    }
+
+    // The header is written last so an interrupted update is redone next time
+    if (status == 0){
+        rewind(index);
+        if (fwrite(&header, sizeof(header), 1, index) != 1){
+            perror("Error writing log index");
+            status = -1;
+        }
+    }
+    if (fclose(index) != 0){
+        status = -1;
+    }
+    return status;
+}
+
+/**
+ * timed_update_index - Runs update_index, timing it.
+ */
+static int timed_update_index(const char *log_filename){
+    uint64_t start = probe_begin();
+    int status = update_index(log_filename);
+    probe_end(PROBE_INDEX_UPDATE, start, 0);
+    return status;
+}
+
+int log_index_update(const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = timed_update_index(log_filename);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+/**
+ * seek_index - Looks up the offset for log_index_seek while the sidecars are locked.
+ */
+static long seek_index(const char *log_filename, time_t start_time){
+    if (timed_update_index(log_filename) != 0){
+        return 0;
+    }
+
+    char name[512];
+    index_filename(log_filename, name, sizeof(name));
+    FILE *index = fopen(name, "rb");
+    if (index == NULL){
+        return 0;
+    }
+
+    fseek(index, 0, SEEK_END);
+    long count = (ftell(index) - (long)sizeof(index_header)) / (long)sizeof(index_point);
+
+    // Binary search for the first point preceded by an entry inside the window
+    long low = 0;
+    long high = count;
+    while (low < high){
+        long middle = low + (high - low) / 2;
+        index_point point;
+        if (fseek(index, (long)sizeof(index_header) + middle * (long)sizeof(index_point), SEEK_SET) != 0 ||
+            fread(&point, sizeof(point), 1, index) != 1){
+            fclose(index);
+            return 0;
+        }
+        if (point.prefix_max < (int64_t)start_time){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // Everything before point low - 1 is older than the window
+    long offset = 0;
+    if (low > 0){
+        index_point point;
+        if (fseek(index, (long)sizeof(index_header) + (low - 1) * (long)sizeof(index_point), SEEK_SET) == 0 &&
+            fread(&point, sizeof(point), 1, index) == 1){
+            offset = (long)point.offset;
+        }
+    }
+
+    fclose(index);
+    return offset;
+}
+
+long log_index_seek(const char *log_filename, time_t start_time){
+    int lock = log_lock_sidecars(log_filename);
+    long offset = seek_index(log_filename, start_time);
+    log_unlock_sidecars(lock);
+    return offset;
+}
@@ -0,0 +1,49 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stdint.h>
+#include <time.h>
+
+// The index is kept in a sidecar file next to the log, e.g. data/logs.txt.idx
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "DMSIDX2"
+
+// Entries are grouped into blocks of this many seconds; each block gets one index point.
+#define INDEX_BLOCK_SECONDS 3600
+
+// Header at the start of the index file.
+typedef struct {
+    char magic[8];                // INDEX_MAGIC, null terminated
+    int64_t indexed_size;         // Bytes of the log covered by the index
+    int64_t max_timestamp;        // Latest entry time seen so far
+    int64_t last_block;           // Block number of the most recent index point
+} index_header;
+
+// One index point: the offset of the first entry of a block.
+typedef struct {
+    int64_t prefix_max;           // Latest entry time stored before offset
+    int64_t offset;               // Byte offset of the entry in the log
+} index_point;
+
+/**
+ * log_index_update - Indexes any entries appended to the log since the last update.
+ * Only the unindexed tail of the log is read. The index is rebuilt from scratch
+ * if it is missing, damaged or the log has been truncated.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int log_index_update(const char *log_filename);
+
+/**
+ * log_index_seek - Finds where to start reading the log for a time window.
+ * Every entry stored before the returned offset is older than start_time.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param start_time: Start of the time window.
+ * @return: Offset of the first entry that can be in the window, or 0 if the
+ *          index cannot be used.
+ */
+long log_index_seek(const char *log_filename, time_t start_time);
+
+#endif
@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "log_lock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Open file description locks belong to the descriptor rather than the process, so
+// threads and descriptors within one process exclude each other too, and closing
+// another descriptor for the log does not drop them. Older systems fall back to
+// process-owned locks, which only exclude other processes.
+#ifdef F_OFD_SETLKW
+#define LOG_LOCK_WAIT F_OFD_SETLKW
+#define LOG_LOCK_SET F_OFD_SETLK
+#else
+#define LOG_LOCK_WAIT F_SETLKW
+#define LOG_LOCK_SET F_SETLK
+#endif
+
+/**
+ * lock_range - Waits for and takes a lock on length bytes from start, relative to whence;
+ * a length of 0 runs to the end of the file, however far it grows.
+ */
+static int lock_range(int fd, short type, short whence, off_t start, off_t length){
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = whence;
+    lock.l_start = start;
+    lock.l_len = length;
+    while (fcntl(fd, type == F_UNLCK ? LOG_LOCK_SET : LOG_LOCK_WAIT, &lock) != 0){
+        if (errno != EINTR){
+            perror("Error locking log file");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int log_lock_append(int fd){
+    // Every append's range runs from the end of the file to infinity, so any two overlap
+    return lock_range(fd, F_WRLCK, SEEK_END, 0, 0);
+}
+
+int log_lock_whole(int fd){
+    return lock_range(fd, F_WRLCK, SEEK_SET, 0, 0);
+}
+
+int log_replaced(int fd, const char *log_filename){
+    struct stat open_stat;
+    struct stat named_stat;
+    if (fstat(fd, &open_stat) != 0 || stat(log_filename, &named_stat) != 0){
+        return 1;
+    }
+    return open_stat.st_dev != named_stat.st_dev || open_stat.st_ino != named_stat.st_ino;
+}
+
+/**
+ * lock_current - Opens a log and locks length bytes from its start, opening it again
+ * if it was replaced while waiting for the lock.
+ */
+static int lock_current(const char *log_filename, off_t length){
+    while (1){
+        int fd = open(log_filename, O_RDWR);
+        if (fd < 0){
+            return -1;
+        }
+        if (lock_range(fd, F_WRLCK, SEEK_SET, 0, length) != 0){
+            close(fd);
+            return -1;
+        }
+        if (!log_replaced(fd, log_filename)){
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+int log_lock_exclusive(const char *log_filename){
+    int fd = lock_current(log_filename, 0);
+    if (fd < 0){
+        perror("Error locking log file");
+    }
+    return fd;
+}
+
+int log_lock_try(const char *lock_filename){
+    int fd = open(lock_filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0){
+        return -1;
+    }
+
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(fd, LOG_LOCK_SET, &lock) != 0){
+        if (errno != EINTR){
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+void log_unlock(int fd){
+    lock_range(fd, F_UNLCK, SEEK_SET, 0, 0);
+}
+
+int log_lock_sidecars(const char *log_filename){
+    return lock_current(log_filename, 1);
+}
+
+void log_unlock_sidecars(int fd){
+    // Closing the descriptor releases its locks
+    if (fd >= 0){
+        close(fd);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef LOG_LOCK_H
+#define LOG_LOCK_H
+
+// Advisory locks let several processes append to one log and keep its sidecar files
+// (index, statistics and rollups) up to date. Locks are fcntl record locks owned by
+// the open file, so they are only held for as long as the work they guard:
+//   - an append locks the log from its end onwards, which every other append also
+//     needs, while its bytes are written;
+//   - a writer opening a log locks all of it while it checks for a torn last entry;
+//   - sidecar updates lock the first byte of the log, so they wait for each other
+//     but not for appends;
+//   - compaction locks all of the log through one descriptor, which shuts out all
+//     three, then renames a rewritten log over it. Anyone who then gets a lock on the
+//     old file finds it replaced and starts again with the new one;
+//   - a segmented log's single writer holds a lock on a lock file beside its manifest
+//     for the whole session.
+
+/**
+ * log_lock_append - Waits for and takes the lock for appending to a log: a write lock
+ * from the current end of the file onwards.
+ *
+ * @param fd: The log, opened for reading and writing.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_lock_append(int fd);
+
+/**
+ * log_lock_whole - Waits for and takes a write lock on the whole log.
+ *
+ * @param fd: The log, opened for reading and writing.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_lock_whole(int fd);
+
+/**
+ * log_lock_exclusive - Opens a log and waits for a write lock on all of it, which no
+ * append, torn entry check or sidecar update can run alongside.
+ *
+ * @param log_filename: Name of the log file.
+ * @return: A descriptor holding the lock, to be closed to release it, or -1 for errors.
+ */
+int log_lock_exclusive(const char *log_filename);
+
+/**
+ * log_replaced - Checks whether a log opened earlier has since been replaced, as
+ * compaction replaces it, so the descriptor no longer refers to the file of that name.
+ *
+ * @param fd: The log, as opened earlier.
+ * @param log_filename: Name of the log file.
+ * @return: 1 if the file has been replaced or removed, 0 otherwise.
+ */
+int log_replaced(int fd, const char *log_filename);
+
+/**
+ * log_lock_try - Opens a lock file, creating it if needed, and takes a write lock on it
+ * if nobody else holds one, without waiting.
+ *
+ * @param lock_filename: Name of the lock file.
+ * @return: A descriptor holding the lock, to be closed to release it, or -1 if the lock
+ * is held elsewhere (errno EAGAIN or EACCES) or for errors.
+ */
+int log_lock_try(const char *lock_filename);
+
+/**
+ * log_unlock - Releases every lock taken through a file descriptor.
+ *
+ * @param fd: The log.
+ */
+void log_unlock(int fd);
+
+/**
+ * log_lock_sidecars - Waits until no other process is updating the sidecar files of
+ * a log and keeps them from starting until log_unlock_sidecars.
+ *
+ * @param log_filename: Name of the log file.
+ * @return: A descriptor holding the lock, or -1 if the log cannot be opened for
+ * writing; callers then go on without the lock.
+ */
+int log_lock_sidecars(const char *log_filename);
+
+/**
+ * log_unlock_sidecars - Releases a lock taken by log_lock_sidecars.
+ *
+ * @param fd: The descriptor returned by log_lock_sidecars; -1 is ignored.
+ */
+void log_unlock_sidecars(int fd);
+
+#endif
@@ -0,0 +1,852 @@
+#include <stdio.h>
+#include "log_scan.h"
+#include "instrument.h"
+#include "local_time.h"
+#include "crc32c.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Numbers longer than this are handed to strtof
+#define SCAN_NUMBER_MAX 64
+
+// Powers of ten that are exact in single precision
+static const float exact_powers_of_ten[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+// Last hour converted from local time; entries within it are converted with arithmetic
+typedef struct {
+    int valid;
+    int year, month, day, hour;
+    time_t start;                 // Epoch time of minute 0, second 0 of the hour
+    uint64_t hits;                // Times converted without a zone lookup
+} hour_cache;
+
+
+int log_map_open(log_map *map, const char *filename){
+    map->data = NULL;
+    map->size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        perror("Error opening file");
+        return -1;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0){
+        perror("Error opening file");
+        close(fd);
+        return -1;
+    }
+
+    // An empty log has nothing to map
+    if (file_stat.st_size > 0){
+        void *data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED){
+            perror("Error mapping file");
+            close(fd);
+            return -1;
+        }
+        madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+        map->data = data;
+        map->size = (size_t)file_stat.st_size;
+    }
+
+    close(fd);
+    return 0;
+}
+
+void log_map_close(log_map *map){
+    if (map->data != NULL){
+        munmap((void *)map->data, map->size);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+size_t log_text_whole_end(const char *tail, size_t length, int at_line_start){
+    if (length == 0){
+        return 0;
+    }
+
+    // Find the last line and the last record's first line that start inside the window;
+    // entries, edits and tombstones all start "Log Entry "
+    const char *prefix = "Log Entry ";
+    size_t prefix_length = strlen(prefix);
+    long last_line = at_line_start ? 0 : -1;
+    long last_entry = -1;
+    long last_newline = -1;
+    long last_checksum = -1;
+    for (size_t i = 0; i < length; i++){
+        if (last_line == (long)i && length - i >= prefix_length && memcmp(tail + i, prefix, prefix_length) == 0){
+            last_entry = (long)i;
+        }
+        if (last_line == (long)i && length - i >= 9 && memcmp(tail + i, "Checksum:", 9) == 0){
+            last_checksum = (long)i;
+        }
+        if (tail[i] == '\n'){
+            last_newline = (long)i;
+            if (i + 1 < length){
+                last_line = (long)i + 1;
+            }
+        }
+    }
+
+    if (tail[length - 1] != '\n'){
+        // The last line was cut short; drop the record it belongs to, which is a new one
+        // if the line is the start of a record's first line
+        if (last_line >= 0 && length - (size_t)last_line < prefix_length &&
+            memcmp(tail + last_line, prefix, length - (size_t)last_line) == 0){
+            return (size_t)last_line;
+        }
+        if (last_entry >= 0){
+            return (size_t)last_entry;
+        }
+        if (last_newline >= 0){
+            return (size_t)(last_newline + 1);
+        }
+        return at_line_start ? 0 : length;
+    }
+    // A time line with nothing after it was cut short before its data lines; a tombstone
+    // is a single line
+    if (last_entry >= 0 && last_entry == last_line &&
+        memcmp(tail + last_entry, "Log Entry Deleted:", 18) != 0){
+        return (size_t)last_entry;
+    }
+    // Once records end in checksum lines, a last record without one was cut short at the
+    // end of a line
+    if (last_checksum >= 0 && last_checksum < last_entry){
+        return (size_t)last_entry;
+    }
+    return length;
+}
+
+size_t log_map_whole_end(const log_map *map){
+    size_t window = 2 * LOG_ENTRY_MAX;
+    size_t from = map->size > window ? map->size - window : 0;
+    return from + log_text_whole_end(map->data + from, map->size - from,
+                                     from == 0 || map->data[from - 1] == '\n');
+}
+
+/**
+ * skip_spaces - Skips whitespace the way a space in a scanf format does.
+ */
+static const char *skip_spaces(const char *p, const char *end){
+    while (p < end && isspace((unsigned char)*p)){
+        p++;
+    }
+    return p;
+}
+
+/**
+ * match_literal - Matches literal format text; a space matches any run of whitespace.
+ *
+ * @return: Position after the match, or NULL if the text does not match.
+ */
+static const char *match_literal(const char *p, const char *end, const char *literal){
+    for (; *literal != '\0'; literal++){
+        if (isspace((unsigned char)*literal)){
+            p = skip_spaces(p, end);
+        } else if (p < end && *p == *literal){
+            p++;
+        } else {
+            return NULL;
+        }
+    }
+    return p;
+}
+
+/**
+ * parse_int - Parses a number like scanf's %d.
+ *
+ * @return: Position after the number, or NULL if there is none.
+ */
+static const char *parse_int(const char *p, const char *end, int *value){
+    p = skip_spaces(p, end);
+
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+
+    const char *digits = p;
+    unsigned int result = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        result = result * 10 + (unsigned int)(*p - '0');
+        p++;
+    }
+    if (p == digits){
+        return NULL;
+    }
+
+    *value = negative ? -(int)result : (int)result;
+    return p;
+}
+
+/**
+ * parse_float_slow - Parses a number with strtof, for forms the fast path does not handle.
+ */
+static const char *parse_float_slow(const char *p, const char *end, float *value){
+    char number[SCAN_NUMBER_MAX];
+    size_t length = (size_t)(end - p) < sizeof(number) - 1 ? (size_t)(end - p) : sizeof(number) - 1;
+    memcpy(number, p, length);
+    number[length] = '\0';
+
+    char *number_end;
+    float result = strtof(number, &number_end);
+    if (number_end == number){
+        return NULL;
+    }
+    *value = result;
+    return p + (number_end - number);
+}
+
+/**
+ * parse_float - Parses a number like scanf's %f.
+ * Plain decimals with at most 7 significant digits and 10 decimal places are
+ * converted with one exact single precision division, which rounds the same
+ * way strtof does. Anything else goes through strtof.
+ *
+ * @return: Position after the number, or NULL if there is none.
+ */
+static const char *parse_float(const char *p, const char *end, float *value){
+    p = skip_spaces(p, end);
+    const char *start = p;
+
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+
+    unsigned int mantissa = 0;
+    int significant = 0;          // Digits from the first non-zero digit
+    int digits = 0;
+    int decimals = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        mantissa = mantissa * 10 + (unsigned int)(*p - '0');
+        significant += (significant > 0 || *p != '0');
+        digits++;
+        p++;
+    }
+    if (p < end && *p == '.'){
+        p++;
+        while (p < end && *p >= '0' && *p <= '9'){
+            mantissa = mantissa * 10 + (unsigned int)(*p - '0');
+            significant += (significant > 0 || *p != '0');
+            digits++;
+            decimals++;
+            p++;
+        }
+    }
+
+    // Exponents, hex, inf/nan, long numbers and bare signs take the slow path
+    int continues = p < end && strchr("eEpPxXiInN", *p) != NULL && *p != '\0';
+    if (digits == 0 || continues || significant > 7 || decimals > 10){
+        return parse_float_slow(start, end, value);
+    }
+
+    float result = (float)mantissa / exact_powers_of_ten[decimals];
+    *value = negative ? -result : result;
+    return p;
+}
+
+/**
+ * parse_int64 - Parses a whole number of up to 18 digits, with an optional minus sign,
+ * that runs to the end of the line or to whitespace.
+ *
+ * @return: Position after the number, or NULL if there is none.
+ */
+static const char *parse_int64(const char *p, const char *end, int64_t *value){
+    int negative = p < end && *p == '-';
+    p += negative;
+    const char *digits = p;
+    int64_t result = 0;
+    while (p < end && *p >= '0' && *p <= '9' && p - digits < 18){
+        result = result * 10 + (*p - '0');
+        p++;
+    }
+    if (p == digits || (p < end && !isspace((unsigned char)*p))){
+        return NULL;
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+/**
+ * parse_epoch - Parses the " @SECONDS" suffix written after the wall clock time.
+ *
+ * @return: Position after the suffix, or NULL if it is not present.
+ */
+static const char *parse_epoch(const char *p, const char *end, time_t *timestamp){
+    int64_t seconds;
+    if ((p = match_literal(p, end, " @")) == NULL || (p = parse_int64(p, end, &seconds)) == NULL){
+        return NULL;
+    }
+    *timestamp = (time_t)seconds;
+    return p;
+}
+
+/**
+ * parse_entry_id - Parses a " #ID" entry ID.
+ *
+ * @return: Position after the ID, or NULL if there is no valid ID.
+ */
+static const char *parse_entry_id(const char *p, const char *end, int64_t *id){
+    if ((p = match_literal(p, end, " #")) == NULL || (p = parse_int64(p, end, id)) == NULL || *id <= 0){
+        return NULL;
+    }
+    return p;
+}
+
+/**
+ * parse_time_line - Parses "Log Entry Time: %d-%d-%d %d:%d:%d [@SECONDS]".
+ * Entries carrying the epoch time use it as is; older entries have their local
+ * wall clock time converted with the zone table, once per hour of entries.
+ *
+ * @param p: Position after the "Log Entry Time:" prefix, or after the ID of an edit or tombstone.
+ * @param display_end: Receives the end of the wall clock time, where the epoch suffix starts.
+ * @param rest: Receives the position after the time and its epoch suffix, if any.
+ * @return: 0 for success, -1 if the line is not a valid entry time.
+ */
+static int parse_time_line(const char *p, const char *end, hour_cache *cache, time_t *timestamp,
+                           const char **display_end, const char **rest){
+    int year, month, day, hour, minute, second;
+    if ((p = match_literal(p, end, " ")) == NULL ||
+        (p = parse_int(p, end, &year)) == NULL ||
+        (p = match_literal(p, end, "-")) == NULL ||
+        (p = parse_int(p, end, &month)) == NULL ||
+        (p = match_literal(p, end, "-")) == NULL ||
+        (p = parse_int(p, end, &day)) == NULL ||
+        (p = match_literal(p, end, " ")) == NULL ||
+        (p = parse_int(p, end, &hour)) == NULL ||
+        (p = match_literal(p, end, ":")) == NULL ||
+        (p = parse_int(p, end, &minute)) == NULL ||
+        (p = match_literal(p, end, ":")) == NULL ||
+        (p = parse_int(p, end, &second)) == NULL){
+        return -1;
+    }
+
+    *display_end = p;
+    if ((*rest = parse_epoch(p, end, timestamp)) != NULL){
+        return 0;
+    }
+    *rest = p;
+
+    // Local time is linear within an hour, so only convert once per hour of entries
+    if (!cache->valid || cache->year != year || cache->month != month ||
+        cache->day != day || cache->hour != hour){
+        uint64_t start = probe_begin();
+        cache->start = local_time_to_epoch(year, month, day, hour, 0, 0);
+        probe_end(PROBE_TIME_CONVERT, start, 0);
+        cache->year = year;
+        cache->month = month;
+        cache->day = day;
+        cache->hour = hour;
+        cache->valid = 1;
+    } else {
+        cache->hits++;
+    }
+
+    *timestamp = cache->start + (time_t)minute * 60 + second;
+    return 0;
+}
+
+/**
+ * record_kind - Tells which kind of record a "Log Entry " line starts.
+ *
+ * @param prefix_length: Receives the length of the line's prefix.
+ * @return: SCAN_ENTRY, SCAN_EDIT or SCAN_DELETE, or -1 if the line starts no record.
+ */
+static int record_kind(const char *p, const char *end, size_t *prefix_length){
+    size_t length = (size_t)(end - p);
+    if (length >= 15 && memcmp(p, "Log Entry Time:", 15) == 0){
+        *prefix_length = 15;
+        return SCAN_ENTRY;
+    }
+    if (length >= 15 && memcmp(p, "Log Entry Edit:", 15) == 0){
+        *prefix_length = 15;
+        return SCAN_EDIT;
+    }
+    if (length >= 18 && memcmp(p, "Log Entry Deleted:", 18) == 0){
+        *prefix_length = 18;
+        return SCAN_DELETE;
+    }
+    return -1;
+}
+
+/**
+ * parse_record_line - Parses the first line of a record:
+ *   "Log Entry Time: %d-%d-%d %d:%d:%d [@SECONDS] [#ID]"
+ *   "Log Entry Edit: #ID %d-%d-%d %d:%d:%d @SECONDS replacing OFFSET"
+ *   "Log Entry Deleted: #ID %d-%d-%d %d:%d:%d @SECONDS replacing OFFSET"
+ * Entries only carry an ID when it is not one more than the entry before's.
+ *
+ * @param record: Receives the kind, time, ID and replaced offset.
+ * @return: 0 for success, -1 if the line is not valid.
+ */
+static int parse_record_line(const char *line, const char *end, int kind, size_t prefix_length,
+                             hour_cache *cache, scanned_entry *record){
+    const char *p = line + prefix_length;
+    int64_t id = 0;
+    if (kind != SCAN_ENTRY && (p = parse_entry_id(p, end, &id)) == NULL){
+        return -1;
+    }
+
+    time_t timestamp;
+    const char *display_end;
+    const char *rest;
+    if (parse_time_line(p, end, cache, &timestamp, &display_end, &rest) != 0){
+        return -1;
+    }
+
+    int64_t replaces = -1;
+    if (kind == SCAN_ENTRY){
+        if (parse_entry_id(rest, end, &id) == NULL){
+            id = 0;
+        }
+    } else if ((rest = match_literal(rest, end, " replacing ")) == NULL ||
+               parse_int64(rest, end, &replaces) == NULL){
+        return -1;
+    }
+
+    memset(record, 0, sizeof(*record));
+    record->kind = kind;
+    record->time_line = line;
+    record->time_display_length = (size_t)(display_end - line);
+    record->has_timestamp = 1;
+    record->timestamp = timestamp;
+    record->id = id;
+    record->replaces = replaces;
+    return 0;
+}
+
+/**
+ * parse_data_line - Parses one data line into the current entry.
+ * Lines that are not recognised or do not parse are ignored.
+ */
+static void parse_data_line(const char *p, const char *end, scanned_entry *current){
+    log_entry *entry = &current->entry;
+    size_t length = (size_t)(end - p);
+
+#define HAS_PREFIX(prefix) (length >= sizeof(prefix) - 1 && memcmp(p, prefix, sizeof(prefix) - 1) == 0)
+#define AFTER(prefix) (p + sizeof(prefix) - 1)
+
+    switch (*p) {
+        case 'B':
+            if (HAS_PREFIX("Blood Glucose:") &&
+                parse_float(AFTER("Blood Glucose:"), end, &entry->blood_glucose_level) != NULL){
+                current->lines |= SCAN_LINE_BLOOD_GLUCOSE;
+            }
+            break;
+        case 'T':
+            if (HAS_PREFIX("Target:")){
+                if (parse_float(AFTER("Target:"), end, &entry->target_blood_glucose) != NULL){
+                    current->lines |= SCAN_LINE_TARGET;
+                }
+            } else if (HAS_PREFIX("Total Insulin Dosage:")){
+                if (parse_float(AFTER("Total Insulin Dosage:"), end, &entry->insulin_dosage) != NULL){
+                    current->lines |= SCAN_LINE_TOTAL_DOSAGE;
+                }
+            } else if (HAS_PREFIX("Type:")){
+                const char *type = skip_spaces(AFTER("Type:"), end);
+                size_t type_length = (size_t)(end - type);
+                if (type_length > 0){
+                    if (type_length > sizeof(entry->entry_type) - 1){
+                        type_length = sizeof(entry->entry_type) - 1;
+                    }
+                    memcpy(entry->entry_type, type, type_length);
+                    entry->entry_type[type_length] = '\0';
+                    current->lines |= SCAN_LINE_TYPE;
+                }
+            }
+            break;
+        case 'C':
+            if (HAS_PREFIX("Carbs:")){
+                const char *q = parse_float(AFTER("Carbs:"), end, &entry->meal_time_carbs);
+                if (q != NULL && (q = match_literal(q, end, " g, Carb Ratio: ")) != NULL &&
+                    parse_float(q, end, &entry->carb_ratio) != NULL){
+                    current->lines |= SCAN_LINE_CARBS;
+                }
+            } else if (HAS_PREFIX("Correction Factor:")){
+                if (parse_int(AFTER("Correction Factor:"), end, &entry->correction_factor) != NULL){
+                    current->lines |= SCAN_LINE_CORRECTION_FACTOR;
+                }
+            } else if (HAS_PREFIX("Correction Dosage:")){
+                if (parse_float(AFTER("Correction Dosage:"), end, &entry->correction_dosage) != NULL){
+                    current->lines |= SCAN_LINE_CORRECTION_DOSAGE;
+                }
+            }
+            break;
+        case 'I':
+            if (HAS_PREFIX("Insulin On Board:") &&
+                parse_float(AFTER("Insulin On Board:"), end, &entry->insulin_on_board) != NULL){
+                current->lines |= SCAN_LINE_INSULIN_ON_BOARD;
+            }
+            break;
+    }
+
+#undef HAS_PREFIX
+#undef AFTER
+}
+
+/**
+ * hex_digit - Returns the value of a hex digit, or -1 if the character is not one.
+ */
+static int hex_digit(char c){
+    if (c >= '0' && c <= '9'){
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * is_checksum_line - Checks whether a line is a record's checksum line.
+ */
+static int is_checksum_line(const char *p, const char *end){
+    return end - p >= 9 && memcmp(p, "Checksum:", 9) == 0;
+}
+
+/**
+ * checksum_matches - Checks a "Checksum: XXXXXXXX" line against the lines before it.
+ *
+ * @param body: The record's first line.
+ * @param p: The checksum line, which ends the lines checked.
+ * @param end: End of the checksum line.
+ * @return: 1 if the checksum line can be read and matches, 0 otherwise.
+ */
+static int checksum_matches(const char *body, const char *p, const char *end){
+    const char *digits = skip_spaces(p + 9, end);
+    if (end - digits < 8){
+        return 0;
+    }
+    uint32_t checksum = 0;
+    for (int i = 0; i < 8; i++){
+        int digit = hex_digit(digits[i]);
+        if (digit < 0){
+            return 0;
+        }
+        checksum = checksum << 4 | (uint32_t)digit;
+    }
+    if (skip_spaces(digits + 8, end) != end){
+        return 0;
+    }
+    return crc32c(0, body, (size_t)(p - body)) == checksum;
+}
+
+int log_record_check(const char *record, size_t length, size_t *body_length, size_t *sealed_length){
+    const char *end = record + length;
+    *body_length = length;
+    *sealed_length = length;
+
+    // The checksum line is the first one after the record's first line to start "Checksum:"
+    const char *p = memchr(record, '\n', length);
+    while (p != NULL && ++p < end){
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        const char *next = line_end != NULL ? line_end + 1 : end;
+        if (line_end == NULL){
+            line_end = end;
+        }
+        if (is_checksum_line(p, line_end)){
+            *body_length = (size_t)(p - record);
+            *sealed_length = (size_t)(next - record);
+            return checksum_matches(record, p, line_end) ? CHECKSUM_VALID : CHECKSUM_BAD;
+        }
+        p = line_end < end ? line_end : NULL;
+    }
+    return CHECKSUM_NONE;
+}
+
+/**
+ * emit_entry - Reports the current entry if there is anything to report.
+ */
+static int emit_entry(const scanned_entry *current, scan_callback callback, void *context){
+    if (current->time_line == NULL && current->lines == 0){
+        return 0;
+    }
+    return callback(current, context);
+}
+
+int log_scan(const char *data, size_t size, scan_callback callback, void *context){
+    const char *p = data;
+    const char *end = data + size;
+    hour_cache cache = {0};
+    uint64_t start = probe_begin();
+    uint64_t lines = 0;
+
+    scanned_entry current;
+    memset(&current, 0, sizeof(current));
+    int discarding = 0;           // Set while skipping the lines of a bad edit or tombstone
+    int sealed = 0;               // Set once the current record's checksum line has been read
+
+    int status = 0;
+    while (p < end && status == 0){
+        lines++;
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        const char *next = line_end != NULL ? line_end + 1 : end;
+        if (line_end == NULL){
+            line_end = end;
+        }
+
+        size_t prefix_length;
+        int kind = line_end - p >= 15 && memcmp(p, "Log Entry ", 10) == 0 ? record_kind(p, line_end, &prefix_length) : -1;
+        if (kind >= 0){
+            status = emit_entry(&current, callback, context);
+            if (status != 0){
+                break;
+            }
+
+            discarding = 0;
+            sealed = 0;
+            scanned_entry record;
+            if (parse_record_line(p, line_end, kind, prefix_length, &cache, &record) == 0){
+                current = record;
+                current.time_line_length = (size_t)(next - p);
+            } else {
+                scanned_entry bad;
+                memset(&bad, 0, sizeof(bad));
+                bad.kind = SCAN_BAD_TIME;
+                bad.time_line = p;
+                bad.time_line_length = (size_t)(next - p);
+                status = callback(&bad, context);
+
+                // Following lines still belong to the previous entry's time, like read_logs;
+                // the lines of a bad edit are dropped with it
+                current.kind = SCAN_ENTRY;
+                current.time_line = NULL;
+                current.time_line_length = 0;
+                current.id = 0;
+                current.replaces = -1;
+                current.checksum = CHECKSUM_NONE;
+                current.lines = 0;
+                memset(&current.entry, 0, sizeof(current.entry));
+                discarding = kind != SCAN_ENTRY;
+            }
+        } else if (*p == 'C' && is_checksum_line(p, line_end)){
+            // Only the first checksum line counts; what follows it up to the next record is stray
+            if (!sealed && current.time_line != NULL){
+                current.checksum = checksum_matches(current.time_line, p, line_end) ? CHECKSUM_VALID : CHECKSUM_BAD;
+                if (current.checksum == CHECKSUM_BAD){
+                    current.kind = SCAN_CORRUPT;
+                }
+            }
+            sealed = 1;
+        } else if (p < line_end && !discarding && !sealed){
+            parse_data_line(p, line_end, &current);
+        }
+
+        p = next;
+    }
+
+    if (status == 0){
+        status = emit_entry(&current, callback, context);
+    }
+
+    // Counted once per scan to keep the per-line loop free of probes
+    probe_count(PROBE_PARSE_LINE, lines);
+    probe_count(PROBE_TIME_CACHED, cache.hits);
+    probe_end(PROBE_LOG_SCAN, start, (uint64_t)(p - data));
+    return status;
+}
+
+/**
+ * keep_record - log_scan callback that keeps the first record and stops.
+ */
+static int keep_record(const scanned_entry *scanned, void *context){
+    *(scanned_entry *)context = *scanned;
+    return 1;
+}
+
+int log_scan_record(const char *data, size_t size, size_t offset, scanned_entry *record){
+    if (offset >= size){
+        return -1;
+    }
+    record->time_line = NULL;
+    log_scan(data + offset, size - offset, keep_record, record);
+    if (record->time_line != data + offset || record->kind == SCAN_BAD_TIME || record->kind == SCAN_CORRUPT){
+        return -1;
+    }
+    return 0;
+}
+
+void scanned_to_entry(const scanned_entry *scanned, log_entry *entry){
+    *entry = scanned->entry;
+    entry->blood_glucose_level_flag = (scanned->lines & SCAN_LINE_BLOOD_GLUCOSE) != 0;
+    entry->target_blood_glucose_flag = (scanned->lines & SCAN_LINE_TARGET) != 0;
+    entry->meal_time_carbs_flag = (scanned->lines & SCAN_LINE_CARBS) != 0;
+    entry->correction_dosage_flag = (scanned->lines & SCAN_LINE_CORRECTION_DOSAGE) != 0;
+    entry->insulin_dosage_flag = (scanned->lines & SCAN_LINE_TOTAL_DOSAGE) != 0;
+    entry->insulin_on_board_flag = (scanned->lines & SCAN_LINE_INSULIN_ON_BOARD) != 0;
+}
+
+size_t log_scan_boundary(const char *data, size_t size, size_t from){
+    const char *end = data + size;
+    const char *p = data + from;
+
+    // Back up to the start of the line holding from
+    while (p > data && p[-1] != '\n'){
+        p--;
+    }
+    if (p < data + from){
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        p = line_end != NULL ? line_end + 1 : end;
+    }
+
+    hour_cache cache = {0};
+    while (p < end){
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        if (line_end == NULL){
+            line_end = end;
+        }
+        time_t timestamp;
+        const char *display_end;
+        const char *rest;
+        if (line_end - p >= 15 && memcmp(p, "Log Entry Time:", 15) == 0 &&
+            parse_time_line(p + 15, line_end, &cache, &timestamp, &display_end, &rest) == 0){
+            return (size_t)(p - data);
+        }
+        p = line_end < end ? line_end + 1 : end;
+    }
+    return size;
+}
+
+// Work shared by render_chunks and its worker threads
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;       // Signalled when a chunk is rendered or written
+    size_t chunks;
+    size_t next;                  // Next chunk to render
+    size_t written;               // Next chunk to write
+    size_t window;                // Chunks that may be rendered ahead of written
+    char **buffers;               // Output of each rendered chunk
+    size_t *lengths;
+    char *done;                   // 1 once a chunk is rendered
+    int failed;
+    chunk_renderer renderer;
+    void *context;
+} chunk_job;
+
+/**
+ * render_worker - Renders chunks into memory buffers until every chunk is taken or one fails.
+ */
+static void *render_worker(void *argument){
+    chunk_job *job = argument;
+    pthread_mutex_lock(&job->lock);
+    while (1){
+        while (!job->failed && job->next < job->chunks && job->next >= job->written + job->window){
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        if (job->failed || job->next >= job->chunks){
+            break;
+        }
+        size_t chunk = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        char *buffer = NULL;
+        size_t length = 0;
+        FILE *out = open_memstream(&buffer, &length);
+        int status = out != NULL ? job->renderer(chunk, out, job->context) : -1;
+        if (out != NULL && fclose(out) != 0){
+            status = -1;
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->buffers[chunk] = buffer;
+        job->lengths[chunk] = length;
+        job->done[chunk] = 1;
+        if (status != 0){
+            job->failed = 1;
+        }
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    instrument_thread_exit();
+    return NULL;
+}
+
+int render_chunks(FILE *out, size_t chunks, int threads, chunk_renderer renderer, void *context){
+    chunk_job job;
+    memset(&job, 0, sizeof(job));
+    job.chunks = chunks;
+    job.window = (size_t)threads * 2;
+    job.renderer = renderer;
+    job.context = context;
+    job.buffers = calloc(chunks, sizeof(char *));
+    job.lengths = calloc(chunks, sizeof(size_t));
+    job.done = calloc(chunks, 1);
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    if (job.buffers == NULL || job.lengths == NULL || job.done == NULL || workers == NULL){
+        perror("Error starting scan threads");
+        free(job.buffers);
+        free(job.lengths);
+        free(job.done);
+        free(workers);
+        return -1;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, render_worker, &job) == 0){
+        started++;
+    }
+
+    // Write each chunk as soon as it and every chunk before it are rendered
+    pthread_mutex_lock(&job.lock);
+    if (started == 0){
+        job.failed = 1;
+    }
+    while (!job.failed && job.written < job.chunks){
+        while (!job.failed && !job.done[job.written]){
+            pthread_cond_wait(&job.changed, &job.lock);
+        }
+        if (job.failed){
+            break;
+        }
+        size_t chunk = job.written;
+        pthread_mutex_unlock(&job.lock);
+
+        if (fwrite(job.buffers[chunk], 1, job.lengths[chunk], out) != job.lengths[chunk]){
+            perror("Error writing query output");
+            pthread_mutex_lock(&job.lock);
+            job.failed = 1;
+        } else {
+            pthread_mutex_lock(&job.lock);
+        }
+        free(job.buffers[chunk]);
+        job.buffers[chunk] = NULL;
+        job.written++;
+        pthread_cond_broadcast(&job.changed);
+    }
+    pthread_cond_broadcast(&job.changed);
+    pthread_mutex_unlock(&job.lock);
+
+    for (int i = 0; i < started; i++){
+        pthread_join(workers[i], NULL);
+    }
+    int status = job.failed ? -1 : 0;
+    for (size_t i = 0; i < chunks; i++){
+        free(job.buffers[i]);
+    }
+    free(job.buffers);
+    free(job.lengths);
+    free(job.done);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.changed);
+    return status;
+}
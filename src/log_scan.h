@@ -0,0 +1,190 @@
+#ifndef LOG_SCAN_H
+#define LOG_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "logging.h"
+
+// Bits for the lines seen in a scanned entry
+#define SCAN_LINE_BLOOD_GLUCOSE 0x01
+#define SCAN_LINE_TARGET 0x02
+#define SCAN_LINE_CARBS 0x04
+#define SCAN_LINE_CORRECTION_FACTOR 0x08
+#define SCAN_LINE_CORRECTION_DOSAGE 0x10
+#define SCAN_LINE_TOTAL_DOSAGE 0x20
+#define SCAN_LINE_TYPE 0x40
+#define SCAN_LINE_INSULIN_ON_BOARD 0x80
+
+// What a scanned entry represents
+#define SCAN_ENTRY 0                // An entry, or the lines following a bad time line
+#define SCAN_BAD_TIME 1             // A "Log Entry Time:", "Log Entry Edit:" or "Log Entry Deleted:" line that could not be parsed
+#define SCAN_EDIT 2                 // A "Log Entry Edit:" record: new values for an earlier entry
+#define SCAN_DELETE 3               // A "Log Entry Deleted:" record: a tombstone for an earlier entry
+#define SCAN_CORRUPT 4              // A record that does not match its checksum line; its values are not reported
+
+// How a text record stands against its checksum line
+#define CHECKSUM_NONE 0             // No checksum line, as in records written before checksums were added
+#define CHECKSUM_VALID 1            // The checksum line matches the record
+#define CHECKSUM_BAD 2              // The checksum line does not match the record or cannot be read
+
+// One entry read back from a text log. Pointers refer into the scanned memory.
+typedef struct {
+    int kind;                     // SCAN_ENTRY, SCAN_BAD_TIME, SCAN_EDIT, SCAN_DELETE or SCAN_CORRUPT
+    const char *time_line;        // The first line of the record, or NULL if the entry follows a bad time line
+    size_t time_line_length;      // Length of time_line including its newline, if any
+    size_t time_display_length;   // Length of the "Log Entry Time:" text and wall clock time alone
+    int has_timestamp;            // 0 if no valid time line has been seen yet
+    time_t timestamp;             // Entry time; inherited from the previous entry after a bad time line
+    int64_t id;                   // ID written on the time line, or the entry an edit or tombstone applies to; 0 if none
+    int64_t replaces;             // Edits and tombstones: offset of the version they replace, -1 for none
+    int checksum;                 // CHECKSUM_NONE, CHECKSUM_VALID or CHECKSUM_BAD
+    int lines;                    // SCAN_LINE_* bits for the data lines present
+    log_entry entry;              // Values of the data lines present
+} scanned_entry;
+
+/**
+ * scan_callback - Called for each entry found by log_scan.
+ *
+ * @param entry: The scanned entry; only valid during the call.
+ * @param context: The context passed to log_scan.
+ * @return: 0 to continue scanning, anything else to stop.
+ */
+typedef int (*scan_callback)(const scanned_entry *entry, void *context);
+
+// A log file mapped into memory for scanning.
+typedef struct {
+    const char *data;             // Start of the file contents
+    size_t size;                  // Size of the file in bytes
+} log_map;
+
+/**
+ * log_map_open - Maps a log file read-only into memory.
+ *
+ * @param map: Receives the mapping.
+ * @param filename: Name of the log file.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_map_open(log_map *map, const char *filename);
+
+/**
+ * log_map_close - Unmaps a log file mapped by log_map_open.
+ *
+ * @param map: The mapping to release.
+ */
+void log_map_close(log_map *map);
+
+/**
+ * log_text_whole_end - Finds where the last whole record of a text log ends, for a log
+ * that may have been cut short or be part way through an append by another process:
+ * before a last record that stops part way through a line, an entry or edit that holds
+ * no data lines, or a record that lacks the checksum line the records before it have.
+ *
+ * @param tail: The end of the log; 2 * LOG_ENTRY_MAX bytes is enough.
+ * @param length: Number of bytes in tail.
+ * @param at_line_start: Set if tail starts at the beginning of a line.
+ * @return: Offset in tail just after the last whole record, or length if the window
+ * holds no line it can judge by.
+ */
+size_t log_text_whole_end(const char *tail, size_t length, int at_line_start);
+
+/**
+ * log_map_whole_end - Finds where the last whole record of a mapped text log ends, as
+ * log_text_whole_end does, so readers leave a record still being appended for later.
+ *
+ * @param map: The mapped log.
+ * @return: Offset just after the last whole record.
+ */
+size_t log_map_whole_end(const log_map *map);
+
+/**
+ * log_scan - Walks text log entries in place and reports each one to a callback.
+ * Lines are parsed with the same rules as the sscanf formats used by read_logs,
+ * so the same entries and values are produced, without copying lines. Entry times
+ * are the epoch seconds written after the wall clock time, or for entries written
+ * before those were added, the wall clock time read in the local zone.
+ * Edit and tombstone records are reported with their own kinds; an edit's data lines
+ * are its new values. A record ending in a checksum line that does not match it is
+ * reported as SCAN_CORRUPT, and lines after a checksum line up to the next record are
+ * skipped. data must start at the beginning of a line.
+ *
+ * @param data: Start of the text to scan.
+ * @param size: Number of bytes to scan.
+ * @param callback: Function called for each entry.
+ * @param context: Passed through to the callback.
+ * @return: 0 when the text was scanned, or the non-zero value returned by the callback.
+ */
+int log_scan(const char *data, size_t size, scan_callback callback, void *context);
+
+/**
+ * log_scan_record - Reads the one record that starts at an offset: an entry, an edit
+ * or a tombstone. Only that record's lines are read.
+ *
+ * @param data: Start of the text; must start at the beginning of a line.
+ * @param size: Number of bytes of text.
+ * @param offset: Offset of the record's first line.
+ * @param record: Receives the record; its pointers refer into data.
+ * @return: 0 for success, -1 if no valid record starts at offset or it is damaged.
+ */
+int log_scan_record(const char *data, size_t size, size_t offset, scanned_entry *record);
+
+/**
+ * log_record_check - Checks one text record against its checksum line.
+ *
+ * @param record: The record's first line.
+ * @param length: Length of the record, up to the next record's first line.
+ * @param body_length: Receives the length of the lines before the checksum line, or
+ *                     length if there is none.
+ * @param sealed_length: Receives the length up to the end of the checksum line, or
+ *                       length if there is none. Anything after it is stray lines.
+ * @return: CHECKSUM_NONE, CHECKSUM_VALID or CHECKSUM_BAD.
+ */
+int log_record_check(const char *record, size_t length, size_t *body_length, size_t *sealed_length);
+
+/**
+ * scanned_to_entry - Copies the values of a scanned entry into a log entry, setting
+ * its flags from the data lines that were present.
+ *
+ * @param scanned: The scanned entry.
+ * @param entry: Receives the log entry data and flags.
+ */
+void scanned_to_entry(const scanned_entry *scanned, log_entry *entry);
+
+/**
+ * log_scan_boundary - Finds the first place at or after an offset where a scan can
+ * start: a "Log Entry Time:" line holding a valid time. Scanning text in pieces split
+ * at such boundaries reports exactly the entries a single scan of the whole text does.
+ *
+ * @param data: Start of the text; must start at the beginning of a line.
+ * @param size: Number of bytes of text.
+ * @param from: Offset to search from.
+ * @return: Offset of the boundary, or size if there is none.
+ */
+size_t log_scan_boundary(const char *data, size_t size, size_t from);
+
+/**
+ * chunk_renderer - Renders one chunk of a query to a stream.
+ *
+ * @param chunk: Index of the chunk.
+ * @param out: Stream for the chunk's output.
+ * @param context: The context passed to render_chunks.
+ * @return: 0 for success, -1 for errors.
+ */
+typedef int (*chunk_renderer)(size_t chunk, FILE *out, void *context);
+
+/**
+ * render_chunks - Renders chunks on a pool of threads and writes their output in
+ * chunk order, so the result is the same as rendering them one after another.
+ * Only a few chunks ahead of the one being written are rendered at a time.
+ *
+ * @param out: Stream the output is written to.
+ * @param chunks: Number of chunks.
+ * @param threads: Number of worker threads.
+ * @param renderer: Renders one chunk; called from the worker threads.
+ * @param context: Passed through to the renderer.
+ * @return: 0 for success, -1 for errors.
+ */
+int render_chunks(FILE *out, size_t chunks, int threads, chunk_renderer renderer, void *context);
+
+#endif
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include "log_verify.h"
+#include "log_scan.h"
+#include "records.h"
+#include "logging.h"
+#include "log_edit.h"
+#include "crc32c.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Slot states while a log is repaired
+#define SLOT_KEPT 1                 // An entry to salvage
+#define SLOT_DELETED 2              // An entry since deleted
+#define SLOT_DAMAGED 3              // An entry whose record is damaged; an intact edit still salvages it
+
+// What log_verify has found so far
+typedef struct {
+    FILE *out;
+    int64_t damage_start;         // Damaged range not printed yet, or -1
+    int64_t damage_end;
+    const char *reason;           // What is wrong with that range
+    long ranges;                  // Damaged ranges printed
+    long intact;                  // Records that match their checksum
+    long unchecked;               // Records written without a checksum
+    long damaged;                 // Damaged records
+} verify_report;
+
+// One entry found while a log is repaired. IDs with no entry, such as those compaction
+// removed the entries of, have no slot.
+typedef struct {
+    int64_t id;
+    int state;                    // One of the SLOT_* states
+    time_t timestamp;
+    log_entry entry;              // The entry's latest values, for SLOT_KEPT
+} repair_slot;
+
+// A log being repaired
+typedef struct {
+    repair_slot *slots;           // In ID order
+    size_t used;
+    size_t capacity;
+    int64_t count;                // IDs given out
+    int sealed;                   // Set once a record with a checksum has been read
+    long damaged;                 // Damaged records left out
+    int status;
+} repair_job;
+
+/**
+ * print_damage - Prints the damaged range held back for merging, if any.
+ */
+static void print_damage(verify_report *report){
+    if (report->damage_start < 0){
+        return;
+    }
+    fprintf(report->out, "Damaged: bytes %lld-%lld: %s\n", (long long)report->damage_start,
+            (long long)report->damage_end - 1, report->reason);
+    report->ranges++;
+    report->damage_start = -1;
+}
+
+/**
+ * add_damage - Records a damaged range, merging it with the one before when they touch
+ * and are damaged the same way.
+ */
+static void add_damage(verify_report *report, int64_t start, int64_t end, const char *reason){
+    if (report->damage_start >= 0 && start == report->damage_end && strcmp(report->reason, reason) == 0){
+        report->damage_end = end;
+        return;
+    }
+    print_damage(report);
+    report->damage_start = start;
+    report->damage_end = end;
+    report->reason = reason;
+}
+
+/**
+ * next_record - Returns the offset of the first line at or after offset that starts a
+ * record, or size if there is none. offset must be the start of a line.
+ */
+static size_t next_record(const char *data, size_t size, size_t offset){
+    while (offset < size && !(size - offset >= 10 && memcmp(data + offset, "Log Entry ", 10) == 0)){
+        const char *newline = memchr(data + offset, '\n', size - offset);
+        offset = newline != NULL ? (size_t)(newline - data) + 1 : size;
+    }
+    return offset;
+}
+
+/**
+ * verify_text - Checks the records of a text log. Records run from one "Log Entry " line
+ * to the next; anything before the first one is stray.
+ */
+static void verify_text(verify_report *report, const char *data, size_t size){
+    size_t p = next_record(data, size, 0);
+    if (p > 0){
+        add_damage(report, 0, (int64_t)p, "stray lines");
+    }
+
+    int sealed = 0;
+    while (p < size){
+        const char *newline = memchr(data + p, '\n', size - p);
+        size_t end = next_record(data, size, newline != NULL ? (size_t)(newline - data) + 1 : size);
+        size_t body_length, sealed_length;
+        int checksum = log_record_check(data + p, end - p, &body_length, &sealed_length);
+        scanned_entry record;
+        if (checksum == CHECKSUM_VALID){
+            report->intact++;
+            sealed = 1;
+        } else if (checksum == CHECKSUM_BAD){
+            report->damaged++;
+            add_damage(report, (int64_t)p, (int64_t)(p + sealed_length), "record does not match its checksum");
+        } else if (sealed){
+            report->damaged++;
+            add_damage(report, (int64_t)p, (int64_t)end, "record has no checksum line");
+        } else if (log_scan_record(data, size, p, &record) != 0){
+            report->damaged++;
+            add_damage(report, (int64_t)p, (int64_t)end, "record line cannot be read");
+        } else {
+            report->unchecked++;
+        }
+        if (p + sealed_length < end){
+            add_damage(report, (int64_t)(p + sealed_length), (int64_t)end, "stray lines");
+        }
+        p = end;
+    }
+}
+
+/**
+ * verify_records - Checks the records of a binary log after its header.
+ */
+static void verify_records(verify_report *report, const char *data, size_t size){
+    int sealed = 0;
+    size_t offset = sizeof(record_header);
+    for (; offset + sizeof(log_record) <= size; offset += sizeof(log_record)){
+        const log_record *record = (const log_record *)(data + offset);
+        if (!(record->flags & RECORD_FLAG_CHECKSUM) && !sealed){
+            report->unchecked++;
+        } else if (!(record->flags & RECORD_FLAG_CHECKSUM)){
+            report->damaged++;
+            add_damage(report, (int64_t)offset, (int64_t)(offset + sizeof(log_record)), "record has no checksum");
+        } else if (record_intact(record)){
+            report->intact++;
+            sealed = 1;
+        } else {
+            report->damaged++;
+            add_damage(report, (int64_t)offset, (int64_t)(offset + sizeof(log_record)), "record does not match its checksum");
+        }
+    }
+    if (offset < size){
+        add_damage(report, (int64_t)offset, (int64_t)size, "partial record at the end");
+    }
+}
+
+/**
+ * is_record_log - Checks that a mapped binary log starts with a valid header.
+ */
+static int is_record_log(const log_map *map, const char *filename){
+    if (map->size < sizeof(record_header) || memcmp(map->data, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0){
+        printf("Error: %s is not a binary log file.\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+int log_verify(FILE *out, const char *filename){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+    int binary = is_binary_log(filename);
+    if (binary && !is_record_log(&map, filename)){
+        log_map_close(&map);
+        return -1;
+    }
+
+    verify_report report = {out, -1, 0, NULL, 0, 0, 0, 0};
+    if (binary){
+        verify_records(&report, map.data, map.size);
+    } else {
+        verify_text(&report, map.data, map.size);
+    }
+    print_damage(&report);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    double megabytes = (double)map.size / 1e6;
+    fprintf(out, "%s: %ld records intact, %ld without checksums, %ld damaged; %ld damaged ranges.\n",
+            filename, report.intact, report.unchecked, report.damaged, report.ranges);
+    fprintf(out, "Checked %.1f MB in %.3f s (%.0f MB/s, CRC-32C by %s).\n",
+            megabytes, seconds, seconds > 0 ? megabytes / seconds : 0.0, crc32c_method());
+    log_map_close(&map);
+    return report.ranges > 0 ? 1 : 0;
+}
+
+/**
+ * give_ids - Gives out IDs up to id. An ID that would leave no next ID to give is
+ * refused, so IDs read from a log cannot overflow.
+ *
+ * @return: 0 for success, -1 if id is out of range.
+ */
+static int give_ids(repair_job *job, int64_t id){
+    if (id < 1 || id == INT64_MAX){
+        return -1;
+    }
+    if (id > job->count){
+        job->count = id;
+    }
+    return 0;
+}
+
+/**
+ * find_slot - Finds the slot of an ID by binary search, or returns NULL if it has none.
+ */
+static repair_slot *find_slot(const repair_job *job, int64_t id){
+    size_t low = 0;
+    size_t high = job->used;
+    while (low < high){
+        size_t middle = low + (high - low) / 2;
+        if (job->slots[middle].id < id){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < job->used && job->slots[low].id == id ? &job->slots[low] : NULL;
+}
+
+/**
+ * salvage_entry - Gives an entry the next ID, or the one written with it, as log_ids
+ * does, and keeps it unless it is damaged. The ID written with a damaged record cannot
+ * be trusted, so it always gets the next one.
+ */
+static void salvage_entry(repair_job *job, int64_t written_id, int damaged, time_t timestamp, const log_entry *entry){
+    int64_t id = !damaged && written_id > job->count ? written_id : job->count + 1;
+    if (give_ids(job, id) != 0){
+        // An intact record with an ID out of range is treated as damaged
+        id = job->count + 1;
+        damaged = 1;
+        if (give_ids(job, id) != 0){
+            job->damaged++;
+            return;
+        }
+    }
+    if (job->used == job->capacity){
+        size_t capacity = job->capacity > 0 ? job->capacity * 2 : 1024;
+        repair_slot *slots = realloc(job->slots, capacity * sizeof(repair_slot));
+        if (slots == NULL){
+            perror("Error repairing log");
+            job->status = -1;
+            return;
+        }
+        job->slots = slots;
+        job->capacity = capacity;
+    }
+    repair_slot *slot = &job->slots[job->used++];
+    slot->id = id;
+    slot->timestamp = timestamp;
+    if (damaged){
+        slot->state = SLOT_DAMAGED;
+        job->damaged++;
+    } else {
+        slot->state = SLOT_KEPT;
+        slot->entry = *entry;
+    }
+}
+
+/**
+ * salvage_revision - Applies an intact edit or tombstone. An edit of an entry whose own
+ * record is damaged salvages it with the edit's values.
+ */
+static void salvage_revision(repair_job *job, int64_t id, int deleted, int64_t replaces,
+                             time_t timestamp, const log_entry *entry){
+    if (deleted && replaces < 0){
+        // Compaction's tombstone keeping the IDs of removed entries given out
+        give_ids(job, id);
+        return;
+    }
+    repair_slot *slot = find_slot(job, id);
+    if (slot == NULL){
+        return;
+    }
+    if (slot->state != SLOT_KEPT && slot->state != SLOT_DAMAGED){
+        return;
+    }
+    if (deleted){
+        slot->state = SLOT_DELETED;
+        return;
+    }
+    if (slot->state == SLOT_DAMAGED){
+        slot->timestamp = timestamp;
+    }
+    slot->state = SLOT_KEPT;
+    slot->entry = *entry;
+}
+
+/**
+ * repair_scanned_entry - log_scan callback that salvages the records of a text log.
+ */
+static int repair_scanned_entry(const scanned_entry *scanned, void *context){
+    repair_job *job = context;
+    if (scanned->kind == SCAN_BAD_TIME || scanned->time_line == NULL){
+        // A record whose first line cannot be read, or the lines after it
+        job->damaged += scanned->kind == SCAN_BAD_TIME;
+        return 0;
+    }
+
+    int damaged = scanned->kind == SCAN_CORRUPT || (scanned->checksum == CHECKSUM_NONE && job->sealed);
+    job->sealed |= scanned->checksum == CHECKSUM_VALID;
+    int entry_record = scanned->time_line_length >= 15 && memcmp(scanned->time_line, "Log Entry Time:", 15) == 0;
+
+    log_entry entry;
+    scanned_to_entry(scanned, &entry);
+    if (entry_record){
+        salvage_entry(job, scanned->id, damaged, scanned->timestamp, &entry);
+    } else if (damaged){
+        job->damaged++;
+    } else {
+        salvage_revision(job, scanned->id, scanned->kind == SCAN_DELETE, scanned->replaces, scanned->timestamp, &entry);
+    }
+    return job->status;
+}
+
+/**
+ * repair_records - Salvages the records of a mapped binary log.
+ */
+static void repair_records(repair_job *job, const log_map *map){
+    size_t offset = sizeof(record_header);
+    for (; offset + sizeof(log_record) <= map->size && job->status == 0; offset += sizeof(log_record)){
+        const log_record *record = (const log_record *)(map->data + offset);
+        int damaged = !record_intact(record) || (!(record->flags & RECORD_FLAG_CHECKSUM) && job->sealed);
+        job->sealed |= (record->flags & RECORD_FLAG_CHECKSUM) && !damaged;
+
+        log_entry entry;
+        record_to_entry(record, &entry);
+        if (!(record->flags & RECORD_FLAG_REVISION)){
+            salvage_entry(job, record->id, damaged, (time_t)record->timestamp, &entry);
+        } else if (damaged){
+            job->damaged++;
+        } else {
+            salvage_revision(job, record->id, (record->flags & RECORD_FLAG_DELETED) != 0, record->replaces,
+                             (time_t)record->timestamp, &entry);
+        }
+    }
+    if (offset < map->size){
+        job->damaged++;
+    }
+}
+
+/**
+ * write_salvaged - Writes the kept entries to the new log, each with its ID written out
+ * when it does not follow the entry before's, and a tombstone keeping the IDs given out
+ * after the last.
+ *
+ * @return: Number of entries written, or -1 for errors.
+ */
+static long write_salvaged(const repair_job *job, FILE *out, int binary){
+    long written = 0;
+    int64_t last_written = 0;
+    time_t last_timestamp = time(NULL);
+    for (size_t i = 0; i < job->used; i++){
+        const repair_slot *slot = &job->slots[i];
+        if (slot->state != SLOT_KEPT){
+            continue;
+        }
+        int64_t id = slot->id;
+        int64_t written_id = id != last_written + 1 ? id : 0;
+        char data[LOG_ENTRY_MAX];
+        int length;
+        if (binary){
+            log_record record;
+            entry_to_record(&slot->entry, slot->timestamp, &record);
+            record.id = written_id;
+            seal_record(&record);
+            memcpy(data, &record, sizeof(record));
+            length = (int)sizeof(record);
+        } else {
+            length = format_numbered_entry(data, sizeof(data), &slot->entry, slot->timestamp, written_id);
+        }
+        if (length < 0 || (size_t)length >= sizeof(data) || fwrite(data, 1, (size_t)length, out) != (size_t)length){
+            perror("Error writing repaired log");
+            return -1;
+        }
+        last_written = id;
+        last_timestamp = slot->timestamp;
+        written++;
+    }
+
+    if (job->count > last_written){
+        char tombstone[LOG_ENTRY_MAX];
+        int length = format_revision(tombstone, sizeof(tombstone), binary, job->count, last_timestamp, -1, NULL);
+        if (length < 0 || fwrite(tombstone, 1, (size_t)length, out) != (size_t)length){
+            perror("Error writing repaired log");
+            return -1;
+        }
+    }
+    return written;
+}
+
+/**
+ * create_repaired - Creates the new log, with a header if it is binary.
+ */
+static FILE *create_repaired(const char *filename, int binary){
+    int fd = open(filename, O_RDWR | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd < 0){
+        perror("Error creating repaired log");
+        return NULL;
+    }
+    if (binary && prepare_record_fd(fd, filename) != 0){
+        close(fd);
+        unlink(filename);
+        return NULL;
+    }
+    FILE *out = fdopen(fd, "ab");
+    if (out == NULL){
+        perror("Error creating repaired log");
+        close(fd);
+        unlink(filename);
+    }
+    return out;
+}
+
+int log_repair(const char *filename, const char *repaired_filename){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+    int binary = is_binary_log(filename);
+    if (binary && !is_record_log(&map, filename)){
+        log_map_close(&map);
+        return -1;
+    }
+
+    repair_job job = {NULL, 0, 0, 0, 0, 0, 0};
+    if (binary){
+        repair_records(&job, &map);
+    } else if (log_scan(map.data, map.size, repair_scanned_entry, &job) != 0){
+        job.status = -1;
+    }
+    log_map_close(&map);
+    if (job.status != 0){
+        free(job.slots);
+        return -1;
+    }
+
+    int repaired_binary = is_binary_log(repaired_filename);
+    FILE *out = create_repaired(repaired_filename, repaired_binary);
+    if (out == NULL){
+        free(job.slots);
+        return -1;
+    }
+    long written = write_salvaged(&job, out, repaired_binary);
+    int status = written < 0 ? -1 : 0;
+    if (status == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0)){
+        perror("Error writing repaired log");
+        status = -1;
+    }
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    if (status != 0){
+        unlink(repaired_filename);
+    } else {
+        printf("Salvaged %ld entries from %s into %s; %ld damaged records were left out.\n",
+               written, filename, repaired_filename, job.damaged);
+    }
+    free(job.slots);
+    return status;
+}
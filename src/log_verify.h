@@ -0,0 +1,39 @@
+#ifndef LOG_VERIFY_H
+#define LOG_VERIFY_H
+
+#include <stdio.h>
+
+// Every record carries a CRC-32C of its bytes. Text records end in a line
+// "Checksum: XXXXXXXX" holding the CRC in hex of the lines before it; binary records
+// hold it in their checksum member (see records.h). Records written before checksums
+// were added have none and are taken as they are, but once a log has a record with a
+// checksum, a later record without one is damaged: it was cut short, or its checksum
+// line was.
+//
+// Reads skip damaged records as they come to them; verify and repair deal with the
+// rest of the damage, such as stray lines between records.
+
+/**
+ * log_verify - Reads all of a text or binary log and checks every record against its
+ * checksum. The byte ranges that are damaged are printed, with neighbouring ranges
+ * damaged the same way merged, then a count of the records found intact, without checksums and damaged.
+ *
+ * @param out: Stream to print the report to.
+ * @param filename: Name of the log file.
+ * @return: 0 if nothing is damaged, 1 if something is, -1 for errors.
+ */
+int log_verify(FILE *out, const char *filename);
+
+/**
+ * log_repair - Writes the entries of a text or binary log that are intact to a new
+ * log, in their latest version and with the IDs they had. Damaged records and stray
+ * lines are left out. The new log is text or binary by its own name, so a log can be
+ * repaired into the other format.
+ *
+ * @param filename: Name of the log file.
+ * @param repaired_filename: Name of the log to create; it must not exist.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_repair(const char *filename, const char *repaired_filename);
+
+#endif
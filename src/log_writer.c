@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include "log_writer.h"
+#include "logging.h"
+#include "log_lock.h"
+#include "log_scan.h"
+#include "records.h"
+#include "log_index.h"
+#include "glucose_stats.h"
+#include "rollup.h"
+#include "log_ids.h"
+#include "instrument.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * elapsed_ms - Milliseconds between two monotonic clock readings.
+ */
+static long elapsed_ms(const struct timespec *from, const struct timespec *to){
+    return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+/**
+ * text_tail_end - Finds where a text log should end: after its last whole record, as
+ * found by log_text_whole_end, otherwise at the end of the file.
+ */
+static off_t text_tail_end(int fd, off_t size){
+    char tail[2 * LOG_ENTRY_MAX];
+    off_t from = size > (off_t)sizeof(tail) ? size - (off_t)sizeof(tail) : 0;
+    size_t length = (size_t)(size - from);
+    if (length == 0 || pread(fd, tail, length, from) != (ssize_t)length){
+        return size;
+    }
+    return from + (off_t)log_text_whole_end(tail, length, from == 0);
+}
+
+/**
+ * binary_tail_end - Finds where a binary log should end: after its last whole record,
+ * or at 0 if all it holds is the start of a header.
+ */
+static off_t binary_tail_end(int fd, off_t size){
+    if (size >= (off_t)sizeof(record_header)){
+        return size - (size - (off_t)sizeof(record_header)) % (off_t)sizeof(log_record);
+    }
+
+    char start[sizeof(record_header)];
+    size_t compared = (size_t)size < sizeof(RECORD_MAGIC) ? (size_t)size : sizeof(RECORD_MAGIC);
+    if (size == 0 || pread(fd, start, (size_t)size, 0) != (ssize_t)size ||
+        memcmp(start, RECORD_MAGIC, compared) != 0){
+        return size;  // Not ours to cut; the header check reports it
+    }
+    return 0;
+}
+
+/**
+ * truncate_torn_tail - Removes a partly written entry from the end of a locked log.
+ */
+static int truncate_torn_tail(int fd, const char *filename){
+    struct stat log_stat;
+    if (fstat(fd, &log_stat) != 0){
+        perror("Error reading log file");
+        return -1;
+    }
+
+    off_t end = is_binary_log(filename) ? binary_tail_end(fd, log_stat.st_size) : text_tail_end(fd, log_stat.st_size);
+    if (end < log_stat.st_size){
+        if (ftruncate(fd, end) != 0){
+            perror("Error removing a partly written entry");
+            return -1;
+        }
+        printf("Removed %lld bytes of a partly written entry from the end of %s.\n",
+               (long long)(log_stat.st_size - end), filename);
+    }
+    return 0;
+}
+
+int log_append_open(const char *filename){
+    while (1){
+        uint64_t start = probe_begin();
+        int fd = open(filename, O_RDWR | O_APPEND | O_CREAT, 0644);
+        if (fd < 0){
+            perror("Error opening file for data logging");
+            return -1;
+        }
+        probe_end(PROBE_LOG_OPEN, start, 0);
+
+        // Nobody is part way through an append while the whole log is locked
+        if (log_lock_whole(fd) != 0){
+            close(fd);
+            return -1;
+        }
+        if (log_replaced(fd, filename)){
+            // Compacted while we waited; open the new log
+            close(fd);
+            continue;
+        }
+        int status = truncate_torn_tail(fd, filename);
+        if (status == 0 && is_binary_log(filename)){
+            status = prepare_record_fd(fd, filename);
+        }
+        log_unlock(fd);
+
+        if (status != 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+int log_append_begin(int *fd, const char *filename){
+    while (1){
+        if (log_lock_append(*fd) != 0){
+            return -1;
+        }
+        if (!log_replaced(*fd, filename)){
+            return 0;
+        }
+
+        // Compaction replaced the log since it was opened; carry on with the new one
+        log_unlock(*fd);
+        int reopened = log_append_open(filename);
+        if (reopened < 0){
+            return -1;
+        }
+        close(*fd);
+        *fd = reopened;
+    }
+}
+
+int log_write_locked(int fd, const char *data, size_t length){
+    struct stat log_stat;
+    if (fstat(fd, &log_stat) != 0){
+        perror("Error reading log file");
+        return -1;
+    }
+
+    int status = 0;
+    size_t written = 0;
+    while (written < length){
+        uint64_t start = probe_begin();
+        ssize_t result = write(fd, data + written, length - written);
+        if (result < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            perror("Error writing to log file");
+            status = -1;
+            break;
+        }
+        written += (size_t)result;
+        probe_end(PROBE_LOG_WRITE, start, (uint64_t)result);
+    }
+
+    // Never leave the log ending part way through an entry
+    if (status != 0 && written > 0 && ftruncate(fd, log_stat.st_size) != 0){
+        perror("Error removing a partly written entry");
+    }
+    return status;
+}
+
+int log_append_locked(int *fd, const char *filename, const char *data, size_t length){
+    if (log_append_begin(fd, filename) != 0){
+        return -1;
+    }
+    int status = log_write_locked(*fd, data, length);
+    log_unlock(*fd);
+    return status;
+}
+
+int log_append(const char *filename, const char *data, size_t length){
+    int fd = log_append_open(filename);
+    if (fd < 0){
+        return -1;
+    }
+    int status = log_append_locked(&fd, filename, data, length);
+    if (close(fd) != 0){
+        perror("Error closing log file");
+        status = -1;
+    }
+    return status;
+}
+
+int log_writer_open(log_writer *writer, const char *filename, sync_policy policy,
+                    int sync_every, long sync_interval_ms){
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+
+    if (strlen(filename) >= sizeof(writer->filename)){
+        printf("Error: log file name too long.\n");
+        return -1;
+    }
+    if ((policy == SYNC_EVERY_N && sync_every <= 0) || (policy == SYNC_INTERVAL && sync_interval_ms <= 0)){
+        printf("Error: invalid log sync policy.\n");
+        return -1;
+    }
+
+    int fd = log_append_open(filename);
+    if (fd < 0){
+        return -1;
+    }
+
+    writer->binary = is_binary_log(filename);
+    writer->fd = fd;
+    strcpy(writer->filename, filename);
+    writer->policy = policy;
+    writer->sync_every = sync_every;
+    writer->sync_interval_ms = sync_interval_ms;
+    clock_gettime(CLOCK_MONOTONIC, &writer->last_sync);
+    return 0;
+}
+
+int log_writer_flush(log_writer *writer){
+    if (writer->used == 0){
+        return 0;
+    }
+    // A failed append is cut back out of the log, so the entries stay buffered for a retry
+    if (log_append_locked(&writer->fd, writer->filename, writer->buffer, writer->used) != 0){
+        return -1;
+    }
+    writer->used = 0;
+
+    // Index the new entries; the index, totals, rollups and IDs are rebuilt on demand if this fails
+    log_index_update(writer->filename);
+    glucose_stats_update(writer->filename);
+    rollup_update(writer->filename);
+    log_ids_update(writer->filename);
+    return 0;
+}
+
+int log_writer_sync(log_writer *writer){
+    if (log_writer_flush(writer) != 0){
+        return -1;
+    }
+    if (writer->unsynced > 0){
+        uint64_t start = probe_begin();
+        if (fsync(writer->fd) != 0){
+            perror("Error syncing log file");
+            return -1;
+        }
+        probe_end(PROBE_LOG_FSYNC, start, 0);
+    }
+    writer->unsynced = 0;
+    clock_gettime(CLOCK_MONOTONIC, &writer->last_sync);
+    return 0;
+}
+
+int log_writer_format(const log_writer *writer, const log_entry *entry, time_t timestamp,
+                      char *buffer, size_t size){
+    if (writer->binary){
+        if (size < sizeof(log_record)){
+            return -1;
+        }
+        log_record record;
+        entry_to_record(entry, timestamp, &record);
+        seal_record(&record);
+        memcpy(buffer, &record, sizeof(record));
+        return (int)sizeof(record);
+    }
+
+    int formatted = format_log_entry(buffer, size, entry, timestamp);
+    if (formatted < 0 || (size_t)formatted >= size){
+        printf("Error: log entry too long to write.\n");
+        return -1;
+    }
+    return formatted;
+}
+
+int log_writer_append(log_writer *writer, const log_entry *entry, time_t timestamp){
+    char data[LOG_ENTRY_MAX];
+    int length = log_writer_format(writer, entry, timestamp, data, sizeof(data));
+    if (length < 0){
+        return -1;
+    }
+    return log_writer_append_formatted(writer, data, (size_t)length);
+}
+
+int log_writer_append_formatted(log_writer *writer, const char *data, size_t length){
+    uint64_t start = probe_begin();
+
+    // Entries never straddle a flush, so every write holds whole entries
+    if (writer->used + length > sizeof(writer->buffer) && log_writer_flush(writer) != 0){
+        return -1;
+    }
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+    writer->unsynced++;
+
+    int commit = 0;
+    switch (writer->policy) {
+        case SYNC_EVERY_ENTRY:
+            commit = 1;
+            break;
+        case SYNC_EVERY_N:
+            commit = writer->unsynced >= writer->sync_every;
+            break;
+        case SYNC_INTERVAL: {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            commit = elapsed_ms(&writer->last_sync, &now) >= writer->sync_interval_ms;
+            break;
+        }
+    }
+
+    // An interval only defers the fsync; the entry is written now, so it is never held
+    // in the buffer waiting for an append that may not come
+    int status = 0;
+    if (commit){
+        status = log_writer_sync(writer);
+    } else if (writer->policy == SYNC_INTERVAL){
+        status = log_writer_flush(writer);
+    }
+    probe_end(PROBE_LOG_APPEND, start, length);
+    return status;
+}
+
+int log_writer_close(log_writer *writer){
+    if (writer->fd < 0){
+        return 0;
+    }
+
+    int status = log_writer_sync(writer);
+    if (close(writer->fd) != 0){
+        perror("Error closing log file");
+        status = -1;
+    }
+    writer->fd = -1;
+    return status;
+}
+
+int parse_sync_policy(const char *text, sync_policy *policy, int *sync_every, long *sync_interval_ms){
+    char *end;
+    if (strcmp(text, "entry") == 0){
+        *policy = SYNC_EVERY_ENTRY;
+        return 0;
+    } else if (strncmp(text, "every:", 6) == 0){
+        long count = strtol(text + 6, &end, 10);
+        if (end == text + 6 || *end != '\0' || count <= 0){
+            return -1;
+        }
+        *policy = SYNC_EVERY_N;
+        *sync_every = (int)count;
+        return 0;
+    } else if (strncmp(text, "interval:", 9) == 0){
+        long interval = strtol(text + 9, &end, 10);
+        if (end == text + 9 || *end != '\0' || interval <= 0){
+            return -1;
+        }
+        *policy = SYNC_INTERVAL;
+        *sync_interval_ms = interval;
+        return 0;
+    }
+    return -1;
+}
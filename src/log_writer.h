@@ -0,0 +1,182 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <stddef.h>
+#include <time.h>
+#include "logging.h"
+
+// Size of the writer's buffer; entries are only ever written out whole.
+#define LOG_WRITER_BUFFER 65536
+
+// When the writer forces logged entries to disk with fsync.
+typedef enum {
+    SYNC_EVERY_ENTRY,             // After every entry
+    SYNC_EVERY_N,                 // After every sync_every entries
+    SYNC_INTERVAL                 // On the first append sync_interval_ms after the last sync
+} sync_policy;
+
+// A log file held open for a whole session.
+typedef struct {
+    int fd;                       // Log file, opened for appending
+    char filename[256];           // Name of the log file
+    int binary;                   // 1 for binary record logs, 0 for text logs
+    sync_policy policy;           // Durability policy
+    int sync_every;               // Entries per fsync for SYNC_EVERY_N
+    long sync_interval_ms;        // Milliseconds between fsyncs for SYNC_INTERVAL
+    int unsynced;                 // Entries appended since the last fsync
+    struct timespec last_sync;    // Time of the last fsync
+    size_t used;                  // Bytes waiting in buffer
+    char buffer[LOG_WRITER_BUFFER];
+} log_writer;
+
+/**
+ * log_append_open - Opens a log for appending with open(), creating it if needed.
+ * While the whole log is locked, binary logs get their header and a partly written
+ * entry left at the end by a writer that stopped mid-write is truncated away, so
+ * appends carry on from the last whole entry.
+ *
+ * @param filename: Name of the log file.
+ * @return: The file descriptor, or -1 for errors.
+ */
+int log_append_open(const char *filename);
+
+/**
+ * log_append_begin - Waits for the append lock on a log opened by log_append_open.
+ * If compaction has replaced the log since, the new log is opened in its place first.
+ *
+ * @param fd: The log; replaced by a descriptor for the new log if it was compacted.
+ * @param filename: Name of the log file.
+ * @return: 0 with the lock held, -1 for errors.
+ */
+int log_append_begin(int *fd, const char *filename);
+
+/**
+ * log_write_locked - Writes whole entries at the end of a log whose append lock is
+ * held. If the write fails part way, the log is cut back to where it started.
+ *
+ * @param fd: The log, locked by log_append_begin.
+ * @param data: The formatted entries.
+ * @param length: Length of the entries in bytes.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_write_locked(int fd, const char *data, size_t length);
+
+/**
+ * log_append_locked - Appends whole entries as one append, holding the append lock for
+ * the length of the write so entries from other processes cannot come between its
+ * bytes. If the write fails part way, the log is cut back to where it started.
+ *
+ * @param fd: A log opened by log_append_open; updated if the log was compacted.
+ * @param filename: Name of the log file.
+ * @param data: The formatted entries.
+ * @param length: Length of the entries in bytes.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_append_locked(int *fd, const char *filename, const char *data, size_t length);
+
+/**
+ * log_append - Opens a log with log_append_open, appends whole entries with
+ * log_append_locked and closes it again.
+ *
+ * @param filename: Name of the log file.
+ * @param data: The formatted entries.
+ * @param length: Length of the entries in bytes.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_append(const char *filename, const char *data, size_t length);
+
+/**
+ * log_writer_open - Opens a log for appending for the rest of the session.
+ * Files ending in .dat are written as binary records, others as text. A partly
+ * written last entry is truncated away as by log_append_open.
+ *
+ * @param writer: The writer to initialise.
+ * @param filename: Name of the log file; created if it does not exist.
+ * @param policy: When appended entries are forced to disk.
+ * @param sync_every: Entries per fsync for SYNC_EVERY_N.
+ * @param sync_interval_ms: Milliseconds between fsyncs for SYNC_INTERVAL.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_open(log_writer *writer, const char *filename, sync_policy policy,
+                    int sync_every, long sync_interval_ms);
+
+/**
+ * log_writer_append - Formats an entry as one record and appends it to the log.
+ * Under SYNC_EVERY_N, entries are collected in the writer's buffer and written out with
+ * a single write call when the sync policy commits them or the buffer fills. Under
+ * SYNC_INTERVAL each entry is written at once and only the fsync waits. The interval is
+ * measured between appends: the fsync runs on the first append at least
+ * sync_interval_ms after the last one. Entries appended before a pause are synced only
+ * when the next append comes, or when log_writer_sync or log_writer_close is called.
+ *
+ * @param writer: An open writer.
+ * @param entry: The entry to append.
+ * @param timestamp: Time of the entry.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_append(log_writer *writer, const log_entry *entry, time_t timestamp);
+
+/**
+ * log_writer_format - Formats an entry the way log_writer_append writes it: a text
+ * entry or a binary record, depending on the writer's log. Only reads the writer,
+ * so entries can be formatted on other threads ahead of being appended.
+ *
+ * @param writer: An open writer.
+ * @param entry: The entry to format.
+ * @param timestamp: Time of the entry.
+ * @param buffer: Buffer to format into, LOG_ENTRY_MAX bytes is always enough.
+ * @param size: Size of the buffer.
+ * @return: Length of the formatted entry, or -1 if it does not fit.
+ */
+int log_writer_format(const log_writer *writer, const log_entry *entry, time_t timestamp,
+                      char *buffer, size_t size);
+
+/**
+ * log_writer_append_formatted - Appends one entry formatted by log_writer_format,
+ * following the sync policy as log_writer_append does.
+ *
+ * @param writer: An open writer.
+ * @param data: The formatted entry.
+ * @param length: Length of the formatted entry.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_append_formatted(log_writer *writer, const char *data, size_t length);
+
+/**
+ * log_writer_flush - Writes any buffered entries to the log without forcing them to disk,
+ * as one locked append. If the write fails the entries stay buffered for a retry.
+ *
+ * @param writer: An open writer.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_flush(log_writer *writer);
+
+/**
+ * log_writer_sync - Writes any buffered entries and forces them to disk.
+ *
+ * @param writer: An open writer.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_sync(log_writer *writer);
+
+/**
+ * log_writer_close - Syncs buffered entries and closes the log.
+ *
+ * @param writer: An open writer.
+ * @return: 0 for success, -1 for errors.
+ */
+int log_writer_close(log_writer *writer);
+
+/**
+ * parse_sync_policy - Parses a durability policy from the command line.
+ * Accepted forms are "entry", "every:N" and "interval:MS".
+ *
+ * @param text: The policy text.
+ * @param policy: Receives the policy.
+ * @param sync_every: Receives N for "every:N".
+ * @param sync_interval_ms: Receives MS for "interval:MS".
+ * @return: 0 for success, -1 if the text is not a valid policy.
+ */
+int parse_sync_policy(const char *text, sync_policy *policy, int *sync_every, long *sync_interval_ms);
+
+#endif
@@ -7,6 +7,26 @@
 #include "config.h"
 #include <stdlib.h>
 #include <string.h> 
+#include "records.h"
+#include "log_index.h"
+#include "glucose_stats.h"
+#include "rollup.h"
+#include "log_scan.h"
+#include "instrument.h"
+#include "local_time.h"
+#include "log_writer.h"
+#include "log_ids.h"
+#include "segments.h"
+#include "crc32c.h"
+#include "report.h"
+#include <unistd.h>
+
+// Threads used to scan large queries; 0 means one per online CPU
+static int query_threads = 0;
+
+// Time taken by log_date_time for the next entry log_data writes
+static _Thread_local time_t pending_entry_time;
+static _Thread_local int has_pending_entry_time = 0;
 
 int log_config(log_entry *entry) {
     if (!entry) {
@@ -14,35 +34,26 @@ int log_config(log_entry *entry) {
     }
 
     // Read carb ratio configuration value from config file
-    const char *carb_ratio_str = read_config("carb ratio");
-    if (carb_ratio_str == NULL){
-        printf("Error: Missing carb ratio in config.txt");
+    if (config_get_float("carb ratio", &entry->carb_ratio) != 0){
+        printf("Error: Missing or invalid carb ratio in config.txt");
         return -1;
     }
-    
-    
-    entry->carb_ratio = atof(carb_ratio_str); // Converts string to float
 
     // Read the ISF from config file
-    const char *insulin_sensitivity_factor_str = read_config("insulin sensitivity factor");
-    
-    if (insulin_sensitivity_factor_str == NULL){
-        printf("Error: Missing insulin sensitivity factor in config.txt");
+    if (config_get_int("insulin sensitivity factor", &entry->correction_factor) != 0){
+        printf("Error: Missing or invalid insulin sensitivity factor in config.txt");
         return -1;
     }
-    
-    
-    entry->correction_factor = atoi(insulin_sensitivity_factor_str); //Convert string to int
 
     // Read blood glucose unit from config file.
-    const char *unit_str = read_config("blood glucose unit");
-    if (unit_str == NULL){
-        printf("Error: Missing blood glucose unit in config.txt");
+    glucose_unit unit;
+    if (config_get_unit(&unit) != 0){
+        printf("Error: Missing or invalid blood glucose unit in config.txt");
         return -1;
     }
     
     // Copy unit into entry struct
-    strncpy(entry->unit, unit_str, sizeof(entry->unit) - 1);
+    strncpy(entry->unit, unit == UNIT_MG_DL ? "mg/dL" : "mmol/L", sizeof(entry->unit) - 1);
     entry->unit[sizeof(entry->unit) - 1] = '\0'; // Null termination
 
     // Validate configuration values
@@ -52,13 +63,10 @@ int log_config(log_entry *entry) {
     }
     
     // Read target blood glucose from config file
-    const char *target_blood_glucose_str = read_config("target blood glucose");
-    if (target_blood_glucose_str == NULL){
-        printf("Error: Missing target blood glucose in config.txt\n");
+    if (config_get_float("target blood glucose", &entry->target_blood_glucose) != 0){
+        printf("Error: Missing or invalid target blood glucose in config.txt\n");
         return -1;
-
     }
-    entry->target_blood_glucose = atof(target_blood_glucose_str); 
     if (entry->target_blood_glucose <= 0){
         printf("Error: Invalid target blood glucose value in config.txt\n");
         return -1;
@@ -69,216 +77,460 @@ int log_config(log_entry *entry) {
 
 
 
+int format_entry_time(char *buffer, size_t size, time_t timestamp){
+    // Convert to local time for display; the epoch seconds are what entries are read back by
+    struct tm date;
+    epoch_to_local_time(timestamp, &date);
+
+    return snprintf(buffer, size, "Log Entry Time: %d-%02d-%02d %02d:%02d:%02d @%lld\n",
+                    date.tm_year + 1900, date.tm_mon + 1, date.tm_mday,
+                    date.tm_hour, date.tm_min, date.tm_sec, (long long)timestamp);
+}
+
 int log_date_time(const char *filename){
-    FILE *file = fopen(filename, "a");
-    if (file == NULL) {
-        perror("Error opening file for date logging\n");
-        return -1;
+    // The time line is written by log_data with the data lines, in one append
+    (void)filename;
+    pending_entry_time = time(NULL);
+    has_pending_entry_time = 1;
+    return 0;
+}
+
+int format_entry_data(char *buffer, size_t size, const log_entry *entry){
+    size_t length = 0;
+
+// Appends formatted text to buffer, keeping length within size
+#define APPEND_FORMAT(...) \
+    length += snprintf(buffer + length, length < size ? size - length : 0, __VA_ARGS__)
+
+    // Log data into file if flag is set
+    if(entry->blood_glucose_level_flag){
+        APPEND_FORMAT("Blood Glucose: %.2f mmol/L\n", entry->blood_glucose_level);
     }
-    
-    time_t t = time(NULL);  // Get current time
 
-    // Convert to local time
-    struct tm date = *localtime(&t);
+    if(entry->target_blood_glucose_flag){
+        APPEND_FORMAT("Target: %.2f mmol/L\n", entry->target_blood_glucose);
+    }
 
-    char datetime_str[20]; // Buffer for formatted date and time
-    snprintf(datetime_str, sizeof(datetime_str), "%d-%02d-%02d %02d:%02d:%02d\n", 
-             date.tm_year + 1900, date.tm_mon + 1, date.tm_mday, 
-             date.tm_hour, date.tm_min, date.tm_sec);
+    if(entry->meal_time_carbs_flag){
+        APPEND_FORMAT("Carbs: %.2f g, Carb Ratio: %.2f/unit\n",
+                      entry->meal_time_carbs, entry->carb_ratio);
+    }
 
+    if(entry->correction_dosage_flag){
+        APPEND_FORMAT("Correction Factor: %d mmol/L/unit\n"
+                      "Correction Dosage: %.2f units\n",
+                      entry->correction_factor, entry->correction_dosage);
+    }
 
-    // Write the timestamp to the file
-    if (fprintf(file, "Log Entry Time: %s\n", datetime_str) < 0){
-        perror("Error writing date to log file\n");
-        fclose(file);
-        return -1;
-    }  
+    if (entry->insulin_on_board_flag){
+        APPEND_FORMAT("Insulin On Board: %.2f units\n", entry->insulin_on_board);
+    }
 
-    fclose(file);
+    if (entry->insulin_dosage_flag){
+        APPEND_FORMAT("Total Insulin Dosage: %.2f units\nType: %s\n", 
+                      entry->insulin_dosage, entry->entry_type);
+    }
     
-    return 0;
+    if (entry->blood_glucose_level_flag && (!entry->correction_dosage_flag && !entry->meal_time_carbs_flag)){
+        APPEND_FORMAT("Type: %s\n", entry->entry_type);
+    }
+
+#undef APPEND_FORMAT
+
+    return (int)length;
 }
 
-int log_data(log_entry entry, const char *filename){
-    
-    FILE *file = fopen(filename, "a");
-    if (file == NULL) {
-        perror("Error opening file for data logging\n");
-        return -1;  
+int format_log_entry(char *buffer, size_t size, const log_entry *entry, time_t timestamp){
+    return format_numbered_entry(buffer, size, entry, timestamp, 0);
+}
+
+int format_numbered_entry(char *buffer, size_t size, const log_entry *entry, time_t timestamp, int64_t id){
+    int length = format_entry_time(buffer, size, timestamp);
+    if (length < 0 || (size_t)length >= size){
+        return length;
+    }
+    if (id > 0){
+        // The ID goes on the end of the time line, before its newline
+        length += snprintf(buffer + length - 1, size - (size_t)length + 1, " #%lld\n", (long long)id) - 1;
+        if ((size_t)length >= size){
+            return length;
+        }
+    }
+    length += format_entry_data(buffer + length, size - (size_t)length, entry);
+    if ((size_t)length >= size){
+        return length;
     }
+    return format_checksum_line(buffer, (size_t)length, size);
+}
+
+int format_checksum_line(char *buffer, size_t length, size_t size){
+    uint32_t checksum = crc32c(0, buffer, length);
+    return (int)length + snprintf(buffer + length, length < size ? size - length : 0,
+                                  "Checksum: %08x\n", (unsigned int)checksum);
+}
+
+int log_data(log_entry entry, const char *filename){
     
-    // Log data into file if flag is set
-    if(entry.blood_glucose_level_flag){
-        if(fprintf(file,"Blood Glucose: %.2f mmol/L\n",entry.blood_glucose_level) < 0 ){
-            perror("Error writing blood glucose to log file\n");
-            fclose(file);
+    uint64_t start = probe_begin();
+    time_t timestamp = has_pending_entry_time ? pending_entry_time : time(NULL);
+    has_pending_entry_time = 0;
+    if (is_binary_log(filename)){
+        if (record_append(filename, &entry, timestamp) != 0){
+            return -1;
+        }
+    } else {
+        // The whole entry goes in one locked append so entries from other processes cannot split it
+        char text[LOG_ENTRY_MAX];
+        int length = format_log_entry(text, sizeof(text), &entry, timestamp);
+        if (length < 0 || (size_t)length >= sizeof(text)){
+            printf("Error: log entry too long to write.\n");
+            return -1;
+        }
+        if (log_append(filename, text, (size_t)length) != 0){
             return -1;
         }
     }
 
-    if(entry.target_blood_glucose_flag){
-        if (fprintf(file,"Target: %.2f mmol/L\n", entry.target_blood_glucose) < 0 ){
-            perror("Error writing target blood glucose to log file\n");
-            fclose(file);
-            return -1;
+    probe_end(PROBE_LOG_APPEND, start, 0);
+
+    // Index the new entry; the index is rebuilt on demand if this fails
+    log_index_update(filename);
+    glucose_stats_update(filename);
+    rollup_update(filename);
+
+    suggest_dosage(stdout, &entry);
+    return 0;  
+}
+
+void suggest_dosage(FILE *out, const log_entry *entry){
+    // Suggests insulin dose if needed
+    if (entry->insulin_dosage_flag || entry->correction_dosage_flag)
+        fprintf(out, "\nSuggested Insulin Dosage: %.2f units\n", entry->insulin_dosage);
+    // Insulin still acting, which any correction has been reduced by
+    if ((entry->insulin_dosage_flag || entry->correction_dosage_flag) &&
+        entry->insulin_on_board_flag && entry->insulin_on_board > 0)
+        fprintf(out, "Insulin On Board: %.2f units\n", entry->insulin_on_board);
+}
+
+int time_filter_start(const char *time_filter, time_t *start_time) {
+    time_t now = time(NULL); 
+    struct tm current_time;
+    epoch_to_local_time(now, &current_time);
+    int year = current_time.tm_year + 1900;
+    int month = current_time.tm_mon + 1;
+   
+    //Determines start time based on the time filter; windows start at local midnight.
+    if (strcmp(time_filter, "day") == 0) {
+        *start_time = local_time_to_epoch(year, month, current_time.tm_mday, 0, 0, 0); // Start of the day
+    } else if (strcmp(time_filter, "week") == 0) {
+        // Start of week (Sunday)
+        *start_time = local_time_to_epoch(year, month, current_time.tm_mday - current_time.tm_wday, 0, 0, 0);
+    } else if (strcmp(time_filter, "2 weeks") == 0) {
+        // Start of 2 weeks ago
+        *start_time = local_time_to_epoch(year, month, current_time.tm_mday - (current_time.tm_wday + 7), 0, 0, 0);
+    } else if (strcmp(time_filter, "month") == 0) {
+        *start_time = local_time_to_epoch(year, month, 1, 0, 0, 0); // Start of the month
+    } else if (strcmp(time_filter, "90 days") == 0) {
+        // Today and the 89 days before it
+        *start_time = local_time_to_epoch(year, month, current_time.tm_mday - 89, 0, 0, 0);
+    } else if (strcmp(time_filter, "all") == 0) {
+        *start_time = 0; // The whole history
+    } else {
+        printf("Invalid time filter specified.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// State shared with display_scanned_entry while read_logs scans the log
+typedef struct {
+    time_t start_time;            // Start of the time window
+    const char *preffered_unit;   // User's preferred blood glucose unit
+    report *report;               // Report the entries are rendered into
+    const char *data;             // Start of the mapped log, for finding edits
+    size_t size;                  // Size of the mapped log
+    const log_ids *ids;           // IDs of the log's entries
+    int64_t hint;                 // Slot of the entry printed before
+} read_logs_context;
+
+/**
+ * shown_in_window - Checks whether View Logs shows anything for a scanned record:
+ * entries and damaged records within the window, and time lines that cannot be read.
+ */
+static int shown_in_window(const read_logs_context *query, const scanned_entry *scanned) {
+    if (scanned->kind == SCAN_BAD_TIME) {
+        return 1;
+    }
+    if (!scanned->has_timestamp || scanned->timestamp < query->start_time) {
+        return 0; // The entry is outside filter
+    }
+    return scanned->kind == SCAN_ENTRY || scanned->kind == SCAN_CORRUPT; // Not a revision
+}
+
+/**
+ * show_scanned_entry - Renders a record that shown_in_window accepted, if it is on the
+ * page. Entries are shown in their latest version with their ID; entries since deleted
+ * show nothing and do not count towards the page. Damaged records show a note in their place.
+ */
+static void show_scanned_entry(read_logs_context *query, const scanned_entry *scanned) {
+    if (scanned->kind == SCAN_BAD_TIME) {
+        if (report_next(query->report)) {
+            static const char heading[] = "Error parsing log entry time: ";
+            report_write(query->report, heading, sizeof(heading) - 1);
+            report_write(query->report, scanned->time_line, scanned->time_line_length);
+            report_write(query->report, "\n", 1);
+        }
+        return;
+    }
+    if (scanned->kind == SCAN_CORRUPT) {
+        if (report_next(query->report)) {
+            static const char note[] = "\nSkipped a damaged log entry; run --verify for details.\n";
+            report_write(query->report, note, sizeof(note) - 1);
         }
+        return;
     }
+    uint64_t start = probe_begin();
 
-    if(entry.meal_time_carbs_flag){
-        if(fprintf(file,"Carbs: %.2f g, Carb Ratio: %.2f/unit\n",
-        entry.meal_time_carbs, entry.carb_ratio) < 0 ) {
-            perror("Error writing carbohydrate data to log file\n");
-            fclose(file);
-            return -1;
+    const scanned_entry *shown = scanned;
+    scanned_entry edit;
+    int64_t id = 0;
+    if (scanned->time_line != NULL) {
+        int64_t offset = (int64_t)(scanned->time_line - query->data);
+        int64_t current;
+        id = log_ids_latest(query->ids, offset, &query->hint, &current);
+        if (id == LOG_ID_DELETED || !report_next(query->report)) {
+            probe_end(PROBE_RENDER, start, 0);
+            return;
+        }
+        if (current != offset && (size_t)current < query->size &&
+            log_scan_record(query->data, query->size, (size_t)current, &edit) == 0 && edit.kind == SCAN_EDIT) {
+            shown = &edit;
         }
+        report_entry_time(query->report, scanned->time_line, scanned->time_display_length, id, shown != scanned);
+    } else if (!report_next(query->report)) {
+        probe_end(PROBE_RENDER, start, 0);
+        return;
     }
 
-    if(entry.correction_dosage_flag){
-        if (fprintf(file, "Correction Factor: %d mmol/L/unit\n"
-                       "Correction Dosage: %.2f units\n",
-                        entry.correction_factor, entry.correction_dosage) < 0 ){
-                            perror("Error writing correction dosage to log file\n");
-                            fclose(file);
-                            return -1;
-                        }
+    // Display applicable log entry details
+    report_entry_lines(query->report, shown->lines, &shown->entry);
+    probe_end(PROBE_RENDER, start, 0);
+}
+
+/**
+ * display_scanned_entry - Renders a scanned entry if it falls within the time window,
+ * for scans in log order.
+ * 
+ * @param scanned: The entry found by log_scan.
+ * @param context: The read_logs_context for the query.
+ * @return: 0 to keep scanning.
+ */
+static int display_scanned_entry(const scanned_entry *scanned, void *context) {
+    read_logs_context *query = context;
+    if (shown_in_window(query, scanned)) {
+        show_scanned_entry(query, scanned);
     }
+    return 0;
+}
 
-    if (entry.insulin_dosage_flag){
-        if (fprintf(file, "Total Insulin Dosage: %.2f units\nType: %s\n", 
-            entry.insulin_dosage, entry.entry_type) < 0){
-                perror("Error writing insulin dosage to log file\n");
-                fclose(file);
-                return -1;
-            }
+// Records of one stretch of a text log that View Logs would show, in log order
+typedef struct {
+    const read_logs_context *query;
+    scanned_entry *entries;
+    size_t count;
+    size_t capacity;
+} scanned_list;
+
+/**
+ * collect_scanned_entry - log_scan callback that adds the records shown_in_window accepts to a scanned_list.
+ */
+static int collect_scanned_entry(const scanned_entry *scanned, void *context) {
+    scanned_list *list = context;
+    if (!shown_in_window(list->query, scanned)) {
+        return 0;
     }
-    
-    if (entry.blood_glucose_level_flag && (!entry.correction_dosage_flag && !entry.meal_time_carbs_flag)){
-        if (fprintf(file, "Type: %s\n", entry.entry_type) < 0){
-            perror("Error writing entry type to log file\n");
-            fclose(file);
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 256;
+        scanned_entry *entries = realloc(list->entries, capacity * sizeof(scanned_entry));
+        if (entries == NULL) {
+            perror("Error reading log page");
             return -1;
         }
+        list->entries = entries;
+        list->capacity = capacity;
     }
+    list->entries[list->count++] = *scanned;
+    return 0;
+}
 
-    // Suggests insulin dose if needed
-    if (entry.insulin_dosage_flag || entry.correction_dosage_flag)
-        printf("\nSuggested Insulin Dosage: %.2f units\n", entry.insulin_dosage);
-    
-    fclose(file);
-    return 0;  
+/**
+ * print_text_page - Renders a page of a mapped text log, newest first. The log is
+ * scanned backwards from its end in stretches of about QUERY_PAGE_BYTES that start on
+ * an entry, and the scan stops once the page is full, so entries before the page are
+ * never read.
+ * 
+ * @param first: Offset before which no entry is in the window.
+ * @return: Bytes scanned, or -1 for errors.
+ */
+static long print_text_page(read_logs_context *query, size_t first) {
+    scanned_list list = {query, NULL, 0, 0};
+    size_t end = query->size;
+    int status = 0;
+    while (status == 0 && end > first && !report_done(query->report)) {
+        // Widen the step until it reaches back past the start of the entry before end
+        size_t start = end;
+        for (size_t back = QUERY_PAGE_BYTES; start == end; back *= 2) {
+            start = end - first > back ? first + log_scan_boundary(query->data + first, end - first, end - first - back)
+                                       : first;
+        }
+
+        list.count = 0;
+        status = log_scan(query->data + start, end - start, collect_scanned_entry, &list) == 0 ? 0 : -1;
+        for (size_t i = list.count; status == 0 && i > 0 && !report_done(query->report); i--) {
+            show_scanned_entry(query, &list.entries[i - 1]);
+        }
+        end = start;
+    }
+    free(list.entries);
+    return status == 0 ? (long)(query->size - end) : -1;
+}
+
+void set_query_threads(int threads) {
+    query_threads = threads > QUERY_MAX_THREADS ? QUERY_MAX_THREADS : threads;
+}
+
+int get_query_threads(void) {
+    if (query_threads > 0) {
+        return query_threads;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1) {
+        return 1;
+    }
+    return online > QUERY_MAX_THREADS ? QUERY_MAX_THREADS : (int)online;
+}
+
+// A text log split into chunks at entry boundaries for a parallel scan
+typedef struct {
+    const char *data;
+    const size_t *bounds;         // Chunk i is data[bounds[i]] up to data[bounds[i + 1]]
+    const read_logs_context *query;
+} chunked_query;
+
+/**
+ * render_log_chunk - Scans one chunk of a text log and prints its entries in the window.
+ * 
+ * @param chunk: Index of the chunk.
+ * @param out: Stream for the chunk's output.
+ * @param context: The chunked_query.
+ * @return: 0 for success.
+ */
+static int render_log_chunk(size_t chunk, FILE *out, void *context) {
+    const chunked_query *job = context;
+    read_logs_context query = *job->query;
+    report chunk_report;
+    if (report_open(&chunk_report, out, query.preffered_unit, NULL) != 0) {
+        return -1;
+    }
+    query.report = &chunk_report;
+    query.hint = -1;
+    log_scan(job->data + job->bounds[chunk], job->bounds[chunk + 1] - job->bounds[chunk],
+             display_scanned_entry, &query);
+    return report_close(&chunk_report);
+}
+
+/**
+ * scan_parallel - Splits text at entry boundaries into chunks of about QUERY_CHUNK_BYTES
+ * and renders them on several threads, in the same order as a single scan would.
+ * 
+ * @return: 0 for success, -1 for errors.
+ */
+static int scan_parallel(const char *data, size_t size, int threads, const read_logs_context *query) {
+    size_t capacity = size / QUERY_CHUNK_BYTES + 2;
+    size_t *bounds = malloc(capacity * sizeof(size_t));
+    if (bounds == NULL) {
+        perror("Error splitting log");
+        return -1;
+    }
+
+    size_t chunks = 0;
+    bounds[0] = 0;
+    while (bounds[chunks] < size) {
+        size_t next = bounds[chunks] + QUERY_CHUNK_BYTES;
+        bounds[++chunks] = next < size ? log_scan_boundary(data, size, next) : size;
+    }
+
+    chunked_query job = {data, bounds, query};
+    int status = render_chunks(query->report->out, chunks, threads, render_log_chunk, &job);
+    free(bounds);
+    return status;
 }
 
 int read_logs(const char *filename, const char *time_filter) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Error opening file");
+    return print_logs(stdout, filename, time_filter, NULL);
+}
+
+int print_logs(FILE *out, const char *filename, const char *time_filter, const log_page *page) {
+    if (is_binary_log(filename)){
+        return read_records(out, filename, time_filter, page);
+    }
+    if (is_segmented_log(filename)){
+        return segments_print_logs(out, filename, time_filter, page);
+    }
+
+    uint64_t start = probe_begin();
+    read_logs_context query;
+    if (time_filter_start(time_filter, &query.start_time) != 0){
         return -1;
     }
 
-    const char *preffered_unit = read_config("blood glucose unit"); //gets user's preffered unit
+    log_map map;
+    if (log_map_open(&map, filename) != 0) {
+        return -1;
+    }
 
-    time_t now = time(NULL); 
-    struct tm *current_time = localtime(&now);
-    time_t start_time = 0; // Inititalize start time
-   
-    //Determines start time based on the time filter.
-    if (strcmp(time_filter, "day") == 0) {
-        current_time->tm_hour = 0;
-        current_time->tm_min = 0;
-        current_time->tm_sec = 0;
-        start_time = mktime(current_time); // Start of the day
-    } else if (strcmp(time_filter, "week") == 0) {
-        current_time->tm_hour = 0;
-        current_time->tm_min = 0;
-        current_time->tm_sec = 0;
-        current_time->tm_mday -= current_time->tm_wday; // Start of week (Sunday)
-        
-        start_time = mktime(current_time);
+    // Skip straight to the first block that can hold entries in the window
+    size_t offset = (size_t)log_index_seek(filename, query.start_time);
+    if (offset > map.size) {
+        offset = 0;
+    }
 
-    } else if (strcmp(time_filter, "2 weeks") == 0) {
-        current_time->tm_hour = 0;
-        current_time->tm_min = 0;
-        current_time->tm_sec = 0;
-        current_time->tm_mday -= (current_time->tm_wday + 7); // Start of 2 weeks ago
-    
-        start_time = mktime(current_time);
-    } else if (strcmp(time_filter, "month") == 0) {
-        current_time->tm_hour = 0;
-        current_time->tm_min = 0;
-        current_time->tm_sec = 0;
-        current_time->tm_mday = 1; // Start of the month
-        start_time = mktime(current_time);
-    } else {
-        printf("Invalid time filter specified.\n");
-        fclose(file);
+    query.preffered_unit = read_config("blood glucose unit"); //gets user's preffered unit
+    report output;
+    if (report_open(&output, out, query.preffered_unit, page) != 0) {
+        log_map_close(&map);
         return -1;
     }
+    query.report = &output;
 
-    int within_filter = 0; // Flag to check if a log entry is within the time filter
-
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        if (strncmp(line, "Log Entry Time:", 15) == 0) {
-            struct tm log_time = {0};
-            //Parse timestamp from the log entry.
-            if (sscanf(line, "Log Entry Time: %d-%d-%d %d:%d:%d\n",
-                    &log_time.tm_year, &log_time.tm_mon, &log_time.tm_mday,
-                    &log_time.tm_hour, &log_time.tm_min, &log_time.tm_sec) == 6) {
-                log_time.tm_year -= 1900; 
-                log_time.tm_mon -= 1;    
-                time_t log_timestamp = mktime(&log_time);
-
-                if (log_timestamp >= start_time) {
-                    printf("\n%s", line); 
-                    within_filter = 1; // Entry is within filter
-                } else {
-                    within_filter = 0; // Entry is outside filter
-                }
-            } else {
-                printf("Error parsing log entry time: %s\n", line);
-            }
-        } else if (within_filter){
-            // Parse and display applicable log entry details
-            if (strncmp(line, "Blood Glucose:", 14) == 0) {
-                float blood_glucose;
-                sscanf(line, "Blood Glucose: %f mmol/L\n", 
-                                    &blood_glucose);
-
-                printf("Blood Glucose Level: %.2f %s\n", 
-                        convert_to_preferred_unit(blood_glucose, read_config("blood glucose unit")), preffered_unit);
-            } else if (strncmp(line, "Target:",7) == 0) {
-                float target_blood_glucose;
-                sscanf(line, "Target: %f mmol/L\n", 
-                                    &target_blood_glucose);
-                printf("Target: %.2f %s\n", 
-                        convert_to_preferred_unit(target_blood_glucose, read_config("blood glucose unit")), preffered_unit);       
-
-            } else if (strncmp(line, "Carbs:", 6) == 0) {
-                float carbs, carb_ratio;
-                sscanf(line, "Carbs: %f g, Carb Ratio: %f/unit", &carbs, &carb_ratio);
-                printf("Carbs: %.2f g, Carb Ratio: %.2f/unit\n", carbs, carb_ratio);
-            } else if (strncmp(line, "Correction Factor:", 18) == 0) {
-                int correction_factor;
-                sscanf(line, "Correction Factor: %d mmol/L/unit\n", 
-                    &correction_factor);
-                printf("Correction Factor: %d mmol/L/unit\n", 
-                    correction_factor);
-            } else if (strncmp(line, "Correction Dosage:", 18) == 0){
-                float correction_dosage;
-                sscanf(line,"Correction Dosage: %f units\n", &correction_dosage);
-                printf("Correction Dosage: %.2f units\n",correction_dosage);
-            } else if (strncmp(line, "Total Insulin Dosage:", 21) == 0) {
-                float total_dosage;
-                sscanf(line, "Total Insulin Dosage: %f units", &total_dosage);
-                printf("Total Insulin Dosage: %.2f units\n", total_dosage);
-            } else if (strncmp(line, "Type:", 5) == 0) {
-                char entry_type[20];
-                sscanf(line, "Type: %[^\n]", entry_type);
-                printf("Type: %s\n", entry_type);
-            }
-        }
+    // Entries are shown in their latest version; without the ID file they are shown as logged
+    log_ids ids;
+    log_ids_open(&ids, filename);
+    query.data = map.data;
+    query.size = map.size;
+    query.ids = &ids;
+    query.hint = -1;
+
+    // Pages are read from the end; large ranges in log order are scanned in chunks on several threads
+    size_t scanned = map.size - offset;
+    int threads = get_query_threads();
+    int status = 0;
+    if (page != NULL) {
+        long read = print_text_page(&query, offset);
+        status = read < 0 ? -1 : 0;
+        scanned = read < 0 ? 0 : (size_t)read;
+    } else if (threads > 1 && scanned >= 2 * QUERY_CHUNK_BYTES) {
+        status = scan_parallel(map.data + offset, scanned, threads, &query);
+    } else {
+        log_scan(map.data + offset, scanned, display_scanned_entry, &query);
     }
-        
-    fclose(file);
-    return 0;
+    if (report_close(&output) != 0) {
+        status = -1;
+    }
+
+    log_ids_close(&ids);
+    log_map_close(&map);
+    probe_end(PROBE_QUERY, start, scanned);
+    return status;
 }
@@ -1,6 +1,22 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Upper bound on the size of one formatted text log entry
+#define LOG_ENTRY_MAX 512
+
+// Queries over more than two chunks of this many bytes are scanned on several threads
+#define QUERY_CHUNK_BYTES (4 << 20)
+
+// Pages of View Logs are read back from the end of a text log in steps of this many bytes
+#define QUERY_PAGE_BYTES (64 << 10)
+
+// Most threads a query is scanned on
+#define QUERY_MAX_THREADS 16
+
 // Struct representing a log entry for insulin management data.
 typedef struct {
     float blood_glucose_level;    // Glucose level in mmol/l
@@ -10,6 +26,7 @@ typedef struct {
     float target_blood_glucose;   // Target blood glucose level in mmol/L 
     int correction_factor;        // Correction factor in mmol/L/unit
     float correction_dosage;      // Calculated correction dosage in units
+    float insulin_on_board;       // Insulin still active from earlier doses when the entry was logged, in units
     float carb_ratio;             // Carbohydrate to insulin ratio in g/unit
     char unit[10];                // Unit measurement for blood glucose in mmol/L or mg/dL
     
@@ -19,8 +36,15 @@ typedef struct {
     int meal_time_carbs_flag;
     int correction_dosage_flag;
     int insulin_dosage_flag;
+    int insulin_on_board_flag;
 } log_entry;
 
+// A page of View Logs: entries newest first, after skipping the newest offset entries
+typedef struct {
+    long offset;                  // Newest entries to skip
+    long limit;                   // Entries to show, or 0 for every entry after the offset
+} log_page;
+
 
 /**
  * log_config - Reads configuration values from file and populates the log_entry struct
@@ -30,28 +54,135 @@ typedef struct {
 int log_config(log_entry *entry);
 
 /**
- * log_date_time - Logs the current date and time into the given file
+ * log_date_time - Takes the current date and time as the time of the next entry
+ * log_data logs. The time line is written by log_data together with the data lines.
  * 
- * @param filename: Name of file to log the date and time into.
+ * @param filename: Name of file the entry will be logged to.
  * @return: 0 for success, -1 for errors
  */
 int log_date_time(const char *filename);
 
 /**
- * log_data - Logs insulin management data to the file given.
+ * format_entry_time - Formats the "Log Entry Time:" line for a timestamp: the local
+ * wall clock time for display, then the epoch seconds, e.g.
+ * "Log Entry Time: 2024-03-01 08:30:00 @1709281800".
+ * 
+ * @param buffer: Buffer to format into.
+ * @param size: Size of the buffer.
+ * @param timestamp: Time of the entry.
+ * @return: Length of the line, as snprintf.
+ */
+int format_entry_time(char *buffer, size_t size, time_t timestamp);
+
+/**
+ * format_entry_data - Formats the data lines of a log entry.
+ * 
+ * @param buffer: Buffer to format into.
+ * @param size: Size of the buffer.
+ * @param entry: log_entry struct containing data to format.
+ * @return: Length of the text, as snprintf.
+ */
+int format_entry_data(char *buffer, size_t size, const log_entry *entry);
+
+/**
+ * format_log_entry - Formats a complete text log entry: the time line, the data lines
+ * and the checksum line.
+ * 
+ * @param buffer: Buffer to format into, LOG_ENTRY_MAX bytes is always enough.
+ * @param size: Size of the buffer.
+ * @param entry: log_entry struct containing data to format.
+ * @param timestamp: Time of the entry.
+ * @return: Length of the text, as snprintf.
+ */
+int format_log_entry(char *buffer, size_t size, const log_entry *entry, time_t timestamp);
+
+/**
+ * format_numbered_entry - Formats a complete text log entry like format_log_entry, with
+ * an ID written on the end of its time line.
+ * 
+ * @param buffer: Buffer to format into, LOG_ENTRY_MAX bytes is always enough.
+ * @param size: Size of the buffer.
+ * @param entry: log_entry struct containing data to format.
+ * @param timestamp: Time of the entry.
+ * @param id: The entry's ID, or 0 to write none.
+ * @return: Length of the text, as snprintf.
+ */
+int format_numbered_entry(char *buffer, size_t size, const log_entry *entry, time_t timestamp, int64_t id);
+
+/**
+ * format_checksum_line - Ends a text record with its checksum line,
+ * "Checksum: XXXXXXXX", holding the CRC-32C in hex of all the record's lines before it.
+ * 
+ * @param buffer: The record's lines, which the checksum line is added after.
+ * @param length: Length of the record's lines.
+ * @param size: Size of the buffer.
+ * @return: Length of the record with its checksum line, as snprintf.
+ */
+int format_checksum_line(char *buffer, size_t length, size_t size);
+
+/**
+ * log_data - Logs insulin management data to the file given, as one locked append
+ * holding the time line and the data lines. The entry time is the one taken by
+ * log_date_time, or the current time if it was not called.
  * 
  * @param entry: log_entry struct containing data to log
  * @return 0 for success, -1 for failure.
  */
 int log_data(log_entry entry, const char *filename);
 
+/**
+ * suggest_dosage - Displays the suggested insulin dosage for an entry if one was calculated.
+ * 
+ * @param out: Stream to print to.
+ * @param entry: The logged entry.
+ */
+void suggest_dosage(FILE *out, const log_entry *entry);
+
+/**
+ * time_filter_start - Computes the start of the window for a time filter, once per
+ * query; entries are then filtered by comparing epoch times.
+ * 
+ * @param time_filter: The time filter; "day", "week", "2 weeks", "month", "90 days" or "all".
+ * @param start_time: Receives the start of the window.
+ * @return 0 for success, -1 for an invalid filter.
+ */
+int time_filter_start(const char *time_filter, time_t *start_time);
+
 /**
  * read_logs: Reads and filters log entries from the specified file based on a time filter
  * 
  * @param filename: File that contains log entries.
- * @param time_filter: The time filter; "day", "week", "2 weeks" or "month".
+ * @param time_filter: The time filter; "day", "week", "2 weeks", "month" or "all".
  * @return 0 for success, -1 for errors.
  */
 int read_logs(const char *filename, const char *time_filter);
 
+/**
+ * set_query_threads - Sets how many threads read_logs and print_logs scan large logs on.
+ * Output is the same whatever the number of threads.
+ * 
+ * @param threads: Number of threads (at most QUERY_MAX_THREADS), 1 to always scan on the
+ * calling thread, or 0 for one per online CPU.
+ */
+void set_query_threads(int threads);
+
+/**
+ * get_query_threads - Returns how many threads large logs are scanned on.
+ * 
+ * @return: The number of threads set with set_query_threads, or one per online CPU.
+ */
+int get_query_threads(void);
+
+/**
+ * print_logs - Prints the log entries within a time filter to a stream, as read_logs does to stdout.
+ * A page is read from the end of the log backwards, and stops once the page is full.
+ * 
+ * @param out: Stream to print to.
+ * @param filename: File that contains log entries.
+ * @param time_filter: The time filter; "day", "week", "2 weeks", "month", "90 days" or "all".
+ * @param page: The page to print, newest first, or NULL to print every entry in log order.
+ * @return 0 for success, -1 for errors.
+ */
+int print_logs(FILE *out, const char *filename, const char *time_filter, const log_page *page);
+
 #endif
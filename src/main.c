@@ -2,8 +2,28 @@
 #include "logging.h"
 #include "calculations.h"
 #include "config.h"
+#include "records.h"
+#include "log_writer.h"
+#include "storage.h"
+#include "import.h"
+#include "glucose_stats.h"
+#include "agp.h"
+#include "backtest.h"
+#include "instrument.h"
+#include "daemon.h"
+#include "pipeline.h"
+#include "rollup.h"
+#include "log_edit.h"
+#include "segments.h"
+#include "log_verify.h"
+#include "report.h"
+#include "fooddb.h"
+#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 // Function declarations
 
@@ -20,44 +40,155 @@ void display_log_types();
 /**
  * log_filtering - Allows user to view logs based on a time range.
  * 
- * @param filename: File containing log entries.
+ * @param store: The open log, or NULL when using a daemon.
+ * @param client: Socket connected to a daemon, or -1 to read the log directly.
+ * @param page: The page to show, newest first, or NULL to show every entry.
  *  */ 
-void log_filtering(const char *filename);
+void log_filtering(storage *store, int client, const log_page *page);
+
+/**
+ * stats_filtering - Allows user to view glucose statistics for a time range.
+ * 
+ * @param store: The open log, or NULL when using a daemon.
+ * @param client: Socket connected to a daemon, or -1 to read the log directly.
+ */
+void stats_filtering(storage *store, int client);
 
 /**
  * collect_user_input - Collects user input for log entry.
  * 
  * @param entry: Pointer to log_entry struct to populate.
+ * @param foods: The food table meal carbohydrates can be added up from, or NULL.
+ */
+void collect_user_input(log_entry *entry, const food_table *foods);
+
+/**
+ * add_up_foods - Lets the user search the food table for the foods of a meal and the
+ * amount of each, and adds up their carbohydrates.
+ * 
+ * @param foods: The open food table.
+ * @return: The carbohydrates of the meal in grams.
  */
-void collect_user_input(log_entry *entry);
+float add_up_foods(const food_table *foods);
 /**
  * collect_insulin_input - Updates insulin settings based on user input.
  * 
  * @param entry: Pointer to the log_entry struct to update.
+ * @param client: Socket connected to a daemon, or -1 to update config.txt directly.
  */
-void collect_insulin_input(log_entry *entry);
+void collect_insulin_input(log_entry *entry, int client);
 
 /**
- * calculate_dosages - Calculates insulin dosage based on the log entry type.
+ * take_insulin_on_board - Sets the insulin on board of an entry whose dosages are about to
+ * be calculated, so it is taken off the correction. The entry is left without it, and the
+ * user told, if it cannot be worked out.
  * 
- * @param entry: Pointer to log_entry struct containing data for calculations.
+ * @param store: The open log.
+ * @param entry: The entry.
+ * @param timestamp: Time of the entry.
+ * @param exclude_id: The ID of an entry being edited, whose own dose is left out, or 0.
  */
-void calculate_dosages(log_entry *entry);
+void take_insulin_on_board(storage *store, log_entry *entry, time_t timestamp, int64_t exclude_id);
 
 /**
- * log_insulin_data - Logs insulin data and the date into a file.
+ * log_insulin_data - Logs insulin data and the date as one entry.
  * 
- * @param filename: File where data will be logged.
+ * @param store: The open log.
  * @param entry: The log_entry struct containing the insulin management data to log
  */
-void log_insulin_data(const char *filename, log_entry entry);
+void log_insulin_data(storage *store, log_entry entry);
+
+/**
+ * edit_entry - Shows an entry by its ID and lets the user edit or delete it.
+ * 
+ * @param store: The open log.
+ * @param settings: The configuration values new entries are logged with.
+ * @param foods: The food table meal carbohydrates can be added up from, or NULL.
+ */
+void edit_entry(storage *store, const log_entry *settings, const food_table *foods);
 
 /**
  * accesss_menu - Controls program flow.
  * 
- * @param filename: The name of the log file.
+ * @param store: The open log, or NULL when using a daemon.
+ * @param client: Socket connected to a daemon, or -1 to use the log and config.txt directly.
+ * @param page: The page View Logs shows, or NULL to show every entry.
+ * @param foods: The food table meal carbohydrates can be added up from, or NULL.
  */
-void access_menu(const char *filename);
+void access_menu(storage *store, int client, const log_page *page, const food_table *foods);
+
+/**
+ * remote_command - Sends a request to the daemon and prints its output or error.
+ * 
+ * @param client: Socket connected to a daemon.
+ * @param request: The command line.
+ * @return: 0 for success, -1 for errors.
+ */
+int remote_command(int client, const char *request);
+
+/**
+ * remote_config - Loads the unit and target used for prompts from the daemon.
+ * 
+ * @param client: Socket connected to a daemon.
+ * @param entry: Pointer to the log_entry struct to populate.
+ * @return: 0 for success, -1 for errors.
+ */
+int remote_config(int client, log_entry *entry);
+
+/**
+ * log_remote_entry - Sends an entry to the daemon, which calculates the dosages and logs it.
+ * 
+ * @param client: Socket connected to a daemon.
+ * @param entry: The entry collected from the user.
+ * @param calculate: Non-zero to have the dosages calculated.
+ */
+void log_remote_entry(int client, const log_entry *entry, int calculate);
+
+/**
+ * save_setting - Updates a setting in config.txt or through the daemon.
+ * 
+ * @param client: Socket connected to a daemon, or -1 to update config.txt directly.
+ * @param key: The configuration key.
+ * @param value: The new value.
+ */
+void save_setting(int client, const char *key, const char *value);
+
+/**
+ * print_usage - Displays the command line options.
+ * 
+ * @param program: Name the program was invoked with.
+ */
+void print_usage(const char *program);
+
+/**
+ * report_statistics - Prints and saves the session statistics requested on the command line.
+ * 
+ * @param print: Non-zero to print the statistics table.
+ * @param json_filename: File to append the statistics to as JSON, or NULL.
+ */
+void report_statistics(int print, const char *json_filename);
+
+/**
+ * run_import - Imports CSV files or stdin into the log. Several sources are
+ * imported together through the pipeline and merged by entry time; SQLite logs
+ * import them one after another.
+ * 
+ * @param store: The open log.
+ * @param sources: CSV file names, or "-" for stdin.
+ * @param count: Number of sources.
+ * @return: 0 on success, -1 on failure.
+ */
+int run_import(storage *store, const char *const sources[], int count);
+
+/**
+ * find_food - Searches a food table from the command line and prints the foods found
+ * and how long the search took.
+ * 
+ * @param table_filename: The food table.
+ * @param query: The text to search for.
+ * @return: 0 on success, -1 on failure.
+ */
+int find_food(const char *table_filename, const char *query);
 
 
 
@@ -67,7 +198,9 @@ void display_main_menu() {
     printf("2. View Logs\n");
     printf("3. View Insulin Settings\n");
     printf("4. Update Insulin Settings\n");
-    printf("5. Exit program\n");
+    printf("5. View Glucose Statistics\n");
+    printf("6. Edit or Delete a Log Entry\n");
+    printf("7. Exit program\n");
     printf("Enter an option\n");
 }
 
@@ -79,16 +212,17 @@ void display_log_types(){
     printf("4. OTHER\n");
 }
 
-void log_filtering(const char *filename){
+void log_filtering(storage *store, int client, const log_page *page){
     printf("\nSelect logs to view:\n");
     printf("1. View logs from today\n");
     printf("2. View logs from the past week\n");
     printf("3. View logs from the past 2 weeks\n");
     printf("4. View logs from the past month\n");
+    printf("5. View all logs\n");
 
     int choice;
-    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 4){
-        printf("Invalid input. Please Enter a number between 1 and 4: ");
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 5){
+        printf("Invalid input. Please Enter a number between 1 and 5: ");
         while (getchar() != '\n'); 
     }
 
@@ -99,23 +233,57 @@ void log_filtering(const char *filename){
         case 2: time_filter = "week"; break;
         case 3: time_filter = "2 weeks"; break;
         case 4: time_filter = "month"; break;
+        case 5: time_filter = "all"; break;
         default: 
             printf("Invalid choice.\n");
             return;
     }
 
-    if(read_logs(filename, time_filter) != 0){
+    if (client >= 0) {
+        char request[96];
+        if (page != NULL) {
+            snprintf(request, sizeof(request), "QUERY %s %ld %ld", time_filter, page->limit, page->offset);
+        } else {
+            snprintf(request, sizeof(request), "QUERY %s", time_filter);
+        }
+        remote_command(client, request);
+    } else if(storage_print_logs(store, stdout, time_filter, page) != 0){
         printf("Failed to filter logs.\n");
     }
 }
 
-void collect_user_input(log_entry *entry){
+void stats_filtering(storage *store, int client){
+    printf("\nSelect period for statistics:\n");
+    printf("1. Today\n");
+    printf("2. This week\n");
+    printf("3. The past 2 weeks\n");
+    printf("4. This month\n");
+    printf("5. The past 90 days\n");
+
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 5){
+        printf("Invalid input. Please Enter a number between 1 and 5: ");
+        while (getchar() != '\n'); 
+    }
+
+    const char *filters[] = {"day", "week", "2 weeks", "month", "90 days"};
+    if (client >= 0) {
+        char request[64];
+        snprintf(request, sizeof(request), "STATS %s", filters[choice - 1]);
+        remote_command(client, request);
+    } else if (storage_print_stats(store, stdout, filters[choice - 1]) != 0){
+        printf("Failed to calculate glucose statistics.\n");
+    }
+}
+
+void collect_user_input(log_entry *entry, const food_table *foods){
     // Resets flags
     entry->blood_glucose_level_flag = 0;
     entry->target_blood_glucose_flag = 0;
     entry->meal_time_carbs_flag = 0;
     entry->correction_dosage_flag = 0;
     entry->insulin_dosage_flag = 0;
+    entry->insulin_on_board_flag = 0;
 
     // Retrieve blood glucose level from user
     printf("\nEnter blood glucose level in %s: ", entry->unit);
@@ -139,10 +307,31 @@ void collect_user_input(log_entry *entry){
 
     // Collect carbohydrates in grams for meals or snacks
     if (strcmp(entry->entry_type, "meal") == 0 || strcmp(entry->entry_type, "snack") == 0) {
-        printf("Enter total carbohydrates in the meal (in grams): ");
-        while(scanf("%f", &entry->meal_time_carbs) != 1 || entry->meal_time_carbs < 0){
-            printf("Invalid input. Please enter a valid number for carbohydrates: ");
-            while(getchar() != '\n');
+        if (foods == NULL) {
+            printf("Enter total carbohydrates in the meal (in grams): ");
+            while(scanf("%f", &entry->meal_time_carbs) != 1 || entry->meal_time_carbs < 0){
+                printf("Invalid input. Please enter a valid number for carbohydrates: ");
+                while(getchar() != '\n');
+            }
+        } else {
+            // The total can be typed in, or added up from the foods of the meal
+            char answer[64];
+            char *end;
+            printf("Enter total carbohydrates in the meal (in grams), or f to add up foods: ");
+            while (1) {
+                if (scanf("%63s", answer) == 1) {
+                    if (strcmp(answer, "f") == 0 || strcmp(answer, "F") == 0) {
+                        entry->meal_time_carbs = add_up_foods(foods);
+                        break;
+                    }
+                    entry->meal_time_carbs = strtof(answer, &end);
+                    if (end != answer && *end == '\0' && entry->meal_time_carbs >= 0) {
+                        break;
+                    }
+                }
+                printf("Invalid input. Please enter a valid number for carbohydrates, or f: ");
+                while(getchar() != '\n');
+            }
         }
         entry->meal_time_carbs_flag = 1;
     }
@@ -150,7 +339,90 @@ void collect_user_input(log_entry *entry){
     
 }
 
-void collect_insulin_input(log_entry *entry) {
+float add_up_foods(const food_table *foods) {
+    float total = 0;
+    char line[FOOD_NAME_MAX + 2];
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+
+    while (1) {
+        printf("\nSearch for a food (press Enter when the meal is complete): ");
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            break;
+        }
+        if (strchr(line, '\n') == NULL) {
+            while ((c = getchar()) != '\n' && c != EOF);
+        }
+        char *query = trimwhitespace(line);
+        if (query[0] == '\0') {
+            break;
+        }
+
+        food_match matches[FOOD_MATCHES_MAX];
+        int count = food_search(foods, query, matches, FOOD_MATCHES_MAX);
+        if (count == 0) {
+            printf("No foods match \"%s\".\n", query);
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            printf("%2d. %.*s: %.1f g carbs per 100 g", i + 1, (int)matches[i].name_length,
+                   matches[i].name, matches[i].carbs);
+            if (matches[i].portion_grams > 0) {
+                printf(", %.*s = %.0f g", (int)matches[i].portion_length, matches[i].portion,
+                       matches[i].portion_grams);
+            }
+            printf(matches[i].fuzzy ? " (close match)\n" : "\n");
+        }
+
+        int choice;
+        printf("Choose a food (1-%d), or 0 to search again: ", count);
+        while (scanf("%d", &choice) != 1 || choice < 0 || choice > count) {
+            printf("Invalid input. Please enter a number between 0 and %d: ", count);
+            while ((c = getchar()) != '\n' && c != EOF);
+        }
+        if (choice == 0) {
+            while ((c = getchar()) != '\n' && c != EOF);
+            continue;
+        }
+        const food_match *food = &matches[choice - 1];
+
+        // Amounts are grams, or servings of the typical portion followed by s
+        char amount[32];
+        char *end;
+        float grams;
+        if (food->portion_grams > 0) {
+            printf("Enter the amount in grams, or the number of servings followed by s (1s = %.*s): ",
+                   (int)food->portion_length, food->portion);
+        } else {
+            printf("Enter the amount in grams: ");
+        }
+        while (1) {
+            if (scanf("%31s", amount) == 1) {
+                grams = strtof(amount, &end);
+                if (end != amount && food->portion_grams > 0 && (*end == 's' || *end == 'S') && end[1] == '\0') {
+                    grams *= food->portion_grams;
+                    end++;
+                }
+                if (end != amount && *end == '\0' && grams >= 0) {
+                    break;
+                }
+            }
+            printf("Invalid input. Please enter a valid amount: ");
+            while ((c = getchar()) != '\n' && c != EOF);
+        }
+        while ((c = getchar()) != '\n' && c != EOF);
+
+        float carbs = grams * food->carbs / 100;
+        total += carbs;
+        printf("Added %.1f g of carbohydrates from %.0f g of %.*s. Meal total: %.1f g\n", carbs, grams,
+               (int)food->name_length, food->name, total);
+    }
+
+    printf("Total carbohydrates in the meal: %.2f g\n", total);
+    return total;
+}
+
+void collect_insulin_input(log_entry *entry, int client) {
     char choice;
     char buffer[50];
     do {
@@ -177,7 +449,7 @@ void collect_insulin_input(log_entry *entry) {
                     
                 }
                 sprintf(buffer, "%d", insulin_sensitivity_factor);
-                update_config("config.txt", "insulin sensitivity factor", buffer);
+                save_setting(client, "insulin sensitivity factor", buffer);
                 entry->correction_factor = insulin_sensitivity_factor;
                 break;
             }
@@ -189,7 +461,7 @@ void collect_insulin_input(log_entry *entry) {
                     while (getchar() != '\n');  
                 }
                 sprintf(buffer, "%.2f", carb_ratio);
-                update_config("config.txt", "carb ratio", buffer);
+                save_setting(client, "carb ratio", buffer);
                 entry->carb_ratio = carb_ratio;
                 break;
             }
@@ -205,7 +477,7 @@ void collect_insulin_input(log_entry *entry) {
                     while (getchar() != '\n');
                    
                 }
-                update_config("config.txt", "blood glucose unit", blood_glucose_unit);
+                save_setting(client, "blood glucose unit", blood_glucose_unit);
                 break;
             }
             case '4':{
@@ -217,7 +489,7 @@ void collect_insulin_input(log_entry *entry) {
                     
                 }
                 sprintf(buffer, "%.2f", target_blood_glucose);
-                update_config("config.txt", "target blood glucose", buffer);
+                save_setting(client, "target blood glucose", buffer);
                 entry->target_blood_glucose = target_blood_glucose;
                 break;
             }
@@ -230,13 +502,18 @@ void collect_insulin_input(log_entry *entry) {
     } while (choice != '5');
 }
 
-void access_menu(const char *filename){
+void access_menu(storage *store, int client, const log_page *page, const food_table *foods){
     
     int choice; 
     int choice2;
     log_entry entry = {0};
 
-    if (log_config(&entry) != 0){
+    if (client >= 0){
+        if (remote_config(client, &entry) != 0){
+            printf("Failed to load configuration values from the daemon.\n");
+            return;
+        }
+    } else if (log_config(&entry) != 0){
         printf("Failed to load configuration values. Please check config.txt.\n");
         return;
     }
@@ -244,8 +521,8 @@ void access_menu(const char *filename){
 
     do {
         display_main_menu();
-        while (scanf("%d", &choice) != 1 || choice < 1 || choice > 5) {
-            printf("Invalid input. Please enter a number between 1 and 5: ");
+        while (scanf("%d", &choice) != 1 || choice < 1 || choice > 7) {
+            printf("Invalid input. Please enter a number between 1 and 7: ");
             while (getchar() != '\n'); 
         }
         if (choice == 1){
@@ -261,73 +538,556 @@ void access_menu(const char *filename){
             strncpy(entry.entry_type, types[choice2 - 1], sizeof(entry.entry_type) - 1);
             entry.entry_type[sizeof(entry.entry_type) - 1] = '\0'; 
 
-            collect_user_input(&entry);
+            collect_user_input(&entry, foods);
+
+            // The daemon calculates the dosages of the entries it logs
+            if (client >= 0) {
+                log_remote_entry(client, &entry, choice2 < 4);
+                continue;
+            }
 
             // Only calculate dosages if relevant
             if (choice2 < 4) { 
+                take_insulin_on_board(store, &entry, time(NULL), 0);
                 calculate_dosages(&entry);
             }
 
-            log_insulin_data(filename, entry);
+            log_insulin_data(store, entry);
             
         } else if (choice == 2){
-            log_filtering(filename);
+            // Make entries still waiting on the sync policy visible
+            if (store != NULL) {
+                storage_flush(store);
+            }
+            log_filtering(store, client, page);
         } else if (choice == 3){
             printf("\nInsulin Settings\n");
-            list_config("config.txt");
+            if (client >= 0) {
+                remote_command(client, "CONFIG");
+            } else {
+                list_config("config.txt");
+            }
         } else if (choice == 4){
 
-            collect_insulin_input(&entry);
-        }else if (choice == 5) {
+            collect_insulin_input(&entry, client);
+        } else if (choice == 5){
+            // Make entries still waiting on the sync policy count
+            if (store != NULL) {
+                storage_flush(store);
+            }
+            stats_filtering(store, client);
+        } else if (choice == 6){
+            if (client >= 0) {
+                printf("Entries can only be edited with the log opened directly.\n");
+            } else if (store->backend == &segment_backend) {
+                printf("Entries of segmented logs have no IDs and cannot be edited.\n");
+            } else {
+                edit_entry(store, &entry, foods);
+            }
+        }else if (choice == 7) {
             printf("Exiting program...Goodbye\n");
         }else{
-            printf("Please enter a valid opetion (1 to 5): ");
+            printf("Please enter a valid opetion (1 to 7): ");
         } 
-    }while (choice != 5);
+    }while (choice != 7);
 }
 
-void calculate_dosages(log_entry *entry) {
-    
-    // Calculates only correction dose if applicable
-    if (entry->blood_glucose_level_flag && entry->target_blood_glucose_flag) {
-        entry->correction_dosage = correction_dosage_calculation(
-            entry,
-            entry->correction_factor,
-            entry->blood_glucose_level,
-            entry->target_blood_glucose
-        );
-        entry->correction_dosage_flag = 1; // Set flag
-        entry->insulin_dosage = round(entry->correction_dosage * 2)/2;
-        entry->insulin_dosage_flag = 1;
+void edit_entry(storage *store, const log_entry *settings, const food_table *foods) {
+    long long id;
+    printf("Enter the ID of the entry, as View Logs shows it: ");
+    while (scanf("%lld", &id) != 1 || id < 1) {
+        printf("Invalid input. Please enter an entry ID: ");
+        while (getchar() != '\n'); 
+    }
+
+    time_t timestamp;
+    log_entry current;
+    if (storage_get(store, (int64_t)id, &timestamp, &current) != 0) {
+        printf("There is no entry #%lld.\n", id);
+        return;
+    }
+    log_record record;
+    entry_to_record(&current, timestamp, &record);
+    report output;
+    if (report_open(&output, stdout, read_config("blood glucose unit"), NULL) == 0) {
+        display_record(&output, &record, (int64_t)id, 0);
+        report_close(&output);
+    }
+
+    int action;
+    printf("\n1. Edit this entry\n");
+    printf("2. Delete this entry\n");
+    printf("3. Cancel\n");
+    while (scanf("%d", &action) != 1 || action < 1 || action > 3) {
+        printf("Invalid input. Please enter a number between 1 and 3: ");
+        while (getchar() != '\n'); 
+    }
+
+    if (action == 2) {
+        if (storage_remove(store, (int64_t)id) == 0) {
+            printf("Deleted entry #%lld.\n", id);
+        } else {
+            printf("Failed to delete entry #%lld.\n", id);
+        }
+        return;
+    } else if (action == 3) {
+        return;
+    }
+
+    // The entry is entered again in full, keeping its ID and time
+    int type;
+    display_log_types();
+    while (scanf("%d", &type) != 1 || type < 1 || type > 4) {
+        printf("Invalid input. Please select a log type (1-4): ");
+        while (getchar() != '\n'); 
+    }
+    const char *types[] = {"meal", "snack", "correction", "other"};
+    log_entry entry = *settings;
+    strncpy(entry.entry_type, types[type - 1], sizeof(entry.entry_type) - 1);
+    entry.entry_type[sizeof(entry.entry_type) - 1] = '\0'; 
+
+    collect_user_input(&entry, foods);
+    if (type < 4) { 
+        // The entry's own earlier dose is no longer on board
+        take_insulin_on_board(store, &entry, timestamp, (int64_t)id);
+        calculate_dosages(&entry);
+    }
+
+    if (storage_edit(store, (int64_t)id, &entry) == 0) {
+        printf("Updated entry #%lld.\n", id);
+        suggest_dosage(stdout, &entry);
     } else {
-        entry->correction_dosage_flag = 0; // Unset flag
-        entry->insulin_dosage_flag = 0;
+        printf("Failed to update entry #%lld.\n", id);
+    }
+}
+
+void take_insulin_on_board(storage *store, log_entry *entry, time_t timestamp, int64_t exclude_id) {
+    if (storage_insulin_on_board(store, timestamp, exclude_id, &entry->insulin_on_board) != 0) {
+        printf("Insulin on board could not be worked out, so it is not taken off the correction.\n");
+        return;
+    }
+    entry->insulin_on_board_flag = 1;
+}
+
+void log_insulin_data(storage *store, log_entry entry) {
+    if (storage_append(store, &entry, time(NULL)) != 0){
+        printf("Failed to log entry.\n");
+        return;
+    }
+    suggest_dosage(stdout, &entry);
+}
+
+int remote_command(int client, const char *request) {
+    char *body;
+    int status = daemon_request(client, request, &body);
+    if (status == 0) {
+        printf("%s", body);
+    } else if (body != NULL) {
+        printf("Daemon error: %s\n", body);
+    }
+    free(body);
+    return status;
+}
+
+int remote_config(int client, log_entry *entry) {
+    char *unit;
+    char *target;
+    if (daemon_request(client, "GET blood glucose unit", &unit) != 0) {
+        free(unit);
+        return -1;
     }
-    // Calculates total insulin dose for meals and snacks
+    if (daemon_request(client, "GET target blood glucose", &target) != 0) {
+        free(unit);
+        free(target);
+        return -1;
+    }
+
+    strncpy(entry->unit, unit, sizeof(entry->unit) - 1);
+    entry->unit[sizeof(entry->unit) - 1] = '\0';
+    entry->target_blood_glucose = strtof(target, NULL);
+    free(unit);
+    free(target);
+    return 0;
+}
+
+void log_remote_entry(int client, const log_entry *entry, int calculate) {
+    // Sent as an import row; glucose has already been converted to mmol/L
+    char request[DAEMON_MAX_REQUEST];
+    char carbs[32] = "";
     if (entry->meal_time_carbs_flag) {
-        entry->insulin_dosage = total_dosage(
-            entry,
-            entry->meal_time_carbs,
-            entry->carb_ratio,
-            entry->correction_factor,
-            entry->blood_glucose_level,
-            entry->target_blood_glucose
-        );
-        entry->insulin_dosage_flag = 1; // Set flag
-    } else {
-        if (strcmp(entry->entry_type,"correction") != 0)
-            entry->insulin_dosage_flag = 0; // Unset flag
+        snprintf(carbs, sizeof(carbs), "%.9g", entry->meal_time_carbs);
+    }
+    snprintf(request, sizeof(request), "LOG %lld,%s,%.9g,mmol/L,%s,%s", (long long)time(NULL),
+             entry->entry_type, entry->blood_glucose_level, carbs, calculate ? "calc" : "");
+
+    if (remote_command(client, request) != 0) {
+        printf("Failed to log entry.\n");
     }
 }
 
-void log_insulin_data(const char *filename, log_entry entry) {
-    log_date_time(filename);
-    log_data(entry, filename);
+void save_setting(int client, const char *key, const char *value) {
+    if (client < 0) {
+        update_config("config.txt", key, value);
+        return;
+    }
+
+    char request[DAEMON_MAX_REQUEST];
+    snprintf(request, sizeof(request), "SET %s=%s", key, value);
+    remote_command(client, request);
 }
 
-int main() {
-    const char *filename = "data/logs.txt";
-    access_menu(filename);
+void print_usage(const char *program) {
+    printf("Usage: %s [--log FILE] [--sync POLICY] [--query-threads N] [--limit N] [--offset N]\n", program);
+    printf("           [--foods TABLE] [--stats] [--stats-json FILE]\n");
+    printf("       %s [--log FILE] [--sync POLICY] --import CSV_FILE|- [--import CSV_FILE ...]\n", program);
+    printf("       %s [--log FILE] [--socket PATH] --daemon\n", program);
+    printf("       %s [--socket PATH] --connect\n", program);
+    printf("       %s [--log FILE] --backtest DAYS [--carb-ratio GRID] [--isf GRID] [--target GRID]\n", program);
+    printf("           [--threads N] [--csv FILE]\n");
+    printf("       %s [--log FILE] [--query-threads N] --agp DAYS\n", program);
+    printf("       %s [--log FILE] --rebuild-rollups\n", program);
+    printf("       %s [--log FILE] --compact\n", program);
+    printf("       %s [--log FILE] --verify\n", program);
+    printf("       %s [--log FILE] --repair NEW_LOG\n", program);
+    printf("       %s --convert TEXT_LOG BINARY_LOG\n", program);
+    printf("       %s --export BINARY_LOG TEXT_LOG\n", program);
+    printf("       %s --split TEXT_LOG MANIFEST.seg\n", program);
+    printf("       %s --build-foods CSV_FILE TABLE\n", program);
+    printf("       %s [--foods TABLE] --find-food TEXT\n", program);
+    printf("\nLog files ending in .dat use the binary record format; files ending in .db or .sqlite\n");
+    printf("  are SQLite databases; files ending in .seg are manifests of logs kept in monthly\n");
+    printf("  segments. --backtest, --agp, --rebuild-rollups, --compact and --repair need a text or\n");
+    printf("  binary log.\n");
+    printf("--split moves a text log into monthly segments, compressing all but the latest month.\n");
+    printf("POLICY is when entries are forced to disk: entry (default), every:N or interval:MS.\n");
+    printf("Imports default to every:%d.\n", IMPORT_SYNC_EVERY);
+    printf("Queries over more than %d MB of log are scanned on N threads (default one per CPU).\n",
+           2 * QUERY_CHUNK_BYTES >> 20);
+    printf("--limit and --offset make View Logs show N entries, newest first, after skipping the\n");
+    printf("  newest --offset entries; only the end of the log that holds them is read.\n");
+    printf("\n--build-foods compiles a CSV file of foods into a table that meal entries can add up\n");
+    printf("  carbohydrates from; rows are name,carbs per 100 g[,portion grams,portion].\n");
+    printf("  The menu uses --foods TABLE, or %s if it exists.\n", FOOD_TABLE_FILE);
+    printf("\nImport rows are: time,type,glucose,unit,carbs,dose\n");
+    printf("  time is YYYY-MM-DD HH:MM:SS or epoch seconds, dose is units, calc or empty.\n");
+    printf("  Up to %d files can be imported at once; each should be in time order.\n", PIPELINE_MAX_SOURCES);
+    printf("\nBacktests replay the past DAYS of entries with every combination of settings.\n");
+    printf("  GRID is VALUE or START:END:STEP; settings not given come from config.txt.\n");
+    printf("\n--agp prints the ambulatory glucose profile of the past DAYS (%d-%d): glucose\n", AGP_MIN_DAYS, AGP_MAX_DAYS);
+    printf("  percentiles by time of day, as an hourly table and a plot of %d minute bins.\n", AGP_BIN_MINUTES);
+    printf("\n--rebuild-rollups regenerates the hourly and daily summary tables from the log.\n");
+    printf("--compact rewrites the log with its edits and deletions folded in. Sessions also do\n");
+    printf("  this in the background once one entry in %d has been edited or deleted.\n", LOG_COMPACT_RATIO);
+    printf("\n--verify reads the whole log, checks every entry against its CRC-32C checksum and\n");
+    printf("  prints the byte ranges that are damaged. --repair writes the intact entries to\n");
+    printf("  NEW_LOG, which must not exist, keeping their IDs; NEW_LOG may be text or binary.\n");
+    printf("\n--daemon serves the log and config.txt on a Unix socket (default %s);\n", DAEMON_SOCKET);
+    printf("  --connect runs the menu against a running daemon.\n");
+    printf("\n--stats prints the time spent in I/O, parsing and rendering when the session ends.\n");
+    printf("--stats-json appends the same statistics to FILE as one JSON line per session.\n");
+}
+
+void report_statistics(int print, const char *json_filename) {
+    if (print) {
+        instrument_report(stdout);
+    }
+    if (json_filename != NULL) {
+        instrument_dump_json(json_filename);
+    }
+}
+
+int run_import(storage *store, const char *const sources[], int count) {
+    log_entry settings = {0};
+    if (log_config(&settings) != 0) {
+        printf("Failed to load configuration values. Please check config.txt.\n");
+        return -1;
+    }
+
+    // The pipeline merges preformatted entries, so it only feeds text and binary logs
+    if (count > 1 && store->writer != NULL) {
+        pipeline_stats stats;
+        int status = pipeline_import(sources, count, store->writer, &settings, &stats);
+        display_pipeline_stats(&stats);
+        return status;
+    }
+
+    int status = 0;
+    for (int i = 0; i < count && status == 0; i++) {
+        const char *source = sources[i];
+        FILE *input = stdin;
+        if (strcmp(source, "-") != 0) {
+            input = fopen(source, "r");
+            if (input == NULL) {
+                perror("Error opening import file");
+                return -1;
+            }
+        }
+
+        status = import_csv(input, source, store, &settings);
+        if (input != stdin) {
+            fclose(input);
+        }
+    }
+    return status;
+}
+
+int find_food(const char *table_filename, const char *query) {
+    food_table foods;
+    if (food_table_open(&foods, table_filename) != 0) {
+        return -1;
+    }
+
+    struct timespec started, finished;
+    food_match matches[FOOD_MATCHES_MAX];
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int count = food_search(&foods, query, matches, FOOD_MATCHES_MAX);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    for (int i = 0; i < count; i++) {
+        printf("%.*s: %.1f g carbs per 100 g", (int)matches[i].name_length, matches[i].name, matches[i].carbs);
+        if (matches[i].portion_grams > 0) {
+            printf(", %.*s = %.0f g", (int)matches[i].portion_length, matches[i].portion, matches[i].portion_grams);
+        }
+        printf(matches[i].fuzzy ? " (close match)\n" : "\n");
+    }
+    printf("%d foods found among %u in %.1f us.\n", count, foods.header->food_count,
+           ((finished.tv_sec - started.tv_sec) * 1e9 + (finished.tv_nsec - started.tv_nsec)) / 1e3);
+    food_table_close(&foods);
     return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = "data/logs.txt";
+    const char *import_sources[PIPELINE_MAX_SOURCES];
+    int import_count = 0;
+    int sync_given = 0;
+    sync_policy policy = SYNC_EVERY_ENTRY;
+    int sync_every = 1;
+    long sync_interval_ms = 1000;
+    int backtest_days = 0;
+    int agp_days = 0;
+    backtest_grid grid;
+    memset(&grid, 0, sizeof(grid)); // Axes not given use config.txt
+    int threads = 0;
+    const char *csv_filename = NULL;
+    const char *socket_path = DAEMON_SOCKET;
+    int daemon_mode = 0;
+    int connect_mode = 0;
+    int print_stats = 0;
+    int rebuild_rollups = 0;
+    int compact = 0;
+    int verify = 0;
+    const char *repaired_filename = NULL;
+    log_page page = {0, 0};
+    int paged = 0;
+    const char *foods_filename = NULL;
+    const char *food_query = NULL;
+    const char *stats_filename = NULL;
+
+    if (argc == 4 && strcmp(argv[1], "--convert") == 0) {
+        return convert_text_log(argv[2], argv[3]) == 0 ? 0 : 1;
+    } else if (argc == 4 && strcmp(argv[1], "--export") == 0) {
+        return export_binary_log(argv[2], argv[3]) == 0 ? 0 : 1;
+    } else if (argc == 4 && strcmp(argv[1], "--split") == 0) {
+        return segments_split(argv[2], argv[3]) == 0 ? 0 : 1;
+    } else if (argc == 4 && strcmp(argv[1], "--build-foods") == 0) {
+        return food_table_build(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            filename = argv[++i];
+        } else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc &&
+                   parse_sync_policy(argv[i + 1], &policy, &sync_every, &sync_interval_ms) == 0) {
+            sync_given = 1;
+            i++;
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc && import_count < PIPELINE_MAX_SOURCES) {
+            import_sources[import_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--backtest") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            backtest_days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--agp") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            agp_days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--carb-ratio") == 0 && i + 1 < argc &&
+                   parse_grid_axis(argv[i + 1], &grid.carb_ratio) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--isf") == 0 && i + 1 < argc &&
+                   parse_grid_axis(argv[i + 1], &grid.sensitivity) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc &&
+                   parse_grid_axis(argv[i + 1], &grid.target) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--query-threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            set_query_threads(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_filename = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "--connect") == 0) {
+            connect_mode = 1;
+        } else if (strcmp(argv[i], "--rebuild-rollups") == 0) {
+            rebuild_rollups = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "--repair") == 0 && i + 1 < argc) {
+            repaired_filename = argv[++i];
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0) {
+            page.limit = atol(argv[++i]);
+            paged = 1;
+        } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+            page.offset = atol(argv[++i]);
+            paged = 1;
+        } else if (strcmp(argv[i], "--foods") == 0 && i + 1 < argc) {
+            foods_filename = argv[++i];
+        } else if (strcmp(argv[i], "--find-food") == 0 && i + 1 < argc) {
+            food_query = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = 1;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_filename = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    instrument_enable(print_stats || stats_filename != NULL);
+
+    if (food_query != NULL) {
+        return find_food(foods_filename != NULL ? foods_filename : FOOD_TABLE_FILE, food_query) == 0 ? 0 : 1;
+    }
+
+    // Rollup rebuilds, compaction, repairs, glucose profiles and backtests read text and binary logs directly
+    if ((rebuild_rollups || compact || repaired_filename != NULL || agp_days > 0 || backtest_days > 0) &&
+        (storage_backend_for(filename) == &sqlite_backend || storage_backend_for(filename) == &segment_backend)) {
+        printf("Error: --backtest, --agp, --rebuild-rollups, --compact and --repair need a text or binary log.\n");
+        return 1;
+    }
+    if (repaired_filename != NULL && (storage_backend_for(repaired_filename) == &sqlite_backend ||
+                                      storage_backend_for(repaired_filename) == &segment_backend)) {
+        printf("Error: --repair writes a text or binary log.\n");
+        return 1;
+    }
+
+    // Checks only read the log; SQLite databases carry their own page checksums
+    if (verify) {
+        if (storage_backend_for(filename) == &sqlite_backend) {
+            printf("Error: --verify needs a text, binary or segmented log.\n");
+            return 1;
+        }
+        int status = is_segmented_log(filename) ? segments_verify(stdout, filename) : log_verify(stdout, filename);
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    if (repaired_filename != NULL) {
+        int status = log_repair(filename, repaired_filename);
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    if (compact) {
+        long folded;
+        int status = log_compact(filename, &folded);
+        if (status != 0) {
+            printf("Failed to compact %s.\n", filename);
+        } else if (folded > 0) {
+            printf("Compacted %s: folded in %ld edits and deletions.\n", filename, folded);
+        } else {
+            printf("%s has no edits or deletions to compact.\n", filename);
+        }
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    if (rebuild_rollups) {
+        int status = rollup_rebuild(filename);
+        if (status == 0) {
+            printf("Rebuilt the hourly and daily rollups of %s.\n", filename);
+        } else {
+            printf("Failed to rebuild the rollups of %s.\n", filename);
+        }
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    // Glucose profiles only read the log
+    if (agp_days > 0) {
+        int status = view_agp(filename, agp_days);
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    // Backtests only read the log
+    if (backtest_days > 0) {
+        int status = run_backtest(filename, backtest_days, &grid, threads, csv_filename);
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    if (daemon_mode) {
+        int status = run_daemon(socket_path, filename);
+        report_statistics(print_stats, stats_filename);
+        return status == 0 ? 0 : 1;
+    }
+
+    // The food table is only mapped, so it costs nothing to open for every session;
+    // the default table is optional
+    food_table food_storage;
+    const food_table *foods = NULL;
+    if (foods_filename != NULL || access(FOOD_TABLE_FILE, F_OK) == 0) {
+        if (food_table_open(&food_storage, foods_filename != NULL ? foods_filename : FOOD_TABLE_FILE) != 0) {
+            return 1;
+        }
+        foods = &food_storage;
+    }
+
+    // The menu as a thin client; the daemon owns the log and config.txt
+    if (connect_mode) {
+        int client = daemon_connect(socket_path);
+        if (client < 0) {
+            return 1;
+        }
+        access_menu(NULL, client, paged ? &page : NULL, foods);
+        close(client);
+        if (foods != NULL) {
+            food_table_close(&food_storage);
+        }
+        report_statistics(print_stats, stats_filename);
+        return 0;
+    }
+
+    // Bulk imports trade per-entry fsync for throughput unless told otherwise
+    if (import_count > 0 && !sync_given) {
+        policy = SYNC_EVERY_N;
+        sync_every = IMPORT_SYNC_EVERY;
+    }
 
-}
\ No newline at end of file
+    // The log stays open for the whole session
+    storage store;
+    if (storage_open(&store, filename, policy, sync_every, sync_interval_ms) != 0) {
+        return 1;
+    }
+
+    int status = 0;
+    if (import_count > 0) {
+        status = run_import(&store, import_sources, import_count);
+    } else {
+        access_menu(&store, -1, paged ? &page : NULL, foods);
+    }
+
+    if (foods != NULL) {
+        food_table_close(&food_storage);
+    }
+    if (storage_close(&store) != 0) {
+        status = -1;
+    }
+    report_statistics(print_stats, stats_filename);
+    return status == 0 ? 0 : 1;
+
+}
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include "pipeline.h"
+#include "import.h"
+#include "instrument.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Input buffer size for each CSV source
+#define PIPELINE_READ_BUFFER (1 << 20)
+
+// Waits spent yielding before a stage starts sleeping between checks
+#define PIPELINE_SPINS 64
+
+// Rows read by a parser thread, waiting to be parsed
+typedef struct {
+    int count;
+    long line_numbers[PIPELINE_BATCH_ROWS];
+    int offsets[PIPELINE_BATCH_ROWS];  // Start of each NUL terminated row in text
+    size_t used;
+    char text[PIPELINE_BATCH_TEXT];
+} line_batch;
+
+// Formatted entries made by a compute thread, waiting to be appended
+typedef struct {
+    int count;
+    time_t timestamps[PIPELINE_BATCH_ROWS];
+    int offsets[PIPELINE_BATCH_ROWS + 1]; // Entry i is text[offsets[i]] up to offsets[i + 1]
+    char text[PIPELINE_BATCH_TEXT];
+} entry_batch;
+
+// Bounded single-producer/single-consumer ring of batches.
+// The producer fills slots in place and publishes them by advancing tail; the
+// consumer reads them in place and hands them back by advancing head.
+typedef struct {
+    alignas(64) atomic_size_t head;   // Next slot to consume, written by the consumer
+    alignas(64) atomic_size_t tail;   // Next slot to fill, written by the producer
+    atomic_int closed;                // Set by the producer after its last batch
+    const atomic_int *cancelled;      // Set when the import is abandoned
+    char *slots;
+    size_t slot_size;
+    long full_waits;                  // Producer only
+    long empty_waits;                 // Consumer only
+    long depth_samples;               // Consumer only
+    double depth_total;               // Consumer only
+} batch_ring;
+
+// One CSV source and the two stages that read it.
+typedef struct {
+    const char *name;
+    FILE *input;
+    const log_entry *settings;
+    const log_writer *writer;         // Only used to format entries
+    batch_ring lines;                 // Parser to compute
+    batch_ring entries;               // Compute to writer
+    long parse_skipped;               // Rows the parser rejected
+    long compute_skipped;             // Rows the compute stage rejected
+    int read_failed;
+    entry_batch *batch;               // Batch being merged by the writer
+    int index;                        // Next entry of batch
+} pipeline_source;
+
+
+/**
+ * wait_briefly - Backs off while a ring is full or empty: yields the CPU at first,
+ * then sleeps so a stalled stage does not burn a core.
+ */
+static void wait_briefly(int *spins){
+    if ((*spins)++ < PIPELINE_SPINS){
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+static int ring_init(batch_ring *ring, size_t slot_size, const atomic_int *cancelled){
+    memset(ring, 0, sizeof(*ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closed, 0);
+    ring->cancelled = cancelled;
+    ring->slot_size = slot_size;
+    ring->slots = malloc(slot_size * PIPELINE_RING_SLOTS);
+    return ring->slots != NULL ? 0 : -1;
+}
+
+/**
+ * ring_reserve - Producer: waits for a free slot.
+ *
+ * @return: The slot to fill, or NULL if the import was cancelled.
+ */
+static void *ring_reserve(batch_ring *ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= PIPELINE_RING_SLOTS){
+        if (atomic_load_explicit(ring->cancelled, memory_order_relaxed)){
+            return NULL;
+        }
+        ring->full_waits++;
+        wait_briefly(&spins);
+    }
+    return ring->slots + (tail & (PIPELINE_RING_SLOTS - 1)) * ring->slot_size;
+}
+
+/**
+ * ring_publish - Producer: hands the reserved slot to the consumer.
+ */
+static void ring_publish(batch_ring *ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void ring_close(batch_ring *ring){
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+/**
+ * ring_next - Consumer: waits for the next published slot.
+ *
+ * @return: The slot, or NULL once the producer has closed the ring and every slot
+ * has been consumed, or the import was cancelled.
+ */
+static void *ring_next(batch_ring *ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+    while (1){
+        // Read closed before tail so a close is never seen without the batches before it
+        int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head != tail){
+            ring->depth_total += (double)(tail - head);
+            ring->depth_samples++;
+            return ring->slots + (head & (PIPELINE_RING_SLOTS - 1)) * ring->slot_size;
+        }
+        if (closed || atomic_load_explicit(ring->cancelled, memory_order_relaxed)){
+            return NULL;
+        }
+        ring->empty_waits++;
+        wait_briefly(&spins);
+    }
+}
+
+/**
+ * ring_release - Consumer: hands the slot returned by ring_next back to the producer.
+ */
+static void ring_release(batch_ring *ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * parse_stage - Parser thread: reads rows, drops blank lines, the header and
+ * overlong lines, and hands the rest to the compute stage in batches.
+ */
+static void *parse_stage(void *argument){
+    pipeline_source *source = argument;
+    setvbuf(source->input, NULL, _IOFBF, PIPELINE_READ_BUFFER);
+
+    char line[IMPORT_LINE_MAX];
+    long line_number = 0;
+    line_batch *batch = NULL;
+
+    while (fgets(line, sizeof(line), source->input) != NULL){
+        line_number++;
+
+        if (strchr(line, '\n') == NULL && !feof(source->input)){
+            printf("%s:%ld: line too long, skipped\n", source->name, line_number);
+            source->parse_skipped++;
+            int c;
+            while ((c = fgetc(source->input)) != '\n' && c != EOF);
+            continue;
+        }
+
+        // Skip blank lines and a header row
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0' || (line_number == 1 && strncasecmp(start, "time", 4) == 0)){
+            continue;
+        }
+
+        if (batch == NULL){
+            batch = ring_reserve(&source->lines);
+            if (batch == NULL){
+                break;
+            }
+            batch->count = 0;
+            batch->used = 0;
+        }
+
+        size_t length = strlen(line) + 1;
+        memcpy(batch->text + batch->used, line, length);
+        batch->offsets[batch->count] = (int)batch->used;
+        batch->line_numbers[batch->count] = line_number;
+        batch->count++;
+        batch->used += length;
+
+        if (batch->count == PIPELINE_BATCH_ROWS || PIPELINE_BATCH_TEXT - batch->used < IMPORT_LINE_MAX){
+            ring_publish(&source->lines);
+            batch = NULL;
+        }
+    }
+
+    if (batch != NULL){
+        ring_publish(&source->lines);
+    }
+    if (ferror(source->input)){
+        perror("Error reading import file");
+        source->read_failed = 1;
+    }
+    ring_close(&source->lines);
+    instrument_thread_exit();
+    return NULL;
+}
+
+/**
+ * compute_stage - Compute thread: parses rows into entries, converting units and
+ * calculating doses, and formats them for the log in batches for the writer.
+ */
+static void *compute_stage(void *argument){
+    pipeline_source *source = argument;
+    entry_batch *batch = NULL;
+    int cancelled = 0;
+
+    line_batch *lines;
+    while (!cancelled && (lines = ring_next(&source->lines)) != NULL){
+        for (int i = 0; i < lines->count; i++){
+            log_entry entry;
+            time_t timestamp;
+            const char *error;
+            if (parse_import_row(lines->text + lines->offsets[i], source->settings, NULL, &entry, &timestamp, &error) != 0){
+                printf("%s:%ld: %s, skipped\n", source->name, lines->line_numbers[i], error);
+                source->compute_skipped++;
+                continue;
+            }
+
+            if (batch == NULL){
+                batch = ring_reserve(&source->entries);
+                if (batch == NULL){
+                    cancelled = 1;
+                    break;
+                }
+                batch->count = 0;
+                batch->offsets[0] = 0;
+            }
+
+            int used = batch->offsets[batch->count];
+            int length = log_writer_format(source->writer, &entry, timestamp,
+                                           batch->text + used, PIPELINE_BATCH_TEXT - used);
+            if (length < 0){
+                source->compute_skipped++;
+                continue;
+            }
+            batch->timestamps[batch->count] = timestamp;
+            batch->count++;
+            batch->offsets[batch->count] = used + length;
+
+            if (batch->count == PIPELINE_BATCH_ROWS || PIPELINE_BATCH_TEXT - (used + length) < LOG_ENTRY_MAX){
+                ring_publish(&source->entries);
+                batch = NULL;
+            }
+        }
+        ring_release(&source->lines);
+    }
+
+    if (batch != NULL && batch->count > 0){
+        ring_publish(&source->entries);
+    }
+    ring_close(&source->entries);
+    instrument_thread_exit();
+    return NULL;
+}
+
+/**
+ * merge_entries - Writer stage: appends the entries of every source in time order,
+ * taking the earliest waiting entry each time.
+ *
+ * @return: 0 for success, -1 if appending failed.
+ */
+static int merge_entries(pipeline_source *sources, int count, log_writer *writer, pipeline_stats *stats){
+    for (int i = 0; i < count; i++){
+        sources[i].batch = ring_next(&sources[i].entries);
+        sources[i].index = 0;
+    }
+
+    while (1){
+        pipeline_source *next = NULL;
+        for (int i = 0; i < count; i++){
+            pipeline_source *source = &sources[i];
+            if (source->batch != NULL &&
+                (next == NULL || source->batch->timestamps[source->index] < next->batch->timestamps[next->index])){
+                next = source;
+            }
+        }
+        if (next == NULL){
+            return 0;
+        }
+
+        entry_batch *batch = next->batch;
+        int start = batch->offsets[next->index];
+        size_t length = (size_t)(batch->offsets[next->index + 1] - start);
+        if (log_writer_append_formatted(writer, batch->text + start, length) != 0){
+            return -1;
+        }
+        stats->imported++;
+        stats->bytes_written += (long)length;
+
+        if (++next->index == batch->count){
+            ring_release(&next->entries);
+            next->batch = ring_next(&next->entries);
+            next->index = 0;
+        }
+    }
+}
+
+int pipeline_import(const char *const sources[], int count, log_writer *writer,
+                    const log_entry *settings, pipeline_stats *stats){
+    memset(stats, 0, sizeof(*stats));
+    if (count < 1 || count > PIPELINE_MAX_SOURCES){
+        printf("Error: between 1 and %d import sources can be given.\n", PIPELINE_MAX_SOURCES);
+        return -1;
+    }
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    atomic_int cancelled;
+    atomic_init(&cancelled, 0);
+    pipeline_source *pipeline = calloc((size_t)count, sizeof(pipeline_source));
+    pthread_t (*threads)[2] = calloc((size_t)count, sizeof(*threads));
+    if (pipeline == NULL || threads == NULL){
+        perror("Error starting import");
+        free(pipeline);
+        free(threads);
+        return -1;
+    }
+
+    // Open every source before starting, so a bad name imports nothing
+    int status = 0;
+    int opened = 0;
+    for (; opened < count; opened++){
+        pipeline_source *source = &pipeline[opened];
+        source->name = sources[opened];
+        source->settings = settings;
+        source->writer = writer;
+        source->input = strcmp(sources[opened], "-") == 0 ? stdin : fopen(sources[opened], "r");
+        if (source->input == NULL){
+            printf("Error opening import file %s: ", sources[opened]);
+            fflush(stdout);
+            perror(NULL);
+            status = -1;
+            break;
+        }
+        if (ring_init(&source->lines, sizeof(line_batch), &cancelled) != 0 ||
+            ring_init(&source->entries, sizeof(entry_batch), &cancelled) != 0){
+            perror("Error starting import");
+            opened++;
+            status = -1;
+            break;
+        }
+    }
+
+    int started_sources = 0;
+    if (status == 0){
+        for (; started_sources < count; started_sources++){
+            pipeline_source *source = &pipeline[started_sources];
+            if (pthread_create(&threads[started_sources][0], NULL, parse_stage, source) != 0){
+                break;
+            }
+            if (pthread_create(&threads[started_sources][1], NULL, compute_stage, source) != 0){
+                // Let the parser finish on its own: nothing will drain it, so cancel
+                atomic_store(&cancelled, 1);
+                pthread_join(threads[started_sources][0], NULL);
+                break;
+            }
+        }
+        if (started_sources < count){
+            printf("Error: could not start import threads.\n");
+            atomic_store(&cancelled, 1);
+            status = -1;
+        } else if (merge_entries(pipeline, count, writer, stats) != 0){
+            atomic_store(&cancelled, 1);
+            status = -1;
+        }
+    }
+
+    for (int i = 0; i < started_sources; i++){
+        pthread_join(threads[i][0], NULL);
+        pthread_join(threads[i][1], NULL);
+    }
+    if (log_writer_sync(writer) != 0){
+        status = -1;
+    }
+
+    long parse_samples = 0, write_samples = 0;
+    for (int i = 0; i < opened; i++){
+        pipeline_source *source = &pipeline[i];
+        if (source->read_failed){
+            status = -1;
+        }
+        stats->skipped += source->parse_skipped + source->compute_skipped;
+        stats->full_waits += source->lines.full_waits + source->entries.full_waits;
+        stats->empty_waits += source->lines.empty_waits + source->entries.empty_waits;
+        stats->parse_depth += source->lines.depth_total;
+        stats->write_depth += source->entries.depth_total;
+        parse_samples += source->lines.depth_samples;
+        write_samples += source->entries.depth_samples;
+
+        if (source->input != NULL && source->input != stdin){
+            fclose(source->input);
+        }
+        free(source->lines.slots);
+        free(source->entries.slots);
+    }
+    stats->sources = count;
+    stats->parse_depth = parse_samples > 0 ? stats->parse_depth / parse_samples : 0;
+    stats->write_depth = write_samples > 0 ? stats->write_depth / write_samples : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    stats->seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+    free(pipeline);
+    free(threads);
+    return status;
+}
+
+void display_pipeline_stats(const pipeline_stats *stats){
+    double seconds = stats->seconds > 0 ? stats->seconds : 1e-9;
+    printf("Imported %ld entries (%ld skipped) from %d sources in %.3f s (%.0f entries/s, %.1f MB/s).\n",
+           stats->imported, stats->skipped, stats->sources, stats->seconds,
+           stats->imported / seconds, stats->bytes_written / seconds / 1e6);
+    printf("Mean queue depth: %.2f batches parsed, %.2f batches formatted (of %d); "
+           "waits: %ld on full rings, %ld on empty rings.\n",
+           stats->parse_depth, stats->write_depth, PIPELINE_RING_SLOTS, stats->full_waits, stats->empty_waits);
+}
@@ -0,0 +1,63 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "logging.h"
+#include "log_writer.h"
+
+// Most CSV sources imported together
+#define PIPELINE_MAX_SOURCES 16
+
+// Batches each ring between two stages holds; a power of two
+#define PIPELINE_RING_SLOTS 8
+
+// Most rows handed between stages in one batch
+#define PIPELINE_BATCH_ROWS 256
+
+// Text held by one batch: CSV rows or formatted log entries
+#define PIPELINE_BATCH_TEXT 65536
+
+// Throughput and queue depths of a pipelined import.
+typedef struct {
+    int sources;                  // CSV sources imported
+    long imported;                // Entries appended to the log
+    long skipped;                 // Invalid rows
+    long bytes_written;           // Bytes appended to the log
+    double seconds;               // Wall clock time of the import
+    double parse_depth;           // Mean batches waiting between the parser and compute stages
+    double write_depth;           // Mean batches waiting between the compute and writer stages
+    long full_waits;              // Times a stage waited for room in a full ring (backpressure)
+    long empty_waits;             // Times a stage waited for an empty ring to fill
+} pipeline_stats;
+
+/**
+ * pipeline_import - Imports CSV rows from several sources, such as the exports of
+ * several devices, through a pipeline of threads. Each source has a parser thread
+ * that reads and splits rows and a compute thread that parses them with
+ * parse_import_row (unit conversion and dosage calculation) and formats the log
+ * entries. The calling thread merges the sources by entry time and appends them
+ * through the writer. Stages hand batches of rows to each other over bounded
+ * lock-free single-producer/single-consumer rings, and a stage waits when the next
+ * ring is full, so memory use stays bounded however fast the input is.
+ *
+ * Each source is expected to be in time order; the log then is too. Invalid rows
+ * are reported and skipped as import_csv does. Doses are calculated without insulin
+ * on board, since the compute threads run ahead of the entries written to the log.
+ *
+ * @param sources: CSV file names, or "-" for stdin.
+ * @param count: Number of sources, at most PIPELINE_MAX_SOURCES.
+ * @param writer: Open writer for the log.
+ * @param settings: Configured ratios, target and unit (from log_config).
+ * @param stats: Receives the throughput and queue depths.
+ * @return: 0 for success, -1 if reading or writing failed.
+ */
+int pipeline_import(const char *const sources[], int count, log_writer *writer,
+                    const log_entry *settings, pipeline_stats *stats);
+
+/**
+ * display_pipeline_stats - Prints the throughput and queue depths of a pipelined import.
+ *
+ * @param stats: The statistics to print.
+ */
+void display_pipeline_stats(const pipeline_stats *stats);
+
+#endif
@@ -0,0 +1,645 @@
+#include <stdio.h>
+#include "records.h"
+#include "logging.h"
+#include "calculations.h"
+#include "config.h"
+#include "log_index.h"
+#include "instrument.h"
+#include "log_scan.h"
+#include "local_time.h"
+#include "log_writer.h"
+#include "log_ids.h"
+#include "log_edit.h"
+#include "crc32c.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of records read per fread call when scanning
+#define RECORD_BATCH 256
+
+_Static_assert(sizeof(log_record) == 64, "log_record must stay 64 bytes");
+
+
+int is_binary_log(const char *filename){
+    size_t length = strlen(filename);
+    return length >= 4 && strcmp(filename + length - 4, ".dat") == 0;
+}
+
+int entry_type_code(const char *entry_type){
+    if (strcmp(entry_type, "meal") == 0){
+        return ENTRY_TYPE_MEAL;
+    } else if (strcmp(entry_type, "snack") == 0){
+        return ENTRY_TYPE_SNACK;
+    } else if (strcmp(entry_type, "correction") == 0){
+        return ENTRY_TYPE_CORRECTION;
+    }
+    return ENTRY_TYPE_OTHER;
+}
+
+const char *entry_type_name(int code){
+    switch (code) {
+        case ENTRY_TYPE_MEAL: return "meal";
+        case ENTRY_TYPE_SNACK: return "snack";
+        case ENTRY_TYPE_CORRECTION: return "correction";
+        default: return "other";
+    }
+}
+
+void entry_to_record(const log_entry *entry, time_t timestamp, log_record *record){
+    memset(record, 0, sizeof(*record));
+    record->timestamp = (int64_t)timestamp;
+    record->blood_glucose_level = entry->blood_glucose_level;
+    record->target_blood_glucose = entry->target_blood_glucose;
+    record->meal_time_carbs = entry->meal_time_carbs;
+    record->carb_ratio = entry->carb_ratio;
+    record->correction_dosage = entry->correction_dosage;
+    record->insulin_dosage = entry->insulin_dosage;
+    record->correction_factor = entry->correction_factor;
+    record->entry_type = (uint16_t)entry_type_code(entry->entry_type);
+    if (entry->insulin_on_board_flag){
+        record->insulin_on_board = entry->insulin_on_board;
+        record->flags |= RECORD_FLAG_INSULIN_ON_BOARD;
+    }
+
+    if (entry->blood_glucose_level_flag) record->flags |= RECORD_FLAG_BLOOD_GLUCOSE;
+    if (entry->target_blood_glucose_flag) record->flags |= RECORD_FLAG_TARGET;
+    if (entry->meal_time_carbs_flag) record->flags |= RECORD_FLAG_CARBS;
+    if (entry->correction_dosage_flag) record->flags |= RECORD_FLAG_CORRECTION;
+    if (entry->insulin_dosage_flag) record->flags |= RECORD_FLAG_INSULIN;
+}
+
+void record_to_entry(const log_record *record, log_entry *entry){
+    memset(entry, 0, sizeof(*entry));
+    entry->blood_glucose_level = record->blood_glucose_level;
+    entry->target_blood_glucose = record->target_blood_glucose;
+    entry->meal_time_carbs = record->meal_time_carbs;
+    entry->carb_ratio = record->carb_ratio;
+    entry->correction_dosage = record->correction_dosage;
+    entry->insulin_dosage = record->insulin_dosage;
+    entry->correction_factor = record->correction_factor;
+    strncpy(entry->entry_type, entry_type_name(record->entry_type), sizeof(entry->entry_type) - 1);
+
+    entry->blood_glucose_level_flag = (record->flags & RECORD_FLAG_BLOOD_GLUCOSE) != 0;
+    entry->target_blood_glucose_flag = (record->flags & RECORD_FLAG_TARGET) != 0;
+    entry->meal_time_carbs_flag = (record->flags & RECORD_FLAG_CARBS) != 0;
+    entry->correction_dosage_flag = (record->flags & RECORD_FLAG_CORRECTION) != 0;
+    entry->insulin_dosage_flag = (record->flags & RECORD_FLAG_INSULIN) != 0;
+    entry->insulin_on_board = record->insulin_on_board;
+    entry->insulin_on_board_flag = (record->flags & RECORD_FLAG_INSULIN_ON_BOARD) != 0;
+}
+
+uint32_t record_checksum(const log_record *record){
+    // The checksum member is skipped, which is the same as taking it as zero
+    static const uint8_t zero[sizeof(record->checksum)];
+    uint32_t crc = crc32c(0, record, offsetof(log_record, checksum));
+    crc = crc32c(crc, zero, sizeof(zero));
+    return crc32c(crc, &record->insulin_on_board, sizeof(record->insulin_on_board));
+}
+
+void seal_record(log_record *record){
+    record->flags |= RECORD_FLAG_CHECKSUM;
+    record->checksum = record_checksum(record);
+}
+
+int record_intact(const log_record *record){
+    return !(record->flags & RECORD_FLAG_CHECKSUM) || record->checksum == record_checksum(record);
+}
+
+/**
+ * init_record_header - Fills in the header for a new binary log.
+ */
+static void init_record_header(record_header *header){
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    header->version = RECORD_VERSION;
+    header->record_size = sizeof(log_record);
+}
+
+/**
+ * write_record_header - Writes the binary log header at the current position.
+ */
+static int write_record_header(FILE *file){
+    record_header header;
+    init_record_header(&header);
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1){
+        perror("Error writing binary log header");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * validate_record_header - Checks the magic and version of a binary log header.
+ */
+static int validate_record_header(const record_header *header, const char *filename){
+    if (strncmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) != 0){
+        printf("Error: %s is not a binary log file.\n", filename);
+        return -1;
+    }
+    if (header->version != RECORD_VERSION || header->record_size != sizeof(log_record)){
+        printf("Error: %s uses unsupported record format version %u.\n", filename, header->version);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * check_record_header - Reads the header at the current position and validates it.
+ */
+static int check_record_header(FILE *file, const char *filename){
+    record_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1){
+        printf("Error: %s is not a binary log file.\n", filename);
+        return -1;
+    }
+    return validate_record_header(&header, filename);
+}
+
+int prepare_record_fd(int fd, const char *filename){
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0){
+        perror("Error reading binary log");
+        return -1;
+    }
+
+    record_header header;
+    if (file_stat.st_size == 0){
+        init_record_header(&header);
+        if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)){
+            perror("Error writing binary log header");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)){
+        printf("Error: %s is not a binary log file.\n", filename);
+        return -1;
+    }
+    return validate_record_header(&header, filename);
+}
+
+FILE *open_record_file(const char *filename, const char *mode){
+    FILE *file = fopen(filename, mode);
+    if (file == NULL) {
+        perror("Error opening file");
+        return NULL;
+    }
+    if (check_record_header(file, filename) != 0){
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int record_append(const char *filename, const log_entry *entry, time_t timestamp){
+    uint64_t start = probe_begin();
+
+    // log_append gives new files a header and checks the header of existing ones
+    log_record record;
+    entry_to_record(entry, timestamp, &record);
+    seal_record(&record);
+    if (log_append(filename, (const char *)&record, sizeof(record)) != 0){
+        return -1;
+    }
+    probe_end(PROBE_LOG_APPEND, start, sizeof(record));
+    return 0;
+}
+
+/**
+ * record_lines - Works out which lines the text log holds for an entry, so records are
+ * shown like the equivalent text entry.
+ */
+static int record_lines(const log_entry *entry){
+    int lines = 0;
+    if (entry->blood_glucose_level_flag){
+        lines |= SCAN_LINE_BLOOD_GLUCOSE;
+    }
+    if (entry->target_blood_glucose_flag){
+        lines |= SCAN_LINE_TARGET;
+    }
+    if (entry->meal_time_carbs_flag){
+        lines |= SCAN_LINE_CARBS;
+    }
+    if (entry->correction_dosage_flag){
+        lines |= SCAN_LINE_CORRECTION_FACTOR | SCAN_LINE_CORRECTION_DOSAGE;
+    }
+    if (entry->insulin_on_board_flag){
+        lines |= SCAN_LINE_INSULIN_ON_BOARD;
+    }
+    if (entry->insulin_dosage_flag){
+        lines |= SCAN_LINE_TOTAL_DOSAGE | SCAN_LINE_TYPE;
+    }
+    if (entry->blood_glucose_level_flag && (!entry->correction_dosage_flag && !entry->meal_time_carbs_flag)){
+        lines |= SCAN_LINE_TYPE;
+    }
+    return lines;
+}
+
+void display_record(report *r, const log_record *record, int64_t id, int edited){
+    uint64_t start = probe_begin();
+    log_entry entry;
+    record_to_entry(record, &entry);
+    report_entry_timestamp(r, (time_t)record->timestamp, id, edited);
+    report_entry_lines(r, record_lines(&entry), &entry);
+    probe_end(PROBE_RENDER, start, 0);
+}
+
+/**
+ * display_latest - Renders the latest version of the entry a record logged, under the
+ * record's time, if it is on the report's page. Edits and tombstones, and entries since
+ * deleted, show nothing; a damaged record shows a note, and an entry whose edit is
+ * damaged shows as logged.
+ *
+ * @param fd: The log, open for reading, to read edits from.
+ * @param offset: Offset of the record in the log.
+ * @param hint: Slot of the entry printed before, updated for the next call.
+ */
+static void display_latest(report *r, const log_ids *ids, int fd, const log_record *record,
+                           int64_t offset, int64_t *hint){
+    if (record->flags & RECORD_FLAG_REVISION){
+        return;
+    }
+    if (!record_intact(record)){
+        if (report_next(r)){
+            static const char note[] = "\nSkipped a damaged log entry; run --verify for details.\n";
+            report_write(r, note, sizeof(note) - 1);
+        }
+        return;
+    }
+    int64_t current;
+    int64_t id = log_ids_latest(ids, offset, hint, &current);
+    log_record edit;
+    if (id == LOG_ID_DELETED || !report_next(r)){
+        return;
+    } else if (current != offset &&
+               pread(fd, &edit, sizeof(edit), (off_t)current) == (ssize_t)sizeof(edit) && record_intact(&edit)){
+        edit.timestamp = record->timestamp;
+        display_record(r, &edit, id, 1);
+    } else {
+        display_record(r, record, id, 0);
+    }
+}
+
+// Records of a binary log split into chunks for a parallel scan
+typedef struct {
+    const log_record *records;
+    size_t count;
+    size_t per_chunk;             // Records in every chunk but the last
+    long offset;                  // Offset of records[0] in the log
+    time_t start_time;
+    const char *preffered_unit;
+    const log_ids *ids;
+    int fd;                       // The log, for reading edits
+} chunked_records;
+
+/**
+ * render_record_chunk - Renders the records of one chunk that fall within the time window.
+ */
+static int render_record_chunk(size_t chunk, FILE *out, void *context){
+    const chunked_records *job = context;
+    size_t first = chunk * job->per_chunk;
+    size_t last = first + job->per_chunk < job->count ? first + job->per_chunk : job->count;
+    report chunk_report;
+    if (report_open(&chunk_report, out, job->preffered_unit, NULL) != 0){
+        return -1;
+    }
+    int64_t hint = -1;
+    for (size_t i = first; i < last; i++){
+        if (job->records[i].timestamp >= (int64_t)job->start_time){
+            display_latest(&chunk_report, job->ids, job->fd, &job->records[i],
+                           job->offset + (int64_t)(i * sizeof(log_record)), &hint);
+        }
+    }
+    return report_close(&chunk_report);
+}
+
+/**
+ * read_records_parallel - Renders the records from an offset to the end of a binary log
+ * in chunks of about QUERY_CHUNK_BYTES on several threads, in file order.
+ *
+ * @return: Bytes scanned, or -1 for errors.
+ */
+static long read_records_parallel(FILE *out, const char *filename, long offset, int threads,
+                                  time_t start_time, const char *preffered_unit,
+                                  const log_ids *ids, int fd){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+
+    chunked_records job;
+    job.records = (const log_record *)(map.data + offset);
+    job.count = (map.size - (size_t)offset) / sizeof(log_record);
+    job.per_chunk = QUERY_CHUNK_BYTES / sizeof(log_record);
+    job.offset = offset;
+    job.start_time = start_time;
+    job.preffered_unit = preffered_unit;
+    job.ids = ids;
+    job.fd = fd;
+
+    size_t chunks = (job.count + job.per_chunk - 1) / job.per_chunk;
+    int status = render_chunks(out, chunks, threads, render_record_chunk, &job);
+    log_map_close(&map);
+    return status == 0 ? (long)(job.count * sizeof(log_record)) : -1;
+}
+
+/**
+ * read_records_page - Renders a page of a binary log, newest first: the records are
+ * read from the end of the log backwards until the page is full.
+ *
+ * @param offset: Offset before which no record is in the window.
+ * @return: Bytes scanned, or -1 for errors.
+ */
+static long read_records_page(report *r, const char *filename, long offset, time_t start_time,
+                              const log_ids *ids, int fd){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+
+    const log_record *records = (const log_record *)(map.data + offset);
+    size_t count = (map.size - (size_t)offset) / sizeof(log_record);
+    size_t i = count;
+    int64_t hint = -1;
+    while (i > 0 && !report_done(r)){
+        i--;
+        if (records[i].timestamp >= (int64_t)start_time){
+            display_latest(r, ids, fd, &records[i], offset + (int64_t)(i * sizeof(log_record)), &hint);
+        }
+    }
+    log_map_close(&map);
+    return (long)((count - i) * sizeof(log_record));
+}
+
+int read_records(FILE *out, const char *filename, const char *time_filter, const log_page *page){
+    uint64_t query_start = probe_begin();
+    time_t start_time = 0;
+    if (time_filter_start(time_filter, &start_time) != 0){
+        return -1;
+    }
+
+    FILE *file = open_record_file(filename, "rb");
+    if (file == NULL){
+        return -1;
+    }
+
+    // Skip straight to the first block that can hold records in the window
+    long offset = log_index_seek(filename, start_time);
+    if (offset > 0){
+        fseek(file, offset, SEEK_SET);
+    }
+
+    const char *preffered_unit = read_config("blood glucose unit"); //gets user's preffered unit
+    report output;
+    if (report_open(&output, out, preffered_unit, page) != 0){
+        fclose(file);
+        return -1;
+    }
+
+    // Entries are shown in their latest version; without the ID file they are shown as logged
+    log_ids ids;
+    log_ids_open(&ids, filename);
+
+    // Pages are read from the end; large ranges in log order are rendered in chunks on several threads
+    struct stat log_stat;
+    long position = ftell(file);
+    int threads = get_query_threads();
+    long scanned = -1;
+    if (page != NULL){
+        scanned = read_records_page(&output, filename, position, start_time, &ids, fileno(file));
+    } else if (threads > 1 && position > 0 && fstat(fileno(file), &log_stat) == 0 &&
+               log_stat.st_size - position >= 2 * QUERY_CHUNK_BYTES){
+        scanned = read_records_parallel(out, filename, position, threads, start_time, preffered_unit,
+                                        &ids, fileno(file));
+    } else {
+        log_record records[RECORD_BATCH];
+        size_t count;
+        int64_t hint = -1;
+        scanned = 0;
+        while ((count = fread(records, sizeof(log_record), RECORD_BATCH, file)) > 0){
+            for (size_t i = 0; i < count; i++){
+                if (records[i].timestamp >= (int64_t)start_time){
+                    display_latest(&output, &ids, fileno(file), &records[i],
+                                   position + (int64_t)(scanned + (long)(i * sizeof(log_record))), &hint);
+                }
+            }
+            scanned += (long)(count * sizeof(log_record));
+        }
+    }
+
+    int status = report_close(&output) == 0 && scanned >= 0 ? 0 : -1;
+    fclose(file);
+    log_ids_close(&ids);
+    probe_end(PROBE_QUERY, query_start, scanned > 0 ? (uint64_t)scanned : 0);
+    return status;
+}
+
+/**
+ * finish_converted_entry - Writes the entry collected so far by convert_text_log.
+ */
+static int finish_converted_entry(FILE *out, const log_entry *entry, time_t timestamp, int64_t id, int *converted){
+    log_record record;
+    entry_to_record(entry, timestamp, &record);
+    record.id = id;
+    seal_record(&record);
+    if (fwrite(&record, sizeof(record), 1, out) != 1){
+        perror("Error writing record to binary log");
+        return -1;
+    }
+    (*converted)++;
+    return 0;
+}
+
+int convert_text_log(const char *text_filename, const char *binary_filename){
+    // Fold in edits and deletions first, so every entry is converted in its latest version
+    long folded;
+    if (access(text_filename, F_OK) == 0 && log_compact(text_filename, &folded) != 0){
+        return -1;
+    }
+
+    FILE *in = fopen(text_filename, "r");
+    if (in == NULL){
+        perror("Error opening text log");
+        return -1;
+    }
+
+    // Refuse to overwrite an existing log
+    FILE *existing = fopen(binary_filename, "rb");
+    if (existing != NULL){
+        fclose(existing);
+        printf("Error: %s already exists.\n", binary_filename);
+        fclose(in);
+        return -1;
+    }
+
+    FILE *out = fopen(binary_filename, "wb");
+    if (out == NULL){
+        perror("Error creating binary log");
+        fclose(in);
+        return -1;
+    }
+
+    if (write_record_header(out) != 0){
+        fclose(in);
+        fclose(out);
+        return -1;
+    }
+
+    log_entry entry = {0};
+    time_t timestamp = 0;
+    int64_t id = 0;     // ID written on the entry's time line, if any
+    int in_entry = 0;   // Set while collecting lines for a valid entry
+    int converted = 0;
+    int skipped = 0;
+    int status = 0;
+
+    char line[256];
+    while (status == 0 && fgets(line, sizeof(line), in)) {
+        if (strncmp(line, "Log Entry Time:", 15) == 0) {
+            if (in_entry){
+                status = finish_converted_entry(out, &entry, timestamp, id, &converted);
+            }
+
+            int year, month, day, hour, minute, second;
+            long long epoch;
+            long long written_id = 0;
+            int fields = sscanf(line, "Log Entry Time: %d-%d-%d %d:%d:%d @%lld #%lld",
+                                &year, &month, &day, &hour, &minute, &second, &epoch, &written_id);
+            if (fields >= 6) {
+                // Entries written before the epoch was added are read in local time
+                timestamp = fields >= 7 ? (time_t)epoch : local_time_to_epoch(year, month, day, hour, minute, second);
+                id = fields == 8 ? (int64_t)written_id : 0;
+                memset(&entry, 0, sizeof(entry));
+                in_entry = 1;
+            } else {
+                printf("Error parsing log entry time: %s\n", line);
+                in_entry = 0;
+                skipped++;
+            }
+        } else if (strncmp(line, "Log Entry ", 10) == 0) {
+            if (in_entry){
+                status = finish_converted_entry(out, &entry, timestamp, id, &converted);
+            }
+            in_entry = 0;
+
+            // All compaction leaves is the tombstone keeping the IDs of deleted entries given out
+            long long last_id, epoch;
+            if (status == 0 && sscanf(line, "Log Entry Deleted: #%lld %*d-%*d-%*d %*d:%*d:%*d @%lld replacing -1",
+                                      &last_id, &epoch) == 2){
+                log_record tombstone;
+                format_revision((char *)&tombstone, sizeof(tombstone), 1, (int64_t)last_id, (time_t)epoch, -1, NULL);
+                if (fwrite(&tombstone, sizeof(tombstone), 1, out) != 1){
+                    perror("Error writing record to binary log");
+                    status = -1;
+                }
+            }
+        } else if (in_entry){
+            if (sscanf(line, "Blood Glucose: %f mmol/L", &entry.blood_glucose_level) == 1) {
+                entry.blood_glucose_level_flag = 1;
+            } else if (sscanf(line, "Target: %f mmol/L", &entry.target_blood_glucose) == 1) {
+                entry.target_blood_glucose_flag = 1;
+            } else if (sscanf(line, "Carbs: %f g, Carb Ratio: %f/unit",
+                              &entry.meal_time_carbs, &entry.carb_ratio) == 2) {
+                entry.meal_time_carbs_flag = 1;
+            } else if (sscanf(line, "Correction Factor: %d mmol/L/unit", &entry.correction_factor) == 1) {
+                entry.correction_dosage_flag = 1;
+            } else if (sscanf(line, "Correction Dosage: %f units", &entry.correction_dosage) == 1) {
+                entry.correction_dosage_flag = 1;
+            } else if (sscanf(line, "Insulin On Board: %f units", &entry.insulin_on_board) == 1) {
+                entry.insulin_on_board_flag = 1;
+            } else if (sscanf(line, "Total Insulin Dosage: %f units", &entry.insulin_dosage) == 1) {
+                entry.insulin_dosage_flag = 1;
+            } else if (strncmp(line, "Type:", 5) == 0) {
+                sscanf(line, "Type: %19[^\n]", entry.entry_type);
+            }
+        }
+    }
+
+    if (status == 0 && in_entry){
+        status = finish_converted_entry(out, &entry, timestamp, id, &converted);
+    }
+
+    fclose(in);
+    if (fclose(out) != 0){
+        perror("Error closing binary log");
+        status = -1;
+    }
+
+    if (status == 0){
+        printf("Converted %d entries from %s to %s", converted, text_filename, binary_filename);
+        if (skipped > 0){
+            printf(" (%d entries skipped)", skipped);
+        }
+        printf(".\n");
+    }
+    return status;
+}
+
+int export_binary_log(const char *binary_filename, const char *text_filename){
+    // Fold in edits and deletions first, so every entry is exported in its latest version
+    long folded;
+    if (access(binary_filename, F_OK) == 0 && log_compact(binary_filename, &folded) != 0){
+        return -1;
+    }
+
+    FILE *in = open_record_file(binary_filename, "rb");
+    if (in == NULL){
+        return -1;
+    }
+
+    FILE *out = fopen(text_filename, "w");
+    if (out == NULL){
+        perror("Error creating text log");
+        fclose(in);
+        return -1;
+    }
+
+    int exported = 0;
+    int status = 0;
+    log_record records[RECORD_BATCH];
+    size_t count;
+    while (status == 0 && (count = fread(records, sizeof(log_record), RECORD_BATCH, in)) > 0){
+        for (size_t i = 0; i < count && status == 0; i++){
+            const log_record *record = &records[i];
+            char line[LOG_ENTRY_MAX];
+            int length;
+            if (record->flags & RECORD_FLAG_REVISION){
+                // All compaction leaves is the tombstone keeping the IDs of deleted entries given out
+                if (record->replaces < 0){
+                    length = format_revision(line, sizeof(line), 0, record->id, (time_t)record->timestamp, -1, NULL);
+                    if (length < 0 || fputs(line, out) < 0){
+                        status = -1;
+                    }
+                }
+                continue;
+            }
+
+            // An ID written on the record goes on the end of the time line
+            log_entry entry;
+            record_to_entry(record, &entry);
+            length = format_numbered_entry(line, sizeof(line), &entry, (time_t)record->timestamp, record->id);
+            if (length < 0 || (size_t)length >= sizeof(line) || fputs(line, out) < 0){
+                perror("Error writing text log");
+                status = -1;
+            } else {
+                exported++;
+            }
+        }
+    }
+
+    fclose(in);
+    if (fclose(out) != 0){
+        perror("Error closing text log");
+        status = -1;
+    }
+
+    if (status == 0){
+        printf("Exported %d entries from %s to %s.\n", exported, binary_filename, text_filename);
+    }
+    return status;
+}
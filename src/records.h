@@ -0,0 +1,200 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "logging.h"
+#include "report.h"
+
+// Binary log files start with this magic followed by the format version and record size.
+#define RECORD_MAGIC "DMSLOGB"
+#define RECORD_VERSION 1
+
+// Entry type codes stored in binary records
+#define ENTRY_TYPE_OTHER 0
+#define ENTRY_TYPE_MEAL 1
+#define ENTRY_TYPE_SNACK 2
+#define ENTRY_TYPE_CORRECTION 3
+
+// Flag bits mirroring the *_flag members of log_entry
+#define RECORD_FLAG_BLOOD_GLUCOSE 0x01
+#define RECORD_FLAG_TARGET 0x02
+#define RECORD_FLAG_CARBS 0x04
+#define RECORD_FLAG_CORRECTION 0x08
+#define RECORD_FLAG_INSULIN 0x10
+
+// Records that revise an earlier entry rather than log a new one
+#define RECORD_FLAG_EDIT 0x20         // New values for entry id
+#define RECORD_FLAG_DELETED 0x40      // A tombstone for entry id
+#define RECORD_FLAG_REVISION (RECORD_FLAG_EDIT | RECORD_FLAG_DELETED)
+
+// Set on records that carry a checksum; records written before checksums were added have none
+#define RECORD_FLAG_CHECKSUM 0x80
+
+// Set on records that carry the insulin on board their dose was suggested against
+#define RECORD_FLAG_INSULIN_ON_BOARD 0x100
+
+// Header at the start of every binary log file.
+typedef struct {
+    char magic[8];                // RECORD_MAGIC, null terminated
+    uint32_t version;             // RECORD_VERSION
+    uint32_t record_size;         // sizeof(log_record)
+} record_header;
+
+// Fixed-size binary log record. Glucose values are stored in mmol/L like the text log.
+typedef struct {
+    int64_t timestamp;            // Seconds since the epoch (UTC)
+    float blood_glucose_level;    // Glucose level in mmol/L
+    float target_blood_glucose;   // Target blood glucose level in mmol/L
+    float meal_time_carbs;        // Total carbohydrates in grams
+    float carb_ratio;             // Carbohydrate to insulin ratio in g/unit
+    float correction_dosage;      // Correction dosage in units
+    float insulin_dosage;         // Total insulin dosage in units
+    int32_t correction_factor;    // Correction factor in mmol/L/unit
+    uint16_t entry_type;          // One of the ENTRY_TYPE_* codes
+    uint16_t flags;               // RECORD_FLAG_* bits for the members that are set
+    int64_t id;                   // Entry ID; 0 for one more than the entry before's. For edits
+                                  // and tombstones, the entry they revise
+    int64_t replaces;             // Edits and tombstones: offset of the version they replace, -1 for none
+    uint32_t checksum;            // CRC-32C of the record with this member zeroed, if RECORD_FLAG_CHECKSUM is set
+    float insulin_on_board;       // Insulin still active from earlier doses in units, if
+                                  // RECORD_FLAG_INSULIN_ON_BOARD is set; zeroed otherwise
+} log_record;
+
+/**
+ * is_binary_log - Checks whether a log file uses the binary record format.
+ * Binary logs are identified by the ".dat" extension.
+ *
+ * @param filename: Name of the log file.
+ * @return: 1 if the file is a binary log, 0 otherwise.
+ */
+int is_binary_log(const char *filename);
+
+/**
+ * entry_type_code - Maps an entry type name to its record code.
+ *
+ * @param entry_type: Entry type name ("meal", "snack", "correction" or "other").
+ * @return: The ENTRY_TYPE_* code; ENTRY_TYPE_OTHER for unknown names.
+ */
+int entry_type_code(const char *entry_type);
+
+/**
+ * entry_type_name - Maps a record code back to its entry type name.
+ *
+ * @param code: One of the ENTRY_TYPE_* codes.
+ * @return: The entry type name.
+ */
+const char *entry_type_name(int code);
+
+/**
+ * entry_to_record - Packs a log entry into a binary record.
+ *
+ * @param entry: The log entry to pack.
+ * @param timestamp: Time of the entry.
+ * @param record: Receives the packed record.
+ */
+void entry_to_record(const log_entry *entry, time_t timestamp, log_record *record);
+
+/**
+ * record_to_entry - Unpacks a binary record into a log entry.
+ *
+ * @param record: The record to unpack.
+ * @param entry: Receives the log entry data and flags.
+ */
+void record_to_entry(const log_record *record, log_entry *entry);
+
+/**
+ * seal_record - Sets a record's checksum. Done last, once every other member is set.
+ *
+ * @param record: The record to seal.
+ */
+void seal_record(log_record *record);
+
+/**
+ * record_intact - Checks a record against its checksum.
+ *
+ * @param record: The record to check.
+ * @return: 1 if the record matches its checksum or has none, 0 if it is damaged.
+ */
+int record_intact(const log_record *record);
+
+/**
+ * record_checksum - Computes the checksum a record should carry.
+ *
+ * @param record: The record.
+ * @return: CRC-32C of the record with its checksum member taken as zero.
+ */
+uint32_t record_checksum(const log_record *record);
+
+/**
+ * open_record_file - Opens a binary log and checks its header.
+ * The file is positioned at the first record on success.
+ *
+ * @param filename: Name of the binary log.
+ * @param mode: fopen mode, "rb" or "r+b".
+ * @return: The open file, or NULL if it cannot be opened or is not a binary log.
+ */
+FILE *open_record_file(const char *filename, const char *mode);
+
+/**
+ * prepare_record_fd - Readies a binary log opened with open() for appending.
+ * Writes the header to an empty file, otherwise checks the existing header.
+ *
+ * @param fd: File descriptor opened for reading and appending.
+ * @param filename: Name of the binary log, for error messages.
+ * @return: 0 for success, -1 for errors.
+ */
+int prepare_record_fd(int fd, const char *filename);
+
+/**
+ * record_append - Appends one entry to a binary log, creating the file if needed.
+ *
+ * @param filename: Name of the binary log.
+ * @param entry: The log entry to append.
+ * @param timestamp: Time of the entry.
+ * @return: 0 for success, -1 for errors.
+ */
+int record_append(const char *filename, const log_entry *entry, time_t timestamp);
+
+/**
+ * display_record - Renders a record in the same layout read_logs uses for text entries.
+ *
+ * @param r: Report to render into.
+ * @param record: The record to render.
+ * @param id: The entry's ID, or 0 if it is not known.
+ * @param edited: Non-zero if the record is an edited version of the entry.
+ */
+void display_record(report *r, const log_record *record, int64_t id, int edited);
+
+/**
+ * read_records - Displays the entries of a binary log within a time filter.
+ * Output matches read_logs for the equivalent text log.
+ *
+ * @param out: Stream to print to.
+ * @param filename: Name of the binary log.
+ * @param time_filter: The time filter; "day", "week", "2 weeks" or "month".
+ * @param page: The page to show, newest first, or NULL to show every entry in log order.
+ * @return: 0 for success, -1 for errors.
+ */
+int read_records(FILE *out, const char *filename, const char *time_filter, const log_page *page);
+
+/**
+ * convert_text_log - Migrates a text log into a new binary log.
+ *
+ * @param text_filename: The existing text log.
+ * @param binary_filename: The binary log to create; must not exist yet.
+ * @return: 0 for success, -1 for errors.
+ */
+int convert_text_log(const char *text_filename, const char *binary_filename);
+
+/**
+ * export_binary_log - Writes the entries of a binary log out in the text log format.
+ *
+ * @param binary_filename: The binary log to export.
+ * @param text_filename: The text file to write.
+ * @return: 0 for success, -1 for errors.
+ */
+int export_binary_log(const char *binary_filename, const char *text_filename);
+
+#endif
@@ -0,0 +1,252 @@
+#include "report.h"
+#include "log_scan.h"
+#include "local_time.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Copies a string literal into the buffer at p and moves p past it
+#define PUT_LITERAL(p, text) (memcpy((p), (text), sizeof(text) - 1), (p) += sizeof(text) - 1)
+
+int report_open(report *r, FILE *out, const char *preffered_unit, const log_page *page){
+    memset(r, 0, sizeof(*r));
+    r->buffer = malloc(REPORT_BUFFER_SIZE);
+    if (r->buffer == NULL){
+        perror("Error starting log report");
+        return -1;
+    }
+    r->out = out;
+
+    // The unit is compared once here rather than for every value shown
+    r->unit = preffered_unit != NULL ? preffered_unit : "mmol/L";
+    r->unit_length = strlen(r->unit);
+    r->glucose_scale = strcmp(r->unit, "mg/dL") == 0 ? 18.018 : 1.0;
+
+    r->skip = page != NULL ? page->offset : 0;
+    r->remaining = page != NULL && page->limit > 0 ? page->limit : -1;
+    return 0;
+}
+
+int report_next(report *r){
+    if (r->skip > 0){
+        r->skip--;
+        return 0;
+    }
+    if (r->remaining == 0){
+        return 0;
+    }
+    if (r->remaining > 0){
+        r->remaining--;
+    }
+    return 1;
+}
+
+void report_skip(report *r, long count){
+    r->skip -= count;
+}
+
+int report_done(const report *r){
+    return r->remaining == 0;
+}
+
+/**
+ * flush_report - Writes the buffered output to the stream.
+ */
+static void flush_report(report *r){
+    if (r->length > 0 && !r->failed && fwrite(r->buffer, 1, r->length, r->out) != r->length){
+        perror("Error writing log report");
+        r->failed = 1;
+    }
+    r->length = 0;
+}
+
+/**
+ * reserve - Makes room for size bytes at the end of the buffer and returns where they start.
+ */
+static char *reserve(report *r, size_t size){
+    if (REPORT_BUFFER_SIZE - r->length < size){
+        flush_report(r);
+    }
+    return r->buffer + r->length;
+}
+
+/**
+ * put_unsigned - Writes an integer in decimal and returns the end.
+ */
+static char *put_unsigned(char *p, uint64_t value){
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0){
+        *p++ = digits[--count];
+    }
+    return p;
+}
+
+/**
+ * put_integer - Writes a signed integer in decimal, as %lld, and returns the end.
+ */
+static char *put_integer(char *p, int64_t value){
+    if (value < 0){
+        *p++ = '-';
+        return put_unsigned(p, -(uint64_t)value);
+    }
+    return put_unsigned(p, (uint64_t)value);
+}
+
+/**
+ * put_two_digits - Writes a date or time field from 0 to 99, as %02d, and returns the end.
+ */
+static char *put_two_digits(char *p, int value){
+    *p++ = (char)('0' + value / 10);
+    *p++ = (char)('0' + value % 10);
+    return p;
+}
+
+/**
+ * put_hundredths - Writes a value with two decimals, exactly as printf's %.2f would, and
+ * returns the end. A float times 100 is exact in a double, and rint rounds halves to
+ * even like printf, so only values too large for an integer go through snprintf.
+ */
+static char *put_hundredths(char *p, float value){
+    double scaled = (double)value * 100.0;
+    if (!(fabs(scaled) < 1e18)){
+        return p + snprintf(p, REPORT_LINE_MAX / 4, "%.2f", value);
+    }
+    if (signbit(scaled)){
+        *p++ = '-';
+        scaled = -scaled;
+    }
+    uint64_t hundredths = (uint64_t)rint(scaled);
+    p = put_unsigned(p, hundredths / 100);
+    *p++ = '.';
+    return put_two_digits(p, (int)(hundredths % 100));
+}
+
+/**
+ * put_glucose - Writes a glucose value in the display unit, followed by the unit.
+ */
+static char *put_glucose(const report *r, char *p, float mmol_l){
+    p = put_hundredths(p, (float)(mmol_l * r->glucose_scale));
+    *p++ = ' ';
+    memcpy(p, r->unit, r->unit_length);
+    return p + r->unit_length;
+}
+
+/**
+ * put_entry_id - Writes the ID shown after an entry's time, if it has one, and the end of the line.
+ */
+static char *put_entry_id(char *p, int64_t id, int edited){
+    if (id > 0){
+        PUT_LITERAL(p, " (#");
+        p = put_integer(p, id);
+        if (edited){
+            PUT_LITERAL(p, ", edited");
+        }
+        *p++ = ')';
+    }
+    *p++ = '\n';
+    return p;
+}
+
+void report_write(report *r, const char *text, size_t length){
+    if (length > REPORT_BUFFER_SIZE - r->length){
+        flush_report(r);
+        if (length > REPORT_BUFFER_SIZE){
+            if (!r->failed && fwrite(text, 1, length, r->out) != length){
+                perror("Error writing log report");
+                r->failed = 1;
+            }
+            return;
+        }
+    }
+    memcpy(r->buffer + r->length, text, length);
+    r->length += length;
+}
+
+void report_entry_time(report *r, const char *time_line, size_t length, int64_t id, int edited){
+    report_write(r, "\n", 1);
+    report_write(r, time_line, length);
+    char *p = reserve(r, REPORT_LINE_MAX);
+    r->length = (size_t)(put_entry_id(p, id, edited) - r->buffer);
+}
+
+void report_entry_timestamp(report *r, time_t timestamp, int64_t id, int edited){
+    struct tm date;
+    epoch_to_local_time(timestamp, &date);
+
+    char *p = reserve(r, REPORT_LINE_MAX);
+    PUT_LITERAL(p, "\nLog Entry Time: ");
+    p = put_integer(p, date.tm_year + 1900);
+    *p++ = '-';
+    p = put_two_digits(p, date.tm_mon + 1);
+    *p++ = '-';
+    p = put_two_digits(p, date.tm_mday);
+    *p++ = ' ';
+    p = put_two_digits(p, date.tm_hour);
+    *p++ = ':';
+    p = put_two_digits(p, date.tm_min);
+    *p++ = ':';
+    p = put_two_digits(p, date.tm_sec);
+    r->length = (size_t)(put_entry_id(p, id, edited) - r->buffer);
+}
+
+void report_entry_lines(report *r, int lines, const log_entry *entry){
+    // Every line of an entry fits in one reservation
+    char *p = reserve(r, 9 * REPORT_LINE_MAX + 2 * r->unit_length);
+    if (lines & SCAN_LINE_BLOOD_GLUCOSE){
+        PUT_LITERAL(p, "Blood Glucose Level: ");
+        p = put_glucose(r, p, entry->blood_glucose_level);
+        *p++ = '\n';
+    }
+    if (lines & SCAN_LINE_TARGET){
+        PUT_LITERAL(p, "Target: ");
+        p = put_glucose(r, p, entry->target_blood_glucose);
+        *p++ = '\n';
+    }
+    if (lines & SCAN_LINE_CARBS){
+        PUT_LITERAL(p, "Carbs: ");
+        p = put_hundredths(p, entry->meal_time_carbs);
+        PUT_LITERAL(p, " g, Carb Ratio: ");
+        p = put_hundredths(p, entry->carb_ratio);
+        PUT_LITERAL(p, "/unit\n");
+    }
+    if (lines & SCAN_LINE_CORRECTION_FACTOR){
+        PUT_LITERAL(p, "Correction Factor: ");
+        p = put_integer(p, entry->correction_factor);
+        PUT_LITERAL(p, " mmol/L/unit\n");
+    }
+    if (lines & SCAN_LINE_CORRECTION_DOSAGE){
+        PUT_LITERAL(p, "Correction Dosage: ");
+        p = put_hundredths(p, entry->correction_dosage);
+        PUT_LITERAL(p, " units\n");
+    }
+    if (lines & SCAN_LINE_INSULIN_ON_BOARD){
+        PUT_LITERAL(p, "Insulin On Board: ");
+        p = put_hundredths(p, entry->insulin_on_board);
+        PUT_LITERAL(p, " units\n");
+    }
+    if (lines & SCAN_LINE_TOTAL_DOSAGE){
+        PUT_LITERAL(p, "Total Insulin Dosage: ");
+        p = put_hundredths(p, entry->insulin_dosage);
+        PUT_LITERAL(p, " units\n");
+    }
+    if (lines & SCAN_LINE_TYPE){
+        size_t length = strnlen(entry->entry_type, sizeof(entry->entry_type));
+        PUT_LITERAL(p, "Type: ");
+        memcpy(p, entry->entry_type, length);
+        p += length;
+        *p++ = '\n';
+    }
+    r->length = (size_t)(p - r->buffer);
+}
+
+int report_close(report *r){
+    flush_report(r);
+    free(r->buffer);
+    r->buffer = NULL;
+    return r->failed ? -1 : 0;
+}
@@ -0,0 +1,117 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "logging.h"
+
+// Bytes of output collected before they are written to the stream in one call
+#define REPORT_BUFFER_SIZE (64 * 1024)
+
+// Longest line a report writes in one piece; lines are formatted straight into the buffer
+#define REPORT_LINE_MAX 256
+
+// View Logs output for one query. Entries are formatted into a large buffer, which is
+// written out when it fills and when the report is closed, instead of one stdio call per
+// field. The display unit is resolved once when the report is opened. A report can show
+// one page of entries: the caller offers entries newest first, and the report says which
+// to show and when the page is full.
+typedef struct {
+    FILE *out;                    // Stream the output is written to
+    char *buffer;                 // Output not yet written
+    size_t length;
+    const char *unit;             // Glucose unit printed after values
+    size_t unit_length;
+    double glucose_scale;         // Multiplier from mmol/L to the display unit
+    long skip;                    // Entries still to skip before the page starts
+    long remaining;               // Entries still to show, or -1 for no limit
+    int failed;                   // Set once writing to the stream fails
+} report;
+
+/**
+ * report_open - Starts a report on a stream.
+ *
+ * @param r: The report to open.
+ * @param out: Stream the output is written to.
+ * @param preffered_unit: The user's preferred blood glucose unit, or NULL for mmol/L.
+ * @param page: The page to show, or NULL to show every entry offered.
+ * @return: 0 for success, -1 for errors.
+ */
+int report_open(report *r, FILE *out, const char *preffered_unit, const log_page *page);
+
+/**
+ * report_next - Counts one more entry towards the page, for entries offered newest first.
+ *
+ * @param r: An open report.
+ * @return: 1 if the entry is on the page and should be shown, 0 if it is skipped.
+ */
+int report_next(report *r);
+
+/**
+ * report_skip - Counts entries that are known to be before the page without offering
+ * them, so a reader can pass over them without decoding them.
+ *
+ * @param r: An open report.
+ * @param count: Number of entries passed over; at most r->skip.
+ */
+void report_skip(report *r, long count);
+
+/**
+ * report_done - Checks whether the page is full, so the reader can stop.
+ *
+ * @param r: An open report.
+ * @return: 1 once the page's last entry has been shown, 0 otherwise.
+ */
+int report_done(const report *r);
+
+/**
+ * report_write - Adds text to the report as it is.
+ *
+ * @param r: An open report.
+ * @param text: The text.
+ * @param length: Length of the text.
+ */
+void report_write(report *r, const char *text, size_t length);
+
+/**
+ * report_entry_time - Adds the heading of an entry: a blank line, the time line as View
+ * Logs shows it, and the entry's ID if it has one.
+ *
+ * @param r: An open report.
+ * @param time_line: "Log Entry Time: YYYY-MM-DD HH:MM:SS", as the entry was logged.
+ * @param length: Length of the time line.
+ * @param id: The entry's ID, or 0 to show none.
+ * @param edited: Non-zero if the entry is shown in an edited version.
+ */
+void report_entry_time(report *r, const char *time_line, size_t length, int64_t id, int edited);
+
+/**
+ * report_entry_timestamp - Adds the heading of an entry from its time, for entries
+ * stored without a time line.
+ *
+ * @param r: An open report.
+ * @param timestamp: Time of the entry.
+ * @param id: The entry's ID, or 0 to show none.
+ * @param edited: Non-zero if the entry is shown in an edited version.
+ */
+void report_entry_timestamp(report *r, time_t timestamp, int64_t id, int edited);
+
+/**
+ * report_entry_lines - Adds the data lines of an entry.
+ *
+ * @param r: An open report.
+ * @param lines: SCAN_LINE_* flags of the lines to show.
+ * @param entry: The entry's values.
+ */
+void report_entry_lines(report *r, int lines, const log_entry *entry);
+
+/**
+ * report_close - Writes out what is left of a report and frees its buffer.
+ *
+ * @param r: The report.
+ * @return: 0 for success, -1 if writing to the stream failed.
+ */
+int report_close(report *r);
+
+#endif
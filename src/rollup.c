@@ -0,0 +1,680 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "rollup.h"
+#include "calculations.h"
+#include "logging.h"
+#include "records.h"
+#include "log_scan.h"
+#include "log_lock.h"
+#include "local_time.h"
+#include "instrument.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of records read per fread call when rolling up a binary log
+#define ROLLUP_RECORD_BATCH 256
+
+// Rows read per fread call when answering a window
+#define ROLLUP_READ_BATCH 64
+
+// Day rows a new file has room for; doubled as the log grows
+#define ROLLUP_INITIAL_DAYS 64
+
+#define HOURS_PER_DAY 24
+
+// Values of one entry that go into the rollups
+typedef struct {
+    int has_reading;
+    float reading;                // Blood glucose in mmol/L
+    float carbs;                  // Grams, 0 if none were logged
+    float bolus;                  // Total insulin dosage in units, 0 if none
+    float correction;             // Correction dosage in units, 0 if none
+} rollup_entry;
+
+// Rollup tables loaded into memory while entries are added. Rows are read from the
+// file when an entry first touches their day, so appending to the latest day reads
+// only that day's rows however long the history is.
+typedef struct {
+    rollup_header header;
+    FILE *file;                   // The rollup file
+    rollup_row *days;             // header.day_count day rows
+    rollup_row *hours;            // HOURS_PER_DAY hour rows for each day
+    int64_t capacity;             // Days allocated in memory
+    int64_t loaded_from;          // First day whose rows are in memory; later ones are too
+    int64_t dirty_from;           // First day whose rows need writing back
+    long skipped;                 // Entries too far from the others to be rolled up
+} rollup_table;
+
+
+/**
+ * rollup_filename - Builds the name of the sidecar rollup file for a log file.
+ */
+static void rollup_filename(const char *log_filename, char *buffer, size_t size){
+    snprintf(buffer, size, "%s%s", log_filename, ROLLUP_SUFFIX);
+}
+
+/**
+ * floor_div - Divides rounding towards negative infinity.
+ */
+static int64_t floor_div(int64_t value, int64_t divisor){
+    int64_t quotient = value / divisor;
+    return quotient - (value % divisor < 0);
+}
+
+/**
+ * local_hour_of - Returns the local hour of a timestamp, counted from 1970-01-01 00:00 local time.
+ */
+static int64_t local_hour_of(int64_t timestamp){
+    return floor_div(timestamp + local_utc_offset((time_t)timestamp), 3600);
+}
+
+/**
+ * hour_rows_offset - Returns where the hour rows start in a file with room for capacity days.
+ */
+static long hour_rows_offset(int64_t capacity){
+    return (long)(sizeof(rollup_header) + (size_t)capacity * sizeof(rollup_row));
+}
+
+/**
+ * reserve_days - Makes room for at least count days in the table.
+ */
+static int reserve_days(rollup_table *table, int64_t count){
+    if (count <= table->capacity){
+        return 0;
+    }
+    int64_t capacity = table->capacity > 0 ? table->capacity : ROLLUP_INITIAL_DAYS;
+    while (capacity < count){
+        capacity *= 2;
+    }
+
+    rollup_row *days = realloc(table->days, (size_t)capacity * sizeof(rollup_row));
+    if (days == NULL){
+        perror("Error allocating rollup tables");
+        return -1;
+    }
+    table->days = days;
+
+    rollup_row *hours = realloc(table->hours, (size_t)capacity * HOURS_PER_DAY * sizeof(rollup_row));
+    if (hours == NULL){
+        perror("Error allocating rollup tables");
+        return -1;
+    }
+    table->hours = hours;
+    table->capacity = capacity;
+    return 0;
+}
+
+/**
+ * clear_days - Zeroes the day rows and hour rows of count days from day index first.
+ */
+static void clear_days(rollup_table *table, int64_t first, int64_t count){
+    memset(table->days + first, 0, (size_t)count * sizeof(rollup_row));
+    memset(table->hours + first * HOURS_PER_DAY, 0, (size_t)count * HOURS_PER_DAY * sizeof(rollup_row));
+}
+
+/**
+ * load_days - Reads the rows of the days from day index first up to the ones already in
+ * memory from the rollup file.
+ */
+static int load_days(rollup_table *table, int64_t first){
+    if (first >= table->loaded_from){
+        return 0;
+    }
+    size_t count = (size_t)(table->loaded_from - first);
+    size_t hours = count * HOURS_PER_DAY;
+    if (fseek(table->file, (long)(sizeof(rollup_header) + (size_t)first * sizeof(rollup_row)), SEEK_SET) != 0 ||
+        fread(table->days + first, sizeof(rollup_row), count, table->file) != count ||
+        fseek(table->file, hour_rows_offset(table->header.day_capacity) +
+                           (long)((size_t)first * HOURS_PER_DAY * sizeof(rollup_row)), SEEK_SET) != 0 ||
+        fread(table->hours + first * HOURS_PER_DAY, sizeof(rollup_row), hours, table->file) != hours){
+        perror("Error reading rollup tables");
+        return -1;
+    }
+    table->loaded_from = first;
+    return 0;
+}
+
+void rollup_merge_row(rollup_row *to, const rollup_row *from){
+    if (from->readings > 0){
+        if (to->readings == 0 || from->min < to->min){
+            to->min = from->min;
+        }
+        if (to->readings == 0 || from->max > to->max){
+            to->max = from->max;
+        }
+    }
+    to->readings += from->readings;
+    to->hypo_events += from->hypo_events;
+    to->hyper_events += from->hyper_events;
+    to->sum += from->sum;
+    to->sum_squares += from->sum_squares;
+    to->carbs += from->carbs;
+    to->bolus += from->bolus;
+    to->correction += from->correction;
+    if (to->readings == 0){
+        to->min = 0;
+        to->max = 0;
+    }
+}
+
+/**
+ * add_entry - Adds one entry to the rows for its local hour and day. Revisions add an
+ * edit's new values (sign 1) or take out the version an edit or deletion replaced
+ * (sign -1); they change the sums but not the hypo and hyper events, which depend on
+ * log order, nor the min and max of the readings taken out. Those are brought up to
+ * date when compaction folds the revisions in and the tables are rebuilt.
+ */
+static int add_entry(rollup_table *table, int64_t timestamp, const rollup_entry *entry, int revision){
+    rollup_header *header = &table->header;
+    int64_t hour = local_hour_of(timestamp);
+    int64_t day = floor_div(hour, HOURS_PER_DAY);
+
+    if (header->day_count == 0){
+        if (reserve_days(table, 1) != 0){
+            return -1;
+        }
+        clear_days(table, 0, 1);
+        header->first_day = day;
+        header->day_count = 1;
+        table->loaded_from = 0;
+        table->dirty_from = 0;
+    } else if (day < header->first_day){
+        // An older entry: shift the tables so they start at its day
+        int64_t shift = header->first_day - day;
+        if (header->day_count + shift > ROLLUP_MAX_DAYS){
+            table->skipped++;
+            return 0;
+        }
+        if (reserve_days(table, header->day_count + shift) != 0 || load_days(table, 0) != 0){
+            return -1;
+        }
+        memmove(table->days + shift, table->days, (size_t)header->day_count * sizeof(rollup_row));
+        memmove(table->hours + shift * HOURS_PER_DAY, table->hours,
+                (size_t)header->day_count * HOURS_PER_DAY * sizeof(rollup_row));
+        clear_days(table, 0, shift);
+        header->first_day = day;
+        header->day_count += shift;
+        table->dirty_from = 0;
+    } else if (day >= header->first_day + header->day_count){
+        int64_t count = day - header->first_day + 1;
+        if (count > ROLLUP_MAX_DAYS){
+            table->skipped++;
+            return 0;
+        }
+        if (reserve_days(table, count) != 0){
+            return -1;
+        }
+        clear_days(table, header->day_count, count - header->day_count);
+        header->day_count = count;
+    }
+
+    // One row holding just this entry, merged into its hour and day
+    rollup_row row;
+    memset(&row, 0, sizeof(row));
+    int sign = revision < 0 ? -1 : 1;
+    if (entry->has_reading){
+        int range = entry->reading < lower_target ? ROLLUP_BELOW :
+                    entry->reading > upper_target ? ROLLUP_ABOVE : ROLLUP_IN_RANGE;
+        row.readings = sign;
+        row.min = entry->reading;
+        row.max = entry->reading;
+        row.sum = sign * entry->reading;
+        row.sum_squares = sign * (double)entry->reading * entry->reading;
+        if (revision == 0){
+            row.hypo_events = range == ROLLUP_BELOW && header->last_range != ROLLUP_BELOW;
+            row.hyper_events = range == ROLLUP_ABOVE && header->last_range != ROLLUP_ABOVE;
+            header->last_range = range;
+        }
+    }
+    row.carbs = sign * entry->carbs;
+    row.bolus = sign * entry->bolus;
+    row.correction = sign * entry->correction;
+
+    int64_t i = day - header->first_day;
+    if (load_days(table, i) != 0){
+        return -1;
+    }
+    rollup_merge_row(&table->days[i], &row);
+    rollup_merge_row(&table->hours[i * HOURS_PER_DAY + (hour - day * HOURS_PER_DAY)], &row);
+    if (i < table->dirty_from){
+        table->dirty_from = i;
+    }
+    return 0;
+}
+
+// State passed through log_scan while rolling up a text log
+typedef struct {
+    rollup_table *table;
+    const char *data;             // Start of the mapped log, for reading replaced versions
+    size_t size;
+    int status;
+} rollup_scan_context;
+
+/**
+ * add_scanned - Adds the values of a scanned entry or edit to the rollups.
+ */
+static int add_scanned(rollup_table *table, const scanned_entry *scanned, int revision){
+    const log_entry *values = &scanned->entry;
+    rollup_entry entry = {0};
+    entry.has_reading = (scanned->lines & SCAN_LINE_BLOOD_GLUCOSE) != 0;
+    entry.reading = values->blood_glucose_level;
+    entry.carbs = scanned->lines & SCAN_LINE_CARBS ? values->meal_time_carbs : 0;
+    entry.bolus = scanned->lines & SCAN_LINE_TOTAL_DOSAGE ? values->insulin_dosage : 0;
+    entry.correction = scanned->lines & SCAN_LINE_CORRECTION_DOSAGE ? values->correction_dosage : 0;
+    if (!entry.has_reading && entry.carbs == 0 && entry.bolus == 0 && entry.correction == 0){
+        return 0;
+    }
+    return add_entry(table, (int64_t)scanned->timestamp, &entry, revision);
+}
+
+/**
+ * rollup_scanned_entry - log_scan callback that adds each entry to the rollups. An edit
+ * or tombstone takes out the version it replaces, and an edit adds its new values.
+ */
+static int rollup_scanned_entry(const scanned_entry *scanned, void *context){
+    rollup_scan_context *scan = context;
+    if (scanned->kind == SCAN_BAD_TIME || scanned->kind == SCAN_CORRUPT || !scanned->has_timestamp){
+        return 0;
+    }
+    if (scanned->kind == SCAN_ENTRY){
+        scan->status = add_scanned(scan->table, scanned, 0);
+        return scan->status;
+    }
+
+    scanned_entry replaced;
+    if (scanned->replaces >= 0 &&
+        log_scan_record(scan->data, scan->size, (size_t)scanned->replaces, &replaced) == 0 &&
+        replaced.kind != SCAN_DELETE){
+        scan->status = add_scanned(scan->table, &replaced, -1);
+    }
+    if (scan->status == 0 && scanned->kind == SCAN_EDIT){
+        scan->status = add_scanned(scan->table, scanned, 1);
+    }
+    return scan->status;
+}
+
+/**
+ * rollup_text_tail - Adds the entries of a text log from header.indexed_size onwards.
+ */
+static int rollup_text_tail(const char *log_filename, rollup_table *table){
+    log_map map;
+    if (log_map_open(&map, log_filename) != 0){
+        return -1;
+    }
+
+    // Leave a record another process is still appending for the next update
+    size_t start = (size_t)table->header.indexed_size;
+    size_t end = map.size > start ? log_map_whole_end(&map) : start;
+
+    int status = 0;
+    if (end > start){
+        rollup_scan_context scan = {table, map.data, map.size, 0};
+        log_scan(map.data + start, end - start, rollup_scanned_entry, &scan);
+        status = scan.status;
+        if (status == 0){
+            table->header.indexed_size = (int64_t)end;
+        }
+    }
+
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * add_record - Adds the values of a binary record to the rollups.
+ */
+static int add_record(rollup_table *table, const log_record *record, int revision){
+    rollup_entry entry = {0};
+    entry.has_reading = (record->flags & RECORD_FLAG_BLOOD_GLUCOSE) != 0;
+    entry.reading = record->blood_glucose_level;
+    entry.carbs = record->flags & RECORD_FLAG_CARBS ? record->meal_time_carbs : 0;
+    entry.bolus = record->flags & RECORD_FLAG_INSULIN ? record->insulin_dosage : 0;
+    entry.correction = record->flags & RECORD_FLAG_CORRECTION ? record->correction_dosage : 0;
+    if (!entry.has_reading && entry.carbs == 0 && entry.bolus == 0 && entry.correction == 0){
+        return 0;
+    }
+    return add_entry(table, record->timestamp, &entry, revision);
+}
+
+/**
+ * rollup_binary_tail - Adds the records of a binary log from header.indexed_size onwards.
+ */
+static int rollup_binary_tail(const char *log_filename, rollup_table *table){
+    FILE *log = fopen(log_filename, "rb");
+    if (log == NULL){
+        return -1;
+    }
+
+    rollup_header *header = &table->header;
+    if (header->indexed_size < (int64_t)sizeof(record_header)){
+        header->indexed_size = sizeof(record_header);
+    }
+    if (fseek(log, (long)header->indexed_size, SEEK_SET) != 0){
+        fclose(log);
+        return -1;
+    }
+
+    log_record records[ROLLUP_RECORD_BATCH];
+    size_t count;
+    while ((count = fread(records, sizeof(log_record), ROLLUP_RECORD_BATCH, log)) > 0){
+        for (size_t i = 0; i < count; i++){
+            const log_record *record = &records[i];
+            int status = 0;
+            if (!record_intact(record)){
+                // Damaged records are left out
+            } else if (record->flags & RECORD_FLAG_REVISION){
+                // Take out the version replaced, then add an edit's new values
+                log_record replaced;
+                if (record->replaces >= 0 &&
+                    pread(fileno(log), &replaced, sizeof(replaced), (off_t)record->replaces) == (ssize_t)sizeof(replaced) &&
+                    record_intact(&replaced) && !(replaced.flags & RECORD_FLAG_DELETED)){
+                    status = add_record(table, &replaced, -1);
+                }
+                if (status == 0 && (record->flags & RECORD_FLAG_EDIT)){
+                    status = add_record(table, record, 1);
+                }
+            } else {
+                status = add_record(table, record, 0);
+            }
+            if (status != 0){
+                fclose(log);
+                return -1;
+            }
+            header->indexed_size += sizeof(log_record);
+        }
+    }
+
+    fclose(log);
+    return 0;
+}
+
+/**
+ * load_rollups - Reads the header of a rollup file and makes room for its rows, which
+ * are read by load_days as entries need them.
+ *
+ * @return: 0 for success, -1 if the file is damaged or does not match the log.
+ */
+static int load_rollups(FILE *file, rollup_table *table, int64_t log_size){
+    rollup_header *header = &table->header;
+    struct stat file_stat;
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        strncmp(header->magic, ROLLUP_MAGIC, sizeof(header->magic)) != 0 ||
+        header->indexed_size > log_size ||
+        header->day_count < 0 || header->day_count > header->day_capacity ||
+        header->day_capacity > ROLLUP_MAX_DAYS || fstat(fileno(file), &file_stat) != 0){
+        return -1;
+    }
+
+    // The rows are only read later, so a file cut short is caught here
+    size_t hours = (size_t)header->day_count * HOURS_PER_DAY;
+    if (header->day_count > 0 &&
+        file_stat.st_size < hour_rows_offset(header->day_capacity) + (off_t)(hours * sizeof(rollup_row))){
+        return -1;
+    }
+    if (reserve_days(table, header->day_count) != 0){
+        return -1;
+    }
+    table->file = file;
+    table->loaded_from = header->day_count;
+    return 0;
+}
+
+/**
+ * write_rollups - Writes the changed rows and then the header back to the rollup file.
+ * When the days outgrow the file, its room for days is doubled and every row is
+ * rewritten at its new place; the old rows are dropped first so unused room reads as zeros.
+ */
+static int write_rollups(FILE *file, rollup_table *table){
+    rollup_header *header = &table->header;
+    if (header->day_count > header->day_capacity){
+        // Every row moves, so the ones not read yet are read first
+        if (load_days(table, 0) != 0){
+            return -1;
+        }
+        int64_t capacity = header->day_capacity > 0 ? header->day_capacity : ROLLUP_INITIAL_DAYS;
+        while (capacity < header->day_count){
+            capacity *= 2;
+        }
+        header->day_capacity = capacity < ROLLUP_MAX_DAYS ? capacity : ROLLUP_MAX_DAYS;
+        table->dirty_from = 0;
+        if (fflush(file) != 0 || ftruncate(fileno(file), sizeof(rollup_header)) != 0){
+            perror("Error writing rollup tables");
+            return -1;
+        }
+    }
+
+    // Only days from the oldest new entry onwards change; the header is written last
+    int64_t changed = header->day_count - table->dirty_from;
+    if (changed > 0){
+        size_t hours = (size_t)changed * HOURS_PER_DAY;
+        if (fseek(file, (long)(sizeof(rollup_header) + (size_t)table->dirty_from * sizeof(rollup_row)), SEEK_SET) != 0 ||
+            fwrite(table->days + table->dirty_from, sizeof(rollup_row), (size_t)changed, file) != (size_t)changed ||
+            fseek(file, hour_rows_offset(header->day_capacity) +
+                        (long)((size_t)table->dirty_from * HOURS_PER_DAY * sizeof(rollup_row)), SEEK_SET) != 0 ||
+            fwrite(table->hours + table->dirty_from * HOURS_PER_DAY, sizeof(rollup_row), hours, file) != hours){
+            perror("Error writing rollup tables");
+            return -1;
+        }
+    }
+
+    rewind(file);
+    if (fwrite(header, sizeof(*header), 1, file) != 1){
+        perror("Error writing rollup tables");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * update_rollups - Brings the rollups up to date with the log; see rollup_update.
+ *
+ * @param rebuild: Non-zero to discard the existing tables and roll up the whole log.
+ */
+static int update_rollups(const char *log_filename, int rebuild){
+    struct stat log_stat;
+    if (stat(log_filename, &log_stat) != 0){
+        return -1;
+    }
+
+    char name[512];
+    rollup_filename(log_filename, name, sizeof(name));
+
+    rollup_table table;
+    memset(&table, 0, sizeof(table));
+
+    FILE *file = rebuild ? NULL : fopen(name, "r+b");
+    if (file == NULL || load_rollups(file, &table, (int64_t)log_stat.st_size) != 0){
+        // Missing, damaged, stale or being rebuilt: start again from the beginning of the log
+        if (file != NULL){
+            fclose(file);
+        }
+        file = fopen(name, "w+b");
+        if (file == NULL){
+            free(table.days);
+            free(table.hours);
+            return -1;
+        }
+        memset(&table.header, 0, sizeof(table.header));
+        table.file = file;
+        table.loaded_from = 0;
+        memcpy(table.header.magic, ROLLUP_MAGIC, sizeof(ROLLUP_MAGIC));
+        table.header.last_range = ROLLUP_IN_RANGE;
+        if (fwrite(&table.header, sizeof(table.header), 1, file) != 1){
+            fclose(file);
+            free(table.days);
+            free(table.hours);
+            return -1;
+        }
+    }
+
+    if (table.header.indexed_size == (int64_t)log_stat.st_size){
+        fclose(file);
+        free(table.days);
+        free(table.hours);
+        return 0;
+    }
+
+    table.dirty_from = table.header.day_count;
+    int status = is_binary_log(log_filename) ? rollup_binary_tail(log_filename, &table)
+                                             : rollup_text_tail(log_filename, &table);
+
+    if (table.skipped > 0){
+        printf("Warning: %ld entries are too far from the rest of the log to be included in the rollups.\n",
+               table.skipped);
+    }
+    if (status == 0){
+        status = write_rollups(file, &table);
+    }
+    if (fclose(file) != 0){
+        status = -1;
+    }
+
+    free(table.days);
+    free(table.hours);
+    return status;
+}
+
+/**
+ * timed_update_rollups - Runs update_rollups, timing it.
+ */
+static int timed_update_rollups(const char *log_filename, int rebuild){
+    uint64_t start = probe_begin();
+    int status = update_rollups(log_filename, rebuild);
+    probe_end(PROBE_ROLLUP_UPDATE, start, 0);
+    return status;
+}
+
+int rollup_update(const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = timed_update_rollups(log_filename, 0);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+int rollup_rebuild(const char *log_filename){
+    int lock = log_lock_sidecars(log_filename);
+    int status = timed_update_rollups(log_filename, 1);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+/**
+ * merge_file_rows - Merges count consecutive rows of a rollup file, starting at a
+ * byte offset, into a row.
+ */
+static int merge_file_rows(FILE *file, long offset, int64_t count, rollup_row *into, long *rows_read){
+    if (count <= 0){
+        return 0;
+    }
+    if (fseek(file, offset, SEEK_SET) != 0){
+        return -1;
+    }
+
+    rollup_row rows[ROLLUP_READ_BATCH];
+    while (count > 0){
+        size_t batch = count < ROLLUP_READ_BATCH ? (size_t)count : ROLLUP_READ_BATCH;
+        if (fread(rows, sizeof(rollup_row), batch, file) != batch){
+            return -1;
+        }
+        for (size_t i = 0; i < batch; i++){
+            rollup_merge_row(into, &rows[i]);
+        }
+        count -= (int64_t)batch;
+        *rows_read += (long)batch;
+    }
+    return 0;
+}
+
+/**
+ * window_rollups - Totals a window for rollup_window while the sidecars are locked.
+ */
+static int window_rollups(const char *log_filename, time_t start_time, time_t end_time, rollup_summary *summary){
+    memset(summary, 0, sizeof(*summary));
+
+    if (timed_update_rollups(log_filename, 0) != 0){
+        printf("Error updating rollup tables.\n");
+        return -1;
+    }
+
+    char name[512];
+    rollup_filename(log_filename, name, sizeof(name));
+    FILE *file = fopen(name, "rb");
+    if (file == NULL){
+        perror("Error opening rollup tables");
+        return -1;
+    }
+
+    rollup_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1){
+        fclose(file);
+        return -1;
+    }
+
+    // Hours of the window, counted from the first hour of the tables
+    int64_t start_hour = local_hour_of((int64_t)start_time);
+    int64_t end_hour = local_hour_of((int64_t)end_time);
+    summary->days = (long)(floor_div(end_hour, HOURS_PER_DAY) - floor_div(start_hour, HOURS_PER_DAY) + 1);
+    int64_t first = start_hour - header.first_day * HOURS_PER_DAY;
+    int64_t last = end_hour - header.first_day * HOURS_PER_DAY;
+    if (first < 0){
+        first = 0;
+    }
+    if (last > header.day_count * HOURS_PER_DAY - 1){
+        last = header.day_count * HOURS_PER_DAY - 1;
+    }
+
+    int status = 0;
+    if (first <= last){
+        // Whole days in the window come from the day rows, the hours either side from the hour rows
+        int64_t first_day = floor_div(first + HOURS_PER_DAY - 1, HOURS_PER_DAY);
+        int64_t last_day = floor_div(last + 1, HOURS_PER_DAY) - 1;
+        long hours = hour_rows_offset(header.day_capacity);
+        rollup_row *totals = &summary->totals;
+        if (first_day > last_day){
+            status = merge_file_rows(file, hours + (long)(first * (int64_t)sizeof(rollup_row)),
+                                     last - first + 1, totals, &summary->rows_read);
+        } else {
+            int64_t tail = (last_day + 1) * HOURS_PER_DAY;
+            if (merge_file_rows(file, hours + (long)(first * (int64_t)sizeof(rollup_row)),
+                                first_day * HOURS_PER_DAY - first, totals, &summary->rows_read) != 0 ||
+                merge_file_rows(file, (long)(sizeof(rollup_header) + (size_t)first_day * sizeof(rollup_row)),
+                                last_day - first_day + 1, totals, &summary->rows_read) != 0 ||
+                merge_file_rows(file, hours + (long)(tail * (int64_t)sizeof(rollup_row)),
+                                last - tail + 1, totals, &summary->rows_read) != 0){
+                status = -1;
+            }
+        }
+    }
+    fclose(file);
+
+    if (status != 0){
+        printf("Error reading rollup tables.\n");
+    }
+    return status;
+}
+
+int rollup_window(const char *log_filename, time_t start_time, time_t end_time, rollup_summary *summary){
+    int lock = log_lock_sidecars(log_filename);
+    int status = window_rollups(log_filename, start_time, end_time, summary);
+    log_unlock_sidecars(lock);
+    return status;
+}
+
+void display_rollup_summary(FILE *out, const rollup_summary *summary, const char *unit){
+    const rollup_row *totals = &summary->totals;
+    double days = summary->days > 0 ? (double)summary->days : 1.0;
+
+    if (totals->readings > 0){
+        fprintf(out, "Lowest reading: %.2f %s\n", convert_to_preferred_unit(totals->min, unit), unit);
+        fprintf(out, "Highest reading: %.2f %s\n", convert_to_preferred_unit(totals->max, unit), unit);
+    }
+    fprintf(out, "Hypo events (below %.1f %s): %lld\n",
+            convert_to_preferred_unit(lower_target, unit), unit, (long long)totals->hypo_events);
+    fprintf(out, "Hyper events (above %.1f %s): %lld\n",
+            convert_to_preferred_unit(upper_target, unit), unit, (long long)totals->hyper_events);
+    fprintf(out, "Carbohydrates: %.0f g (%.0f g/day)\n", totals->carbs, totals->carbs / days);
+    fprintf(out, "Insulin: %.2f units (%.2f units/day), of which correction: %.2f units\n",
+            totals->bolus, totals->bolus / days, totals->correction);
+}
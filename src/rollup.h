@@ -0,0 +1,108 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Rollup tables are kept in a sidecar file next to the log, e.g. data/logs.txt.rollup
+#define ROLLUP_SUFFIX ".rollup"
+#define ROLLUP_MAGIC "DMSROL1"
+
+// Most days kept in one file (about 50 years)
+#define ROLLUP_MAX_DAYS (366L * 50)
+
+// Range of the most recent blood glucose reading, used to count hypo and hyper events
+#define ROLLUP_BELOW -1
+#define ROLLUP_IN_RANGE 0
+#define ROLLUP_ABOVE 1
+
+// Header at the start of the rollup file. It is followed by day_capacity day rows,
+// then 24 hour rows for each of those days.
+typedef struct {
+    char magic[8];                // ROLLUP_MAGIC, null terminated
+    int64_t indexed_size;         // Bytes of the log covered by the rollups
+    int64_t first_day;            // Local day of the first row, counted from 1970-01-01
+    int64_t day_count;            // Days in use, from first_day
+    int64_t day_capacity;         // Day rows the file has room for
+    int32_t last_range;           // ROLLUP_BELOW, ROLLUP_IN_RANGE or ROLLUP_ABOVE
+    int32_t reserved;             // Zeroed
+} rollup_header;
+
+// Totals of the entries logged in one local hour or one local day.
+typedef struct {
+    int64_t readings;             // Blood glucose readings
+    int64_t hypo_events;          // Readings below lower_target after one that was not
+    int64_t hyper_events;         // Readings above upper_target after one that was not
+    float min;                    // Lowest reading in mmol/L; 0 without readings
+    float max;                    // Highest reading in mmol/L; 0 without readings
+    double sum;                   // Sum of readings in mmol/L
+    double sum_squares;           // Sum of squared readings
+    double carbs;                 // Carbohydrates logged, in grams
+    double bolus;                 // Total insulin dosages logged, in units
+    double correction;            // Correction dosages logged, in units
+} rollup_row;
+
+// Totals for a time window, combined from rollup rows.
+typedef struct {
+    rollup_row totals;            // The window's totals
+    long days;                    // Local days the window touches
+    long rows_read;               // Rollup rows combined to answer the query
+} rollup_summary;
+
+/**
+ * rollup_update - Adds the entries appended to the log since the last update to the
+ * hourly and daily rollup tables. Only the unread tail of the log is read, only the
+ * rows of the days its entries fall on are read from the rollup file, and only the
+ * rows that change are written back. The tables are rebuilt from scratch if
+ * they are missing, damaged or the log has been truncated.
+ *
+ * Hours and days are local; hypo and hyper events are counted in log order. Edits and
+ * deletions change the counts and sums straight away; the events and the min and max
+ * catch up when compaction folds them into the log.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int rollup_update(const char *log_filename);
+
+/**
+ * rollup_rebuild - Regenerates the rollup tables from the whole log in one streaming pass.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @return: 0 for success, -1 for errors.
+ */
+int rollup_rebuild(const char *log_filename);
+
+/**
+ * rollup_window - Totals the entries in a time window from the rollup tables.
+ * Whole local days are read from the daily table and the hours at either end from
+ * the hourly table, so a 90 day window reads at most about 140 rows. The hours
+ * holding start_time and end_time are both included.
+ *
+ * @param log_filename: Name of the log file (text or binary).
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param summary: Receives the totals.
+ * @return: 0 for success, -1 for errors.
+ */
+int rollup_window(const char *log_filename, time_t start_time, time_t end_time, rollup_summary *summary);
+
+/**
+ * rollup_merge_row - Adds the totals of one row to another.
+ *
+ * @param to: The row to add to.
+ * @param from: The row to add; left unchanged.
+ */
+void rollup_merge_row(rollup_row *to, const rollup_row *from);
+
+/**
+ * display_rollup_summary - Prints the extremes, events, carbohydrates and insulin of a window.
+ *
+ * @param out: Stream to print to.
+ * @param summary: The totals to print.
+ * @param unit: The user's preferred unit ("mmol/L" or "mg/dL").
+ */
+void display_rollup_summary(FILE *out, const rollup_summary *summary, const char *unit);
+
+#endif
@@ -0,0 +1,924 @@
+#include <stdio.h>
+#include "segments.h"
+#include "storage.h"
+#include "gorilla.h"
+#include "records.h"
+#include "report.h"
+#include "log_scan.h"
+#include "log_index.h"
+#include "log_ids.h"
+#include "log_lock.h"
+#include "log_edit.h"
+#include "log_verify.h"
+#include "local_time.h"
+#include "calculations.h"
+#include "instrument.h"
+#include "config.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One month of a segmented log, as the manifest lists it
+typedef struct {
+    int month;                    // Months since the year 0: year * 12 + month - 1
+    int closed;                   // 1 for a compressed month, 0 for the open one
+    int64_t min_timestamp;        // Closed months: the earliest and latest entry times
+    int64_t max_timestamp;
+    int64_t entries;              // Closed months: the number of entries
+} log_segment;
+
+// The months of a segmented log, in month order with the open month last
+typedef struct {
+    log_segment *segments;
+    int count;
+    int capacity;
+} segment_manifest;
+
+// A segmented log held open by storage_open
+typedef struct {
+    int lock;                     // Descriptor holding the writer's lock file
+    segment_manifest manifest;
+    storage open;                 // The open month, through the text backend
+    sync_policy policy;           // Sync policy the open month is opened with
+    int sync_every;
+    long sync_interval_ms;
+    int open_empty;               // Set while the open month has no entries
+} segmented_log;
+
+// Entries collected into memory
+typedef struct {
+    log_record *records;
+    size_t count;
+    size_t capacity;
+} record_list;
+
+int is_segmented_log(const char *filename){
+    size_t length = strlen(filename);
+    size_t suffix_length = strlen(STORAGE_SEGMENT_SUFFIX);
+    return length > suffix_length && strcmp(filename + length - suffix_length, STORAGE_SEGMENT_SUFFIX) == 0;
+}
+
+/**
+ * month_of - Local month of a time, counted from the year 0.
+ */
+static int month_of(time_t timestamp){
+    struct tm date;
+    epoch_to_local_time(timestamp, &date);
+    return (date.tm_year + 1900) * 12 + date.tm_mon;
+}
+
+/**
+ * segment_filename - Builds the name of a month's segment file from the manifest's name.
+ */
+static void segment_filename(const char *manifest, int month, int closed, char *buffer, size_t size){
+    snprintf(buffer, size, "%s.%04d-%02d%s", manifest, month / 12, month % 12 + 1,
+             closed ? SEGMENT_CLOSED_SUFFIX : SEGMENT_OPEN_SUFFIX);
+}
+
+/**
+ * add_segment - Adds a month to the end of a manifest.
+ */
+static int add_segment(segment_manifest *manifest, const log_segment *segment){
+    if (manifest->count == manifest->capacity){
+        int capacity = manifest->capacity > 0 ? manifest->capacity * 2 : 16;
+        log_segment *segments = realloc(manifest->segments, (size_t)capacity * sizeof(log_segment));
+        if (segments == NULL){
+            perror("Error reading log manifest");
+            return -1;
+        }
+        manifest->segments = segments;
+        manifest->capacity = capacity;
+    }
+    manifest->segments[manifest->count++] = *segment;
+    return 0;
+}
+
+/**
+ * open_segment - The open month of a manifest, or NULL if it has none.
+ */
+static log_segment *open_segment(const segment_manifest *manifest){
+    if (manifest->count == 0 || manifest->segments[manifest->count - 1].closed){
+        return NULL;
+    }
+    return &manifest->segments[manifest->count - 1];
+}
+
+/**
+ * read_manifest - Reads a manifest. A missing manifest fails with errno ENOENT and
+ * prints nothing, so a writer can create it.
+ */
+static int read_manifest(const char *filename, segment_manifest *manifest){
+    memset(manifest, 0, sizeof(*manifest));
+    FILE *file = fopen(filename, "r");
+    if (file == NULL){
+        return -1;
+    }
+
+    char line[256];
+    int status = 0;
+    if (fgets(line, sizeof(line), file) == NULL || strncmp(line, SEGMENT_MAGIC, strlen(SEGMENT_MAGIC)) != 0){
+        status = -1;
+    }
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL){
+        log_segment segment;
+        memset(&segment, 0, sizeof(segment));
+        int year, month;
+        long long min_timestamp, max_timestamp, entries;
+        if (sscanf(line, "closed %d-%d %lld %lld %lld", &year, &month, &min_timestamp, &max_timestamp, &entries) == 5){
+            segment.closed = 1;
+            segment.min_timestamp = min_timestamp;
+            segment.max_timestamp = max_timestamp;
+            segment.entries = entries;
+        } else if (sscanf(line, "open %d-%d", &year, &month) != 2){
+            status = -1;
+            break;
+        }
+        // Only the last month can be open
+        if (month < 1 || month > 12 || open_segment(manifest) != NULL){
+            status = -1;
+            break;
+        }
+        segment.month = year * 12 + month - 1;
+        status = add_segment(manifest, &segment);
+    }
+    fclose(file);
+
+    if (status != 0){
+        printf("Error: %s is not a segmented log manifest.\n", filename);
+        free(manifest->segments);
+        memset(manifest, 0, sizeof(*manifest));
+        errno = EINVAL;
+    }
+    return status;
+}
+
+/**
+ * write_manifest - Replaces a manifest in one rename, so readers see the old months or
+ * the new ones and never a mixture.
+ */
+static int write_manifest(const char *filename, const segment_manifest *manifest){
+    char name[512];
+    snprintf(name, sizeof(name), "%s.tmp", filename);
+    FILE *out = fopen(name, "w");
+    if (out == NULL){
+        perror("Error writing log manifest");
+        return -1;
+    }
+
+    fprintf(out, "%s\n", SEGMENT_MAGIC);
+    for (int i = 0; i < manifest->count; i++){
+        const log_segment *segment = &manifest->segments[i];
+        if (segment->closed){
+            fprintf(out, "closed %04d-%02d %lld %lld %lld\n", segment->month / 12, segment->month % 12 + 1,
+                    (long long)segment->min_timestamp, (long long)segment->max_timestamp,
+                    (long long)segment->entries);
+        } else {
+            fprintf(out, "open %04d-%02d\n", segment->month / 12, segment->month % 12 + 1);
+        }
+    }
+
+    int status = 0;
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0){
+        perror("Error writing log manifest");
+        status = -1;
+    }
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    if (status == 0 && rename(name, filename) != 0){
+        perror("Error writing log manifest");
+        status = -1;
+    }
+    if (status != 0){
+        unlink(name);
+    }
+    return status;
+}
+
+// State passed through log_scan while reading the open month
+typedef struct {
+    time_t start_time;
+    time_t end_time;
+    gorilla_callback callback;
+    void *context;
+    long undated;                 // Entries before the first valid time line
+} text_segment_context;
+
+/**
+ * scan_text_segment_entry - log_scan callback that reports the entries in the window as records.
+ */
+static int scan_text_segment_entry(const scanned_entry *scanned, void *context){
+    text_segment_context *scan = context;
+    if (scanned->kind != SCAN_ENTRY){
+        return 0;
+    }
+    if (!scanned->has_timestamp){
+        scan->undated++;
+        return 0;
+    }
+    if (scanned->timestamp < scan->start_time || scanned->timestamp > scan->end_time){
+        return 0;
+    }
+
+    log_entry entry;
+    log_record record;
+    scanned_to_entry(scanned, &entry);
+    entry_to_record(&entry, scanned->timestamp, &record);
+    return scan->callback(&record, scan->context);
+}
+
+/**
+ * scan_text_segment - Reports the entries of a text log within a window as records,
+ * starting from the first indexed block of the window.
+ */
+static int scan_text_segment(const char *filename, time_t start_time, time_t end_time,
+                             gorilla_callback callback, void *context, long *undated){
+    log_map map;
+    if (log_map_open(&map, filename) != 0){
+        return -1;
+    }
+
+    // Reading a whole month, as when closing it, needs no index
+    size_t offset = start_time > (time_t)INT64_MIN ? (size_t)log_index_seek(filename, start_time) : 0;
+    if (offset > map.size){
+        offset = 0;
+    }
+
+    text_segment_context scan = {start_time, end_time, callback, context, 0};
+    int status = log_scan(map.data + offset, map.size - offset, scan_text_segment_entry, &scan);
+    log_map_close(&map);
+    if (undated != NULL){
+        *undated = scan.undated;
+    }
+    return status;
+}
+
+/**
+ * scan_segments - Reports the entries of the months of a manifest that overlap a
+ * window, in month order. Closed months are decoded block by block; the open month
+ * is read as text.
+ */
+static int scan_segments(const char *filename, const segment_manifest *manifest, time_t start_time,
+                         time_t end_time, gorilla_callback callback, void *context){
+    char name[512];
+    for (int i = 0; i < manifest->count; i++){
+        const log_segment *segment = &manifest->segments[i];
+        int status;
+        if (segment->closed){
+            if (segment->max_timestamp < (int64_t)start_time || segment->min_timestamp > (int64_t)end_time){
+                continue;
+            }
+            segment_filename(filename, segment->month, 1, name, sizeof(name));
+            status = gorilla_read(name, start_time, end_time, callback, context);
+        } else {
+            segment_filename(filename, segment->month, 0, name, sizeof(name));
+            status = scan_text_segment(name, start_time, end_time, callback, context, NULL);
+        }
+        if (status != 0){
+            return status;
+        }
+    }
+    return 0;
+}
+
+/**
+ * collect_record - Callback that adds each record to a record_list.
+ */
+static int collect_record(const log_record *record, void *context){
+    record_list *list = context;
+    if (list->count == list->capacity){
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 1024;
+        log_record *records = realloc(list->records, capacity * sizeof(log_record));
+        if (records == NULL){
+            perror("Error reading log segment");
+            return -1;
+        }
+        list->records = records;
+        list->capacity = capacity;
+    }
+    list->records[list->count++] = *record;
+    return 0;
+}
+
+/**
+ * close_segment - Compresses a list of entries into a month's segment file and fills in
+ * the times and number of entries it holds.
+ */
+static int close_segment(const char *filename, log_segment *segment, const log_record *records, size_t count,
+                         int64_t *size){
+    char name[512];
+    segment_filename(filename, segment->month, 1, name, sizeof(name));
+    if (gorilla_write(name, records, count, size) != 0){
+        return -1;
+    }
+
+    segment->closed = 1;
+    segment->entries = (int64_t)count;
+    segment->min_timestamp = records[0].timestamp;
+    segment->max_timestamp = records[0].timestamp;
+    for (size_t i = 1; i < count; i++){
+        if (records[i].timestamp < segment->min_timestamp){
+            segment->min_timestamp = records[i].timestamp;
+        }
+        if (records[i].timestamp > segment->max_timestamp){
+            segment->max_timestamp = records[i].timestamp;
+        }
+    }
+    return 0;
+}
+
+/**
+ * remove_text_segment - Removes a month's text file and its sidecars once the month is closed.
+ */
+static void remove_text_segment(const char *name){
+    const char *suffixes[] = {"", INDEX_SUFFIX, STATS_SUFFIX, ROLLUP_SUFFIX, IDS_SUFFIX};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++){
+        char sidecar[600];
+        snprintf(sidecar, sizeof(sidecar), "%s%s", name, suffixes[i]);
+        unlink(sidecar);
+    }
+}
+
+/**
+ * open_month - Opens the open month of a segmented log for appending.
+ */
+static int open_month(storage *store){
+    segmented_log *log = store->segments;
+    char name[512];
+    segment_filename(store->filename, open_segment(&log->manifest)->month, 0, name, sizeof(name));
+    if (storage_open(&log->open, name, log->policy, log->sync_every, log->sync_interval_ms) != 0){
+        return -1;
+    }
+    struct stat segment_stat;
+    log->open_empty = stat(name, &segment_stat) == 0 && segment_stat.st_size == 0;
+    return 0;
+}
+
+/**
+ * move_open_month - Moves an open month that has no entries yet back to an earlier
+ * month, so a new log loaded with its history is split into months from the start.
+ * The open month stays after the last closed one.
+ */
+static int move_open_month(storage *store, int month){
+    segmented_log *log = store->segments;
+    segment_manifest *manifest = &log->manifest;
+    if (manifest->count >= 2 && manifest->segments[manifest->count - 2].month >= month){
+        return 0;
+    }
+
+    log_segment *segment = open_segment(manifest);
+    char name[512];
+    segment_filename(store->filename, segment->month, 0, name, sizeof(name));
+    int status = storage_close(&log->open);
+    int previous = segment->month;
+    segment->month = month;
+    if (status != 0 || write_manifest(store->filename, manifest) != 0){
+        segment->month = previous;
+        open_month(store);
+        return -1;
+    }
+    remove_text_segment(name);
+    return open_month(store);
+}
+
+/**
+ * roll_over - Closes the open month and opens a later one. The compressed segment is
+ * on disk before the manifest names it, and the text file is only removed after, so a
+ * crash at any point leaves every entry in a month the manifest names.
+ */
+static int roll_over(storage *store, int month){
+    segmented_log *log = store->segments;
+    log_segment *segment = open_segment(&log->manifest);
+    char name[512];
+    segment_filename(store->filename, segment->month, 0, name, sizeof(name));
+
+    int status = storage_close(&log->open);
+    record_list list = {NULL, 0, 0};
+    if (status == 0){
+        status = scan_text_segment(name, (time_t)INT64_MIN, (time_t)INT64_MAX, collect_record, &list, NULL);
+    }
+
+    // A month that got no entries is dropped rather than closed
+    log_segment closed = *segment;
+    if (status == 0 && list.count > 0){
+        status = close_segment(store->filename, &closed, list.records, list.count, NULL);
+    }
+    free(list.records);
+
+    if (status == 0){
+        // The manifest is rebuilt with the month closed and the next one open
+        log_segment next = {month, 0, 0, 0, 0};
+        segment_manifest manifest = {NULL, 0, 0};
+        for (int i = 0; i < log->manifest.count - 1 && status == 0; i++){
+            status = add_segment(&manifest, &log->manifest.segments[i]);
+        }
+        if (status != 0 || (closed.closed && add_segment(&manifest, &closed) != 0) ||
+            add_segment(&manifest, &next) != 0 || write_manifest(store->filename, &manifest) != 0){
+            free(manifest.segments);
+            status = -1;
+        } else {
+            free(log->manifest.segments);
+            log->manifest = manifest;
+        }
+    }
+    if (status != 0){
+        if (closed.closed){
+            char compressed[512];
+            segment_filename(store->filename, closed.month, 1, compressed, sizeof(compressed));
+            unlink(compressed);
+        }
+        printf("Error closing log segment %s; entries are still logged to it.\n", name);
+        open_month(store);
+        return -1;
+    }
+
+    remove_text_segment(name);
+    return open_month(store);
+}
+
+static int segment_open(storage *store, sync_policy policy, int sync_every, long sync_interval_ms){
+    segmented_log *log = calloc(1, sizeof(segmented_log));
+    if (log == NULL){
+        perror("Error opening log file");
+        return -1;
+    }
+    log->policy = policy;
+    log->sync_every = sync_every;
+    log->sync_interval_ms = sync_interval_ms;
+
+    // One writer at a time, as the open month moves from file to file
+    char name[512];
+    snprintf(name, sizeof(name), "%s%s", store->filename, SEGMENT_LOCK_SUFFIX);
+    log->lock = log_lock_try(name);
+    if (log->lock < 0){
+        if (errno == EAGAIN || errno == EACCES){
+            printf("Error: %s is already open for writing.\n", store->filename);
+        } else {
+            perror("Error opening log file");
+        }
+        free(log);
+        return -1;
+    }
+
+    int status = read_manifest(store->filename, &log->manifest);
+    if (status != 0 && errno == ENOENT){
+        status = 0;
+    } else if (status != 0){
+        perror("Error opening log file");
+    }
+    if (status == 0 && open_segment(&log->manifest) == NULL){
+        log_segment segment = {month_of(time(NULL)), 0, 0, 0, 0};
+        if (log->manifest.count > 0 && log->manifest.segments[log->manifest.count - 1].month >= segment.month){
+            segment.month = log->manifest.segments[log->manifest.count - 1].month + 1;
+        }
+        if (add_segment(&log->manifest, &segment) != 0 || write_manifest(store->filename, &log->manifest) != 0){
+            status = -1;
+        }
+    }
+
+    store->segments = log;
+    if (status == 0 && open_month(store) != 0){
+        status = -1;
+    }
+    if (status != 0){
+        free(log->manifest.segments);
+        close(log->lock);
+        free(log);
+        store->segments = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int segment_append(storage *store, const log_entry *entry, time_t timestamp){
+    segmented_log *log = store->segments;
+    int month = month_of(timestamp);
+    int open = open_segment(&log->manifest)->month;
+    if (month > open){
+        roll_over(store, month);
+    } else if (month < open && log->open_empty){
+        move_open_month(store, month);
+    }
+    if (log->open.backend == NULL && open_month(store) != 0){
+        return -1;
+    }
+    if (storage_append(&log->open, entry, timestamp) != 0){
+        return -1;
+    }
+    log->open_empty = 0;
+    return 0;
+}
+
+static int segment_flush(storage *store){
+    segmented_log *log = store->segments;
+    return log->open.backend != NULL ? storage_flush(&log->open) : -1;
+}
+
+static int segment_sync(storage *store){
+    segmented_log *log = store->segments;
+    return log->open.backend != NULL ? storage_sync(&log->open) : -1;
+}
+
+// State passed through scan_segments for storage_scan
+typedef struct {
+    storage_callback callback;
+    void *context;
+} segment_scan_context;
+
+/**
+ * report_record - Callback that reports a record to a storage_callback as an entry without an ID.
+ */
+static int report_record(const log_record *record, void *context){
+    segment_scan_context *scan = context;
+    log_entry entry;
+    record_to_entry(record, &entry);
+    return scan->callback(0, (time_t)record->timestamp, &entry, scan->context);
+}
+
+static int segment_scan(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context){
+    segmented_log *log = store->segments;
+    segment_scan_context scan = {callback, context};
+    return scan_segments(store->filename, &log->manifest, start_time, end_time, report_record, &scan);
+}
+
+// Totals of the closed months in a window
+typedef struct {
+    stats_totals glucose;
+    rollup_row totals;
+    int last_range;               // ROLLUP_BELOW, ROLLUP_IN_RANGE or ROLLUP_ABOVE
+} segment_totals;
+
+/**
+ * total_record - Callback that adds a record to the totals, as the statistics and rollup
+ * sidecars would.
+ */
+static int total_record(const log_record *record, void *context){
+    segment_totals *totals = context;
+    if (record->flags & RECORD_FLAG_BLOOD_GLUCOSE){
+        float reading = record->blood_glucose_level;
+        int range = reading < lower_target ? ROLLUP_BELOW : reading > upper_target ? ROLLUP_ABOVE : ROLLUP_IN_RANGE;
+        totals->glucose.count++;
+        totals->glucose.below += range == ROLLUP_BELOW;
+        totals->glucose.in_range += range == ROLLUP_IN_RANGE;
+        totals->glucose.above += range == ROLLUP_ABOVE;
+        totals->glucose.sum += reading;
+        totals->glucose.sum_squares += (double)reading * reading;
+
+        rollup_row row;
+        memset(&row, 0, sizeof(row));
+        row.readings = 1;
+        row.min = reading;
+        row.max = reading;
+        row.sum = reading;
+        row.sum_squares = (double)reading * reading;
+        row.hypo_events = range == ROLLUP_BELOW && totals->last_range != ROLLUP_BELOW;
+        row.hyper_events = range == ROLLUP_ABOVE && totals->last_range != ROLLUP_ABOVE;
+        rollup_merge_row(&totals->totals, &row);
+        totals->last_range = range;
+    }
+    if (record->flags & RECORD_FLAG_CARBS){
+        totals->totals.carbs += record->meal_time_carbs;
+    }
+    if (record->flags & RECORD_FLAG_INSULIN){
+        totals->totals.bolus += record->insulin_dosage;
+    }
+    if (record->flags & RECORD_FLAG_CORRECTION){
+        totals->totals.correction += record->correction_dosage;
+    }
+    return 0;
+}
+
+static int segment_aggregate(storage *store, time_t start_time, time_t end_time, storage_summary *summary){
+    segmented_log *log = store->segments;
+    segment_totals totals;
+    memset(&totals, 0, sizeof(totals));
+    totals.last_range = ROLLUP_IN_RANGE;
+
+    // Closed months are decoded; the open month answers from its sidecars
+    char name[512];
+    stats_totals glucose = {0};
+    for (int i = 0; i < log->manifest.count; i++){
+        const log_segment *segment = &log->manifest.segments[i];
+        if (!segment->closed){
+            segment_filename(store->filename, segment->month, 0, name, sizeof(name));
+            if (glucose_stats_totals(name, start_time, end_time, &glucose) != 0 ||
+                rollup_window(name, start_time, end_time, &summary->totals) != 0){
+                return -1;
+            }
+        } else if (segment->max_timestamp >= (int64_t)start_time && segment->min_timestamp <= (int64_t)end_time){
+            segment_filename(store->filename, segment->month, 1, name, sizeof(name));
+            if (gorilla_read(name, start_time, end_time, total_record, &totals) != 0){
+                return -1;
+            }
+        }
+    }
+
+    glucose.count += totals.glucose.count;
+    glucose.below += totals.glucose.below;
+    glucose.in_range += totals.glucose.in_range;
+    glucose.above += totals.glucose.above;
+    glucose.sum += totals.glucose.sum;
+    glucose.sum_squares += totals.glucose.sum_squares;
+    summarize_totals(&glucose, &summary->glucose);
+    rollup_merge_row(&summary->totals.totals, &totals.totals);
+    return 0;
+}
+
+static int segment_print_logs(storage *store, FILE *out, const char *time_filter, const log_page *page){
+    return segments_print_logs(out, store->filename, time_filter, page);
+}
+
+/**
+ * no_ids - Reports that entries of segmented logs cannot be read or changed by ID.
+ */
+static int no_ids(void){
+    printf("Error: entries of segmented logs have no IDs and cannot be edited.\n");
+    return -1;
+}
+
+static int segment_get(storage *store, int64_t id, time_t *timestamp, log_entry *entry){
+    (void)store;
+    (void)id;
+    (void)timestamp;
+    (void)entry;
+    return no_ids();
+}
+
+static int segment_edit(storage *store, int64_t id, const log_entry *entry){
+    (void)store;
+    (void)id;
+    (void)entry;
+    return no_ids();
+}
+
+static int segment_remove(storage *store, int64_t id){
+    (void)store;
+    (void)id;
+    return no_ids();
+}
+
+static int segment_close(storage *store){
+    segmented_log *log = store->segments;
+    int status = storage_close(&log->open);
+    free(log->manifest.segments);
+    close(log->lock);
+    free(log);
+    store->segments = NULL;
+    return status;
+}
+
+const storage_backend segment_backend = {
+    "segments", segment_open, segment_append, segment_flush, segment_sync, segment_scan, segment_aggregate,
+    segment_print_logs, segment_get, segment_edit, segment_remove, segment_close
+};
+
+/**
+ * print_record - Callback that renders a record into a report as View Logs shows an entry.
+ */
+static int print_record(const log_record *record, void *context){
+    display_record(context, record, 0, 0);
+    return 0;
+}
+
+/**
+ * print_segments_page - Renders a page of a segmented log, newest first. Months are read
+ * from the newest back until the page is full. A closed month that lies wholly within
+ * the window and before the page is passed over by its entry count, without decoding it.
+ */
+static int print_segments_page(const char *filename, const segment_manifest *manifest, time_t start_time,
+                               report *r){
+    record_list list = {NULL, 0, 0};
+    char name[512];
+    int status = 0;
+    for (int i = manifest->count - 1; i >= 0 && status == 0 && !report_done(r); i--){
+        const log_segment *segment = &manifest->segments[i];
+        if (segment->closed && segment->max_timestamp < (int64_t)start_time){
+            continue;
+        }
+        if (segment->closed && segment->min_timestamp >= (int64_t)start_time && segment->entries <= r->skip){
+            report_skip(r, (long)segment->entries);
+            continue;
+        }
+
+        segment_filename(filename, segment->month, segment->closed, name, sizeof(name));
+        list.count = 0;
+        if (segment->closed){
+            status = gorilla_read(name, start_time, (time_t)INT64_MAX, collect_record, &list);
+        } else {
+            status = scan_text_segment(name, start_time, (time_t)INT64_MAX, collect_record, &list, NULL);
+        }
+        for (size_t j = list.count; status == 0 && j > 0 && !report_done(r); j--){
+            if (report_next(r)){
+                display_record(r, &list.records[j - 1], 0, 0);
+            }
+        }
+    }
+    free(list.records);
+    return status;
+}
+
+int segments_print_logs(FILE *out, const char *manifest, const char *time_filter, const log_page *page){
+    uint64_t start = probe_begin();
+    time_t start_time;
+    if (time_filter_start(time_filter, &start_time) != 0){
+        return -1;
+    }
+
+    segment_manifest segments;
+    if (read_manifest(manifest, &segments) != 0){
+        if (errno == ENOENT){
+            perror("Error opening log file");
+        }
+        return -1;
+    }
+
+    report output;
+    if (report_open(&output, out, read_config("blood glucose unit"), page) != 0){
+        free(segments.segments);
+        return -1;
+    }
+    int status;
+    if (page != NULL){
+        status = print_segments_page(manifest, &segments, start_time, &output);
+    } else {
+        status = scan_segments(manifest, &segments, start_time, (time_t)INT64_MAX, print_record, &output);
+    }
+    if (report_close(&output) != 0){
+        status = -1;
+    }
+    free(segments.segments);
+    probe_end(PROBE_QUERY, start, 0);
+    return status;
+}
+
+// A record and the local month it falls in, for sorting a log into months
+typedef struct {
+    int month;
+    size_t order;                 // Position in the log, to keep entries in log order within a month
+    log_record record;
+} dated_record;
+
+int segments_verify(FILE *out, const char *manifest){
+    segment_manifest list;
+    if (read_manifest(manifest, &list) != 0){
+        if (errno == ENOENT){
+            perror("Error opening segmented log");
+        }
+        return -1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < list.count && status >= 0; i++){
+        char name[512];
+        segment_filename(manifest, list.segments[i].month, list.segments[i].closed, name, sizeof(name));
+        int checked = list.segments[i].closed ? gorilla_verify(out, name) : log_verify(out, name);
+        status = checked < 0 ? -1 : checked > status ? checked : status;
+    }
+    free(list.segments);
+    return status;
+}
+
+/**
+ * compare_dated - qsort comparator ordering records by month, then by position in the log.
+ */
+static int compare_dated(const void *a, const void *b){
+    const dated_record *left = a;
+    const dated_record *right = b;
+    if (left->month != right->month){
+        return left->month < right->month ? -1 : 1;
+    }
+    return left->order < right->order ? -1 : left->order > right->order;
+}
+
+/**
+ * write_text_segment - Writes the entries of the open month as a new text log.
+ */
+static int write_text_segment(const char *name, const log_record *records, size_t count, int64_t *size){
+    FILE *out = fopen(name, "w");
+    if (out == NULL){
+        perror("Error creating log segment");
+        return -1;
+    }
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++){
+        log_entry entry;
+        record_to_entry(&records[i], &entry);
+        char text[LOG_ENTRY_MAX];
+        int length = format_log_entry(text, sizeof(text), &entry, (time_t)records[i].timestamp);
+        if (length < 0 || (size_t)length >= sizeof(text) || fputs(text, out) < 0){
+            perror("Error writing log segment");
+            status = -1;
+        }
+    }
+    if (status == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0)){
+        perror("Error writing log segment");
+        status = -1;
+    }
+    *size = (int64_t)ftell(out);
+    if (fclose(out) != 0){
+        status = -1;
+    }
+    return status;
+}
+
+int segments_split(const char *text_filename, const char *manifest){
+    if (!is_segmented_log(manifest)){
+        printf("Error: the manifest of a segmented log must end in %s.\n", STORAGE_SEGMENT_SUFFIX);
+        return -1;
+    }
+    if (is_binary_log(text_filename) || is_segmented_log(text_filename) ||
+        storage_backend_for(text_filename) == &sqlite_backend){
+        printf("Error: %s is not a text log.\n", text_filename);
+        return -1;
+    }
+    struct stat manifest_stat;
+    if (stat(manifest, &manifest_stat) == 0){
+        printf("Error: %s already exists.\n", manifest);
+        return -1;
+    }
+
+    // Segments keep entries as logged, so edits are folded in first
+    long folded;
+    if (log_compact(text_filename, &folded) != 0){
+        return -1;
+    }
+
+    record_list list = {NULL, 0, 0};
+    long undated = 0;
+    if (scan_text_segment(text_filename, (time_t)INT64_MIN, (time_t)INT64_MAX, collect_record, &list, &undated) != 0){
+        free(list.records);
+        return -1;
+    }
+    struct stat text_stat;
+    if (stat(text_filename, &text_stat) != 0){
+        text_stat.st_size = 0;
+    }
+
+    dated_record *dated = malloc((list.count > 0 ? list.count : 1) * sizeof(dated_record));
+    if (dated == NULL){
+        perror("Error splitting log");
+        free(list.records);
+        return -1;
+    }
+    for (size_t i = 0; i < list.count; i++){
+        dated[i].month = month_of((time_t)list.records[i].timestamp);
+        dated[i].order = i;
+        dated[i].record = list.records[i];
+    }
+    qsort(dated, list.count, sizeof(dated_record), compare_dated);
+    for (size_t i = 0; i < list.count; i++){
+        list.records[i] = dated[i].record;
+    }
+
+    // Every month but the latest is compressed; the latest stays open for appends
+    segment_manifest segments = {NULL, 0, 0};
+    int64_t compressed = 0;
+    int64_t open_size = 0;
+    int status = 0;
+    size_t first = 0;
+    char name[512];
+    while (first < list.count && status == 0){
+        size_t last = first;
+        while (last < list.count && dated[last].month == dated[first].month){
+            last++;
+        }
+        log_segment segment = {dated[first].month, 0, 0, 0, 0};
+        if (last < list.count){
+            int64_t size;
+            status = close_segment(manifest, &segment, list.records + first, last - first, &size);
+            compressed += size;
+        } else {
+            segment_filename(manifest, segment.month, 0, name, sizeof(name));
+            status = write_text_segment(name, list.records + first, last - first, &open_size);
+        }
+        if (status == 0){
+            status = add_segment(&segments, &segment);
+        }
+        first = last;
+    }
+    if (status == 0){
+        status = write_manifest(manifest, &segments);
+    }
+
+    if (status == 0){
+        printf("Split %zu entries of %s into %d closed months (%lld bytes) and an open month (%lld bytes),\n"
+               "from %lld bytes of text.\n", list.count, text_filename, segments.count > 0 ? segments.count - 1 : 0,
+               (long long)compressed, (long long)open_size, (long long)text_stat.st_size);
+        if (undated > 0){
+            printf("Left out %ld entries logged before the first valid time line.\n", undated);
+        }
+    } else {
+        // Nothing names the segments written so far
+        for (int i = 0; i < segments.count; i++){
+            segment_filename(manifest, segments.segments[i].month, segments.segments[i].closed, name, sizeof(name));
+            unlink(name);
+        }
+        printf("Failed to split %s.\n", text_filename);
+    }
+    free(segments.segments);
+    free(dated);
+    free(list.records);
+    return status;
+}
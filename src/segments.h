@@ -0,0 +1,71 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "logging.h"
+
+// A segmented log is a manifest, e.g. data/logs.seg, naming one file per local month:
+// data/logs.seg.2026-09.gor for a closed month and data/logs.seg.2026-10.txt for the
+// open one. The open month is an ordinary text log with its own sidecars, which new
+// entries are appended to. Once an entry arrives for a later month, the open month is
+// closed: its entries are compressed into a segment file (see gorilla.h), the manifest
+// is rewritten to name it, and the text file is removed. Queries only open the segments
+// whose entries overlap their window.
+//
+// The manifest starts with SEGMENT_MAGIC, then has one line per month in month order:
+//   closed YYYY-MM MIN_TIME MAX_TIME ENTRIES
+//   open YYYY-MM
+// Entries are logged to the open month whatever their time, so a closed month's line
+// records the times it actually holds.
+#define SEGMENT_MAGIC "DMSSEG1"
+
+// Suffixes of the segment files and the lock file held by the log's single writer
+#define SEGMENT_OPEN_SUFFIX ".txt"
+#define SEGMENT_CLOSED_SUFFIX ".gor"
+#define SEGMENT_LOCK_SUFFIX ".lock"
+
+/**
+ * is_segmented_log - Checks whether a log file is the manifest of a segmented log.
+ * Segmented logs are identified by the ".seg" extension.
+ *
+ * @param filename: Name of the log file.
+ * @return: 1 if the file is a segmented log, 0 otherwise.
+ */
+int is_segmented_log(const char *filename);
+
+/**
+ * segments_print_logs - Prints the entries of a segmented log within a time filter, as
+ * View Logs shows them. Only the segments overlapping the window are read.
+ *
+ * @param out: Stream to print to.
+ * @param manifest: Name of the manifest.
+ * @param time_filter: "day", "week", "2 weeks", "month", "90 days" or "all".
+ * @param page: The page to print, newest first, or NULL to print every entry in log order.
+ * @return: 0 for success, -1 for errors.
+ */
+int segments_print_logs(FILE *out, const char *manifest, const char *time_filter, const log_page *page);
+
+/**
+ * segments_verify - Checks every segment of a segmented log against its checksums: the
+ * records of the open month and the blocks of the closed ones. Each segment's damage
+ * and counts are printed.
+ *
+ * @param out: Stream to print the report to.
+ * @param manifest: Name of the manifest.
+ * @return: 0 if nothing is damaged, 1 if something is, -1 for errors.
+ */
+int segments_verify(FILE *out, const char *manifest);
+
+/**
+ * segments_split - Splits a text log into a new segmented log: one compressed segment
+ * per local month, except for the latest month, which is left open. Edits are folded
+ * in first, and entries keep their order within each month. The text log is left as it is.
+ *
+ * @param text_filename: Name of the text log.
+ * @param manifest: Name of the manifest to create; it must not exist.
+ * @return: 0 for success, -1 for errors.
+ */
+int segments_split(const char *text_filename, const char *manifest);
+
+#endif
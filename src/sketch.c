@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include "sketch.h"
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * compare_centroids - Orders centroids by mean for qsort.
+ */
+static int compare_centroids(const void *a, const void *b){
+    double first = ((const sketch_centroid *)a)->mean;
+    double second = ((const sketch_centroid *)b)->mean;
+    return (first > second) - (first < second);
+}
+
+/**
+ * scale - The t-digest k1 scale function: k(q) = compression / (2 pi) * asin(2q - 1).
+ * Centroids may only span one unit of k, so they are small where k is steep, at the tails.
+ */
+static double scale(double fraction){
+    return SKETCH_COMPRESSION / (2.0 * M_PI) * asin(2.0 * fraction - 1.0);
+}
+
+/**
+ * compress - Merges the buffered points into the centroids. Points are sorted by mean
+ * and swept once; neighbours are combined while the result spans at most one unit of k.
+ */
+static void compress(quantile_sketch *sketch){
+    if (sketch->buffered == 0){
+        return;
+    }
+    int count = sketch->centroids + sketch->buffered;
+    qsort(sketch->points, (size_t)count, sizeof(sketch_centroid), compare_centroids);
+
+    double total = sketch->total_weight;
+    double before = 0;            // Weight of the finished centroids
+    double lower_k = scale(0);    // k at the start of the current centroid
+    int kept = 0;
+    sketch_centroid current = sketch->points[0];
+    for (int i = 1; i < count; i++){
+        const sketch_centroid *next = &sketch->points[i];
+        double merged_weight = current.weight + next->weight;
+        if (scale((before + merged_weight) / total) - lower_k <= 1.0){
+            current.mean += (next->mean - current.mean) * next->weight / merged_weight;
+            current.weight = merged_weight;
+        } else {
+            before += current.weight;
+            lower_k = scale(before / total);
+            sketch->points[kept++] = current;
+            current = *next;
+        }
+    }
+    sketch->points[kept++] = current;
+    sketch->centroids = kept;
+    sketch->buffered = 0;
+}
+
+/**
+ * add_point - Buffers a weighted point, compressing first if the buffer is full.
+ */
+static void add_point(quantile_sketch *sketch, double mean, double weight){
+    if (sketch->buffered == SKETCH_BUFFER){
+        compress(sketch);
+    }
+    sketch_centroid *point = &sketch->points[sketch->centroids + sketch->buffered++];
+    point->mean = mean;
+    point->weight = weight;
+    sketch->total_weight += weight;
+}
+
+void sketch_init(quantile_sketch *sketch){
+    sketch->centroids = 0;
+    sketch->buffered = 0;
+    sketch->total_weight = 0;
+    sketch->min = 0;
+    sketch->max = 0;
+}
+
+void sketch_add(quantile_sketch *sketch, double value){
+    if (sketch->total_weight == 0 || value < sketch->min){
+        sketch->min = value;
+    }
+    if (sketch->total_weight == 0 || value > sketch->max){
+        sketch->max = value;
+    }
+    add_point(sketch, value, 1.0);
+}
+
+void sketch_merge(quantile_sketch *into, const quantile_sketch *from){
+    if (from->total_weight == 0){
+        return;
+    }
+    if (into->total_weight == 0 || from->min < into->min){
+        into->min = from->min;
+    }
+    if (into->total_weight == 0 || from->max > into->max){
+        into->max = from->max;
+    }
+    for (int i = 0; i < from->centroids + from->buffered; i++){
+        add_point(into, from->points[i].mean, from->points[i].weight);
+    }
+}
+
+double sketch_quantile(quantile_sketch *sketch, double fraction){
+    compress(sketch);
+    if (sketch->centroids == 0){
+        return 0;
+    }
+    if (fraction <= 0){
+        return sketch->min;
+    }
+    if (fraction >= 1){
+        return sketch->max;
+    }
+
+    // Each centroid's mean sits at the middle of its weight; interpolate between
+    // neighbouring middles, and between the outer middles and the min and max.
+    const sketch_centroid *points = sketch->points;
+    int count = sketch->centroids;
+    double target = fraction * sketch->total_weight;
+    double position = points[0].weight / 2;
+    if (target < position){
+        return sketch->min + (points[0].mean - sketch->min) * target / position;
+    }
+    for (int i = 0; i + 1 < count; i++){
+        double next_position = position + (points[i].weight + points[i + 1].weight) / 2;
+        if (target < next_position){
+            return points[i].mean + (points[i + 1].mean - points[i].mean) *
+                   (target - position) / (next_position - position);
+        }
+        position = next_position;
+    }
+    double remaining = sketch->total_weight - position;
+    if (remaining <= 0){
+        return sketch->max;
+    }
+    return points[count - 1].mean + (sketch->max - points[count - 1].mean) * (target - position) / remaining;
+}
@@ -0,0 +1,62 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+// Accuracy of the quantile sketch; a sketch keeps at most SKETCH_COMPRESSION + 1 centroids
+#define SKETCH_COMPRESSION 100
+
+// Values held unmerged before the sketch is compressed
+#define SKETCH_BUFFER 256
+
+// A weighted point: the mean of the values it stands for
+typedef struct {
+    double mean;
+    double weight;
+} sketch_centroid;
+
+// Bounded-memory summary of a stream of values for estimating quantiles (a merging
+// t-digest). Values are buffered and periodically merged into centroids, which are
+// kept small near the tails so extreme quantiles stay accurate. Sketches of
+// separate streams can be merged into a sketch of the combined stream.
+typedef struct {
+    int centroids;                // Compressed centroids at the start of points
+    int buffered;                 // Unmerged points after them
+    double total_weight;          // Number of values added
+    double min;                   // Smallest value added
+    double max;                   // Largest value added
+    sketch_centroid points[SKETCH_COMPRESSION + 1 + SKETCH_BUFFER];
+} quantile_sketch;
+
+/**
+ * sketch_init - Empties a sketch.
+ *
+ * @param sketch: The sketch to initialise.
+ */
+void sketch_init(quantile_sketch *sketch);
+
+/**
+ * sketch_add - Adds one value to a sketch.
+ *
+ * @param sketch: The sketch.
+ * @param value: The value to add.
+ */
+void sketch_add(quantile_sketch *sketch, double value);
+
+/**
+ * sketch_merge - Adds every value summarised by one sketch to another.
+ *
+ * @param into: The sketch to add to.
+ * @param from: The sketch to add; left unchanged.
+ */
+void sketch_merge(quantile_sketch *into, const quantile_sketch *from);
+
+/**
+ * sketch_quantile - Estimates a quantile of the values added to a sketch, by
+ * interpolating between centroids. Compresses any buffered values first.
+ *
+ * @param sketch: The sketch.
+ * @param fraction: The quantile, from 0 (minimum) to 1 (maximum).
+ * @return: The estimate, or 0 if the sketch is empty.
+ */
+double sketch_quantile(quantile_sketch *sketch, double fraction);
+
+#endif
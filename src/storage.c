@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "storage.h"
+#include "records.h"
+#include "log_index.h"
+#include "log_scan.h"
+#include "log_ids.h"
+#include "log_edit.h"
+#include "instrument.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * has_suffix - Checks whether a file name ends in a suffix.
+ */
+static int has_suffix(const char *filename, const char *suffix){
+    size_t length = strlen(filename);
+    size_t suffix_length = strlen(suffix);
+    return length > suffix_length && strcmp(filename + length - suffix_length, suffix) == 0;
+}
+
+/**
+ * file_open - Opens a text or binary log through a log writer held for the session.
+ */
+static int file_open(storage *store, sync_policy policy, int sync_every, long sync_interval_ms){
+    store->writer = malloc(sizeof(log_writer));
+    if (store->writer == NULL){
+        perror("Error opening log file");
+        return -1;
+    }
+    if (log_writer_open(store->writer, store->filename, policy, sync_every, sync_interval_ms) != 0){
+        free(store->writer);
+        store->writer = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int file_append(storage *store, const log_entry *entry, time_t timestamp){
+    return log_writer_append(store->writer, entry, timestamp);
+}
+
+static int file_flush(storage *store){
+    return log_writer_flush(store->writer);
+}
+
+static int file_sync(storage *store){
+    return log_writer_sync(store->writer);
+}
+
+// State passed through log_scan while scanning a text log for storage_scan
+typedef struct {
+    time_t start_time;
+    time_t end_time;
+    storage_callback callback;
+    void *context;
+    const log_map *map;           // The log, for reading edits
+    const log_ids *ids;
+    int64_t hint;                 // Slot of the entry reported before
+} text_scan_context;
+
+/**
+ * scan_text_entry - log_scan callback that reports the latest version of the entries
+ * within the window.
+ */
+static int scan_text_entry(const scanned_entry *scanned, void *context){
+    text_scan_context *scan = context;
+    if (scanned->kind != SCAN_ENTRY || !scanned->has_timestamp ||
+        scanned->timestamp < scan->start_time || scanned->timestamp > scan->end_time){
+        return 0;
+    }
+
+    const scanned_entry *latest = scanned;
+    scanned_entry edit;
+    int64_t id = 0;
+    if (scanned->time_line != NULL){
+        int64_t offset = (int64_t)(scanned->time_line - scan->map->data);
+        int64_t current;
+        id = log_ids_latest(scan->ids, offset, &scan->hint, &current);
+        if (id == LOG_ID_DELETED){
+            return 0;
+        }
+        if (current != offset && (size_t)current < scan->map->size &&
+            log_scan_record(scan->map->data, scan->map->size, (size_t)current, &edit) == 0 &&
+            edit.kind == SCAN_EDIT){
+            latest = &edit;
+        }
+    }
+
+    // The scanner records which lines it saw; entries carry that as their flags
+    log_entry entry;
+    scanned_to_entry(latest, &entry);
+    return scan->callback(id, scanned->timestamp, &entry, scan->context);
+}
+
+/**
+ * scan_records - Reports the latest version of the records of a mapped binary log within the window.
+ */
+static int scan_records(const log_map *map, size_t offset, time_t start_time, time_t end_time,
+                        const log_ids *ids, storage_callback callback, void *context){
+    const log_record *records = (const log_record *)(map->data + offset);
+    size_t count = (map->size - offset) / sizeof(log_record);
+    int64_t hint = -1;
+    for (size_t i = 0; i < count; i++){
+        if (records[i].timestamp < (int64_t)start_time || records[i].timestamp > (int64_t)end_time ||
+            (records[i].flags & RECORD_FLAG_REVISION) || !record_intact(&records[i])){
+            continue;
+        }
+        int64_t current;
+        int64_t id = log_ids_latest(ids, (int64_t)(offset + i * sizeof(log_record)), &hint, &current);
+        if (id == LOG_ID_DELETED){
+            continue;
+        }
+        const log_record *latest = &records[i];
+        if (current != (int64_t)(offset + i * sizeof(log_record)) &&
+            (size_t)current + sizeof(log_record) <= map->size &&
+            record_intact((const log_record *)(map->data + current))){
+            latest = (const log_record *)(map->data + current);
+        }
+
+        log_entry entry;
+        record_to_entry(latest, &entry);
+        int status = callback(id, (time_t)records[i].timestamp, &entry, context);
+        if (status != 0){
+            return status;
+        }
+    }
+    return 0;
+}
+
+/**
+ * file_scan - Scans a text or binary log from the first indexed block of the window.
+ */
+static int file_scan(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context){
+    log_map map;
+    if (log_map_open(&map, store->filename) != 0){
+        return -1;
+    }
+
+    // Skip straight to the first block that can hold entries in the window
+    size_t offset = (size_t)log_index_seek(store->filename, start_time);
+    if (offset > map.size){
+        offset = 0;
+    }
+
+    // Entries are reported in their latest version; without the ID file they are reported as logged
+    log_ids ids;
+    log_ids_open(&ids, store->filename);
+
+    int status;
+    if (store->writer->binary){
+        if (map.size < sizeof(record_header) || memcmp(map.data, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0){
+            printf("Error: %s is not a binary log file.\n", store->filename);
+            log_ids_close(&ids);
+            log_map_close(&map);
+            return -1;
+        }
+        if (offset < sizeof(record_header)){
+            offset = sizeof(record_header);
+        }
+        status = scan_records(&map, offset, start_time, end_time, &ids, callback, context);
+    } else {
+        text_scan_context scan = {start_time, end_time, callback, context, &map, &ids, -1};
+        status = log_scan(map.data + offset, map.size - offset, scan_text_entry, &scan);
+    }
+
+    log_ids_close(&ids);
+    log_map_close(&map);
+    return status;
+}
+
+/**
+ * file_aggregate - Answers from the statistics and rollup sidecars of the log.
+ */
+static int file_aggregate(storage *store, time_t start_time, time_t end_time, storage_summary *summary){
+    if (glucose_stats_window(store->filename, start_time, end_time, &summary->glucose) != 0 ||
+        rollup_window(store->filename, start_time, end_time, &summary->totals) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+static int file_print_logs(storage *store, FILE *out, const char *time_filter, const log_page *page){
+    return print_logs(out, store->filename, time_filter, page);
+}
+
+static int file_get(storage *store, int64_t id, time_t *timestamp, log_entry *entry){
+    // The ID file only covers entries that have reached the log
+    if (log_writer_flush(store->writer) != 0){
+        return -1;
+    }
+    return log_get_entry(store->filename, id, timestamp, entry);
+}
+
+/**
+ * compact_in_background - Thread body: compacts a log.
+ */
+static void *compact_in_background(void *argument){
+    storage *store = argument;
+    long folded;
+    log_compact(store->filename, &folded);
+    instrument_thread_exit();
+    return NULL;
+}
+
+/**
+ * start_compaction - Starts compacting the log on a thread of its own once enough of it
+ * has been edited or deleted, unless a compaction is still running. Appends made in the
+ * meantime wait for it and then go to the compacted log.
+ */
+static void start_compaction(storage *store){
+    if (store->compacting){
+        if (pthread_tryjoin_np(store->compactor, NULL) != 0){
+            return;
+        }
+        store->compacting = 0;
+    }
+    if (log_compact_due(store->filename) &&
+        pthread_create(&store->compactor, NULL, compact_in_background, store) == 0){
+        store->compacting = 1;
+    }
+}
+
+static int file_edit(storage *store, int64_t id, const log_entry *entry){
+    if (log_writer_flush(store->writer) != 0 || log_edit_entry(store->filename, id, entry) != 0){
+        return -1;
+    }
+    start_compaction(store);
+    return 0;
+}
+
+static int file_remove(storage *store, int64_t id){
+    if (log_writer_flush(store->writer) != 0 || log_delete_entry(store->filename, id) != 0){
+        return -1;
+    }
+    start_compaction(store);
+    return 0;
+}
+
+static int file_close(storage *store){
+    if (store->compacting){
+        pthread_join(store->compactor, NULL);
+        store->compacting = 0;
+    }
+    int status = log_writer_close(store->writer);
+    free(store->writer);
+    store->writer = NULL;
+    return status;
+}
+
+static const storage_backend text_backend = {
+    "text", file_open, file_append, file_flush, file_sync, file_scan, file_aggregate, file_print_logs,
+    file_get, file_edit, file_remove, file_close
+};
+
+static const storage_backend binary_backend = {
+    "binary", file_open, file_append, file_flush, file_sync, file_scan, file_aggregate, file_print_logs,
+    file_get, file_edit, file_remove, file_close
+};
+
+const storage_backend *storage_backend_for(const char *filename){
+    if (has_suffix(filename, STORAGE_SQLITE_SUFFIX) || has_suffix(filename, STORAGE_SQLITE_SUFFIX_LONG)){
+        return &sqlite_backend;
+    }
+    if (has_suffix(filename, STORAGE_SEGMENT_SUFFIX)){
+        return &segment_backend;
+    }
+    return is_binary_log(filename) ? &binary_backend : &text_backend;
+}
+
+int storage_open(storage *store, const char *filename, sync_policy policy, int sync_every, long sync_interval_ms){
+    memset(store, 0, sizeof(*store));
+    if (strlen(filename) >= sizeof(store->filename)){
+        printf("Error: log file name too long.\n");
+        return -1;
+    }
+    if ((policy == SYNC_EVERY_N && sync_every <= 0) || (policy == SYNC_INTERVAL && sync_interval_ms <= 0)){
+        printf("Error: invalid log sync policy.\n");
+        return -1;
+    }
+
+    strcpy(store->filename, filename);
+    store->backend = storage_backend_for(filename);
+    if (store->backend->open(store, policy, sync_every, sync_interval_ms) != 0){
+        store->backend = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int storage_append(storage *store, const log_entry *entry, time_t timestamp){
+    if (store->backend->append(store, entry, timestamp) != 0){
+        return -1;
+    }
+    if (store->insulin.loaded && entry->insulin_dosage_flag &&
+        iob_tracker_add(&store->insulin, timestamp, entry->insulin_dosage) != 0){
+        iob_tracker_clear(&store->insulin);
+    }
+    return 0;
+}
+
+int storage_flush(storage *store){
+    return store->backend->flush(store);
+}
+
+int storage_sync(storage *store){
+    return store->backend->sync(store);
+}
+
+int storage_scan(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context){
+    return store->backend->scan(store, start_time, end_time, callback, context);
+}
+
+int storage_aggregate(storage *store, time_t start_time, time_t end_time, storage_summary *summary){
+    memset(summary, 0, sizeof(*summary));
+    return store->backend->aggregate(store, start_time, end_time, summary);
+}
+
+int storage_print_logs(storage *store, FILE *out, const char *time_filter, const log_page *page){
+    return store->backend->print_logs(store, out, time_filter, page);
+}
+
+int storage_get(storage *store, int64_t id, time_t *timestamp, log_entry *entry){
+    return store->backend->get(store, id, timestamp, entry);
+}
+
+int storage_edit(storage *store, int64_t id, const log_entry *entry){
+    iob_tracker_clear(&store->insulin);
+    return store->backend->edit(store, id, entry);
+}
+
+int storage_remove(storage *store, int64_t id){
+    iob_tracker_clear(&store->insulin);
+    return store->backend->remove(store, id);
+}
+
+// State passed through storage_scan while reading doses into an insulin on board tracker
+typedef struct {
+    iob_tracker *tracker;
+    int64_t exclude_id;
+    int failed;
+} dose_scan;
+
+/**
+ * add_dose - storage_callback adding an entry's insulin dosage to the tracker.
+ */
+static int add_dose(int64_t id, time_t timestamp, const log_entry *entry, void *context){
+    dose_scan *scan = context;
+    if (entry->insulin_dosage_flag && (scan->exclude_id == 0 || id != scan->exclude_id) &&
+        iob_tracker_add(scan->tracker, timestamp, entry->insulin_dosage) != 0){
+        scan->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * load_doses - Reads the doses logged from one duration of insulin action before a time
+ * into a cleared tracker. Doses logged after the time are read too, so the tracker keeps
+ * up with the log for later times.
+ */
+static int load_doses(storage *store, iob_tracker *tracker, const iob_settings *settings,
+                      time_t when, int64_t exclude_id){
+    time_t now = time(NULL);
+    dose_scan scan = {tracker, exclude_id, 0};
+    iob_tracker_clear(tracker);
+    tracker->covered_from = when - settings->duration;
+    if (storage_flush(store) != 0 ||
+        storage_scan(store, tracker->covered_from, when > now ? when : now, add_dose, &scan) < 0 ||
+        scan.failed){
+        iob_tracker_clear(tracker);
+        return -1;
+    }
+    tracker->loaded = 1;
+    return 0;
+}
+
+int storage_insulin_on_board(storage *store, time_t time, int64_t exclude_id, float *units){
+    iob_settings settings;
+    if (iob_read_settings(&settings) != 0){
+        return -1;
+    }
+
+    // Leaving an entry out needs a tracker of its own, read for this one answer
+    if (exclude_id != 0){
+        iob_tracker tracker = {0};
+        int status = load_doses(store, &tracker, &settings, time, exclude_id);
+        if (status == 0){
+            *units = iob_tracker_total(&tracker, &settings, time);
+        }
+        iob_tracker_free(&tracker);
+        return status;
+    }
+
+    iob_tracker *tracker = &store->insulin;
+    if ((!tracker->loaded || time - settings.duration < tracker->covered_from) &&
+        load_doses(store, tracker, &settings, time, 0) != 0){
+        return -1;
+    }
+    *units = iob_tracker_total(tracker, &settings, time);
+    return 0;
+}
+
+int storage_print_stats(storage *store, FILE *out, const char *time_filter){
+    time_t start_time;
+    if (time_filter_start(time_filter, &start_time) != 0){
+        return -1;
+    }
+
+    storage_summary summary;
+    if (storage_aggregate(store, start_time, time(NULL), &summary) != 0){
+        return -1;
+    }
+
+    const char *unit = read_config("blood glucose unit");
+    fprintf(out, "\nGlucose Statistics\n");
+    display_glucose_summary(out, &summary.glucose, unit != NULL ? unit : "mmol/L");
+    display_rollup_summary(out, &summary.totals, unit != NULL ? unit : "mmol/L");
+    return 0;
+}
+
+int storage_close(storage *store){
+    if (store->backend == NULL){
+        return 0;
+    }
+    int status = store->backend->close(store);
+    store->backend = NULL;
+    iob_tracker_free(&store->insulin);
+    return status;
+}
@@ -0,0 +1,230 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "logging.h"
+#include "log_writer.h"
+#include "glucose_stats.h"
+#include "rollup.h"
+#include "iob.h"
+
+// SQLite logs are chosen by file name, like binary logs: data/logs.db or data/logs.sqlite
+#define STORAGE_SQLITE_SUFFIX ".db"
+#define STORAGE_SQLITE_SUFFIX_LONG ".sqlite"
+
+// Segmented logs are chosen by the name of their manifest: data/logs.seg
+#define STORAGE_SEGMENT_SUFFIX ".seg"
+
+// Statistics for a time window, as View Glucose Statistics prints them
+typedef struct {
+    glucose_summary glucose;      // Time in range, mean, variability and GMI
+    rollup_summary totals;        // Extremes, events, carbohydrates and insulin
+} storage_summary;
+
+/**
+ * storage_callback - Called for each entry found by storage_scan.
+ *
+ * @param id: The entry's ID, or 0 if it has none.
+ * @param timestamp: Time of the entry.
+ * @param entry: The entry; only valid during the call.
+ * @param context: The context passed to storage_scan.
+ * @return: 0 to continue scanning, anything else to stop.
+ */
+typedef int (*storage_callback)(int64_t id, time_t timestamp, const log_entry *entry, void *context);
+
+typedef struct storage storage;
+
+// The operations a storage backend provides. Each backend keeps its own state in the
+// storage it is opened into.
+typedef struct {
+    const char *name;             // "text", "binary", "sqlite" or "segments"
+    int (*open)(storage *store, sync_policy policy, int sync_every, long sync_interval_ms);
+    int (*append)(storage *store, const log_entry *entry, time_t timestamp);
+    int (*flush)(storage *store);
+    int (*sync)(storage *store);
+    int (*scan)(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context);
+    int (*aggregate)(storage *store, time_t start_time, time_t end_time, storage_summary *summary);
+    int (*print_logs)(storage *store, FILE *out, const char *time_filter, const log_page *page);
+    int (*get)(storage *store, int64_t id, time_t *timestamp, log_entry *entry);
+    int (*edit)(storage *store, int64_t id, const log_entry *entry);
+    int (*remove)(storage *store, int64_t id);
+    int (*close)(storage *store);
+} storage_backend;
+
+// A log held open for a session through one of the backends.
+struct storage {
+    const storage_backend *backend;
+    char filename[256];           // Name of the log file
+    log_writer *writer;           // Text and binary logs: the session's writer
+    void *database;               // SQLite logs: the backend's connection and statements
+    void *segments;               // Segmented logs: the manifest and the open segment
+    pthread_t compactor;          // Text and binary logs: thread compacting the log
+    int compacting;               // Set while compactor has not been joined
+    iob_tracker insulin;          // Doses still acting, read from the log when first needed
+};
+
+/**
+ * storage_backend_for - Chooses the backend for a log by its file name: SQLite for names
+ * ending in .db or .sqlite, monthly segments for .seg, binary records for .dat, text otherwise.
+ *
+ * @param filename: Name of the log file.
+ * @return: The backend.
+ */
+const storage_backend *storage_backend_for(const char *filename);
+
+/**
+ * storage_open - Opens a log for the rest of the session with the backend its name selects.
+ *
+ * @param store: The storage to initialise.
+ * @param filename: Name of the log file; created if it does not exist.
+ * @param policy: When appended entries are forced to disk.
+ * @param sync_every: Entries per sync for SYNC_EVERY_N.
+ * @param sync_interval_ms: Milliseconds between syncs for SYNC_INTERVAL.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_open(storage *store, const char *filename, sync_policy policy, int sync_every, long sync_interval_ms);
+
+/**
+ * storage_append - Appends an entry, following the sync policy.
+ *
+ * @param store: An open storage.
+ * @param entry: The entry to append.
+ * @param timestamp: Time of the entry.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_append(storage *store, const log_entry *entry, time_t timestamp);
+
+/**
+ * storage_flush - Makes appended entries visible to queries and other processes
+ * without necessarily forcing them to disk.
+ *
+ * @param store: An open storage.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_flush(storage *store);
+
+/**
+ * storage_sync - Makes appended entries visible and forces them to disk.
+ *
+ * @param store: An open storage.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_sync(storage *store);
+
+/**
+ * storage_scan - Reports the entries logged between two times, inclusive, in the order
+ * they were logged. Entries appended but not yet flushed may be left out.
+ *
+ * @param store: An open storage.
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param callback: Function called for each entry.
+ * @param context: Passed through to the callback.
+ * @return: 0 when the range was scanned, the callback's non-zero value, or -1 for errors.
+ */
+int storage_scan(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context);
+
+/**
+ * storage_aggregate - Computes the statistics View Glucose Statistics shows for a time window.
+ * Text and binary logs answer from their sidecar totals, which resolve the window to
+ * whole hours; SQLite logs answer with one aggregate query over the timestamp index.
+ * Segmented logs decode the closed months the window overlaps and answer for the open
+ * month from its sidecars.
+ *
+ * @param store: An open storage.
+ * @param start_time: Start of the time window.
+ * @param end_time: End of the time window.
+ * @param summary: Receives the statistics.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_aggregate(storage *store, time_t start_time, time_t end_time, storage_summary *summary);
+
+/**
+ * storage_print_logs - Prints the entries within a time filter, as View Logs shows them.
+ *
+ * @param store: An open storage.
+ * @param out: Stream to print to.
+ * @param time_filter: "day", "week", "2 weeks", "month", "90 days" or "all".
+ * @param page: The page to print, newest first, or NULL to print every entry in log order.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_print_logs(storage *store, FILE *out, const char *time_filter, const log_page *page);
+
+/**
+ * storage_print_stats - Prints the glucose statistics for a time filter, as View Glucose
+ * Statistics shows them.
+ *
+ * @param store: An open storage.
+ * @param out: Stream to print to.
+ * @param time_filter: "day", "week", "2 weeks", "month", "90 days" or "all".
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_print_stats(storage *store, FILE *out, const char *time_filter);
+
+/**
+ * storage_get - Reads the latest version of an entry by its ID, as View Logs shows it.
+ * Entries of segmented logs have no IDs, so they cannot be read, edited or removed.
+ *
+ * @param store: An open storage.
+ * @param id: The entry's ID.
+ * @param timestamp: Receives the time of the entry.
+ * @param entry: Receives the entry's values.
+ * @return: 0 for success, -1 if there is no such entry or it was deleted.
+ */
+int storage_get(storage *store, int64_t id, time_t *timestamp, log_entry *entry);
+
+/**
+ * storage_edit - Replaces the values of an entry; it keeps its ID and time. Text and
+ * binary logs append an edit record, and start compacting the log in the background
+ * once enough of it has been edited or deleted.
+ *
+ * @param store: An open storage.
+ * @param id: The entry's ID.
+ * @param entry: The new values.
+ * @return: 0 for success, -1 if there is no such entry, it was deleted, or for errors.
+ */
+int storage_edit(storage *store, int64_t id, const log_entry *entry);
+
+/**
+ * storage_remove - Deletes an entry. Text and binary logs append a tombstone, and compact
+ * like storage_edit.
+ *
+ * @param store: An open storage.
+ * @param id: The entry's ID.
+ * @return: 0 for success, -1 if there is no such entry, it was already deleted, or for errors.
+ */
+int storage_remove(storage *store, int64_t id);
+
+/**
+ * storage_insulin_on_board - Works out the insulin still acting at a time from the doses
+ * logged before it, with the settings in config.txt. The doses are read from the log the
+ * first time, then kept up to date as entries are appended, so each answer costs one pass
+ * over the doses still acting. Edits and deletions, and times earlier than those asked
+ * about before, read the log again. Doses other processes append are only seen then.
+ *
+ * @param store: An open storage.
+ * @param time: The time to work out insulin on board for.
+ * @param exclude_id: An entry whose dose is left out, such as one being edited, or 0.
+ * @param units: Receives insulin on board in units.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_insulin_on_board(storage *store, time_t time, int64_t exclude_id, float *units);
+
+/**
+ * storage_close - Waits for any background compaction, syncs appended entries and closes the log.
+ *
+ * @param store: An open storage.
+ * @return: 0 for success, -1 for errors.
+ */
+int storage_close(storage *store);
+
+// The SQLite backend, in storage_sqlite.c
+extern const storage_backend sqlite_backend;
+
+// The segmented log backend, in segments.c
+extern const storage_backend segment_backend;
+
+#endif
@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include "storage.h"
+#include "records.h"
+#include "report.h"
+#include "calculations.h"
+#include "config.h"
+#include "local_time.h"
+#include "instrument.h"
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Milliseconds a connection waits for another process's write transaction
+#define SQLITE_BUSY_MS 5000
+
+// One row per entry, in the order entries were logged. Members that are not set are
+// NULL. glucose_event is ROLLUP_BELOW or ROLLUP_ABOVE for a reading that starts a hypo
+// or hyper event, as the rollups count them, and 0 otherwise.
+static const char *schema_sql =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=FULL;"
+    "CREATE TABLE IF NOT EXISTS entries ("
+    " id INTEGER PRIMARY KEY,"
+    " timestamp INTEGER NOT NULL,"
+    " blood_glucose REAL,"
+    " target REAL,"
+    " carbs REAL,"
+    " carb_ratio REAL,"
+    " correction_factor INTEGER,"
+    " correction_dosage REAL,"
+    " insulin_dosage REAL,"
+    " entry_type TEXT NOT NULL,"
+    " glucose_event INTEGER NOT NULL DEFAULT 0,"
+    " insulin_on_board REAL);"
+    "CREATE INDEX IF NOT EXISTS entries_timestamp ON entries(timestamp);";
+
+// Logs created before the insulin on board was kept are given its column when opened
+static const char *insulin_on_board_sql = "SELECT insulin_on_board FROM entries LIMIT 0";
+static const char *add_insulin_on_board_sql = "ALTER TABLE entries ADD COLUMN insulin_on_board REAL";
+
+// The event is worked out against the latest earlier reading inside the insert, so it
+// stays right with several processes appending
+static const char *insert_sql =
+    "INSERT INTO entries (timestamp, blood_glucose, target, carbs, carb_ratio, correction_factor,"
+    " correction_dosage, insulin_dosage, entry_type, insulin_on_board, glucose_event)"
+    " SELECT ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?12,"
+    " CASE WHEN ?2 IS NULL THEN 0"
+    "  WHEN ?2 < ?10 THEN (CASE WHEN coalesce(last, ?10) < ?10 THEN 0 ELSE -1 END)"
+    "  WHEN ?2 > ?11 THEN (CASE WHEN coalesce(last, ?10) > ?11 THEN 0 ELSE 1 END)"
+    "  ELSE 0 END"
+    " FROM (SELECT (SELECT blood_glucose FROM entries WHERE blood_glucose IS NOT NULL"
+    "  ORDER BY id DESC LIMIT 1) AS last)";
+
+// An edit works its event out again against the latest reading logged before the entry.
+// Events of later readings are left as they were counted.
+static const char *update_sql =
+    "UPDATE entries SET blood_glucose = ?2, target = ?3, carbs = ?4, carb_ratio = ?5,"
+    " correction_factor = ?6, correction_dosage = ?7, insulin_dosage = ?8, entry_type = ?9,"
+    " insulin_on_board = ?12,"
+    " glucose_event = (SELECT CASE WHEN ?2 IS NULL THEN 0"
+    "  WHEN ?2 < ?10 THEN (CASE WHEN coalesce(last, ?10) < ?10 THEN 0 ELSE -1 END)"
+    "  WHEN ?2 > ?11 THEN (CASE WHEN coalesce(last, ?10) > ?11 THEN 0 ELSE 1 END)"
+    "  ELSE 0 END"
+    "  FROM (SELECT (SELECT blood_glucose FROM entries WHERE blood_glucose IS NOT NULL AND id < ?1"
+    "   ORDER BY id DESC LIMIT 1) AS last))"
+    " WHERE id = ?1";
+
+static const char *delete_sql = "DELETE FROM entries WHERE id = ?1";
+
+static const char *scan_sql =
+    "SELECT timestamp, blood_glucose, target, carbs, carb_ratio, correction_factor,"
+    " correction_dosage, insulin_dosage, entry_type, id, insulin_on_board FROM entries"
+    " WHERE timestamp BETWEEN ?1 AND ?2 ORDER BY id";
+
+// A page of View Logs, newest first; a limit of -1 is no limit
+static const char *page_sql =
+    "SELECT timestamp, blood_glucose, target, carbs, carb_ratio, correction_factor,"
+    " correction_dosage, insulin_dosage, entry_type, id, insulin_on_board FROM entries"
+    " WHERE timestamp >= ?1 ORDER BY id DESC LIMIT ?2 OFFSET ?3";
+
+static const char *get_sql =
+    "SELECT timestamp, blood_glucose, target, carbs, carb_ratio, correction_factor,"
+    " correction_dosage, insulin_dosage, entry_type, id, insulin_on_board FROM entries WHERE id = ?1";
+
+static const char *aggregate_sql =
+    "SELECT count(blood_glucose), sum(blood_glucose < ?3), sum(blood_glucose > ?4),"
+    " total(blood_glucose), total(blood_glucose * blood_glucose), min(blood_glucose), max(blood_glucose),"
+    " sum(glucose_event = -1), sum(glucose_event = 1), total(carbs), total(insulin_dosage),"
+    " total(correction_dosage) FROM entries WHERE timestamp BETWEEN ?1 AND ?2";
+
+// A SQLite log held open for a session
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+    sqlite3_stmt *update;
+    sqlite3_stmt *remove;
+    sqlite3_stmt *scan;
+    sqlite3_stmt *page;
+    sqlite3_stmt *get;
+    sqlite3_stmt *aggregate;
+    int in_transaction;           // A write transaction holds entries not yet committed
+    sync_policy policy;           // Durability policy
+    int sync_every;               // Entries per commit for SYNC_EVERY_N
+    long sync_interval_ms;        // Milliseconds between commits for SYNC_INTERVAL
+    int unsynced;                 // Entries appended since the last commit
+    struct timespec last_sync;    // Time of the last commit
+} sqlite_log;
+
+/**
+ * elapsed_ms - Milliseconds between two monotonic clock readings.
+ */
+static long elapsed_ms(const struct timespec *from, const struct timespec *to){
+    return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+/**
+ * report_error - Prints the connection's last error.
+ */
+static void report_error(sqlite_log *log, const char *what){
+    printf("Error %s: %s\n", what, sqlite3_errmsg(log->db));
+}
+
+/**
+ * run_sql - Runs statements that return no rows.
+ */
+static int run_sql(sqlite_log *log, const char *sql, const char *what){
+    char *message = NULL;
+    if (sqlite3_exec(log->db, sql, NULL, NULL, &message) != SQLITE_OK){
+        printf("Error %s: %s\n", what, message != NULL ? message : sqlite3_errmsg(log->db));
+        sqlite3_free(message);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * add_insulin_on_board - Adds the insulin_on_board column to a log created without it.
+ * Another process may add it first, so the column is looked for again when adding fails.
+ */
+static int add_insulin_on_board(sqlite_log *log){
+    for (int attempt = 0; attempt < 2; attempt++){
+        sqlite3_stmt *probe = NULL;
+        int found = sqlite3_prepare_v2(log->db, insulin_on_board_sql, -1, &probe, NULL) == SQLITE_OK;
+        sqlite3_finalize(probe);
+        if (found){
+            return 0;
+        }
+        if (attempt == 0 && sqlite3_exec(log->db, add_insulin_on_board_sql, NULL, NULL, NULL) == SQLITE_OK){
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * commit - Commits the open write transaction, which forces its entries to disk.
+ */
+static int commit(sqlite_log *log){
+    if (log->in_transaction){
+        uint64_t start = probe_begin();
+        if (run_sql(log, "COMMIT", "committing log entries") != 0){
+            return -1;
+        }
+        probe_end(PROBE_LOG_FSYNC, start, 0);
+        log->in_transaction = 0;
+    }
+    log->unsynced = 0;
+    clock_gettime(CLOCK_MONOTONIC, &log->last_sync);
+    return 0;
+}
+
+/**
+ * close_log - Finalizes the statements and closes the connection.
+ */
+static void close_log(sqlite_log *log){
+    sqlite3_finalize(log->insert);
+    sqlite3_finalize(log->update);
+    sqlite3_finalize(log->remove);
+    sqlite3_finalize(log->scan);
+    sqlite3_finalize(log->page);
+    sqlite3_finalize(log->get);
+    sqlite3_finalize(log->aggregate);
+    sqlite3_close(log->db);
+    free(log);
+}
+
+static int sqlite_open(storage *store, sync_policy policy, int sync_every, long sync_interval_ms){
+    uint64_t start = probe_begin();
+    sqlite_log *log = calloc(1, sizeof(sqlite_log));
+    if (log == NULL){
+        perror("Error opening log file");
+        return -1;
+    }
+
+    if (sqlite3_open(store->filename, &log->db) != SQLITE_OK){
+        printf("Error opening %s: %s\n", store->filename, sqlite3_errmsg(log->db));
+        close_log(log);
+        return -1;
+    }
+    sqlite3_busy_timeout(log->db, SQLITE_BUSY_MS);
+
+    if (run_sql(log, schema_sql, "creating log tables") != 0 ||
+        add_insulin_on_board(log) != 0 ||
+        sqlite3_prepare_v2(log->db, insert_sql, -1, &log->insert, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, update_sql, -1, &log->update, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, delete_sql, -1, &log->remove, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, scan_sql, -1, &log->scan, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, page_sql, -1, &log->page, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, get_sql, -1, &log->get, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(log->db, aggregate_sql, -1, &log->aggregate, NULL) != SQLITE_OK){
+        report_error(log, "preparing log statements");
+        close_log(log);
+        return -1;
+    }
+
+    log->policy = policy;
+    log->sync_every = sync_every;
+    log->sync_interval_ms = sync_interval_ms;
+    clock_gettime(CLOCK_MONOTONIC, &log->last_sync);
+    store->database = log;
+    probe_end(PROBE_LOG_OPEN, start, 0);
+    return 0;
+}
+
+/**
+ * begin - Starts a write transaction unless one is open.
+ */
+static int begin(sqlite_log *log){
+    if (!log->in_transaction){
+        if (run_sql(log, "BEGIN IMMEDIATE", "starting log transaction") != 0){
+            return -1;
+        }
+        log->in_transaction = 1;
+    }
+    return 0;
+}
+
+/**
+ * bind_entry - Binds the values of an entry, and the targets its event is worked out
+ * against, to parameters 2 to 12 of the insert or update statement.
+ */
+static void bind_entry(sqlite3_stmt *insert, const log_entry *entry){
+    if (entry->blood_glucose_level_flag){
+        sqlite3_bind_double(insert, 2, entry->blood_glucose_level);
+    } else {
+        sqlite3_bind_null(insert, 2);
+    }
+    if (entry->target_blood_glucose_flag){
+        sqlite3_bind_double(insert, 3, entry->target_blood_glucose);
+    } else {
+        sqlite3_bind_null(insert, 3);
+    }
+    if (entry->meal_time_carbs_flag){
+        sqlite3_bind_double(insert, 4, entry->meal_time_carbs);
+        sqlite3_bind_double(insert, 5, entry->carb_ratio);
+    } else {
+        sqlite3_bind_null(insert, 4);
+        sqlite3_bind_null(insert, 5);
+    }
+    if (entry->correction_dosage_flag){
+        sqlite3_bind_int(insert, 6, entry->correction_factor);
+        sqlite3_bind_double(insert, 7, entry->correction_dosage);
+    } else {
+        sqlite3_bind_null(insert, 6);
+        sqlite3_bind_null(insert, 7);
+    }
+    if (entry->insulin_dosage_flag){
+        sqlite3_bind_double(insert, 8, entry->insulin_dosage);
+    } else {
+        sqlite3_bind_null(insert, 8);
+    }
+    sqlite3_bind_text(insert, 9, entry->entry_type, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_double(insert, 10, lower_target);
+    sqlite3_bind_double(insert, 11, upper_target);
+    if (entry->insulin_on_board_flag){
+        sqlite3_bind_double(insert, 12, entry->insulin_on_board);
+    } else {
+        sqlite3_bind_null(insert, 12);
+    }
+}
+
+static int sqlite_append(storage *store, const log_entry *entry, time_t timestamp){
+    sqlite_log *log = store->database;
+    uint64_t start = probe_begin();
+
+    // Entries between commits share one transaction, as a file log shares one fsync
+    if (begin(log) != 0){
+        return -1;
+    }
+
+    sqlite3_stmt *insert = log->insert;
+    sqlite3_bind_int64(insert, 1, (sqlite3_int64)timestamp);
+    bind_entry(insert, entry);
+
+    int result = sqlite3_step(insert);
+    sqlite3_reset(insert);
+    if (result != SQLITE_DONE){
+        report_error(log, "writing to log file");
+        return -1;
+    }
+    log->unsynced++;
+
+    int sync = 0;
+    switch (log->policy) {
+        case SYNC_EVERY_ENTRY:
+            sync = 1;
+            break;
+        case SYNC_EVERY_N:
+            sync = log->unsynced >= log->sync_every;
+            break;
+        case SYNC_INTERVAL: {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            sync = elapsed_ms(&log->last_sync, &now) >= log->sync_interval_ms;
+            break;
+        }
+    }
+
+    int status = sync ? commit(log) : 0;
+    probe_end(PROBE_LOG_APPEND, start, sizeof(log_record));
+    return status;
+}
+
+/**
+ * sqlite_sync - Commits appended entries. With synchronous=FULL a commit is both what
+ * makes entries visible to other connections and what forces them to disk, so flushing
+ * and syncing are the same.
+ */
+static int sqlite_sync(storage *store){
+    return commit(store->database);
+}
+
+/**
+ * read_row - Reads a row of the scan statement back into an entry.
+ */
+static void read_row(sqlite3_stmt *scan, time_t *timestamp, log_entry *entry){
+    memset(entry, 0, sizeof(*entry));
+    *timestamp = (time_t)sqlite3_column_int64(scan, 0);
+    if (sqlite3_column_type(scan, 1) != SQLITE_NULL){
+        entry->blood_glucose_level = (float)sqlite3_column_double(scan, 1);
+        entry->blood_glucose_level_flag = 1;
+    }
+    if (sqlite3_column_type(scan, 2) != SQLITE_NULL){
+        entry->target_blood_glucose = (float)sqlite3_column_double(scan, 2);
+        entry->target_blood_glucose_flag = 1;
+    }
+    if (sqlite3_column_type(scan, 3) != SQLITE_NULL){
+        entry->meal_time_carbs = (float)sqlite3_column_double(scan, 3);
+        entry->carb_ratio = (float)sqlite3_column_double(scan, 4);
+        entry->meal_time_carbs_flag = 1;
+    }
+    if (sqlite3_column_type(scan, 6) != SQLITE_NULL){
+        entry->correction_factor = sqlite3_column_int(scan, 5);
+        entry->correction_dosage = (float)sqlite3_column_double(scan, 6);
+        entry->correction_dosage_flag = 1;
+    }
+    if (sqlite3_column_type(scan, 7) != SQLITE_NULL){
+        entry->insulin_dosage = (float)sqlite3_column_double(scan, 7);
+        entry->insulin_dosage_flag = 1;
+    }
+    if (sqlite3_column_type(scan, 10) != SQLITE_NULL){
+        entry->insulin_on_board = (float)sqlite3_column_double(scan, 10);
+        entry->insulin_on_board_flag = 1;
+    }
+    const unsigned char *type = sqlite3_column_text(scan, 8);
+    if (type != NULL){
+        strncpy(entry->entry_type, (const char *)type, sizeof(entry->entry_type) - 1);
+    }
+}
+
+/**
+ * report_rows - Steps a bound scan or page statement, reporting each row to a callback.
+ */
+static int report_rows(sqlite_log *log, sqlite3_stmt *statement, storage_callback callback, void *context){
+    int status = 0;
+    int result;
+    while (status == 0 && (result = sqlite3_step(statement)) == SQLITE_ROW){
+        time_t timestamp;
+        log_entry entry;
+        read_row(statement, &timestamp, &entry);
+        status = callback((int64_t)sqlite3_column_int64(statement, 9), timestamp, &entry, context);
+    }
+    if (status == 0 && result != SQLITE_DONE){
+        report_error(log, "reading log file");
+        status = -1;
+    }
+    sqlite3_reset(statement);
+    return status;
+}
+
+static int sqlite_scan(storage *store, time_t start_time, time_t end_time, storage_callback callback, void *context){
+    sqlite_log *log = store->database;
+    sqlite3_bind_int64(log->scan, 1, (sqlite3_int64)start_time);
+    sqlite3_bind_int64(log->scan, 2, (sqlite3_int64)end_time);
+    return report_rows(log, log->scan, callback, context);
+}
+
+static int sqlite_get(storage *store, int64_t id, time_t *timestamp, log_entry *entry){
+    sqlite_log *log = store->database;
+    sqlite3_stmt *get = log->get;
+    sqlite3_bind_int64(get, 1, (sqlite3_int64)id);
+    int result = sqlite3_step(get);
+    if (result == SQLITE_ROW){
+        read_row(get, timestamp, entry);
+    } else if (result != SQLITE_DONE){
+        report_error(log, "reading log file");
+    }
+    sqlite3_reset(get);
+    return result == SQLITE_ROW ? 0 : -1;
+}
+
+/**
+ * change_entry - Runs the update or delete statement for one entry and commits it, with
+ * any entries appended before it, straight away.
+ */
+static int change_entry(sqlite_log *log, sqlite3_stmt *statement, int64_t id){
+    if (begin(log) != 0){
+        sqlite3_reset(statement);
+        return -1;
+    }
+    sqlite3_bind_int64(statement, 1, (sqlite3_int64)id);
+    int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result != SQLITE_DONE){
+        report_error(log, "writing to log file");
+        return -1;
+    }
+    int changed = sqlite3_changes(log->db);
+    if (commit(log) != 0){
+        return -1;
+    }
+    if (changed == 0){
+        printf("Error: there is no entry #%lld.\n", (long long)id);
+        return -1;
+    }
+    return 0;
+}
+
+static int sqlite_edit(storage *store, int64_t id, const log_entry *entry){
+    sqlite_log *log = store->database;
+    bind_entry(log->update, entry);
+    return change_entry(log, log->update, id);
+}
+
+static int sqlite_remove(storage *store, int64_t id){
+    sqlite_log *log = store->database;
+    return change_entry(log, log->remove, id);
+}
+
+/**
+ * local_day_of - Local day of a time, counted from 1970-01-01.
+ */
+static long local_day_of(time_t timestamp){
+    long long local = (long long)timestamp + local_utc_offset(timestamp);
+    long long day = local / 86400;
+    return (long)(local % 86400 < 0 ? day - 1 : day);
+}
+
+static int sqlite_aggregate(storage *store, time_t start_time, time_t end_time, storage_summary *summary){
+    sqlite_log *log = store->database;
+    sqlite3_stmt *aggregate = log->aggregate;
+    sqlite3_bind_int64(aggregate, 1, (sqlite3_int64)start_time);
+    sqlite3_bind_int64(aggregate, 2, (sqlite3_int64)end_time);
+    sqlite3_bind_double(aggregate, 3, lower_target);
+    sqlite3_bind_double(aggregate, 4, upper_target);
+
+    if (sqlite3_step(aggregate) != SQLITE_ROW){
+        report_error(log, "reading log file");
+        sqlite3_reset(aggregate);
+        return -1;
+    }
+
+    stats_totals window;
+    window.count = sqlite3_column_int64(aggregate, 0);
+    window.below = sqlite3_column_int64(aggregate, 1);
+    window.above = sqlite3_column_int64(aggregate, 2);
+    window.in_range = window.count - window.below - window.above;
+    window.sum = sqlite3_column_double(aggregate, 3);
+    window.sum_squares = sqlite3_column_double(aggregate, 4);
+    summarize_totals(&window, &summary->glucose);
+
+    rollup_row *totals = &summary->totals.totals;
+    totals->readings = window.count;
+    totals->min = (float)sqlite3_column_double(aggregate, 5);
+    totals->max = (float)sqlite3_column_double(aggregate, 6);
+    totals->sum = window.sum;
+    totals->sum_squares = window.sum_squares;
+    totals->hypo_events = sqlite3_column_int64(aggregate, 7);
+    totals->hyper_events = sqlite3_column_int64(aggregate, 8);
+    totals->carbs = sqlite3_column_double(aggregate, 9);
+    totals->bolus = sqlite3_column_double(aggregate, 10);
+    totals->correction = sqlite3_column_double(aggregate, 11);
+    summary->totals.days = local_day_of(end_time) - local_day_of(start_time) + 1;
+    sqlite3_reset(aggregate);
+    return 0;
+}
+
+/**
+ * print_entry - Callback that renders an entry into a report as View Logs shows it.
+ */
+static int print_entry(int64_t id, time_t timestamp, const log_entry *entry, void *context){
+    log_record record;
+    entry_to_record(entry, timestamp, &record);
+    display_record(context, &record, id, 0);
+    return 0;
+}
+
+static int sqlite_print_logs(storage *store, FILE *out, const char *time_filter, const log_page *page){
+    uint64_t start = probe_begin();
+    time_t start_time;
+    if (time_filter_start(time_filter, &start_time) != 0){
+        return -1;
+    }
+
+    // Pages are cut by the query, so the report shows every row it is given
+    report output;
+    if (report_open(&output, out, read_config("blood glucose unit"), NULL) != 0){
+        return -1;
+    }
+    int status;
+    if (page != NULL){
+        sqlite_log *log = store->database;
+        sqlite3_bind_int64(log->page, 1, (sqlite3_int64)start_time);
+        sqlite3_bind_int64(log->page, 2, page->limit > 0 ? (sqlite3_int64)page->limit : -1);
+        sqlite3_bind_int64(log->page, 3, (sqlite3_int64)page->offset);
+        status = report_rows(log, log->page, print_entry, &output);
+    } else {
+        status = sqlite_scan(store, start_time, (time_t)INT64_MAX, print_entry, &output);
+    }
+    if (report_close(&output) != 0){
+        status = -1;
+    }
+    probe_end(PROBE_QUERY, start, 0);
+    return status;
+}
+
+static int sqlite_close(storage *store){
+    sqlite_log *log = store->database;
+    int status = commit(log);
+    close_log(log);
+    store->database = NULL;
+    return status;
+}
+
+const storage_backend sqlite_backend = {
+    "sqlite", sqlite_open, sqlite_append, sqlite_sync, sqlite_sync, sqlite_scan, sqlite_aggregate,
+    sqlite_print_logs, sqlite_get, sqlite_edit, sqlite_remove, sqlite_close
+};